@@ -0,0 +1,60 @@
+#ifndef __BLACKBOX_H
+#define __BLACKBOX_H
+
+#include <stdbool.h>
+
+#include "fc.h"
+
+// Number of records buffered in RAM between the control loop and the sd card
+// writer. Must be a power of 2
+#define BLACKBOX_RING_LENGTH   32
+
+#define BLACKBOX_AXIS_COUNT    3
+#define BLACKBOX_MOTOR_COUNT   4
+
+#define BLACKBOX_FILE_MAGIC    "FCBB"
+#define BLACKBOX_FILE_VERSION  2
+
+/**
+ * @brief One control loop iteration
+ *
+ * Axis arrays are ordered roll, pitch, yaw. Motor outputs are ordered by
+ * MOTOR_INDEX (TIM1 CCR1-CCR4)
+ */
+typedef struct BlackboxRecord_t {
+    uint32_t sequence;   // Set by blackboxClaim, gaps mean dropped records
+    uint32_t timeUs;     // 1 MHz timestamp at the start of the iteration
+    uint16_t loopTimeUs; // Execution time of the previous iteration
+    uint16_t throttle;
+    int16_t  gyro[BLACKBOX_AXIS_COUNT];     // deg/s
+    int16_t  setpoint[BLACKBOX_AXIS_COUNT]; // deg/s
+    int16_t  pidP[BLACKBOX_AXIS_COUNT];
+    int16_t  pidI[BLACKBOX_AXIS_COUNT];
+    int16_t  pidD[BLACKBOX_AXIS_COUNT];
+    uint16_t motor[BLACKBOX_MOTOR_COUNT];   // pwm us
+} BlackboxRecord_t;
+
+/**
+ * @brief Written once at the start of every log file, followed by the
+ * encoded records (see blackboxEncoder.c)
+ */
+typedef struct BlackboxFileHeader_t {
+    char     magic[4];
+    uint16_t version;
+    uint16_t recordSize;
+} BlackboxFileHeader_t;
+
+void blackboxInit(void);
+void blackboxStart(void);
+void blackboxStop(void);
+
+BlackboxRecord_t *blackboxClaim(void);
+void blackboxCommit(void);
+
+uint32_t blackboxPeek(const BlackboxRecord_t **records);
+void blackboxRelease(uint32_t count);
+uint32_t blackboxDroppedCount(void);
+
+void vBlackboxTask(void *pvParameters);
+
+#endif /* defined(__BLACKBOX_H) */
@@ -0,0 +1,44 @@
+#ifndef __BLACKBOX_ENCODER_H
+#define __BLACKBOX_ENCODER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "fc.h"
+#include "blackbox.h"
+
+#define BLACKBOX_FRAME_KEY          'K'
+#define BLACKBOX_FRAME_DELTA        'D'
+
+// A keyframe is sent every this many frames, so a decoder can resynchronise
+// after a corrupt or missing section of the log
+#define BLACKBOX_KEYFRAME_INTERVAL  32
+
+// sequence and timeUs, followed by the 16 bit fields
+#define BLACKBOX_FIELD_COUNT        (4 + 5 * BLACKBOX_AXIS_COUNT \
+                                     + BLACKBOX_MOTOR_COUNT)
+
+// A 32 bit zig-zag varint takes at most 5 bytes. The 16 bit fields are always
+// coded as a value or difference of 16 bit values, which is at most 17 bits
+// after zig-zag coding, so at most 3 bytes
+#define BLACKBOX_ENCODED_MAX_BYTES  (1 + 2 * 5 + (BLACKBOX_FIELD_COUNT - 2) * 3)
+
+/**
+ * @brief Prediction history, shared by the encoder and decoder
+ *
+ * Both sides must start from a state set up by blackboxCodecReset
+ */
+typedef struct BlackboxCodec_t {
+    int32_t  prev[BLACKBOX_FIELD_COUNT];
+    uint32_t prevTimeDeltaUs;
+    uint32_t framesSinceKey;
+    bool     haveHistory;
+} BlackboxCodec_t;
+
+void blackboxCodecReset(BlackboxCodec_t *codec);
+size_t blackboxEncode(BlackboxCodec_t *codec, const BlackboxRecord_t *record,
+                      uint8_t *out);
+int blackboxDecode(BlackboxCodec_t *codec, const uint8_t *in, size_t length,
+                   BlackboxRecord_t *record);
+
+#endif /* defined(__BLACKBOX_ENCODER_H) */
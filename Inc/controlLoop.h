@@ -7,16 +7,54 @@
 #include "freertos.h"
 #endif
 
-#define CONTROL_LOOP_PERIOD_TICKS 5 // Note that this also controls IMU task loop time
-#define CONTROL_LOOP_PERIOD_MS    (CONTROL_LOOP_PERIOD_TICKS / portTICK_PERIOD_MS)
+/*
+ * The control loop is released by a hardware timer (see loopScheduler.c), so
+ * its rate needn't be a whole number of RTOS ticks, e.g. 2, 4 or 8 kHz. The
+ * gyro reads and the blackbox keep their own rates, which must divide it
+ */
+#define CONTROL_LOOP_RATE_HZ      200
+#define CONTROL_LOOP_PERIOD_US    (1000000 / CONTROL_LOOP_RATE_HZ)
+
+#define IMU_RATE_HZ               200
+#define CONTROL_LOOP_LOG_RATE_HZ  200
+#define IMU_DIVIDER               (CONTROL_LOOP_RATE_HZ / IMU_RATE_HZ)
+#define CONTROL_LOOP_LOG_DIVIDER  (CONTROL_LOOP_RATE_HZ / CONTROL_LOOP_LOG_RATE_HZ)
+
+#if (CONTROL_LOOP_RATE_HZ % IMU_RATE_HZ) != 0 \
+    || (CONTROL_LOOP_RATE_HZ % CONTROL_LOOP_LOG_RATE_HZ) != 0
+#error "The imu and log rates must divide CONTROL_LOOP_RATE_HZ"
+#endif
+
+/*
+ * Rates of the other stages of the control loop, see the rate group table in
+ * controlLoop.c. A ppm frame comes every PPM_FRAME_PERIOD_MS, so the rc
+ * needn't follow the loop above 200 Hz. The telemetry state is sent at most
+ * every TELEMETRY_PERIOD_MS, and the input timeouts are checked every 20 ms
+ */
+#define RC_RATE_HZ                   200
+#define CONTROL_LOOP_TELEMETRY_HZ    100
+#define CONTROL_LOOP_STATUS_HZ       50
+#define RC_DIVIDER                   (CONTROL_LOOP_RATE_HZ / RC_RATE_HZ)
+#define TELEMETRY_DIVIDER            (CONTROL_LOOP_RATE_HZ / CONTROL_LOOP_TELEMETRY_HZ)
+#define STATUS_DIVIDER               (CONTROL_LOOP_RATE_HZ / CONTROL_LOOP_STATUS_HZ)
+
+#if (CONTROL_LOOP_RATE_HZ % RC_RATE_HZ) != 0 \
+    || (CONTROL_LOOP_RATE_HZ % CONTROL_LOOP_TELEMETRY_HZ) != 0 \
+    || (CONTROL_LOOP_RATE_HZ % CONTROL_LOOP_STATUS_HZ) != 0
+#error "The stage rates must divide CONTROL_LOOP_RATE_HZ"
+#endif
+
+// The most the stages due in one iteration may take, leaving the rest of the
+// period to the lower priority tasks
+#define CONTROL_LOOP_BUDGET_US       (CONTROL_LOOP_PERIOD_US / 2)
 
 /*
  * Timeout values, if no data is received within these periods, system failure is
- * assumed
+ * assumed. The loop's own timing is checked by loopTiming.c
  */
 #define PPM_RX_TIMEOUT_MS       1000
-#define GYRO_RX_TIMEOUT_MS      (CONTROL_LOOP_PERIOD_MS * 5)
-#define CONTROL_LOOP_TIMEOUT_MS (CONTROL_LOOP_PERIOD_MS * 5)
+// Five gyro periods, but at least two ticks
+#define GYRO_RX_TIMEOUT_MS      ((5 * 1000 / IMU_RATE_HZ > 2) ? 5 * 1000 / IMU_RATE_HZ : 2)
 
 void vControlLoopTask(void *pvParameter);
 
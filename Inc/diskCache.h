@@ -0,0 +1,56 @@
+#ifndef __DISK_CACHE_H
+#define __DISK_CACHE_H
+
+#include <stdbool.h>
+
+#include "fc.h"
+#include "diskio.h"
+
+#define DISK_CACHE_SECTOR_SIZE   512
+
+// Sets must be a power of 2. Consecutive sectors go to consecutive sets, so
+// neighbouring FAT sectors don't evict each other
+#ifndef DISK_CACHE_SETS
+#define DISK_CACHE_SETS          2
+#endif
+#ifndef DISK_CACHE_WAYS
+#define DISK_CACHE_WAYS          2
+#endif
+
+// Upper limit on the RAM used for cached sector data
+#define DISK_CACHE_MAX_BYTES     2048
+
+#define DISK_CACHE_LINES         (DISK_CACHE_SETS * DISK_CACHE_WAYS)
+
+#if DISK_CACHE_LINES * DISK_CACHE_SECTOR_SIZE > DISK_CACHE_MAX_BYTES
+#error "Disk cache is larger than DISK_CACHE_MAX_BYTES"
+#endif
+
+typedef struct DiskCacheStats_t {
+    uint32_t readHits;
+    uint32_t readMisses;
+    uint32_t writeHits;       // Single sector writes to a sector already cached
+    uint32_t writeMisses;
+    uint32_t bypassReads;     // Multi sector reads and writes go straight to
+    uint32_t bypassWrites;    // the card
+    uint32_t evictions;       // Lines replaced to make space
+    uint32_t flushedSectors;  // Dirty sectors written back
+    uint32_t flushCommands;   // Write commands used to write them back
+} DiskCacheStats_t;
+
+void diskCacheInit(void);
+DRESULT diskCacheRead(BYTE *buff, DWORD sector, UINT count);
+DRESULT diskCacheWrite(const BYTE *buff, DWORD sector, UINT count);
+DRESULT diskCacheSync(void);
+void diskCacheInvalidate(DWORD start, DWORD end);
+const DiskCacheStats_t *diskCacheStats(void);
+void diskCacheResetStats(void);
+
+/* Provided by the disk driver (sd.c) */
+
+DRESULT SD_Read_Sectors(BYTE *buff, DWORD sector, UINT count);
+DRESULT SD_Write_Sectors(const BYTE *buff, DWORD sector, UINT count);
+DRESULT SD_Write_Sectors_Gather(const BYTE *const *buffers, DWORD sector,
+                                UINT count);
+
+#endif /* defined(__DISK_CACHE_H) */
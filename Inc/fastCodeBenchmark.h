@@ -0,0 +1,6 @@
+#ifndef __FAST_CODE_BENCHMARK_H
+#define __FAST_CODE_BENCHMARK_H
+
+void fastCodeBenchmark(void);
+
+#endif /* defined(__FAST_CODE_BENCHMARK_H) */
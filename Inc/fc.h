@@ -16,6 +16,15 @@ void assertFailed(char *file, int line);
     else \
         assertFailed(__FILE__, __LINE__)
 
+// Run a function from RAM instead of flash, for the control loop and
+// interrupt handlers. Copied at start up, see .fast_code in the linker
+// script. Build with FAST_CODE=0 to leave everything in flash
+#if !defined(FAST_CODE_ENABLE) || FAST_CODE_ENABLE
+#define FAST_CODE __attribute__((section(".fast_code")))
+#else
+#define FAST_CODE
+#endif
+
 #else
 #include <stdint.h>
 #include <assert.h>
@@ -27,6 +36,8 @@ void assertFailed(char *file, int line);
 #define HAL_ERROR 1
 #define HAL_BUSY 2
 #define HAL_TIMEOUT 3
+
+#define FAST_CODE
 #endif
 
 typedef enum {
@@ -3,13 +3,6 @@
 
 #include "fc.h"
 
-#ifndef __UNIT_TEST
-#include "freertos.h"
-#include "queue.h"
-
-extern QueueHandle_t ratesQueue;
-#endif
-
 typedef struct Accel_t {
     int32_t x;
     int32_t y;
@@ -49,7 +49,8 @@ extern "C" {
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions ------------------------------------------------------- */
 
-#define CAN_INTERRUPT               CEC_CAN_IRQn
+#define CAN_TX_INTERRUPT            CAN1_TX_IRQn
+#define CAN_RX_INTERRUPT            CAN1_RX0_IRQn
 #define CAN_PRIORITY_BASE           0
 
 void NMI_Handler(void);
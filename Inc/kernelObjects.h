@@ -0,0 +1,23 @@
+#ifndef __KERNEL_OBJECTS_H
+#define __KERNEL_OBJECTS_H
+
+#include "fc.h"
+
+#include "freertos.h"
+#include "queue.h"
+
+/**
+ * @brief Every queue, semaphore and mutex, see the table in kernelObjects.c
+ */
+typedef enum KernelQueue {
+    KERNEL_QUEUE_I2C_MUTEX = 0,
+    KERNEL_QUEUE_I2C_DMA,
+    KERNEL_QUEUE_SD_DMA,
+    KERNEL_QUEUE_COUNT,
+} KernelQueue;
+
+QueueHandle_t kernelQueueCreate(KernelQueue queue);
+void kernelTasksCreate(void);
+void kernelRamReport(void);
+
+#endif /* defined(__KERNEL_OBJECTS_H) */
@@ -0,0 +1,37 @@
+#ifndef __LOG_FILE_H
+#define __LOG_FILE_H
+
+#include "fc.h"
+#include "ff.h"
+
+#define LOG_FILE_SECTOR_SIZE      _MIN_SS
+
+// Data is written to the card in multi block writes of this many sectors
+#define LOG_FILE_BUFFER_SECTORS   4
+
+// Cluster link map for a single contiguous fragment: table size, fragment
+// length, fragment start cluster and terminator
+#define LOG_FILE_LINK_MAP_LENGTH  4
+
+/**
+ * @brief A pre-allocated, contiguous file written directly by sector
+ *
+ * Only the LogFile functions may be used on the file while it is open
+ */
+typedef struct LogFile_t {
+    FIL      file;
+    DWORD    linkMap[LOG_FILE_LINK_MAP_LENGTH];
+    DWORD    startSector;    // First sector of the file on the card
+    DWORD    sectorCount;    // Sectors available to write
+    DWORD    sectorsWritten; // Full sectors written to the card
+    uint32_t bufferLength;   // Bytes waiting in buffer
+    uint8_t  buffer[LOG_FILE_BUFFER_SECTORS * LOG_FILE_SECTOR_SIZE];
+} LogFile_t;
+
+FRESULT logFileOpen(LogFile_t *log, const TCHAR *name, DWORD size);
+FRESULT logFileWrite(LogFile_t *log, const void *data, uint32_t length);
+FRESULT logFileSync(LogFile_t *log);
+FRESULT logFileClose(LogFile_t *log);
+DWORD logFileLength(const LogFile_t *log);
+
+#endif /* defined(__LOG_FILE_H) */
@@ -0,0 +1,32 @@
+#ifndef __LOOP_SCHEDULER_H
+#define __LOOP_SCHEDULER_H
+
+#include <stdbool.h>
+
+#include "fc.h"
+
+// Tasks released by the timer
+#define LOOP_SCHEDULER_MAX_TASKS      4
+
+// The timer counts in us, with a 16 bit auto reload
+#define LOOP_SCHEDULER_MIN_PERIOD_US  100
+#define LOOP_SCHEDULER_MAX_PERIOD_US  65536
+
+// A task waiting this long for a release assumes the timer has stopped
+#define LOOP_SCHEDULER_TIMEOUT_MS     100
+
+uint32_t loopSchedulerPeriodUs(uint32_t rateHz);
+uint32_t loopSchedulerStartCount(uint32_t nowUs, uint32_t periodUs,
+                                 uint32_t phaseUs);
+void loopSchedulerReset(void);
+FC_Status loopSchedulerAddTask(void *task, uint32_t divider);
+uint32_t loopSchedulerRelease(void);
+
+#ifndef __UNIT_TEST
+FC_Status loopSchedulerInit(uint32_t rateHz, uint32_t phaseUs);
+uint32_t loopSchedulerWait(void);
+uint32_t loopSchedulerNowUs(void);
+void loopSchedulerIrqHandler(void);
+#endif
+
+#endif /* defined(__LOOP_SCHEDULER_H) */
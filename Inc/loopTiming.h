@@ -0,0 +1,35 @@
+#ifndef __LOOP_TIMING_H
+#define __LOOP_TIMING_H
+
+#include "fc.h"
+#include "telemetry.h"
+
+// Width of each period histogram bucket. The buckets are centred on the
+// nominal period, the first and last also count everything beyond them
+#define LOOP_TIMING_BUCKET_US       100
+#define LOOP_TIMING_BUCKETS         TELEMETRY_LOOP_TIMING_BUCKETS
+
+// Consecutive deadline misses before each step of the response
+#define LOOP_TIMING_WARN_MISSES     3
+#define LOOP_TIMING_FAIL_MISSES     20
+
+// A start this many periods late is a stall (e.g. the debugger), the
+// release times are realigned to it rather than caught up
+#define LOOP_TIMING_STALL_PERIODS   10
+
+/**
+ * @brief Response to the loop timing, from least to most severe
+ */
+typedef enum LoopTimingLevel {
+    LOOP_TIMING_OK = 0,
+    LOOP_TIMING_MISSED,     // This iteration missed its deadline
+    LOOP_TIMING_WARN,       // At least LOOP_TIMING_WARN_MISSES in a row
+    LOOP_TIMING_FAIL,       // At least LOOP_TIMING_FAIL_MISSES in a row
+} LoopTimingLevel;
+
+void loopTimingInit(uint32_t periodUs);
+LoopTimingLevel loopTimingUpdate(uint32_t startUs, uint32_t endUs);
+uint32_t loopTimingBucket(uint32_t periodUs);
+const TelemetryLoopTiming_t *loopTimingStats(void);
+
+#endif /* defined(__LOOP_TIMING_H) */
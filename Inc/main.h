@@ -1,4 +1,6 @@
 #ifndef __MAIN_H
 #define __MAIN_H
 
+void vBlinkTask(void *pvParameters);
+
 #endif /* __MAIN_H */
@@ -0,0 +1,11 @@
+#ifndef __MIXER_H
+#define __MIXER_H
+
+#include "fc.h"
+#include "motors.h"
+#include "rate_control.h"
+
+void mixMotors(uint32_t rcThrottle, const RotationAxisOutputs_t *outputs,
+               uint32_t compare[MOTOR_COUNT]);
+
+#endif /* defined(__MIXER_H) */
@@ -1,6 +1,17 @@
 #ifndef __MOTORS_H
 #define __MOTORS_H
 
+#include "fc.h"
+#include "rc.h"
+
+#ifdef __UNIT_TEST
+// The HAL's timer channels, MOTOR_INDEX relies on their spacing
+#define TIM_CHANNEL_1 0x00000000U
+#define TIM_CHANNEL_2 0x00000004U
+#define TIM_CHANNEL_3 0x00000008U
+#define TIM_CHANNEL_4 0x0000000CU
+#endif
+
 // PWM4 -- PA8 -- CH1
 // PWM3 -- PA9 -- CH2
 // PWM2 -- PA10 -- CH3
@@ -13,10 +24,33 @@ typedef enum MotorNum
     MOTOR_BACK_RIGHT = TIM_CHANNEL_1,  // PWM1 -- PA11
 } MotorNum;
 
+#define MOTOR_COUNT 4
+
+// TIM_CHANNEL_x values are spaced 4 apart, this gives the CCRx index (0-3)
+#define MOTOR_INDEX(motor) ((motor) >> 2)
+
+/**
+ * @brief Clamp a motor output to the valid pwm range
+ *
+ * Unlike setMotor, values out of range are clamped rather than forced low, so
+ * this is intended for mixer outputs which are expected to saturate
+ */
+static inline uint32_t motorLimit(int val)
+{
+    if (val < MOTOR_LOW_VAL_US) {
+        return MOTOR_LOW_VAL_US;
+    } else if (val > MOTOR_HIGH_VAL_US) {
+        return MOTOR_HIGH_VAL_US;
+    }
+    return val;
+}
+
 FC_Status motorsStart();
 FC_Status motorsStop();
 FC_Status motorsDeinit();
 FC_Status setMotor(MotorNum motor, uint32_t val);
+FC_Status motorsWriteAll(const uint32_t compare[MOTOR_COUNT]);
+void motorsGetAll(uint32_t compare[MOTOR_COUNT]);
 void motorsInit(void);
 
 void vMotorsTask(void *pvParameters);
@@ -0,0 +1,53 @@
+#ifndef __PARAM_STORE_H
+#define __PARAM_STORE_H
+
+#include <stdbool.h>
+
+#include "fc.h"
+
+// The store alternates between two banks, each one erasable flash sector
+// (sectors 1 and 2, see STM32F410RBTx_FLASH.ld)
+#define PARAM_STORE_BANK_COUNT    2
+#define PARAM_STORE_BANK_SIZE     (16 * 1024)
+
+#define PARAM_STORE_MAGIC         0x314D5250 // "PRM1"
+
+// Most parameters that can be saved at once
+#define PARAM_STORE_MAX_PARAMS    32
+
+/**
+ * @brief One saved value, or the bank header (first record of a bank, hash
+ * is PARAM_STORE_MAGIC and value is the bank generation)
+ *
+ * The words are programmed in order, so a record cut short by a reset has
+ * an erased or wrong check and is ignored
+ */
+typedef struct ParamStoreRecord_t {
+    uint32_t hash;
+    uint32_t value;
+    uint32_t check;
+} ParamStoreRecord_t;
+
+#define PARAM_STORE_BANK_RECORDS  (PARAM_STORE_BANK_SIZE / sizeof(ParamStoreRecord_t))
+
+typedef struct ParamStoreStats_t {
+    uint32_t recordsWritten;
+    uint32_t compactions;
+    uint32_t generation;      // Of the active bank, counts up every compaction
+    uint32_t recordsUsed;     // In the active bank, including the header
+} ParamStoreStats_t;
+
+FC_Status paramStoreInit(void);
+uint32_t paramStoreLoad(const uint32_t *hashes, uint32_t *values,
+                        uint32_t count);
+FC_Status paramStoreSave(const uint32_t *hashes, const uint32_t *values,
+                         uint32_t count);
+const ParamStoreStats_t *paramStoreStats(void);
+
+// Flash access, faked in the unit tests. Offsets are in words from the start
+// of the bank
+const uint32_t *paramFlashBank(int bank);
+FC_Status paramFlashErase(int bank);
+FC_Status paramFlashProgram(int bank, uint32_t offset, uint32_t word);
+
+#endif /* defined(__PARAM_STORE_H) */
@@ -0,0 +1,94 @@
+#ifndef __PARAMS_H
+#define __PARAMS_H
+
+#include <stdbool.h>
+
+#include "fc.h"
+#include "telemetry.h"
+
+// Longest parameter name, the same as a MAVLink param_id
+#define PARAM_NAME_LENGTH         TELEMETRY_PARAM_ID_LENGTH
+
+// Changed values are saved once they have been left alone this long, and
+// only while disarmed (see paramsUpdate)
+#define PARAM_SAVE_DELAY_MS       1000
+
+// PARAM_VALUE replies sent per paramsUpdate when listing every parameter
+#define PARAM_LIST_BURST          4
+
+#define PARAM_PERIOD_MS           10
+
+/*
+ * Name hash, FNV-1a of the name padded with zeros to PARAM_NAME_LENGTH bytes
+ * (the way a MAVLink param_id arrives). For a string literal this is a
+ * constant expression, so the table holds precomputed hashes
+ */
+#define PARAM_HASH_OFFSET         2166136261u
+#define PARAM_HASH_PRIME          16777619u
+
+#define PARAM_NAME_CHAR(name, i)  ((i) < sizeof(name) - 1 ? (uint8_t)(name)[i] : 0)
+#define PARAM_HASH_STEP(hash, name, i) \
+    ((uint32_t)(((hash) ^ PARAM_NAME_CHAR(name, i)) * PARAM_HASH_PRIME))
+#define PARAM_HASH(n) \
+    PARAM_HASH_STEP(PARAM_HASH_STEP(PARAM_HASH_STEP(PARAM_HASH_STEP( \
+    PARAM_HASH_STEP(PARAM_HASH_STEP(PARAM_HASH_STEP(PARAM_HASH_STEP( \
+    PARAM_HASH_STEP(PARAM_HASH_STEP(PARAM_HASH_STEP(PARAM_HASH_STEP( \
+    PARAM_HASH_STEP(PARAM_HASH_STEP(PARAM_HASH_STEP(PARAM_HASH_STEP( \
+    PARAM_HASH_OFFSET, n, 0), n, 1), n, 2), n, 3), n, 4), n, 5), n, 6), \
+    n, 7), n, 8), n, 9), n, 10), n, 11), n, 12), n, 13), n, 14), n, 15)
+
+/**
+ * @brief Every parameter, the id is the index into the table in params.c
+ */
+typedef enum ParamId {
+    PARAM_RATE_P = 0,
+    PARAM_RATE_I = 1,
+    PARAM_RATE_D = 2,
+    PARAM_COUNT,
+} ParamId;
+
+typedef enum ParamType {
+    PARAM_TYPE_FLOAT = 0,
+    PARAM_TYPE_INT32 = 1,
+} ParamType;
+
+typedef union ParamValue_t {
+    float    f;
+    int32_t  i;
+    uint32_t raw;  // As saved in flash
+} ParamValue_t;
+
+/**
+ * @brief Fixed properties of a parameter
+ */
+typedef struct ParamInfo_t {
+    const char  *name;        // At most PARAM_NAME_LENGTH characters
+    uint32_t     hash;        // PARAM_HASH(name)
+    ParamType    type;
+    ParamValue_t defaultValue;
+    ParamValue_t min;
+    ParamValue_t max;
+} ParamInfo_t;
+
+FC_Status paramsInit(void);
+FC_Status paramsLoad(void);
+void paramRegister(ParamId id, void *value);
+
+const ParamInfo_t *paramInfo(ParamId id);
+uint32_t paramHashName(const char *name);
+int paramFind(const char *name);
+
+ParamValue_t paramGet(ParamId id);
+FC_Status paramSet(ParamId id, ParamValue_t value);
+void paramsApply(void);
+uint32_t paramsUnsaved(void);
+
+void paramsSetArmed(bool armed);
+void paramsHandleMessage(TelemetryMessage msg, const uint8_t *payload);
+void paramsUpdate(uint32_t nowMs);
+
+#ifndef __UNIT_TEST
+void vParamTask(void *pvParameters);
+#endif
+
+#endif /* defined(__PARAMS_H) */
@@ -6,6 +6,10 @@ typedef struct ControlInfo {
     float integratedError;
     int saturated;
     int lastError;
+    // Outputs of the last controlLoop call, only kept for logging
+    int pTerm;
+    int iTerm;
+    int dTerm;
 } ControlInfo_t;
 
 typedef struct PID_Gains {
@@ -2,17 +2,21 @@
 #define __PPM_H
 
 #include "fc.h"
+#include "rc.h"
+
+#ifndef __UNIT_TEST
 #include "freertos.h"
 #include "queue.h"
-#include "rc.h"
+#endif
 
 typedef struct tPpmSignal {
     uint16_t signals[RC_CHANNEL_IN_COUNT];
 } tPpmSignal;
 
+#ifndef __UNIT_TEST
 extern TIM_HandleTypeDef htim5;
-extern QueueHandle_t ppmSignalQueue;
 
 void ppmInit(void);
 void vRCTask(void *pvParameters);
+#endif
 #endif /* defined(__PPM_H) */
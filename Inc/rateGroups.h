@@ -0,0 +1,53 @@
+#ifndef __RATE_GROUPS_H
+#define __RATE_GROUPS_H
+
+#include "fc.h"
+
+// Longest cycle of dividers and phases checked by rateGroupsPeakBudgetUs
+#define RATE_GROUPS_MAX_HYPERPERIOD  10000
+
+#define RATE_GROUP(run, name, divider, phase, budgetUs) \
+    {run, name, divider, phase, budgetUs}
+
+typedef void (*RateGroupFunction)(void);
+// Free running us counter, wraps at 2^32
+typedef uint32_t (*RateGroupClock)(void);
+
+/**
+ * @brief Work run every divider iterations of a loop, on the iterations
+ * where iteration % divider == phase
+ */
+typedef struct RateGroup_t {
+    RateGroupFunction  run;
+    const char        *name;
+    uint32_t           divider;
+    uint32_t           phase;
+    uint32_t           budgetUs;    // Longest a run should take
+} RateGroup_t;
+
+typedef struct RateGroupStats_t {
+    uint32_t runs;
+    uint32_t lastUs;
+    uint32_t maxUs;
+    uint32_t overruns;              // Runs longer than the budget
+} RateGroupStats_t;
+
+/**
+ * @brief A table of rate groups and its state, one per loop
+ */
+typedef struct RateGroupSet_t {
+    const RateGroup_t *groups;
+    RateGroupStats_t  *stats;       // One per group
+    uint32_t           count;
+    uint32_t           iteration;
+    uint32_t           hyperperiod; // Iterations before the groups repeat
+    RateGroupClock     clockUs;
+} RateGroupSet_t;
+
+FC_Status rateGroupsInit(RateGroupSet_t *set, const RateGroup_t *groups,
+                         RateGroupStats_t *stats, uint32_t count,
+                         uint32_t iterationBudgetUs, RateGroupClock clockUs);
+uint32_t rateGroupsPeakBudgetUs(const RateGroup_t *groups, uint32_t count);
+const RateGroup_t *rateGroupsRun(RateGroupSet_t *set);
+
+#endif /* defined(__RATE_GROUPS_H) */
@@ -1,12 +1,20 @@
 #ifndef __RATE_CONTROL_H
 #define __RATE_CONTROL_H
 
+#include "pid.h"
+
 #define ROTATION_AXIS_OUTPUT_MAX 500
 #define ROTATION_AXIS_OUTPUT_MIN -500
 
 #define RATES_MAX 500 //! Max rotation rate in dps
 #define RATES_MIN -500 //! Min rotation rate in dps
 
+// Default gains, for testing on the bench. Flight tuning was P 10, I 0.01,
+// D 1, set them with the RATE_P/I/D parameters
+#define RATE_P_DEFAULT 2.0f
+#define RATE_I_DEFAULT 0.01f
+#define RATE_D_DEFAULT 1.0f
+
 /**
  * @brief Rotation rates for roll pitch and yaw
  *        Rotation rates in deg/s
@@ -28,6 +36,14 @@ typedef struct RotationAxisOutputs {
     int yaw;
 } RotationAxisOutputs_t;
 
+typedef enum RateAxis {
+    RATE_AXIS_ROLL  = 0,
+    RATE_AXIS_PITCH = 1,
+    RATE_AXIS_YAW   = 2,
+} RateAxis;
+
+void rateControlInit(void);
 RotationAxisOutputs_t* controlRates(Rates_t* actualRates, Rates_t* desiredRates);
 void resetRateInfo();
+const ControlInfo_t *getRateControlInfo(RateAxis axis);
 #endif
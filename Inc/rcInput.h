@@ -0,0 +1,14 @@
+#ifndef __RC_INPUT_H
+#define __RC_INPUT_H
+
+#include <stdbool.h>
+
+#include "fc.h"
+#include "ppm.h"
+#include "rate_control.h"
+
+FC_Status processPpmSignal(tPpmSignal *ppmSignal, Rates_t *desiredRatesOut,
+                           uint32_t *rcThrottleOut, bool *armedOut);
+bool rcRatesActive(bool armed, uint32_t rcThrottle);
+
+#endif /* defined(__RC_INPUT_H) */
@@ -0,0 +1,22 @@
+#ifndef __SD_H
+#define __SD_H
+
+#include "fc.h"
+#include "freertos.h"
+#include "semphr.h"
+#include "sdCard.h"
+
+/* Definition for SPIx's DMA NVIC */
+#define SPIx_DMA_TX_IRQn                DMA2_Stream3_IRQn
+#define SPIx_DMA_RX_IRQn                DMA2_Stream0_IRQn
+#define SPIx_DMA_TX_IRQHandler          DMA2_Stream3_IRQHandler
+#define SPIx_DMA_RX_IRQHandler          DMA2_Stream0_IRQHandler
+
+extern SPI_HandleTypeDef SpiHandle;
+extern SemaphoreHandle_t SD_DMA_CompleteSem;
+
+const SdCardInfo_t *SD_Get_Card_Info(void);
+
+void vSdBenchmarkTask(void *pvParameters);
+
+#endif /* defined(__SD_H) */
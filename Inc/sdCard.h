@@ -0,0 +1,40 @@
+#ifndef __SD_CARD_H
+#define __SD_CARD_H
+
+#include <stdbool.h>
+
+#include "fc.h"
+
+#define SD_CSD_LENGTH_BYTES          16
+#define SD_CID_LENGTH_BYTES          16
+#define SD_STATUS_LENGTH_BYTES       64
+
+// Highest spi clock for a card in default speed mode, regardless of what
+// TRAN_SPEED reports
+#define SD_SPI_MAX_CLOCK_HZ          25000000
+
+/**
+ * @brief Card properties read from the CSD, CID and SD status registers
+ */
+typedef struct SdCardInfo_t {
+    bool     highCapacity;       // SDHC/SDXC, addressed by sector not byte
+    uint8_t  csdVersion;         // 1 or 2
+    uint32_t sectorCount;        // Number of 512 byte sectors
+    uint32_t eraseBlockSectors;  // Erase block (allocation unit) size in sectors
+    bool     sectorErase;        // Card can erase single sectors (ERASE_BLK_EN)
+    uint32_t maxClockHz;         // From TRAN_SPEED
+    uint32_t spiClockHz;         // Spi clock selected for this card
+    uint8_t  manufacturerId;
+    char     oemId[3];
+    char     productName[6];
+    uint8_t  productRevision;
+    uint32_t serialNumber;
+} SdCardInfo_t;
+
+FC_Status SD_Parse_CSD(const uint8_t csd[SD_CSD_LENGTH_BYTES],
+                       SdCardInfo_t *info);
+void SD_Parse_CID(const uint8_t cid[SD_CID_LENGTH_BYTES], SdCardInfo_t *info);
+uint32_t SD_Parse_AU_Sectors(const uint8_t status[SD_STATUS_LENGTH_BYTES]);
+uint32_t SD_Select_Clock_Divider(uint32_t pclkHz, uint32_t maxClockHz);
+
+#endif /* defined(__SD_CARD_H) */
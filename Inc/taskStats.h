@@ -0,0 +1,34 @@
+#ifndef __TASK_STATS_H
+#define __TASK_STATS_H
+
+#include <stdbool.h>
+
+#include "fc.h"
+#include "telemetry.h"
+
+// How often the cpu use of each task is measured and reported
+#define TASK_STATS_PERIOD_MS      1000
+
+// Most tasks read from the kernel, including ones not reported
+#define TASK_STATS_MAX_KERNEL_TASKS 16
+
+/**
+ * @brief One task, as read from the kernel (uxTaskGetSystemState)
+ */
+typedef struct TaskStatsSample_t {
+    const char *name;
+    uint32_t    number;       // xTaskNumber, unique and never reused
+    uint32_t    runTimeUs;    // Total time the task has run
+    uint16_t    stackFree;    // Least ever free, in words
+    bool        idle;
+} TaskStatsSample_t;
+
+void taskStatsReset(uint32_t nowUs);
+void taskStatsCompute(const TaskStatsSample_t *samples, uint32_t count,
+                      uint32_t nowUs, TelemetryTaskStats_t *out);
+
+#ifndef __UNIT_TEST
+void vTaskStatsTask(void *pvParameters);
+#endif
+
+#endif /* defined(__TASK_STATS_H) */
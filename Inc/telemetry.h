@@ -0,0 +1,263 @@
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#include <stdbool.h>
+
+#include "fc.h"
+#include "rc.h"
+#include "trace.h"
+
+/*
+ * Frames use MAVLink v1 framing, so standard ground tools see the heartbeat
+ * and skip the flight controller specific messages:
+ * +     0xFE, payload length, sequence, system id, component id, message id
+ * +     payload, little endian
+ * +     crc16 (X.25) of everything after 0xFE, then the message crc extra
+ */
+#define TELEMETRY_STX              0xFE
+#define TELEMETRY_SYSTEM_ID        1
+#define TELEMETRY_COMPONENT_ID     1   // MAV_COMP_ID_AUTOPILOT1
+#define TELEMETRY_HEADER_LENGTH    6
+#define TELEMETRY_CRC_LENGTH       2
+#define TELEMETRY_FRAME_OVERHEAD   (TELEMETRY_HEADER_LENGTH + TELEMETRY_CRC_LENGTH)
+
+// Pieces of live data a message payload is sent from, in order
+#define TELEMETRY_MAX_SOURCES      2
+
+// Share of the uart bandwidth telemetry may use, the rest is left for debug
+// messages
+#define TELEMETRY_LINK_SHARE_PERCENT 50
+
+// How often the telemetry task checks for messages that are due. This is the
+// fastest any message can be sent
+#define TELEMETRY_PERIOD_MS        10
+#define TELEMETRY_MAX_RATE_HZ      (1000 / TELEMETRY_PERIOD_MS)
+
+typedef enum TelemetryMessage {
+    TELEMETRY_MSG_HEARTBEAT  = 0,
+    TELEMETRY_MSG_ATTITUDE   = 1,
+    TELEMETRY_MSG_RATES      = 2,
+    TELEMETRY_MSG_RC_INPUT   = 3,
+    TELEMETRY_MSG_MOTORS     = 4,
+    TELEMETRY_MSG_LOOP_STATS = 5,
+    // Parameter protocol, only sent in reply to the ground station
+    TELEMETRY_MSG_PARAM_REQUEST_READ = 6,
+    TELEMETRY_MSG_PARAM_REQUEST_LIST = 7,
+    TELEMETRY_MSG_PARAM_VALUE        = 8,
+    TELEMETRY_MSG_PARAM_SET          = 9,
+    TELEMETRY_MSG_TASK_STATS         = 10,
+    // Trace dump (see trace.c), sent when a trace stops
+    TELEMETRY_MSG_TRACE_EVENTS       = 11,
+    TELEMETRY_MSG_TRACE_NAME         = 12,
+    TELEMETRY_MSG_LOOP_TIMING        = 13,
+    TELEMETRY_MSG_COUNT,
+} TelemetryMessage;
+
+/**
+ * @brief Fixed properties of a message, shared with the host decoder
+ */
+typedef struct TelemetryMessageInfo_t {
+    const char *name;
+    uint8_t     id;            // MAVLink message id
+    uint8_t     crcExtra;      // Must change whenever the payload layout does
+    uint8_t     payloadLength;
+    uint8_t     defaultRateHz;
+} TelemetryMessageInfo_t;
+
+/*
+ * Payloads. ATTITUDE is an Attitude_t, RATES is the measured then the desired
+ * Rates_t, RC_INPUT is the pulse width of each channel in us (uint16_t) and
+ * MOTORS the pwm compare value of each motor in us (uint32_t), in
+ * MOTOR_INDEX order
+ */
+
+/**
+ * @brief MAVLink HEARTBEAT (message 0)
+ */
+typedef struct __attribute__((packed)) TelemetryHeartbeat_t {
+    uint32_t customMode;
+    uint8_t  type;            // MAV_TYPE_QUADROTOR
+    uint8_t  autopilot;       // MAV_AUTOPILOT_GENERIC
+    uint8_t  baseMode;        // MAV_MODE_FLAG_SAFETY_ARMED when armed
+    uint8_t  systemStatus;    // MAV_STATE_STANDBY or MAV_STATE_ACTIVE
+    uint8_t  mavlinkVersion;
+} TelemetryHeartbeat_t;
+
+#define TELEMETRY_MAV_TYPE_QUADROTOR       2
+#define TELEMETRY_MAV_AUTOPILOT_GENERIC    0
+#define TELEMETRY_MAV_MODE_FLAG_ARMED      0x80
+#define TELEMETRY_MAV_STATE_STANDBY        3
+#define TELEMETRY_MAV_STATE_ACTIVE         4
+#define TELEMETRY_MAV_STATE_CRITICAL       5
+#define TELEMETRY_MAVLINK_VERSION          3
+
+// Length of a parameter name, not null terminated if it uses all of it
+#define TELEMETRY_PARAM_ID_LENGTH          16
+
+/**
+ * @brief MAVLink PARAM_REQUEST_READ (message 20)
+ */
+typedef struct __attribute__((packed)) TelemetryParamRequestRead_t {
+    int16_t paramIndex;       // -1 to look up by paramId
+    uint8_t targetSystem;
+    uint8_t targetComponent;
+    char    paramId[TELEMETRY_PARAM_ID_LENGTH];
+} TelemetryParamRequestRead_t;
+
+/**
+ * @brief MAVLink PARAM_REQUEST_LIST (message 21)
+ */
+typedef struct __attribute__((packed)) TelemetryParamRequestList_t {
+    uint8_t targetSystem;
+    uint8_t targetComponent;
+} TelemetryParamRequestList_t;
+
+/**
+ * @brief MAVLink PARAM_VALUE (message 22)
+ */
+typedef struct __attribute__((packed)) TelemetryParamValue_t {
+    float    paramValue;      // Integer parameters are converted to float
+    uint16_t paramCount;
+    uint16_t paramIndex;
+    char     paramId[TELEMETRY_PARAM_ID_LENGTH];
+    uint8_t  paramType;       // MAV_PARAM_TYPE
+} TelemetryParamValue_t;
+
+/**
+ * @brief MAVLink PARAM_SET (message 23)
+ */
+typedef struct __attribute__((packed)) TelemetryParamSet_t {
+    float   paramValue;
+    uint8_t targetSystem;
+    uint8_t targetComponent;
+    char    paramId[TELEMETRY_PARAM_ID_LENGTH];
+    uint8_t paramType;
+} TelemetryParamSet_t;
+
+#define TELEMETRY_MAV_PARAM_TYPE_UINT32    5
+#define TELEMETRY_MAV_PARAM_TYPE_INT32     6
+#define TELEMETRY_MAV_PARAM_TYPE_REAL32    9
+
+/**
+ * @brief Control loop timing, kept up to date by the control loop
+ */
+typedef struct TelemetryLoopStats_t {
+    uint32_t timeUs;          // Start of the last iteration
+    uint32_t loopTimeUs;      // Execution time of the last iteration
+    uint32_t maxLoopTimeUs;   // Longest execution time since start up
+    uint32_t iterations;
+    uint32_t telemetryDropped; // Frames that didn't fit in the uart ring
+} TelemetryLoopStats_t;
+
+// Period histogram buckets in LOOP_TIMING
+#define TELEMETRY_LOOP_TIMING_BUCKETS 16
+
+/**
+ * @brief Control loop period and deadline accounting, see loopTiming.c
+ */
+typedef struct TelemetryLoopTiming_t {
+    uint32_t periodUs;             // Start to start, of the last iteration
+    uint32_t minPeriodUs;
+    uint32_t maxPeriodUs;
+    uint32_t maxLateUs;            // Latest start after its release time
+    uint32_t executionUs;          // Of the last iteration
+    uint32_t maxExecutionUs;
+    uint32_t iterations;
+    uint32_t deadlineMisses;       // Iterations that ended after the next release
+    uint16_t consecutiveMisses;
+    uint16_t maxConsecutiveMisses;
+    // Count of periods by difference from the nominal period, see
+    // loopTimingBucket
+    uint32_t histogram[TELEMETRY_LOOP_TIMING_BUCKETS];
+} TelemetryLoopTiming_t;
+
+// Most tasks reported in TASK_STATS, including the idle task
+#define TELEMETRY_MAX_TASKS         10
+
+/**
+ * @brief Cpu use and stack margin of each task, see taskStats.c
+ *
+ * Tasks are listed by task number (creation order, the idle task is last),
+ * the arrays are only valid up to taskCount
+ */
+typedef struct __attribute__((packed)) TelemetryTaskStats_t {
+    uint32_t timeUs;          // End of the reported interval
+    uint32_t intervalUs;
+    uint16_t cpuLoad;         // Every task but idle, in 0.1 %
+    uint16_t taskLoad[TELEMETRY_MAX_TASKS];  // In 0.1 %
+    uint16_t stackFree[TELEMETRY_MAX_TASKS]; // Least ever free, in words
+    uint8_t  taskNumber[TELEMETRY_MAX_TASKS];
+    uint8_t  taskCount;
+} TelemetryTaskStats_t;
+
+/**
+ * @brief Part of a trace dump, events index to index + TRACE_EVENTS_PER_FRAME
+ * - 1 of total, oldest first. The last frame is padded with zeros
+ */
+typedef struct TelemetryTraceEvents_t {
+    uint16_t     index;
+    uint16_t     total;
+    TraceEvent_t events[TRACE_EVENTS_PER_FRAME];
+} TelemetryTraceEvents_t;
+
+/**
+ * @brief Name of a task, queue, interrupt or mark in a trace dump, sent
+ * before the events
+ */
+typedef struct __attribute__((packed)) TelemetryTraceName_t {
+    uint8_t kind;             // TraceNameKind
+    uint8_t number;
+    char    name[TRACE_NAME_LENGTH];
+} TelemetryTraceName_t;
+
+// Same as MOTOR_COUNT, motors.h can't be used on the host
+#define TELEMETRY_MOTOR_COUNT       4
+
+#define TELEMETRY_RC_INPUT_LENGTH   (RC_CHANNEL_IN_COUNT * sizeof(uint16_t))
+#define TELEMETRY_MOTORS_LENGTH     (TELEMETRY_MOTOR_COUNT * sizeof(uint32_t))
+
+/**
+ * @brief Receive state for incoming frames (see telemetryParse)
+ */
+typedef struct TelemetryParser_t {
+    // The frame being received, always starting with TELEMETRY_STX
+    uint8_t  frame[UINT8_MAX + TELEMETRY_FRAME_OVERHEAD];
+    uint32_t length;
+    uint32_t consumed;        // Length of the frame last returned
+    uint32_t badCrc;
+    uint32_t unknown;         // Unknown message ids, or false starts
+    uint32_t skippedBytes;
+} TelemetryParser_t;
+
+typedef struct TelemetryStats_t {
+    uint32_t framesSent;
+    uint32_t framesDropped;
+    uint32_t bytesSent;
+} TelemetryStats_t;
+
+const TelemetryMessageInfo_t *telemetryMessageInfo(TelemetryMessage msg);
+const TelemetryMessageInfo_t *telemetryFindMessage(uint8_t id);
+
+void telemetryInit(uint32_t linkBytesPerSecond);
+void telemetrySetSource(TelemetryMessage msg, int index, const void *data,
+                        uint32_t length);
+FC_Status telemetrySetRate(TelemetryMessage msg, uint32_t rateHz);
+uint32_t telemetryGetRate(TelemetryMessage msg);
+void telemetrySetArmed(bool armed);
+void telemetrySetCritical(bool critical);
+void telemetryUpdate(uint32_t nowMs);
+FC_Status telemetrySend(TelemetryMessage msg, const void *payload);
+const TelemetryStats_t *telemetryStats(void);
+
+void telemetryParserReset(TelemetryParser_t *parser);
+const TelemetryMessageInfo_t *telemetryParse(TelemetryParser_t *parser,
+                                             const uint8_t **data,
+                                             uint32_t *length);
+
+uint16_t telemetryCrcAccumulate(uint16_t crc, const void *data, uint32_t length);
+
+#ifndef __UNIT_TEST
+void vTelemetryTask(void *pvParameters);
+#endif
+
+#endif /* defined(__TELEMETRY_H) */
@@ -0,0 +1,89 @@
+#ifndef __TOPIC_BUS_H
+#define __TOPIC_BUS_H
+
+#include <stdbool.h>
+
+#include "fc.h"
+
+#ifndef __UNIT_TEST
+#include "freertos.h"
+#endif
+
+// Tasks that can block in topicWait on one topic at once
+#define TOPIC_MAX_WAITERS    2
+
+// Times a copy is retried if the writer overwrites it, see topicUpdate
+#define TOPIC_READ_RETRIES   3
+
+// Free running us counter for the statistics, wraps at 2^32
+typedef uint32_t (*TopicClock)(void);
+
+typedef struct TopicStats_t {
+    uint32_t publishes;
+    uint32_t firstUs;
+    uint32_t lastUs;
+    uint32_t minIntervalUs;
+    uint32_t maxIntervalUs;
+    uint32_t tornReads;         // Copies overwritten by the writer, retried
+} TopicStats_t;
+
+/**
+ * @brief The latest sample of one kind of data, see TOPIC_DEFINE
+ *
+ * There are two buffers. The writer fills the one readers aren't using and
+ * publishing switches to it, so a sample is only overwritten two publishes
+ * later
+ */
+typedef struct Topic_t {
+    const char          *name;
+    uint32_t             size;
+    uint8_t             *buffers;       // 2 * size
+    volatile uint32_t    generation;    // Samples published
+    volatile uint32_t    claims;        // Samples started by the writer
+    bool                 advertised;
+    TopicStats_t         stats;
+    void * volatile      waiters[TOPIC_MAX_WAITERS];
+} Topic_t;
+
+/**
+ * @brief A reader's place in a topic, the last sample it took
+ */
+typedef struct TopicReader_t {
+    Topic_t  *topic;
+    uint32_t  generation;
+    uint32_t  missed;               // Samples published but never taken
+} TopicReader_t;
+
+/**
+ * @brief Define a topic carrying type, declare it elsewhere with
+ * TOPIC_DECLARE
+ */
+#define TOPIC_DEFINE(topic, type) \
+    static type topic##Buffers[2]; \
+    Topic_t topic = {.name = #topic, .size = sizeof(type), \
+                     .buffers = (uint8_t *)topic##Buffers}
+
+#define TOPIC_DECLARE(topic) extern Topic_t topic
+
+void topicBusInit(TopicClock clockUs);
+
+FC_Status topicAdvertise(Topic_t *topic);
+void *topicClaim(Topic_t *topic);
+void topicPublish(Topic_t *topic);
+void topicWrite(Topic_t *topic, const void *data);
+
+void topicSubscribe(TopicReader_t *reader, Topic_t *topic);
+bool topicUpdated(const TopicReader_t *reader);
+bool topicUpdate(TopicReader_t *reader, void *data);
+const void *topicPeek(TopicReader_t *reader, uint32_t *generation);
+bool topicPeekValid(const TopicReader_t *reader, uint32_t generation);
+uint32_t topicRateHz(const Topic_t *topic);
+
+#ifndef __UNIT_TEST
+void topicPublishFromISR(Topic_t *topic, BaseType_t *higherPriorityTaskWoken);
+void topicWriteFromISR(Topic_t *topic, const void *data,
+                       BaseType_t *higherPriorityTaskWoken);
+FC_Status topicWait(TopicReader_t *reader, uint32_t timeoutMs);
+#endif
+
+#endif /* defined(__TOPIC_BUS_H) */
@@ -0,0 +1,19 @@
+#ifndef __TOPICS_H
+#define __TOPICS_H
+
+#include "topicBus.h"
+
+/*
+ * The firmware's topics, defined in topics.c. Each has one writer
+ */
+
+// tPpmSignal, a whole ppm frame, from the ppm capture interrupt
+TOPIC_DECLARE(rcInputTopic);
+// Rates_t, the gyro rates in dps, from the IMU task
+TOPIC_DECLARE(gyroRatesTopic);
+// RotationAxisOutputs_t, the rate controller's outputs, from the control loop
+TOPIC_DECLARE(rotationOutputsTopic);
+
+void topicsInit(void);
+
+#endif /* defined(__TOPICS_H) */
@@ -0,0 +1,192 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+/*
+ * Included from FreeRTOSConfig.h for the kernel trace hooks, so this can't
+ * include any FreeRTOS headers
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fc.h"
+
+// Events kept in RAM, 8 bytes each. Must be a power of 2
+#define TRACE_RING_LENGTH         256
+
+// Events still recorded after traceTrigger, the rest of the ring shows what
+// led up to it
+#define TRACE_POST_TRIGGER_EVENTS (TRACE_RING_LENGTH / 4)
+
+// Events per TRACE_EVENTS telemetry frame
+#define TRACE_EVENTS_PER_FRAME    30
+
+// Dump pacing, one frame per period keeps within the uart bandwidth left by
+// the rest of the telemetry
+#define TRACE_DUMP_PERIOD_MS      50
+
+#define TRACE_NAME_LENGTH         16
+
+typedef enum TraceEventType {
+    TRACE_TASK_SWITCHED_IN = 0,    // id is the task number
+    TRACE_TASK_SWITCHED_OUT,
+    TRACE_TASK_READY,
+    TRACE_TASK_PRIORITY_INHERIT,   // id is the mutex holder, arg its new priority
+    TRACE_TASK_PRIORITY_DISINHERIT,
+    TRACE_ISR_ENTER,               // id is the exception number
+    TRACE_ISR_EXIT,
+    TRACE_QUEUE_SEND,              // id is the queue number (traceNameQueue)
+    TRACE_QUEUE_SEND_FAILED,
+    TRACE_QUEUE_RECEIVE,           // Also taking a semaphore or mutex
+    TRACE_QUEUE_RECEIVE_FAILED,
+    TRACE_QUEUE_BLOCK_SEND,
+    TRACE_QUEUE_BLOCK_RECEIVE,
+    TRACE_MARK_BEGIN,              // id is a TraceMark
+    TRACE_MARK_END,
+    TRACE_EVENT_TYPE_COUNT,
+} TraceEventType;
+
+// Set in arg of queue events from an interrupt
+#define TRACE_ARG_FROM_ISR        1
+
+/**
+ * @brief Stages of the code marked with TRACE_BEGIN and TRACE_END
+ */
+typedef enum TraceMark {
+    TRACE_MARK_CONTROL_LOOP = 0,
+    TRACE_MARK_PPM,
+    TRACE_MARK_CONTROL_RATES,
+    TRACE_MARK_MOTORS,
+    TRACE_MARK_LOG,
+    TRACE_MARK_COUNT,
+} TraceMark;
+
+typedef struct TraceEvent_t {
+    uint32_t timeUs;   // TIM5, the same 1MHz clock as everything else
+    uint8_t  type;     // TraceEventType
+    uint8_t  id;
+    uint16_t arg;
+} TraceEvent_t;
+
+/**
+ * @brief What the names in TRACE_NAME frames are for
+ */
+typedef enum TraceNameKind {
+    TRACE_NAME_TASK = 0,
+    TRACE_NAME_QUEUE,
+    TRACE_NAME_ISR,
+    TRACE_NAME_MARK,
+} TraceNameKind;
+
+typedef enum TraceState {
+    TRACE_RECORDING = 0,  // Overwriting the oldest events
+    TRACE_TRIGGERED,      // Recording until traceStopIndex
+    TRACE_STOPPED,        // Holding the events for the dump
+} TraceState;
+
+// Only for traceRecord, use the functions below
+extern TraceEvent_t traceRing[TRACE_RING_LENGTH];
+extern volatile uint32_t traceIndex;
+extern volatile uint32_t traceStopIndex;
+extern volatile TraceState traceState;
+
+#ifndef __UNIT_TEST
+#define TRACE_TIME_US()           (TIM5->CNT)
+#define TRACE_LOCK(state)         do { (state) = __get_PRIMASK(); __disable_irq(); } while (0)
+#define TRACE_UNLOCK(state)       __set_PRIMASK(state)
+#define TRACE_EXCEPTION_NUMBER()  ((uint8_t)__get_IPSR())
+#else
+uint32_t traceTimeUs(void);
+#define TRACE_TIME_US()           traceTimeUs()
+#define TRACE_LOCK(state)         ((state) = 0)
+#define TRACE_UNLOCK(state)       ((void)(state))
+#define TRACE_EXCEPTION_NUMBER()  0
+#endif
+
+/**
+ * @brief Add an event to the ring
+ *
+ * Inlined into every hook, this is a timer read, an 8 byte store and the
+ * index update, with interrupts masked so an interrupt can't claim the same
+ * slot
+ */
+static inline void traceRecord(uint8_t type, uint8_t id, uint16_t arg)
+{
+    uint32_t lockState;
+
+    TRACE_LOCK(lockState);
+
+    if (traceState != TRACE_STOPPED) {
+        TraceEvent_t *event = &traceRing[traceIndex & (TRACE_RING_LENGTH - 1)];
+
+        event->timeUs = TRACE_TIME_US();
+        event->type = type;
+        event->id = id;
+        event->arg = arg;
+
+        if (++traceIndex == traceStopIndex && traceState == TRACE_TRIGGERED) {
+            traceState = TRACE_STOPPED;
+        }
+    }
+
+    TRACE_UNLOCK(lockState);
+}
+
+#define TRACE_BEGIN(mark)  traceRecord(TRACE_MARK_BEGIN, (mark), 0)
+#define TRACE_END(mark)    traceRecord(TRACE_MARK_END, (mark), 0)
+
+// At the start and end of an interrupt handler
+#define TRACE_ISR_ENTER()  traceRecord(TRACE_ISR_ENTER, TRACE_EXCEPTION_NUMBER(), 0)
+#define TRACE_ISR_EXIT()   traceRecord(TRACE_ISR_EXIT, TRACE_EXCEPTION_NUMBER(), 0)
+
+void traceInit(void);
+void traceTrigger(void);
+TraceState traceGetState(void);
+uint32_t traceEventCount(void);
+uint32_t traceRead(uint32_t first, TraceEvent_t *events, uint32_t count);
+void traceRestart(void);
+
+const char *traceMarkName(TraceMark mark);
+
+#ifndef __UNIT_TEST
+void traceNameQueue(void *queue, const char *name);
+void traceUpdate(uint32_t nowMs);
+#endif
+
+/*
+ * Kernel hooks, see FreeRTOS.h. These expand inside tasks.c and queue.c,
+ * where pxCurrentTCB and the queue fields are visible
+ */
+#define traceTASK_SWITCHED_IN() \
+    traceRecord(TRACE_TASK_SWITCHED_IN, pxCurrentTCB->uxTCBNumber, pxCurrentTCB->uxPriority)
+#define traceTASK_SWITCHED_OUT() \
+    traceRecord(TRACE_TASK_SWITCHED_OUT, pxCurrentTCB->uxTCBNumber, 0)
+#define traceMOVED_TASK_TO_READY_STATE(pxTCB) \
+    traceRecord(TRACE_TASK_READY, (pxTCB)->uxTCBNumber, 0)
+#define traceTASK_PRIORITY_INHERIT(pxTCBOfMutexHolder, uxInheritedPriority) \
+    traceRecord(TRACE_TASK_PRIORITY_INHERIT, (pxTCBOfMutexHolder)->uxTCBNumber, (uxInheritedPriority))
+#define traceTASK_PRIORITY_DISINHERIT(pxTCBOfMutexHolder, uxOriginalPriority) \
+    traceRecord(TRACE_TASK_PRIORITY_DISINHERIT, (pxTCBOfMutexHolder)->uxTCBNumber, (uxOriginalPriority))
+
+#define traceQUEUE_SEND(pxQueue) \
+    traceRecord(TRACE_QUEUE_SEND, (pxQueue)->uxQueueNumber, 0)
+#define traceQUEUE_SEND_FAILED(pxQueue) \
+    traceRecord(TRACE_QUEUE_SEND_FAILED, (pxQueue)->uxQueueNumber, 0)
+#define traceQUEUE_SEND_FROM_ISR(pxQueue) \
+    traceRecord(TRACE_QUEUE_SEND, (pxQueue)->uxQueueNumber, TRACE_ARG_FROM_ISR)
+#define traceQUEUE_SEND_FROM_ISR_FAILED(pxQueue) \
+    traceRecord(TRACE_QUEUE_SEND_FAILED, (pxQueue)->uxQueueNumber, TRACE_ARG_FROM_ISR)
+#define traceQUEUE_RECEIVE(pxQueue) \
+    traceRecord(TRACE_QUEUE_RECEIVE, (pxQueue)->uxQueueNumber, 0)
+#define traceQUEUE_RECEIVE_FAILED(pxQueue) \
+    traceRecord(TRACE_QUEUE_RECEIVE_FAILED, (pxQueue)->uxQueueNumber, 0)
+#define traceQUEUE_RECEIVE_FROM_ISR(pxQueue) \
+    traceRecord(TRACE_QUEUE_RECEIVE, (pxQueue)->uxQueueNumber, TRACE_ARG_FROM_ISR)
+#define traceQUEUE_RECEIVE_FROM_ISR_FAILED(pxQueue) \
+    traceRecord(TRACE_QUEUE_RECEIVE_FAILED, (pxQueue)->uxQueueNumber, TRACE_ARG_FROM_ISR)
+#define traceBLOCKING_ON_QUEUE_SEND(pxQueue) \
+    traceRecord(TRACE_QUEUE_BLOCK_SEND, (pxQueue)->uxQueueNumber, 0)
+#define traceBLOCKING_ON_QUEUE_RECEIVE(pxQueue) \
+    traceRecord(TRACE_QUEUE_BLOCK_RECEIVE, (pxQueue)->uxQueueNumber, 0)
+
+#endif /* defined(__TRACE_H) */
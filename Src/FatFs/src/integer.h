@@ -14,6 +14,8 @@ typedef unsigned __int64 QWORD;
 
 #else			/* Embedded platform */
 
+#include <stdint.h>
+
 /* These types MUST be 16-bit or 32-bit */
 typedef int				INT;
 typedef unsigned int	UINT;
@@ -26,9 +28,11 @@ typedef short			SHORT;
 typedef unsigned short	WORD;
 typedef unsigned short	WCHAR;
 
-/* These types MUST be 32-bit */
-typedef long			LONG;
-typedef unsigned long	DWORD;
+/* These types MUST be 32-bit. Fixed width types keep them 32-bit when
+   FatFs is built for 64-bit hosts by the unit tests, they are the same
+   long types as before on the target */
+typedef int32_t			LONG;
+typedef uint32_t		DWORD;
 
 /* This type MUST be 64-bit (Remove this for ANSI C (C89) compatibility) */
 typedef unsigned long long QWORD;
@@ -98,19 +98,30 @@
 #define configTICK_RATE_HZ                ((TickType_t)1000)
 #define configMAX_PRIORITIES              (7)
 #define configMINIMAL_STACK_SIZE          ((uint16_t)128)
-#define configTOTAL_HEAP_SIZE             ((size_t)(15 * 1024))
 #define configMAX_TASK_NAME_LEN           (16)
 #define configUSE_TRACE_FACILITY          1
 #define configUSE_16_BIT_TICKS            0
 #define configIDLE_SHOULD_YIELD           1
 #define configUSE_MUTEXES                 1
 #define configQUEUE_REGISTRY_SIZE         8
-#define configCHECK_FOR_STACK_OVERFLOW    0
+#define configCHECK_FOR_STACK_OVERFLOW    2
 #define configUSE_RECURSIVE_MUTEXES       1
 #define configUSE_MALLOC_FAILED_HOOK      0
 #define configUSE_APPLICATION_TASK_TAG    0
 #define configUSE_COUNTING_SEMAPHORES     1
-#define configGENERATE_RUN_TIME_STATS     0
+#define configGENERATE_RUN_TIME_STATS     1
+
+/* Every task, queue, semaphore and mutex is allocated statically from the
+tables in kernelObjects.c, so there is no kernel heap (heap_n.c isn't
+linked) */
+#define configSUPPORT_STATIC_ALLOCATION   1
+#define configSUPPORT_DYNAMIC_ALLOCATION  0
+
+/* Run time stats count on TIM5, a free running 1MHz 32 bit counter. It is
+started by ppmInit, from hardware_init, before the scheduler starts. See
+taskStats.c */
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS() configASSERT((TIM5->CR1 & TIM_CR1_CEN) != 0)
+#define portGET_RUN_TIME_COUNTER_VALUE()        (TIM5->CNT)
 
 /* Co-routine definitions. */
 #define configUSE_CO_ROUTINES           0
@@ -132,6 +143,7 @@ to exclude the API function. */
 #define INCLUDE_vTaskDelayUntil        1
 #define INCLUDE_vTaskDelay             1
 #define INCLUDE_xTaskGetSchedulerState 1
+#define INCLUDE_xTaskGetIdleTaskHandle 1
 
 /* Cortex-M specific definitions. */
 #ifdef __NVIC_PRIO_BITS
@@ -172,5 +184,8 @@ header file. */
               to prevent overwriting SysTick_Handler defined within STM32Cube HAL */
 /* #define xPortSysTickHandler SysTick_Handler */
 
+/* Kernel trace hooks, recording into the trace ring. See trace.c */
+#include "trace.h"
+
 #endif /* FREERTOS_CONFIG_H */
 
@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "fc.h"
+#include "blackbox.h"
+
+#ifndef __UNIT_TEST
+
+#include "freertos.h"
+#include "task.h"
+
+#include "debug.h"
+#include "ff.h"
+#include "logFile.h"
+#include "blackboxEncoder.h"
+
+#endif
+
+/**
+ * @file Src/blackbox.c
+ *
+ * @brief Flight recorder, logs every control loop iteration to the sd card
+ *
+ * The control loop fills records in place in a single producer, single
+ * consumer ring buffer (blackboxClaim/blackboxCommit). This never blocks and
+ * never formats anything, if the ring is full the record is dropped and
+ * counted. A low priority task drains the ring, encodes the records (see
+ * blackboxEncoder.c) and streams them to a pre-allocated log file (see
+ * logFile.c).
+ *
+ * The sequence number in each record increments for dropped records too, so
+ * gaps in the log show exactly where data was lost.
+ */
+
+#define BLACKBOX_RING_MASK (BLACKBOX_RING_LENGTH - 1)
+
+#if (BLACKBOX_RING_LENGTH & BLACKBOX_RING_MASK) != 0
+#error "BLACKBOX_RING_LENGTH must be a power of 2"
+#endif
+
+// Make sure a record is fully written before the index that publishes it
+#define BLACKBOX_BARRIER() __sync_synchronize()
+
+static BlackboxRecord_t ring[BLACKBOX_RING_LENGTH];
+
+// head is only written by the producer, tail only by the consumer. Both count
+// up forever and are masked on use, so head - tail is the fill level
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+static volatile uint32_t dropped = 0;
+static volatile bool recording = false;
+static uint32_t nextSequence = 0;
+
+void blackboxInit(void)
+{
+    head = 0;
+    tail = 0;
+    dropped = 0;
+    nextSequence = 0;
+    recording = false;
+}
+
+/**
+ * @brief Start accepting records, called once the log file is open
+ */
+void blackboxStart(void)
+{
+    recording = true;
+}
+
+/**
+ * @brief Stop accepting records. Records already in the ring can still be
+ * drained
+ */
+void blackboxStop(void)
+{
+    recording = false;
+}
+
+/**
+ * @brief Get the next free record to fill in
+ *
+ * Must only be called from one task (the control loop). Every call must be
+ * followed by blackboxCommit if it doesn't return NULL
+ *
+ * @return The record to fill, or NULL if not recording or the ring is full
+ */
+BlackboxRecord_t *blackboxClaim(void)
+{
+    if (!recording) {
+        return NULL;
+    }
+
+    uint32_t sequence = nextSequence++;
+
+    if (head - tail >= BLACKBOX_RING_LENGTH) {
+        dropped++;
+        return NULL;
+    }
+
+    BlackboxRecord_t *record = &ring[head & BLACKBOX_RING_MASK];
+    record->sequence = sequence;
+
+    return record;
+}
+
+/**
+ * @brief Publish the record returned by the last blackboxClaim
+ */
+void blackboxCommit(void)
+{
+    BLACKBOX_BARRIER();
+    head = head + 1;
+}
+
+/**
+ * @brief Get the oldest committed records
+ *
+ * @param[out] records Set to point at the oldest committed record
+ *
+ * @return The number of records that can be read contiguously from records
+ */
+uint32_t blackboxPeek(const BlackboxRecord_t **records)
+{
+    uint32_t available = head - tail;
+    uint32_t index = tail & BLACKBOX_RING_MASK;
+
+    // Don't read record contents before seeing the index that published them
+    BLACKBOX_BARRIER();
+
+    if (index + available > BLACKBOX_RING_LENGTH) {
+        available = BLACKBOX_RING_LENGTH - index;
+    }
+
+    (*records) = &ring[index];
+
+    return available;
+}
+
+/**
+ * @brief Free records returned by blackboxPeek once they have been written
+ */
+void blackboxRelease(uint32_t count)
+{
+    BLACKBOX_BARRIER();
+    tail = tail + count;
+}
+
+uint32_t blackboxDroppedCount(void)
+{
+    return dropped;
+}
+
+#ifndef __UNIT_TEST
+
+// How often the writer wakes up to drain the ring. The ring must be able to
+// hold this many control loop iterations plus the worst case sd write time
+#define BLACKBOX_WRITE_PERIOD_MS   20
+// Write buffered data to the card every this many write periods, so a crash
+// loses at most this much data
+#define BLACKBOX_SYNC_INTERVAL     50
+#define BLACKBOX_MAX_FILES         1000
+
+// Space to allocate for each log. About 20 minutes at 1 kHz. If the card has no
+// contiguous space this big, smaller sizes are tried down to the minimum
+#define BLACKBOX_FILE_SIZE         (32UL * 1024 * 1024)
+#define BLACKBOX_MIN_FILE_SIZE     (1UL * 1024 * 1024)
+
+static FATFS fileSystem;
+static LogFile_t logFile;
+static BlackboxCodec_t encoder;
+
+static FC_Status blackboxOpenFile(void)
+{
+    BlackboxFileHeader_t header;
+    char name[13];
+    DWORD size;
+    FRESULT res;
+    int i;
+
+    res = f_mount(&fileSystem, "", 1 /* mount now */);
+    if (res != FR_OK) {
+        DEBUG_PRINT("BB mount fail %d\n", res);
+        return FC_ERROR;
+    }
+
+    // Try names until one doesn't exist
+    for (i = 0; i < BLACKBOX_MAX_FILES; i++) {
+        snprintf(name, sizeof(name), "BB%03d.BBL", i);
+
+        size = BLACKBOX_FILE_SIZE;
+        do {
+            res = logFileOpen(&logFile, name, size);
+            size /= 2;
+        } while (res == FR_DENIED && size >= BLACKBOX_MIN_FILE_SIZE);
+
+        if (res != FR_EXIST) {
+            break;
+        }
+    }
+
+    if (res != FR_OK) {
+        DEBUG_PRINT("BB open fail %d\n", res);
+        return FC_ERROR;
+    }
+
+    memcpy(header.magic, BLACKBOX_FILE_MAGIC, sizeof(header.magic));
+    header.version = BLACKBOX_FILE_VERSION;
+    header.recordSize = sizeof(BlackboxRecord_t);
+
+    res = logFileWrite(&logFile, &header, sizeof(header));
+    if (res != FR_OK) {
+        DEBUG_PRINT("BB header fail %d\n", res);
+        logFileClose(&logFile);
+        return FC_ERROR;
+    }
+
+    blackboxCodecReset(&encoder);
+
+    // name is on the stack, and debug messages are formatted later
+    DEBUG_PRINT("BB logging to BB%03d.BBL\n", i);
+
+    return FC_OK;
+}
+
+/**
+ * @brief Close the log after a write error or once it is full, and stop
+ * recording
+ */
+static void blackboxFinish(FRESULT res)
+{
+    if (res == FR_DENIED) {
+        DEBUG_PRINT("BB log full, stopping\n");
+    } else {
+        DEBUG_PRINT("BB write fail %d, stopping\n", res);
+    }
+
+    blackboxStop();
+    logFileClose(&logFile);
+    vTaskDelete(NULL);
+}
+
+void vBlackboxTask(void *pvParameters)
+{
+    const BlackboxRecord_t *records;
+    uint8_t frame[BLACKBOX_ENCODED_MAX_BYTES];
+    uint32_t count;
+    uint32_t lastDropped = 0;
+    uint32_t periodsSinceSync = 0;
+    FRESULT res;
+
+    blackboxInit();
+
+    if (blackboxOpenFile() != FC_OK) {
+        DEBUG_PRINT("Blackbox disabled\n");
+        vTaskDelete(NULL);
+    }
+
+    blackboxStart();
+
+    TickType_t lastWakeTime = xTaskGetTickCount();
+    for ( ;; )
+    {
+        vTaskDelayUntil(&lastWakeTime, BLACKBOX_WRITE_PERIOD_MS / portTICK_PERIOD_MS);
+
+        // The ring may wrap, so this can take two passes to drain
+        while ((count = blackboxPeek(&records)) != 0) {
+            for (uint32_t i = 0; i < count; i++) {
+                size_t length = blackboxEncode(&encoder, &records[i], frame);
+
+                res = logFileWrite(&logFile, frame, length);
+                if (res != FR_OK) {
+                    blackboxFinish(res);
+                }
+            }
+
+            // Records have been copied into the log file buffer
+            blackboxRelease(count);
+        }
+
+        if (++periodsSinceSync >= BLACKBOX_SYNC_INTERVAL) {
+            res = logFileSync(&logFile);
+            if (res != FR_OK) {
+                blackboxFinish(res);
+            }
+            periodsSinceSync = 0;
+        }
+
+        // Report drops rather than stalling the control loop to avoid them
+        uint32_t droppedNow = blackboxDroppedCount();
+        if (droppedNow != lastDropped) {
+            DEBUG_PRINT("BB dropped %lu\n", droppedNow - lastDropped);
+            lastDropped = droppedNow;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,264 @@
+#include <string.h>
+
+#include "fc.h"
+#include "blackbox.h"
+#include "blackboxEncoder.h"
+
+/**
+ * @file Src/blackboxEncoder.c
+ *
+ * @brief Compact encoding of blackbox records
+ *
+ * Each frame starts with a frame type byte, followed by one varint per field.
+ *
+ * Keyframes (BLACKBOX_FRAME_KEY) hold the absolute value of every field and
+ * reset the prediction history, so decoding can start at any keyframe.
+ *
+ * Delta frames (BLACKBOX_FRAME_DELTA) hold the difference between each field
+ * and a prediction made from previous frames:
+ * +     sequence   previous + 1, so the residual is the number of dropped
+ *                  records
+ * +     timeUs     linear extrapolation of the previous two timestamps
+ * +     others     the previous value
+ *
+ * Signed values are zig-zag coded so small negative residuals stay small,
+ * then written as little endian base 128 varints.
+ *
+ * This file is shared with the host tools, so it must not depend on the HAL
+ * or FreeRTOS.
+ */
+
+enum {
+    FIELD_SEQUENCE = 0,
+    FIELD_TIME     = 1,
+    FIELD_FIRST_16 = 2, // All following fields are 16 bits
+};
+
+static void recordToFields(const BlackboxRecord_t *record, int32_t *fields)
+{
+    int i = FIELD_FIRST_16;
+
+    fields[FIELD_SEQUENCE] = record->sequence;
+    fields[FIELD_TIME] = record->timeUs;
+    fields[i++] = record->loopTimeUs;
+    fields[i++] = record->throttle;
+
+    for (int axis = 0; axis < BLACKBOX_AXIS_COUNT; axis++) {
+        fields[i++] = record->gyro[axis];
+        fields[i++] = record->setpoint[axis];
+        fields[i++] = record->pidP[axis];
+        fields[i++] = record->pidI[axis];
+        fields[i++] = record->pidD[axis];
+    }
+
+    for (int motor = 0; motor < BLACKBOX_MOTOR_COUNT; motor++) {
+        fields[i++] = record->motor[motor];
+    }
+}
+
+static void fieldsToRecord(const int32_t *fields, BlackboxRecord_t *record)
+{
+    int i = FIELD_FIRST_16;
+
+    record->sequence = fields[FIELD_SEQUENCE];
+    record->timeUs = fields[FIELD_TIME];
+    record->loopTimeUs = fields[i++];
+    record->throttle = fields[i++];
+
+    for (int axis = 0; axis < BLACKBOX_AXIS_COUNT; axis++) {
+        record->gyro[axis] = fields[i++];
+        record->setpoint[axis] = fields[i++];
+        record->pidP[axis] = fields[i++];
+        record->pidI[axis] = fields[i++];
+        record->pidD[axis] = fields[i++];
+    }
+
+    for (int motor = 0; motor < BLACKBOX_MOTOR_COUNT; motor++) {
+        record->motor[motor] = fields[i++];
+    }
+}
+
+static inline uint32_t zigzagEncode(int32_t val)
+{
+    return ((uint32_t)val << 1) ^ (uint32_t)(val >> 31);
+}
+
+static inline int32_t zigzagDecode(uint32_t val)
+{
+    return (int32_t)(val >> 1) ^ -(int32_t)(val & 1);
+}
+
+static inline size_t writeVarint(uint32_t val, uint8_t *out)
+{
+    size_t length = 0;
+
+    while (val >= 0x80) {
+        out[length++] = (val & 0x7F) | 0x80;
+        val >>= 7;
+    }
+    out[length++] = val;
+
+    return length;
+}
+
+/**
+ * @return Number of bytes read, or 0 if the varint is truncated or too long
+ */
+static inline size_t readVarint(const uint8_t *in, size_t length,
+                                uint32_t *val)
+{
+    uint32_t result = 0;
+
+    for (size_t i = 0; i < length && i < 5; i++) {
+        result |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+        if ((in[i] & 0x80) == 0) {
+            (*val) = result;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Compute the prediction for every field from the codec history
+ */
+static void predict(const BlackboxCodec_t *codec, int32_t *prediction)
+{
+    memcpy(prediction, codec->prev, sizeof(codec->prev));
+    prediction[FIELD_SEQUENCE] = (uint32_t)codec->prev[FIELD_SEQUENCE] + 1;
+    prediction[FIELD_TIME] = (uint32_t)codec->prev[FIELD_TIME]
+                             + codec->prevTimeDeltaUs;
+}
+
+static void updateHistory(BlackboxCodec_t *codec, const int32_t *fields,
+                          bool keyframe)
+{
+    if (keyframe) {
+        codec->prevTimeDeltaUs = 0;
+        codec->framesSinceKey = 0;
+    } else {
+        codec->prevTimeDeltaUs = (uint32_t)fields[FIELD_TIME]
+                                 - (uint32_t)codec->prev[FIELD_TIME];
+    }
+
+    memcpy(codec->prev, fields, sizeof(codec->prev));
+    codec->haveHistory = true;
+    codec->framesSinceKey++;
+}
+
+void blackboxCodecReset(BlackboxCodec_t *codec)
+{
+    memset(codec, 0, sizeof(*codec));
+}
+
+/**
+ * @brief Encode one record
+ *
+ * @param codec  Prediction history, updated with this record
+ * @param record The record to encode
+ * @param[out] out Buffer for the encoded frame, must have space for
+ *                 BLACKBOX_ENCODED_MAX_BYTES
+ *
+ * @return The number of bytes written to out
+ */
+size_t blackboxEncode(BlackboxCodec_t *codec, const BlackboxRecord_t *record,
+                      uint8_t *out)
+{
+    int32_t fields[BLACKBOX_FIELD_COUNT];
+    int32_t prediction[BLACKBOX_FIELD_COUNT];
+    bool keyframe = !codec->haveHistory
+                    || codec->framesSinceKey >= BLACKBOX_KEYFRAME_INTERVAL;
+    size_t length = 0;
+
+    recordToFields(record, fields);
+
+    if (keyframe) {
+        out[length++] = BLACKBOX_FRAME_KEY;
+        length += writeVarint(fields[FIELD_SEQUENCE], &out[length]);
+        length += writeVarint(fields[FIELD_TIME], &out[length]);
+        for (int i = FIELD_FIRST_16; i < BLACKBOX_FIELD_COUNT; i++) {
+            length += writeVarint(zigzagEncode(fields[i]), &out[length]);
+        }
+    } else {
+        predict(codec, prediction);
+
+        out[length++] = BLACKBOX_FRAME_DELTA;
+        for (int i = 0; i < BLACKBOX_FIELD_COUNT; i++) {
+            int32_t residual = (uint32_t)fields[i] - (uint32_t)prediction[i];
+            length += writeVarint(zigzagEncode(residual), &out[length]);
+        }
+    }
+
+    updateHistory(codec, fields, keyframe);
+
+    return length;
+}
+
+/**
+ * @brief Decode one frame
+ *
+ * @param codec  Prediction history, must have been used to decode all frames
+ *               since the last keyframe
+ * @param in     Encoded data, starting at a frame type byte
+ * @param length Number of bytes available in in
+ * @param[out] record The decoded record
+ *
+ * @return Number of bytes consumed
+ * +     0  = The frame is truncated, more data is needed
+ * +     -1 = Not a valid frame at this position, or a delta frame with no
+ *            history. Skip a byte and retry to resynchronise
+ */
+int blackboxDecode(BlackboxCodec_t *codec, const uint8_t *in, size_t length,
+                   BlackboxRecord_t *record)
+{
+    int32_t fields[BLACKBOX_FIELD_COUNT];
+    int32_t prediction[BLACKBOX_FIELD_COUNT];
+    size_t pos = 1;
+    bool keyframe;
+
+    if (length == 0) {
+        return 0;
+    }
+
+    if (in[0] == BLACKBOX_FRAME_KEY) {
+        keyframe = true;
+    } else if (in[0] == BLACKBOX_FRAME_DELTA && codec->haveHistory) {
+        keyframe = false;
+        predict(codec, prediction);
+    } else {
+        return -1;
+    }
+
+    for (int i = 0; i < BLACKBOX_FIELD_COUNT; i++) {
+        uint32_t raw;
+        size_t used = readVarint(&in[pos], length - pos, &raw);
+
+        if (used == 0) {
+            // Truncated if we ran out of data, otherwise corrupt
+            return (length - pos < 5) ? 0 : -1;
+        }
+        pos += used;
+
+        if (keyframe) {
+            fields[i] = (i < FIELD_FIRST_16) ? (int32_t)raw : zigzagDecode(raw);
+        } else {
+            fields[i] = (uint32_t)prediction[i] + (uint32_t)zigzagDecode(raw);
+        }
+
+        // Keep 16 bit fields in range so the history matches the encoder
+        if (i >= FIELD_FIRST_16 && (fields[i] < -32768 || fields[i] > 65535)) {
+            return -1;
+        }
+    }
+
+    // Clear padding too, so decoded records can be compared with memcmp
+    memset(record, 0, sizeof(*record));
+    fieldsToRecord(fields, record);
+    // Re-read the fields from the record so they are truncated to the same
+    // width the encoder saw
+    recordToFields(record, fields);
+    updateHistory(codec, fields, keyframe);
+
+    return pos;
+}
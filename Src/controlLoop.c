@@ -7,9 +7,31 @@
 #include "ppm.h"
 #include "debug.h"
 #include "motors.h"
+#include "mixer.h"
+#include "rcInput.h"
 #include "rate_control.h"
 #include "controlLoop.h"
 #include "imu.h"
+#include "blackbox.h"
+#include "telemetry.h"
+#include "params.h"
+#include "trace.h"
+#include "loopTiming.h"
+#include "loopScheduler.h"
+#include "rateGroups.h"
+#include "topics.h"
+
+#if TELEMETRY_MOTOR_COUNT != MOTOR_COUNT
+#error "TELEMETRY_MOTOR_COUNT must match MOTOR_COUNT"
+#endif
+
+// Live state of the control loop, sent as telemetry (see telemetry.c). Only
+// changed by the control loop task
+static tPpmSignal ppmSignal = {{0}};
+static Rates_t actualRates = {0};
+static Rates_t desiredRates = {0};
+static uint32_t motorOutputs[MOTOR_COUNT];
+static TelemetryLoopStats_t loopStats;
 
 FC_Status controlLoopInit()
 {
@@ -23,77 +45,81 @@ FC_Status controlLoopInit()
         Error_Handler("Failed to start motor output");
     }
 
+    rateControlInit();
+
+    telemetrySetSource(TELEMETRY_MSG_RATES, 0, &actualRates,
+                       sizeof(actualRates));
+    telemetrySetSource(TELEMETRY_MSG_RATES, 1, &desiredRates,
+                       sizeof(desiredRates));
+    telemetrySetSource(TELEMETRY_MSG_RC_INPUT, 0, ppmSignal.signals,
+                       sizeof(ppmSignal.signals));
+    telemetrySetSource(TELEMETRY_MSG_MOTORS, 0, motorOutputs,
+                       sizeof(motorOutputs));
+    telemetrySetSource(TELEMETRY_MSG_LOOP_STATS, 0, &loopStats,
+                       sizeof(loopStats));
+
+    loopTimingInit(CONTROL_LOOP_PERIOD_US);
+    telemetrySetSource(TELEMETRY_MSG_LOOP_TIMING, 0, loopTimingStats(),
+                       sizeof(TelemetryLoopTiming_t));
+
     return FC_OK;
 }
 
-FC_Status processPpmSignal(tPpmSignal *ppmSignal, Rates_t *desiredRatesOut,
-                           uint32_t *rcThrottleOut, bool *armedOut)
+FAST_CODE void updateMotors(uint32_t rcThrottle, RotationAxisOutputs_t *outputs)
 {
-    uint32_t rcThrottle = ppmSignal->signals[THROTTLE_CHANNEL];
-    rcThrottle = limit(rcThrottle, MOTOR_LOW_VAL_US, MOTOR_HIGH_VAL_US);
-    (*rcThrottleOut) = rcThrottle;
-
-    // Check if we are still armed
-    // only disarm if throttle is low, so don't accidentally disarm in
-    // flight
-    if (ppmSignal->signals[ARMED_SWITCH_CHANNEL] >= SWITCH_HIGH_THRESHOLD) {
-        (*armedOut) = true;
-    } else if (ppmSignal->signals[ARMED_SWITCH_CHANNEL] <= SWITCH_LOW_THRESHOLD
-               && rcThrottle <= THROTTLE_LOW_THRESHOLD ) {
-        (*armedOut) = false;
-    }
-
-
-    /*DEBUG_PRINT("rin: %d, pin: %d, yin: %d\n", ppmSignal->signals[ROLL_CHANNEL],*/
-    /*ppmSignal->signals[PITCH_CHANNEL],ppmSignal->signals[YAW_CHANNEL]);*/
-    desiredRatesOut->roll = limit(map(ppmSignal->signals[ROLL_CHANNEL],
-                                  MIN_RC_VAL, MAX_RC_VAL,
-                                  ROTATION_AXIS_OUTPUT_MIN,
-                                  ROTATION_AXIS_OUTPUT_MAX),
-                              ROTATION_AXIS_OUTPUT_MIN,
-                              ROTATION_AXIS_OUTPUT_MAX);
-    desiredRatesOut->pitch= limit(map(ppmSignal->signals[PITCH_CHANNEL],
-                                  MIN_RC_VAL, MAX_RC_VAL,
-                                  ROTATION_AXIS_OUTPUT_MIN,
-                                  ROTATION_AXIS_OUTPUT_MAX),
-                              ROTATION_AXIS_OUTPUT_MIN,
-                              ROTATION_AXIS_OUTPUT_MAX);
-    desiredRatesOut->yaw= limit(map(ppmSignal->signals[YAW_CHANNEL],
-                                MIN_RC_VAL, MAX_RC_VAL,
-                                ROTATION_AXIS_OUTPUT_MIN,
-                                ROTATION_AXIS_OUTPUT_MAX),
-                            ROTATION_AXIS_OUTPUT_MIN,
-                            ROTATION_AXIS_OUTPUT_MAX);
-    /*DEBUG_PRINT("rd: %d, pd: %d, yd: %d\n", desiredRatesOut->roll,*/
-    /*desiredRatesOut->pitch, desiredRatesOut->yaw);*/
+    uint32_t compare[MOTOR_COUNT];
 
-    return FC_OK;
+    // Mix into a buffer first and commit all four motors in one go, so they
+    // change in the same pwm period
+    mixMotors(rcThrottle, outputs, compare);
+
+    motorsWriteAll(compare);
 }
 
-void updateMotors(uint32_t rcThrottle, RotationAxisOutputs_t *outputs)
+/**
+ * @brief Record this iteration in the blackbox
+ *
+ * Only copies values into the ring buffer, so this is cheap enough to call
+ * every iteration. If the ring is full the record is dropped
+ */
+static void logIteration(uint32_t startUs, uint32_t lastLoopTimeUs,
+                         uint32_t rcThrottle, Rates_t *actualRates,
+                         Rates_t *desiredRates)
 {
-    // Note that motor value limiting is done in the setMotor function
-    setMotor(MOTOR_FRONT_LEFT,
-             rcThrottle - outputs->roll
-             + outputs->pitch
-             - outputs->yaw);
-    setMotor(MOTOR_BACK_LEFT,
-             rcThrottle - outputs->roll
-             - outputs->pitch
-             + outputs->yaw);
-    setMotor(MOTOR_FRONT_RIGHT,
-             rcThrottle + outputs->roll
-             + outputs->pitch
-             + outputs->yaw);
-    setMotor(MOTOR_BACK_RIGHT,
-             rcThrottle + outputs->roll
-             - outputs->pitch
-             - outputs->yaw);
+    BlackboxRecord_t *record = blackboxClaim();
+
+    if (record == NULL) {
+        return;
+    }
+
+    record->timeUs = startUs;
+    record->loopTimeUs = lastLoopTimeUs;
+    record->throttle = rcThrottle;
+
+    record->gyro[RATE_AXIS_ROLL] = actualRates->roll;
+    record->gyro[RATE_AXIS_PITCH] = actualRates->pitch;
+    record->gyro[RATE_AXIS_YAW] = actualRates->yaw;
+
+    record->setpoint[RATE_AXIS_ROLL] = desiredRates->roll;
+    record->setpoint[RATE_AXIS_PITCH] = desiredRates->pitch;
+    record->setpoint[RATE_AXIS_YAW] = desiredRates->yaw;
+
+    for (int axis = RATE_AXIS_ROLL; axis <= RATE_AXIS_YAW; axis++) {
+        const ControlInfo_t *info = getRateControlInfo(axis);
+        record->pidP[axis] = info->pTerm;
+        record->pidI[axis] = info->iTerm;
+        record->pidD[axis] = info->dTerm;
+    }
+
+    for (int i = 0; i < MOTOR_COUNT; i++) {
+        record->motor[i] = motorOutputs[i];
+    }
+
+    blackboxCommit();
 }
 
 FC_Status checkControlLoopStatus(TickType_t lastPpmRxTime,
-                                 TickType_t lastGyroRxTime,
-                                 TickType_t lastLoopTime)
+                                 TickType_t lastGyroRxTime)
 {
     FC_Status systemStatus = FC_OK;
     TickType_t curTick = xTaskGetTickCount();
@@ -108,11 +134,6 @@ FC_Status checkControlLoopStatus(TickType_t lastPpmRxTime,
         DEBUG_PRINT("Gyro timeout cur %lu last %lu\n", curTick, lastGyroRxTime);
         systemStatus = FC_ERROR;
     }
-    if (curTick - lastLoopTime > CONTROL_LOOP_TIMEOUT_MS)
-    {
-        DEBUG_PRINT("CtrlLp timeout cur %lu last %lu\n", curTick, lastLoopTime);
-        systemStatus = FC_ERROR;
-    }
 
     if (systemStatus != FC_OK)
     {
@@ -130,26 +151,191 @@ FC_Status checkControlLoopStatus(TickType_t lastPpmRxTime,
     return systemStatus;
 }
 
-void vControlLoopTask(void *pvParameters)
+/**
+ * @brief Respond to the loop missing its deadlines, in steps
+ *
+ * A miss keeps a trace of what got in the way. A run of misses is reported
+ * to the ground station, and if the loop still can't keep up the motors are
+ * stopped and the system reset, as for a lost input
+ */
+static void handleLoopTiming(LoopTimingLevel level)
 {
-    tPpmSignal ppmSignal = {0};
+    static LoopTimingLevel lastLevel = LOOP_TIMING_OK;
 
-    bool armed = false;
-    bool newGyroReceived = false;
-    uint32_t rcThrottle = 1000;
+    switch (level)
+    {
+        case LOOP_TIMING_OK:
+            if (lastLevel >= LOOP_TIMING_WARN) {
+                DEBUG_PRINT("Loop timing recovered\n");
+                telemetrySetCritical(false);
+            }
+            break;
+
+        case LOOP_TIMING_MISSED:
+            traceTrigger();
+            break;
+
+        case LOOP_TIMING_WARN:
+            if (lastLevel != LOOP_TIMING_WARN) {
+                DEBUG_PRINT("Loop missed %u deadlines\n",
+                            loopTimingStats()->consecutiveMisses);
+                telemetrySetCritical(true);
+            }
+            break;
+
+        case LOOP_TIMING_FAIL:
+            motorsStop();
+            NVIC_SystemReset();
+            break;
+    }
+
+    lastLevel = level;
+}
 
-    Rates_t actualRates;
-    Rates_t desiredRates;
+/*
+ * The stages of the loop, run as rate groups (see rateGroups.c). Their state
+ * is only used by the control loop task
+ */
+static bool armed = false;
+static bool newGyroReceived = false;
+static uint32_t rcThrottle = 1000;
+static uint32_t loopStartUs;
+static uint32_t loopTimeUs = 0;
+static TickType_t lastPpmRxTime;
+static TickType_t lastGyroRxTime;
+static uint32_t gyroMissedIterations = 0;
+static TopicReader_t rcReader;
+static TopicReader_t gyroReader;
+
+/**
+ * @brief Take any new parameter values before they are used
+ */
+static void paramsStage(void)
+{
+    paramsApply();
+}
+
+static void rcStage(void)
+{
+    if (topicUpdate(&rcReader, &ppmSignal)) {
+        lastPpmRxTime = xTaskGetTickCount();
+
+        TRACE_BEGIN(TRACE_MARK_PPM);
+        if (processPpmSignal(&ppmSignal, &desiredRates,
+                             &rcThrottle, &armed) != FC_OK)
+        {
+            DEBUG_PRINT("Failed to process ppm signal\n");
+        }
+        TRACE_END(TRACE_MARK_PPM);
+    }
+
+    telemetrySetArmed(armed);
+    paramsSetArmed(armed);
+}
+
+FAST_CODE static void ratesStage(void)
+{
     RotationAxisOutputs_t *rotationOutputsPtr;
 
+    if (topicUpdate(&gyroReader, &actualRates)) {
+        lastGyroRxTime = xTaskGetTickCount();
+        newGyroReceived = true;
+        gyroMissedIterations = 0;
+    } else if (++gyroMissedIterations > IMU_DIVIDER) {
+        // The gyro is only read every IMU_DIVIDER iterations
+        DEBUG_PRINT("Failed to receive gyro data\n");
+    }
+
+    if (rcRatesActive(armed, rcThrottle)) {
+        if (newGyroReceived) {
+            /*DEBUG_PRINT("ra: %d, pa: %d, ya: %d\n", actualRates.roll,*/
+            /*actualRates.pitch, actualRates.yaw);*/
+
+            TRACE_BEGIN(TRACE_MARK_CONTROL_RATES);
+            rotationOutputsPtr = controlRates(&actualRates, &desiredRates);
+            TRACE_END(TRACE_MARK_CONTROL_RATES);
+            newGyroReceived = false;
+
+            /*DEBUG_PRINT("ro: %d, po: %d, yo: %d\n", rotationOutputsPtr->roll,*/
+            /*rotationOutputsPtr->pitch, rotationOutputsPtr->yaw);*/
+
+            TRACE_BEGIN(TRACE_MARK_MOTORS);
+            updateMotors(rcThrottle, rotationOutputsPtr);
+            TRACE_END(TRACE_MARK_MOTORS);
+
+            topicWrite(&rotationOutputsTopic, rotationOutputsPtr);
+        }
+    } else {
+        resetRateInfo(); // reset integral terms while on ground
+        motorsStop();
+    }
+}
+
+static void logStage(void)
+{
+    TRACE_BEGIN(TRACE_MARK_LOG);
+    logIteration(loopStartUs, loopTimeUs, rcThrottle, &actualRates,
+                 &desiredRates);
+    TRACE_END(TRACE_MARK_LOG);
+}
+
+/**
+ * @brief Refresh the live state sent as telemetry
+ */
+static void telemetryStage(void)
+{
+    motorsGetAll(motorOutputs);
+    loopStats.telemetryDropped = telemetryStats()->framesDropped;
+}
+
+static void statusStage(void)
+{
+    checkControlLoopStatus(lastPpmRxTime, lastGyroRxTime);
+}
+
+/*
+ * Run in this order each iteration they are due. The slower groups are at
+ * different phases, so they never land in the same iteration
+ */
+static const RateGroup_t controlLoopGroups[] = {
+    RATE_GROUP(paramsStage,    "params",    1,                        0,  10),
+    RATE_GROUP(rcStage,        "rc",        RC_DIVIDER,               0,  50),
+    RATE_GROUP(ratesStage,     "rates",     1,                        0, 100),
+    RATE_GROUP(logStage,       "log",       CONTROL_LOOP_LOG_DIVIDER, 0,  50),
+    RATE_GROUP(telemetryStage, "telemetry", TELEMETRY_DIVIDER,        0,  20),
+    RATE_GROUP(statusStage,    "status",    STATUS_DIVIDER,           1,  20),
+};
+
+#define CONTROL_LOOP_GROUP_COUNT \
+    (sizeof(controlLoopGroups) / sizeof(controlLoopGroups[0]))
+
+static RateGroupStats_t controlLoopGroupStats[CONTROL_LOOP_GROUP_COUNT];
+static RateGroupSet_t controlLoopRateGroups;
+
+void vControlLoopTask(void *pvParameters)
+{
     DEBUG_PRINT("Control loop start\n");
     controlLoopInit();
 
+    topicSubscribe(&rcReader, &rcInputTopic);
+    topicSubscribe(&gyroReader, &gyroRatesTopic);
+    if (topicAdvertise(&rotationOutputsTopic) != FC_OK) {
+        Error_Handler("Failed to advertise rotation outputs");
+    }
+
+    if (rateGroupsInit(&controlLoopRateGroups, controlLoopGroups,
+                       controlLoopGroupStats, CONTROL_LOOP_GROUP_COUNT,
+                       CONTROL_LOOP_BUDGET_US, loopSchedulerNowUs) != FC_OK)
+    {
+        Error_Handler("Control loop groups over budget");
+    }
+
     DEBUG_PRINT("Waiting for low throttle\n");
     // Wait for throttle to be low before continuing startup
     // This is for safety
     while (1) {
-        if (xQueueReceive(ppmSignalQueue, &ppmSignal, 100) == pdTRUE) {
+        if (topicWait(&rcReader, 100) == FC_OK
+            && topicUpdate(&rcReader, &ppmSignal)) {
             rcThrottle = ppmSignal.signals[THROTTLE_CHANNEL];
             if (rcThrottle <= THROTTLE_LOW_THRESHOLD) {
                 DEBUG_PRINT("Starting, thr %d\n", ppmSignal.signals[THROTTLE_CHANNEL]);
@@ -162,54 +348,39 @@ void vControlLoopTask(void *pvParameters)
 
     DEBUG_PRINT("Starting control loop\n");
 
-    TickType_t lastPpmRxTime  = xTaskGetTickCount();
-    TickType_t lastLoopTime   = xTaskGetTickCount();
-    TickType_t lastGyroRxTime = xTaskGetTickCount();
-    // This is seperate from lastLoopTime because vTaskDelayUntil sets this
-    // to the last wake time + increment, even if there is some unforseen delay
-    // that causes the task to miss its deadline
-    TickType_t lastWakeTime   = xTaskGetTickCount();
+    lastPpmRxTime  = xTaskGetTickCount();
+    lastGyroRxTime = xTaskGetTickCount();
+
+    // Released by the loop timer from here on, see loopScheduler.c
+    if (loopSchedulerAddTask(xTaskGetCurrentTaskHandle(), 1) != FC_OK) {
+        Error_Handler("Failed to schedule control loop");
+    }
 
     for ( ;; )
     {
-        if (xQueueReceive(ppmSignalQueue, &ppmSignal, 0) == pdTRUE) {
-            lastPpmRxTime = xTaskGetTickCount();
+        loopStartUs = loopSchedulerNowUs();
+        TRACE_BEGIN(TRACE_MARK_CONTROL_LOOP);
 
-            if (processPpmSignal(&ppmSignal, &desiredRates,
-                                 &rcThrottle, &armed) != FC_OK)
-            {
-                DEBUG_PRINT("Failed to process ppm signal\n");
-            }
-        }
+        const RateGroup_t *overrun = rateGroupsRun(&controlLoopRateGroups);
 
-        if (xQueueReceive(ratesQueue, &actualRates, 0) == pdTRUE) {
-            lastGyroRxTime = xTaskGetTickCount();
-            newGyroReceived = true;
-        } else {
-            DEBUG_PRINT("Failed to receive gyro data\n");
+        if (overrun != NULL) {
+            // Keep a trace of what took the time, as for a deadline miss
+            traceTrigger();
+            DEBUG_PRINT("%s over budget\n", overrun->name);
         }
 
-        if (armed && rcThrottle >= THROTTLE_LOW_THRESHOLD) {
-            if (newGyroReceived) {
-                /*DEBUG_PRINT("ra: %d, pa: %d, ya: %d\n", actualRates.roll,*/
-                /*actualRates.pitch, actualRates.yaw);*/
-
-                rotationOutputsPtr = controlRates(&actualRates, &desiredRates);
-                newGyroReceived = false;
-
-                /*DEBUG_PRINT("ro: %d, po: %d, yo: %d\n", rotationOutputsPtr->roll,*/
-                /*rotationOutputsPtr->pitch, rotationOutputsPtr->yaw);*/
+        loopTimeUs = loopSchedulerNowUs() - loopStartUs;
 
-                updateMotors(rcThrottle, rotationOutputsPtr);
-            }
-        } else {
-            resetRateInfo(); // reset integral terms while on ground
-            motorsStop();
+        loopStats.timeUs = loopStartUs;
+        loopStats.loopTimeUs = loopTimeUs;
+        if (loopTimeUs > loopStats.maxLoopTimeUs) {
+            loopStats.maxLoopTimeUs = loopTimeUs;
         }
+        loopStats.iterations++;
 
-        checkControlLoopStatus(lastPpmRxTime, lastGyroRxTime, lastLoopTime);
-        lastLoopTime = xTaskGetTickCount();
+        TRACE_END(TRACE_MARK_CONTROL_LOOP);
+        handleLoopTiming(loopTimingUpdate(loopStartUs, loopStartUs + loopTimeUs));
 
-        vTaskDelayUntil(&lastWakeTime, CONTROL_LOOP_PERIOD_TICKS);
+        loopSchedulerWait();
     }
 }
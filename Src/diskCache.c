@@ -0,0 +1,298 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "fc.h"
+#include "diskio.h"
+#include "diskCache.h"
+
+/**
+ * @file Src/diskCache.c
+ *
+ * @brief Write-back sector cache between FatFs and the sd card driver
+ *
+ * FatFs reads and writes FAT and directory sectors one at a time, often the
+ * same few sectors over and over. Single sector reads and writes go through a
+ * small set-associative cache (least recently used replacement, clean lines
+ * replaced before dirty ones). Dirty sectors are only written back when they
+ * have to be evicted or on CTRL_SYNC, and then all of them are written in
+ * sector order, with neighbouring sectors merged into one multi block write.
+ *
+ * Multi sector transfers are file data, which is rarely read back, so they go
+ * straight to the card. Any cached copies of those sectors are kept up to
+ * date.
+ *
+ * The card is only reached through SD_Read_Sectors, SD_Write_Sectors and
+ * SD_Write_Sectors_Gather, so this file doesn't depend on the hardware.
+ */
+
+#define DISK_CACHE_SET_MASK (DISK_CACHE_SETS - 1)
+
+#if (DISK_CACHE_SETS & DISK_CACHE_SET_MASK) != 0
+#error "DISK_CACHE_SETS must be a power of 2"
+#endif
+
+typedef struct DiskCacheLine_t {
+    DWORD    sector;
+    uint32_t lastUse;
+    bool     valid;
+    bool     dirty;
+    BYTE     data[DISK_CACHE_SECTOR_SIZE];
+} DiskCacheLine_t;
+
+static DiskCacheLine_t lines[DISK_CACHE_SETS][DISK_CACHE_WAYS];
+static DiskCacheStats_t stats;
+static uint32_t useCounter = 0;
+
+void diskCacheInit(void)
+{
+    memset(lines, 0, sizeof(lines));
+    useCounter = 0;
+    diskCacheResetStats();
+}
+
+static DiskCacheLine_t *findLine(DWORD sector)
+{
+    DiskCacheLine_t *set = lines[sector & DISK_CACHE_SET_MASK];
+
+    for (int way = 0; way < DISK_CACHE_WAYS; way++) {
+        if (set[way].valid && set[way].sector == sector) {
+            return &set[way];
+        }
+    }
+
+    return NULL;
+}
+
+static void touch(DiskCacheLine_t *line)
+{
+    line->lastUse = ++useCounter;
+}
+
+/**
+ * @brief Write back every dirty line, merging consecutive sectors
+ */
+static DRESULT flushDirty(void)
+{
+    DiskCacheLine_t *dirty[DISK_CACHE_LINES];
+    const BYTE *buffers[DISK_CACHE_LINES];
+    int count = 0;
+
+    // Insertion sort the dirty lines by sector
+    for (int set = 0; set < DISK_CACHE_SETS; set++) {
+        for (int way = 0; way < DISK_CACHE_WAYS; way++) {
+            DiskCacheLine_t *line = &lines[set][way];
+            int i;
+
+            if (!line->valid || !line->dirty) {
+                continue;
+            }
+
+            for (i = count; i > 0 && dirty[i - 1]->sector > line->sector; i--) {
+                dirty[i] = dirty[i - 1];
+            }
+            dirty[i] = line;
+            count++;
+        }
+    }
+
+    for (int start = 0; start < count; ) {
+        int run = 1;
+
+        buffers[0] = dirty[start]->data;
+        while (start + run < count
+               && dirty[start + run]->sector == dirty[start]->sector + run)
+        {
+            buffers[run] = dirty[start + run]->data;
+            run++;
+        }
+
+        if (SD_Write_Sectors_Gather(buffers, dirty[start]->sector, run)
+            != RES_OK)
+        {
+            return RES_ERROR;
+        }
+
+        for (int i = start; i < start + run; i++) {
+            dirty[i]->dirty = false;
+        }
+
+        stats.flushCommands++;
+        stats.flushedSectors += run;
+        start += run;
+    }
+
+    return RES_OK;
+}
+
+/**
+ * @brief Find a line to hold sector, writing back dirty data if needed
+ *
+ * @return The line, which is marked invalid, or NULL on a write error
+ */
+static DiskCacheLine_t *allocateLine(DWORD sector)
+{
+    DiskCacheLine_t *set = lines[sector & DISK_CACHE_SET_MASK];
+    DiskCacheLine_t *victim = NULL;
+
+    for (int way = 0; way < DISK_CACHE_WAYS; way++) {
+        DiskCacheLine_t *line = &set[way];
+
+        if (!line->valid) {
+            return line;
+        }
+
+        // Prefer clean lines, then the least recently used
+        if (victim == NULL
+            || (victim->dirty && !line->dirty)
+            || (victim->dirty == line->dirty && line->lastUse < victim->lastUse))
+        {
+            victim = line;
+        }
+    }
+
+    stats.evictions++;
+
+    // Write back everything rather than just the victim, so neighbouring
+    // dirty sectors go out together
+    if (victim->dirty && flushDirty() != RES_OK) {
+        return NULL;
+    }
+
+    victim->valid = false;
+
+    return victim;
+}
+
+/**
+ * @brief Read sectors, from the cache where possible
+ */
+DRESULT diskCacheRead(BYTE *buff, DWORD sector, UINT count)
+{
+    DiskCacheLine_t *line;
+
+    if (count != 1) {
+        stats.bypassReads++;
+
+        if (SD_Read_Sectors(buff, sector, count) != RES_OK) {
+            return RES_ERROR;
+        }
+
+        // The cache may hold newer data than the card
+        for (UINT i = 0; i < count; i++) {
+            line = findLine(sector + i);
+            if (line != NULL && line->dirty) {
+                memcpy(&buff[i * DISK_CACHE_SECTOR_SIZE], line->data,
+                       DISK_CACHE_SECTOR_SIZE);
+            }
+        }
+
+        return RES_OK;
+    }
+
+    line = findLine(sector);
+    if (line != NULL) {
+        stats.readHits++;
+    } else {
+        stats.readMisses++;
+
+        line = allocateLine(sector);
+        if (line == NULL || SD_Read_Sectors(line->data, sector, 1) != RES_OK) {
+            return RES_ERROR;
+        }
+        line->sector = sector;
+        line->dirty = false;
+        line->valid = true;
+    }
+
+    touch(line);
+    memcpy(buff, line->data, DISK_CACHE_SECTOR_SIZE);
+
+    return RES_OK;
+}
+
+/**
+ * @brief Write sectors. Single sectors are held in the cache until they are
+ * evicted or diskCacheSync is called
+ */
+DRESULT diskCacheWrite(const BYTE *buff, DWORD sector, UINT count)
+{
+    DiskCacheLine_t *line;
+
+    if (count != 1) {
+        stats.bypassWrites++;
+
+        if (SD_Write_Sectors(buff, sector, count) != RES_OK) {
+            return RES_ERROR;
+        }
+
+        for (UINT i = 0; i < count; i++) {
+            line = findLine(sector + i);
+            if (line != NULL) {
+                memcpy(line->data, &buff[i * DISK_CACHE_SECTOR_SIZE],
+                       DISK_CACHE_SECTOR_SIZE);
+                line->dirty = false;
+            }
+        }
+
+        return RES_OK;
+    }
+
+    line = findLine(sector);
+    if (line != NULL) {
+        stats.writeHits++;
+    } else {
+        stats.writeMisses++;
+
+        line = allocateLine(sector);
+        if (line == NULL) {
+            return RES_ERROR;
+        }
+        line->sector = sector;
+        line->valid = true;
+    }
+
+    touch(line);
+    memcpy(line->data, buff, DISK_CACHE_SECTOR_SIZE);
+    line->dirty = true;
+
+    return RES_OK;
+}
+
+/**
+ * @brief Write back all dirty sectors
+ */
+DRESULT diskCacheSync(void)
+{
+    return flushDirty();
+}
+
+/**
+ * @brief Drop cached copies of a range of sectors, including unwritten data,
+ * for example when the range is erased
+ *
+ * @param start First sector
+ * @param end   Last sector (inclusive)
+ */
+void diskCacheInvalidate(DWORD start, DWORD end)
+{
+    for (int set = 0; set < DISK_CACHE_SETS; set++) {
+        for (int way = 0; way < DISK_CACHE_WAYS; way++) {
+            DiskCacheLine_t *line = &lines[set][way];
+
+            if (line->valid && line->sector >= start && line->sector <= end) {
+                line->valid = false;
+                line->dirty = false;
+            }
+        }
+    }
+}
+
+const DiskCacheStats_t *diskCacheStats(void)
+{
+    return &stats;
+}
+
+void diskCacheResetStats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
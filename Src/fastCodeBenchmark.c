@@ -0,0 +1,216 @@
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "fc.h"
+#include "fastCodeBenchmark.h"
+#include "rate_control.h"
+
+/**
+ * @file Src/fastCodeBenchmark.c
+ *
+ * @brief Measure the cycles the control code takes from flash and from RAM
+ *
+ * The same workload, a three axis PID and quad X mix modelled on pid.c and
+ * updateMotors, is built twice: once in flash and once as FAST_CODE. Each
+ * is timed with the DWT cycle counter, with interrupts off:
+ * +     Flash, with the ART instruction cache warm from the previous run
+ * +     Flash, with the cache reset first, as when the loop wakes after
+ *       other tasks have run
+ * +     RAM
+ * +     controlRates itself, wherever this build put it
+ *
+ * Along with the RAM the FAST_CODE functions take, this shows whether
+ * running them from RAM is worth it. This is a bring-up tool, call it from
+ * main before the scheduler starts. Build with FAST_CODE=0 to compare the
+ * whole firmware, e.g. the LOOP_TIMING execution time.
+ */
+
+#define FAST_BENCH_RUNS       100
+// Iterations of the workload per run, so each run is long enough to see
+// but short enough for the instruction cache to matter
+#define FAST_BENCH_ITERATIONS 16
+#define FAST_BENCH_AXES       3
+#define FAST_BENCH_MOTORS     4
+
+#define FAST_BENCH_OUTPUT_MAX 500
+#define FAST_BENCH_MOTOR_MIN  1000
+#define FAST_BENCH_MOTOR_MAX  2000
+
+typedef struct FastBenchAxis_t {
+    int integratedError;
+    int lastError;
+    int saturated;
+} FastBenchAxis_t;
+
+typedef struct FastBenchResult_t {
+    uint32_t bestCycles;
+    uint32_t worstCycles;
+    uint32_t totalCycles;
+} FastBenchResult_t;
+
+// Linker script symbols, the FAST_CODE functions copied to RAM
+extern uint8_t _sfast_code;
+extern uint8_t _efast_code;
+
+static FastBenchAxis_t benchAxes[FAST_BENCH_AXES];
+static volatile uint32_t benchMotors[FAST_BENCH_MOTORS];
+
+static inline int benchClamp(int val, int min, int max)
+{
+    return (val < min) ? min : ((val > max) ? max : val);
+}
+
+/**
+ * @brief The workload, inlined into each copy so they don't share any code
+ */
+static inline __attribute__((always_inline)) uint32_t benchWorkload(uint32_t seed)
+{
+    uint32_t checksum = 0;
+
+    for (int i = 0; i < FAST_BENCH_ITERATIONS; i++) {
+        int outputs[FAST_BENCH_AXES];
+
+        for (int axis = 0; axis < FAST_BENCH_AXES; axis++) {
+            FastBenchAxis_t *state = &benchAxes[axis];
+            int error = (int)((seed + i * 37 + axis * 101) & 0x3FF) - 512;
+
+            if (!((state->saturated > 0 && error > 0)
+                  || (state->saturated < 0 && error < 0))) {
+                state->integratedError += error;
+            }
+
+            int output = 3 * error + state->integratedError / 16
+                         + 2 * (error - state->lastError);
+            state->lastError = error;
+
+            if (output > FAST_BENCH_OUTPUT_MAX) {
+                state->saturated = 1;
+            } else if (output < -FAST_BENCH_OUTPUT_MAX) {
+                state->saturated = -1;
+            } else {
+                state->saturated = 0;
+            }
+            outputs[axis] = benchClamp(output, -FAST_BENCH_OUTPUT_MAX,
+                                       FAST_BENCH_OUTPUT_MAX);
+        }
+
+        int throttle = 1200 + (int)((seed + i) & 0xFF);
+
+        benchMotors[0] = benchClamp(throttle - outputs[0] + outputs[1] - outputs[2],
+                                    FAST_BENCH_MOTOR_MIN, FAST_BENCH_MOTOR_MAX);
+        benchMotors[1] = benchClamp(throttle - outputs[0] - outputs[1] + outputs[2],
+                                    FAST_BENCH_MOTOR_MIN, FAST_BENCH_MOTOR_MAX);
+        benchMotors[2] = benchClamp(throttle + outputs[0] + outputs[1] + outputs[2],
+                                    FAST_BENCH_MOTOR_MIN, FAST_BENCH_MOTOR_MAX);
+        benchMotors[3] = benchClamp(throttle + outputs[0] - outputs[1] - outputs[2],
+                                    FAST_BENCH_MOTOR_MIN, FAST_BENCH_MOTOR_MAX);
+
+        checksum += benchMotors[0] + benchMotors[1] + benchMotors[2]
+                    + benchMotors[3];
+    }
+
+    return checksum;
+}
+
+static __attribute__((noinline)) uint32_t benchFlash(uint32_t seed)
+{
+    return benchWorkload(seed);
+}
+
+static FAST_CODE __attribute__((noinline)) uint32_t benchRam(uint32_t seed)
+{
+    return benchWorkload(seed);
+}
+
+static __attribute__((noinline)) uint32_t benchControlRates(uint32_t seed)
+{
+    Rates_t actual = {.roll = 0, .pitch = 0, .yaw = 0};
+    Rates_t desired = {
+        .roll = (int)(seed & 0x3FF) - 512,
+        .pitch = (int)((seed * 3) & 0x3FF) - 512,
+        .yaw = (int)((seed * 7) & 0x3FF) - 512,
+    };
+
+    return controlRates(&actual, &desired)->roll;
+}
+
+/**
+ * @brief Time FAST_BENCH_RUNS runs of a function
+ *
+ * @param function
+ * @param coldCache Reset the flash instruction cache before each run
+ */
+static FastBenchResult_t measure(uint32_t (*function)(uint32_t), bool coldCache)
+{
+    FastBenchResult_t result = {
+        .bestCycles = UINT32_MAX,
+        .worstCycles = 0,
+        .totalCycles = 0,
+    };
+
+    for (uint32_t run = 0; run < FAST_BENCH_RUNS; run++) {
+        __disable_irq();
+
+        if (coldCache) {
+            __HAL_FLASH_INSTRUCTION_CACHE_DISABLE();
+            __HAL_FLASH_INSTRUCTION_CACHE_RESET();
+            __HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+        }
+
+        uint32_t start = DWT->CYCCNT;
+        function(run);
+        uint32_t cycles = DWT->CYCCNT - start;
+
+        __enable_irq();
+
+        if (cycles < result.bestCycles) {
+            result.bestCycles = cycles;
+        }
+        if (cycles > result.worstCycles) {
+            result.worstCycles = cycles;
+        }
+        result.totalCycles += cycles;
+    }
+
+    return result;
+}
+
+static void printResult(const char *name, FastBenchResult_t result)
+{
+    printf("  %-24s %6lu %6lu %6lu\n", name, result.bestCycles,
+           result.totalCycles / FAST_BENCH_RUNS, result.worstCycles);
+}
+
+static bool inRam(void *function)
+{
+    return (uint8_t *)function >= &_sfast_code
+           && (uint8_t *)function < &_efast_code;
+}
+
+/**
+ * @brief Print the cycles taken by the workload from flash and RAM
+ */
+void fastCodeBenchmark(void)
+{
+    // The cycle counter is part of the debug unit, which has to be enabled
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    printf("Fast code: %lu bytes in RAM\n",
+           (uint32_t)(&_efast_code - &_sfast_code));
+    if (!inRam(benchRam)) {
+        printf("  Built with FAST_CODE=0, both copies are in flash\n");
+    }
+
+    printf("  %-24s %6s %6s %6s\n", "cycles", "best", "mean", "worst");
+    printResult("flash", measure(benchFlash, false));
+    printResult("flash, cache reset", measure(benchFlash, true));
+    printResult("RAM", measure(benchRam, false));
+    printResult(inRam(controlRates) ? "controlRates (RAM)"
+                                    : "controlRates (flash)",
+                measure(benchControlRates, true));
+
+    // Don't leave the benchmark's errors in the integrators
+    resetRateInfo();
+}
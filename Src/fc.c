@@ -2,6 +2,7 @@
 #ifndef __UNIT_TEST
 #include "pins.h"
 #include "debug.h"
+#include "freertos.h"
 #include "task.h"
 #endif
 
@@ -43,8 +44,8 @@ void Error_Handler(char *msg)
 
 void assertFailed(char *file, int line)
 {
-    char buf[PRINT_QUEUE_STRING_SIZE];
-    snprintf(buf, PRINT_QUEUE_STRING_SIZE, "ASSERT:%s:%d", file, line);
+    char buf[DEBUG_LINE_MAX_LENGTH];
+    snprintf(buf, sizeof(buf), "ASSERT:%s:%d", file, line);
     Error_Handler(buf);
 }
 
@@ -1,6 +1,7 @@
 #include "fc.h"
 #include "debug.h"
 #include "i2c.h"
+#include "kernelObjects.h"
 
 /*
  * I2C Defines
@@ -55,20 +56,9 @@ void setup_I2C() {
         Error_Handler("I2C init fail");
     }
 
-    // Create I2C bus mutex
-    I2CMutex = xSemaphoreCreateMutex();
-
-    if( I2CMutex == NULL )
-    {
-        Error_Handler("Failed to create I2C mutex");
-    }
-
-    I2C_DMA_CompleteSem = xSemaphoreCreateBinary();
-
-    if (I2C_DMA_CompleteSem == NULL)
-    {
-        Error_Handler("Failed to init I2C DMA Sem\n");
-    }
+    // Bus mutex, and the semaphore the DMA complete callbacks give
+    I2CMutex = kernelQueueCreate(KERNEL_QUEUE_I2C_MUTEX);
+    I2C_DMA_CompleteSem = kernelQueueCreate(KERNEL_QUEUE_I2C_DMA);
 
     I2C_ClearBusyFlagErratum(1000);
 }
@@ -12,6 +12,11 @@
 
 #include "debug.h"
 #include "i2c.h"
+#include "calculateAttitude.h"
+#include "telemetry.h"
+#include "topics.h"
+#include "loopScheduler.h"
+#include "rateGroups.h"
 
 #endif
 
@@ -49,10 +54,6 @@
 
 #ifndef __UNIT_TEST
 
-#define RATES_QUEUE_LENGTH 1 // only care about most recent element, so keep it short
-
-QueueHandle_t ratesQueue;
-
 FC_Status AccelGyro_RegRead(uint8_t regAddress, uint8_t *val, int size)
 {
     HAL_StatusTypeDef rc;
@@ -179,15 +180,6 @@ FC_Status IMU_Init(void)
         return FC_ERROR;
     }
 
-#ifndef __UNIT_TEST
-    ratesQueue = xQueueCreate(RATES_QUEUE_LENGTH, sizeof(Rates_t));
-
-    if (ratesQueue == NULL)
-    {
-        DEBUG_PRINT("Failed to create rates queue\n");
-    }
-#endif
-
     return FC_OK;
 }
 
@@ -260,6 +252,52 @@ FC_Status getRates(Rates_t *rates)
 
 
 #ifndef __UNIT_TEST
+
+// The attitude is only needed for telemetry, so the accelerometer is read
+// every this many iterations to keep the i2c bus free for the gyro
+#define IMU_ATTITUDE_DIVIDER 10
+
+// The most one iteration may take, half the IMU period
+#define IMU_BUDGET_US        (IMU_DIVIDER * CONTROL_LOOP_PERIOD_US / 2)
+
+// Sent as telemetry, only changed by the IMU task
+static Attitude_t attitude;
+
+static void gyroStage(void)
+{
+    // Read straight into the topic, the claimed buffer isn't seen by readers
+    // unless it is published
+    Rates_t *rates = topicClaim(&gyroRatesTopic);
+
+    if (getRates(rates) == FC_OK) {
+        topicPublish(&gyroRatesTopic);
+    }
+    else {
+        DEBUG_PRINT("Error getting rates\n");
+    }
+}
+
+static void attitudeStage(void)
+{
+    Accel_t accel;
+
+    if (getAccel(&accel) == FC_OK) {
+        calculateAttitude(&accel, &attitude);
+    }
+}
+
+// Each iteration reads the gyro first, so the control loop gets it as soon
+// as possible. Budgets are for the i2c transfers at 400 kHz
+static const RateGroup_t imuGroups[] = {
+    RATE_GROUP(gyroStage,     "gyro",     1,                    0, 400),
+    RATE_GROUP(attitudeStage, "attitude", IMU_ATTITUDE_DIVIDER, 1, 600),
+};
+
+#define IMU_GROUP_COUNT (sizeof(imuGroups) / sizeof(imuGroups[0]))
+
+static RateGroupStats_t imuGroupStats[IMU_GROUP_COUNT];
+static RateGroupSet_t imuRateGroups;
+
 void vIMUTask(void *pvParameters)
 {
     DEBUG_PRINT("Starting IMU Task\n");
@@ -270,20 +308,34 @@ void vIMUTask(void *pvParameters)
     }
     DEBUG_PRINT("Initialized IMU\n");
 
-    Rates_t rates = {0};
-    TickType_t lastWakeTime = xTaskGetTickCount();
+    telemetrySetSource(TELEMETRY_MSG_ATTITUDE, 0, &attitude, sizeof(attitude));
+
+    if (topicAdvertise(&gyroRatesTopic) != FC_OK) {
+        Error_Handler("Failed to advertise gyro rates");
+    }
+
+    if (rateGroupsInit(&imuRateGroups, imuGroups, imuGroupStats,
+                       IMU_GROUP_COUNT, IMU_BUDGET_US,
+                       loopSchedulerNowUs) != FC_OK)
+    {
+        Error_Handler("IMU groups over budget");
+    }
+
+    // Read the gyro every IMU_DIVIDER control loop releases
+    if (loopSchedulerAddTask(xTaskGetCurrentTaskHandle(), IMU_DIVIDER) != FC_OK) {
+        Error_Handler("Failed to schedule IMU");
+    }
     for ( ;; )
     {
-        if (getRates(&rates) == FC_OK) {
-            xQueueOverwrite(ratesQueue, (void *)&rates);
-        }
-        else {
-            DEBUG_PRINT("Error getting rates\n");
+        const RateGroup_t *overrun = rateGroupsRun(&imuRateGroups);
+
+        if (overrun != NULL) {
+            DEBUG_PRINT("%s over budget\n", overrun->name);
         }
 
-        // This should run at the same rate as the control loop
-        // as there is no point running the control loop without new data
-        vTaskDelayUntil(&lastWakeTime, CONTROL_LOOP_PERIOD_TICKS);
+        // Released by the same timer as the control loop, as there is no
+        // point running the control loop without new data
+        loopSchedulerWait();
     }
 }
 #endif
@@ -3,7 +3,11 @@
 #include "sched.h"
 #include "cmsis_os.h"
 #include "i2c.h"
+#include "sd.h"
 #include "ppm.h"
+#include "uartTx.h"
+#include "trace.h"
+#include "loopScheduler.h"
 
 /* Private functions ---------------------------------------------------------*/
 
@@ -84,9 +88,11 @@ void UsageFault_Handler(void)
   * @retval None
   * @Note   This function is redefined in "main.h" and related to I2C data transmission     
   */
-void I2Cx_EV_IRQHandler(void)
+FAST_CODE void I2Cx_EV_IRQHandler(void)
 {
+  TRACE_ISR_ENTER();
   HAL_I2C_EV_IRQHandler(& I2cHandle);
+  TRACE_ISR_EXIT();
 }
 
 /**
@@ -97,7 +103,9 @@ void I2Cx_EV_IRQHandler(void)
   */
 void I2Cx_ER_IRQHandler(void)
 {
+  TRACE_ISR_ENTER();
   HAL_I2C_ER_IRQHandler(& I2cHandle);
+  TRACE_ISR_EXIT();
 }
 
 /**
@@ -107,9 +115,11 @@ void I2Cx_ER_IRQHandler(void)
   * @Note   This function is redefined in "main.h" and related to DMA stream 
   *         used for I2C data transmission     
   */
-void I2Cx_DMA_RX_IRQHandler(void)
+FAST_CODE void I2Cx_DMA_RX_IRQHandler(void)
 {
+  TRACE_ISR_ENTER();
   HAL_DMA_IRQHandler(I2cHandle.hdmarx);
+  TRACE_ISR_EXIT();
 }
 
 /**
@@ -119,10 +129,64 @@ void I2Cx_DMA_RX_IRQHandler(void)
   * @Note   This function is redefined in "main.h" and related to DMA stream 
   *         used for I2C data reception    
   */
-void I2Cx_DMA_TX_IRQHandler(void)
+FAST_CODE void I2Cx_DMA_TX_IRQHandler(void)
 {
+  TRACE_ISR_ENTER();
   HAL_DMA_IRQHandler(I2cHandle.hdmatx);
+  TRACE_ISR_EXIT();
 }
+
+/**
+  * @brief  This function handles DMA interrupt request for sd card spi
+  *         reception
+  * @param  None
+  * @retval None
+  */
+FAST_CODE void SPIx_DMA_RX_IRQHandler(void)
+{
+  TRACE_ISR_ENTER();
+  HAL_DMA_IRQHandler(SpiHandle.hdmarx);
+  TRACE_ISR_EXIT();
+}
+
+/**
+  * @brief  This function handles DMA interrupt request for sd card spi
+  *         transmission
+  * @param  None
+  * @retval None
+  */
+FAST_CODE void SPIx_DMA_TX_IRQHandler(void)
+{
+  TRACE_ISR_ENTER();
+  HAL_DMA_IRQHandler(SpiHandle.hdmatx);
+  TRACE_ISR_EXIT();
+}
+/**
+  * @brief  This function handles DMA interrupt request for debug uart
+  *         transmission
+  * @param  None
+  * @retval None
+  */
+FAST_CODE void UARTx_DMA_TX_IRQHandler(void)
+{
+  TRACE_ISR_ENTER();
+  HAL_DMA_IRQHandler(UartHandle.hdmatx);
+  TRACE_ISR_EXIT();
+}
+
+/**
+  * @brief  This function handles the debug uart interrupt, raised once the
+  *         last byte of a DMA transfer has been sent
+  * @param  None
+  * @retval None
+  */
+void UARTx_IRQHandler(void)
+{
+  TRACE_ISR_ENTER();
+  HAL_UART_IRQHandler(&UartHandle);
+  TRACE_ISR_EXIT();
+}
+
 /**
   * @brief  This function handles SysTick Handler.
   * @param  None
@@ -130,14 +194,27 @@ void I2Cx_DMA_TX_IRQHandler(void)
   */
 void SysTick_Handler(void)
 {
+  // Not traced, at 1kHz it would fill the trace ring
   HAL_IncTick();
   osSystickHandler();
 }
 
+/**
+* @brief This function handles TIM6 global interrupt, the loop scheduler's
+*        timer
+*/
+FAST_CODE void TIM6_DAC_IRQHandler(void)
+{
+    // Not traced, at loop rates it would fill the trace ring
+    loopSchedulerIrqHandler();
+}
+
 /**
 * @brief This function handles TIM5 global interrupt.
 */
-void TIM5_IRQHandler(void)
+FAST_CODE void TIM5_IRQHandler(void)
 {
+    TRACE_ISR_ENTER();
     HAL_TIM_IRQHandler(&htim5);
+    TRACE_ISR_EXIT();
 }
@@ -0,0 +1,222 @@
+#include <stdio.h>
+
+#include "fc.h"
+#include "kernelObjects.h"
+
+#include "freertos.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+
+#include "main.h"
+#include "debug.h"
+#include "imu.h"
+#include "ppm.h"
+#include "controlLoop.h"
+#include "blackbox.h"
+#include "telemetry.h"
+#include "params.h"
+#include "taskStats.h"
+#include "rate_control.h"
+#include "trace.h"
+
+/**
+ * @file Src/kernelObjects.c
+ *
+ * @brief The memory for every task, queue, semaphore and mutex
+ *
+ * All kernel objects are allocated statically (configSUPPORT_STATIC_ALLOCATION,
+ * there is no kernel heap), from the tables below. Their size is fixed at
+ * link time and shows in the map file (make ram-report), and creating them
+ * can't fail at run time.
+ */
+
+#if configSUPPORT_DYNAMIC_ALLOCATION != 0
+#error "Kernel objects must be allocated from the tables in kernelObjects.c"
+#endif
+
+/*
+ * Tasks, created in this order by kernelTasksCreate. Stack depths are in
+ * words
+ */
+
+#define KERNEL_TASK(function, name, stack, priority) \
+    {function, name, stack, sizeof(stack) / sizeof((stack)[0]), priority}
+
+typedef struct KernelTaskInfo_t {
+    TaskFunction_t  function;
+    const char     *name;
+    StackType_t    *stack;
+    uint32_t        stackDepth;
+    UBaseType_t     priority;
+} KernelTaskInfo_t;
+
+static StackType_t blinkStack[50];
+static StackType_t debugStack[300];
+static StackType_t imuStack[300];
+static StackType_t controlLoopStack[400];
+static StackType_t blackboxStack[300];
+static StackType_t telemetryStack[150];
+static StackType_t paramStack[200];
+static StackType_t taskStatsStack[150];
+
+static const KernelTaskInfo_t tasks[] = {
+    KERNEL_TASK(vBlinkTask,       "blinkTask",       blinkStack,       2),
+    KERNEL_TASK(vDebugTask,       "debugTask",       debugStack,       1),
+    KERNEL_TASK(vIMUTask,         "IMUTask",         imuStack,         4),
+    KERNEL_TASK(vControlLoopTask, "ControlLoopTask", controlLoopStack, 3),
+    KERNEL_TASK(vBlackboxTask,    "BlackboxTask",    blackboxStack,    1),
+    KERNEL_TASK(vTelemetryTask,   "TelemetryTask",   telemetryStack,   1),
+    KERNEL_TASK(vParamTask,       "ParamTask",       paramStack,       1),
+    KERNEL_TASK(vTaskStatsTask,   "TaskStatsTask",   taskStatsStack,   1),
+    // Replaces the blackbox task, both use the sd card
+    /*KERNEL_TASK(vSdBenchmarkTask, "SdBenchmarkTask", blackboxStack, 1),*/
+};
+
+#define KERNEL_TASK_COUNT (sizeof(tasks) / sizeof(tasks[0]))
+
+static StaticTask_t taskBuffers[KERNEL_TASK_COUNT];
+
+static StackType_t idleStack[configMINIMAL_STACK_SIZE];
+static StaticTask_t idleTaskBuffer;
+
+/*
+ * Queues, semaphores and mutexes, created by their owner with
+ * kernelQueueCreate
+ */
+
+typedef enum KernelQueueKind {
+    KERNEL_KIND_QUEUE = 0,
+    KERNEL_KIND_MUTEX,
+    KERNEL_KIND_BINARY_SEMAPHORE,
+} KernelQueueKind;
+
+typedef struct KernelQueueInfo_t {
+    const char     *name;
+    KernelQueueKind kind;
+    uint32_t        length;
+    uint32_t        itemSize;
+    uint8_t        *storage;    // length * itemSize, queues only
+} KernelQueueInfo_t;
+
+static const KernelQueueInfo_t queues[KERNEL_QUEUE_COUNT] = {
+    [KERNEL_QUEUE_I2C_MUTEX] = {"I2C mutex", KERNEL_KIND_MUTEX, 1, 0, NULL},
+    [KERNEL_QUEUE_I2C_DMA]   = {"I2C DMA", KERNEL_KIND_BINARY_SEMAPHORE, 1, 0,
+                                NULL},
+    [KERNEL_QUEUE_SD_DMA]    = {"SD DMA", KERNEL_KIND_BINARY_SEMAPHORE, 1, 0,
+                                NULL},
+};
+
+static StaticQueue_t queueBuffers[KERNEL_QUEUE_COUNT];
+static QueueHandle_t queueHandles[KERNEL_QUEUE_COUNT];
+
+/**
+ * @brief Create a queue, semaphore or mutex from the table, and name it for
+ * the trace
+ *
+ * Creating one that already exists returns it again
+ *
+ * @return The handle, never NULL
+ */
+QueueHandle_t kernelQueueCreate(KernelQueue queue)
+{
+    if (queue >= KERNEL_QUEUE_COUNT) {
+        Error_Handler("Invalid kernel queue");
+    }
+
+    if (queueHandles[queue] != NULL) {
+        return queueHandles[queue];
+    }
+
+    const KernelQueueInfo_t *info = &queues[queue];
+    QueueHandle_t handle = NULL;
+
+    switch (info->kind)
+    {
+        case KERNEL_KIND_QUEUE:
+            handle = xQueueCreateStatic(info->length, info->itemSize,
+                                        info->storage, &queueBuffers[queue]);
+            break;
+
+        case KERNEL_KIND_MUTEX:
+            handle = xSemaphoreCreateMutexStatic(&queueBuffers[queue]);
+            break;
+
+        case KERNEL_KIND_BINARY_SEMAPHORE:
+            handle = xSemaphoreCreateBinaryStatic(&queueBuffers[queue]);
+            break;
+    }
+
+    if (handle == NULL) {
+        Error_Handler("Failed to create kernel queue");
+    }
+
+    queueHandles[queue] = handle;
+    traceNameQueue(handle, info->name);
+
+    return handle;
+}
+
+/**
+ * @brief Create every task in the table. Called once, before the scheduler
+ * starts
+ */
+void kernelTasksCreate(void)
+{
+    for (uint32_t i = 0; i < KERNEL_TASK_COUNT; i++) {
+        const KernelTaskInfo_t *info = &tasks[i];
+
+        if (xTaskCreateStatic(info->function, info->name, info->stackDepth,
+                              NULL, info->priority, info->stack,
+                              &taskBuffers[i]) == NULL) {
+            Error_Handler("Failed to create task");
+        }
+    }
+}
+
+/**
+ * @brief Memory for the idle task, called by the kernel as the scheduler
+ * starts
+ */
+void vApplicationGetIdleTaskMemory(StaticTask_t **ppxIdleTaskTCBBuffer,
+                                   StackType_t **ppxIdleTaskStackBuffer,
+                                   uint32_t *pulIdleTaskStackSize)
+{
+    *ppxIdleTaskTCBBuffer = &idleTaskBuffer;
+    *ppxIdleTaskStackBuffer = idleStack;
+    *pulIdleTaskStackSize = configMINIMAL_STACK_SIZE;
+}
+
+/**
+ * @brief Print the RAM used by each kernel object. See make ram-report for
+ * the rest of RAM
+ */
+void kernelRamReport(void)
+{
+    uint32_t total = 0;
+
+    printf("Kernel RAM (bytes):\n");
+
+    for (uint32_t i = 0; i < KERNEL_TASK_COUNT; i++) {
+        uint32_t size = tasks[i].stackDepth * sizeof(StackType_t)
+                        + sizeof(StaticTask_t);
+
+        printf("  task  %-16s %5lu\n", tasks[i].name, size);
+        total += size;
+    }
+
+    uint32_t idleSize = sizeof(idleStack) + sizeof(idleTaskBuffer);
+
+    printf("  task  %-16s %5lu\n", "IDLE", idleSize);
+    total += idleSize;
+
+    for (uint32_t i = 0; i < KERNEL_QUEUE_COUNT; i++) {
+        uint32_t size = queues[i].length * queues[i].itemSize
+                        + sizeof(StaticQueue_t);
+
+        printf("  queue %-16s %5lu\n", queues[i].name, size);
+        total += size;
+    }
+
+    printf("  total                  %5lu\n", total);
+}
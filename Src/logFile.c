@@ -0,0 +1,226 @@
+#include <string.h>
+
+#include "fc.h"
+#include "ff.h"
+#include "diskio.h"
+#include "logFile.h"
+
+/**
+ * @file Src/logFile.c
+ *
+ * @brief Log files streamed straight to the card, bypassing FatFs
+ *
+ * logFileOpen allocates the whole file up front as one contiguous run of
+ * clusters (f_expand) and works out where it starts on the card from the
+ * cluster link map. Writes are then collected into a few sectors and sent with
+ * disk_write, which uses a multi block write with a pre-erase count (ACMD23)
+ * for more than one sector. No FAT or directory sectors are touched until the
+ * file is closed, so write latency stays flat.
+ *
+ * The directory entry holds the pre-allocated size while the file is open.
+ * The unused space is erased when the file is opened, so a log that is never
+ * closed ends in erased sectors rather than old data. logFileClose sets the
+ * real size and frees the unused clusters.
+ */
+
+static FATFS *logFileSystem(const LogFile_t *log)
+{
+    return log->file.obj.fs;
+}
+
+/**
+ * @brief Write the first count sectors of the buffer to the card
+ */
+static FRESULT writeSectors(LogFile_t *log, UINT count)
+{
+    if (log->sectorsWritten + count > log->sectorCount) {
+        return FR_DENIED;
+    }
+
+    if (disk_write(logFileSystem(log)->drv, log->buffer,
+                   log->startSector + log->sectorsWritten, count) != RES_OK)
+    {
+        return FR_DISK_ERR;
+    }
+
+    return FR_OK;
+}
+
+/**
+ * @brief Create a new log file, and allocate space for it
+ *
+ * @param[out] log  The log file
+ * @param[in]  name Name of the file to create, it must not already exist
+ * @param[in]  size Maximum size of the file in bytes
+ *
+ * @return FR_OK, FR_EXIST if the file already exists, FR_DENIED if there
+ *         isn't a contiguous free area of size bytes, or another FatFs error
+ */
+FRESULT logFileOpen(LogFile_t *log, const TCHAR *name, DWORD size)
+{
+    FATFS *fs;
+    FRESULT res;
+
+    memset(log, 0, sizeof(*log));
+
+    res = f_open(&log->file, name, FA_WRITE | FA_CREATE_NEW);
+    if (res != FR_OK) {
+        return res;
+    }
+
+    fs = logFileSystem(log);
+
+    res = f_expand(&log->file, size, 1 /* allocate now */);
+
+    if (res == FR_OK) {
+        // A contiguous file is a single fragment, so the link map shows
+        // where it starts
+        log->file.cltbl = log->linkMap;
+        log->linkMap[0] = LOG_FILE_LINK_MAP_LENGTH;
+        res = f_lseek(&log->file, CREATE_LINKMAP);
+    }
+
+    if (res == FR_OK) {
+        // Write the FAT chain and directory entry now, so they aren't
+        // touched again until the file is closed
+        res = f_sync(&log->file);
+    }
+
+    if (res != FR_OK) {
+        f_close(&log->file);
+        // Don't leave an empty file behind, so the caller can retry with
+        // the same name
+        f_unlink(name);
+        return res;
+    }
+
+    log->startSector = fs->database + (log->linkMap[2] - 2) * fs->csize;
+    log->sectorCount = size / LOG_FILE_SECTOR_SIZE;
+
+    // Erase the area, in case the log isn't closed. Not every card supports
+    // this, and the log is still usable without it
+    DWORD range[2] = {log->startSector,
+                      log->startSector + log->sectorCount - 1};
+    disk_ioctl(fs->drv, CTRL_TRIM, range);
+
+    return FR_OK;
+}
+
+/**
+ * @brief Append data to a log file
+ *
+ * Data is only written to the card once a full buffer has been collected,
+ * call logFileSync to write it sooner
+ *
+ * @return FR_OK, FR_DENIED if the file is full, or FR_DISK_ERR
+ */
+FRESULT logFileWrite(LogFile_t *log, const void *data, uint32_t length)
+{
+    const uint8_t *src = data;
+    FRESULT res;
+
+    if (logFileLength(log) + length
+        > log->sectorCount * LOG_FILE_SECTOR_SIZE)
+    {
+        return FR_DENIED;
+    }
+
+    while (length != 0) {
+        uint32_t space = sizeof(log->buffer) - log->bufferLength;
+        uint32_t copy = (length < space) ? length : space;
+
+        memcpy(&log->buffer[log->bufferLength], src, copy);
+        log->bufferLength += copy;
+        src += copy;
+        length -= copy;
+
+        if (log->bufferLength == sizeof(log->buffer)) {
+            res = writeSectors(log, LOG_FILE_BUFFER_SECTORS);
+            if (res != FR_OK) {
+                return res;
+            }
+            log->sectorsWritten += LOG_FILE_BUFFER_SECTORS;
+            log->bufferLength = 0;
+        }
+    }
+
+    return FR_OK;
+}
+
+/**
+ * @brief Write all buffered data to the card
+ *
+ * A partly filled last sector is padded with zeros, and written again once
+ * more data arrives
+ *
+ * @return FR_OK, or FR_DISK_ERR
+ */
+FRESULT logFileSync(LogFile_t *log)
+{
+    UINT fullSectors = log->bufferLength / LOG_FILE_SECTOR_SIZE;
+    UINT partial = log->bufferLength % LOG_FILE_SECTOR_SIZE;
+    UINT count = fullSectors + (partial ? 1 : 0);
+    FRESULT res;
+
+    if (count == 0) {
+        return FR_OK;
+    }
+
+    if (partial) {
+        memset(&log->buffer[log->bufferLength], 0,
+               LOG_FILE_SECTOR_SIZE - partial);
+    }
+
+    res = writeSectors(log, count);
+    if (res != FR_OK) {
+        return res;
+    }
+
+    if (disk_ioctl(logFileSystem(log)->drv, CTRL_SYNC, NULL) != RES_OK) {
+        return FR_DISK_ERR;
+    }
+
+    // Keep the partial sector at the start of the buffer, it is written
+    // to the same place next time
+    log->sectorsWritten += fullSectors;
+    if (fullSectors != 0 && partial != 0) {
+        memmove(log->buffer,
+                &log->buffer[fullSectors * LOG_FILE_SECTOR_SIZE], partial);
+    }
+    log->bufferLength = partial;
+
+    return FR_OK;
+}
+
+/**
+ * @brief Write buffered data, set the file size to the data written and free
+ * the unused space
+ *
+ * @return FR_OK, or a FatFs error
+ */
+FRESULT logFileClose(LogFile_t *log)
+{
+    FRESULT res;
+
+    res = logFileSync(log);
+
+    if (res == FR_OK) {
+        res = f_lseek(&log->file, logFileLength(log));
+    }
+
+    if (res == FR_OK) {
+        res = f_truncate(&log->file);
+    }
+
+    FRESULT closeRes = f_close(&log->file);
+
+    return (res != FR_OK) ? res : closeRes;
+}
+
+/**
+ * @return The number of bytes written to the log
+ */
+DWORD logFileLength(const LogFile_t *log)
+{
+    return log->sectorsWritten * LOG_FILE_SECTOR_SIZE + log->bufferLength;
+}
@@ -0,0 +1,209 @@
+#include "fc.h"
+#include "loopScheduler.h"
+
+#ifndef __UNIT_TEST
+#include "freertos.h"
+#include "task.h"
+#endif
+
+/**
+ * @file Src/loopScheduler.c
+ *
+ * @brief Releases the control loop and IMU tasks from a hardware timer
+ *
+ * The RTOS tick is 1 kHz, so a loop delayed in ticks can only run at a whole
+ * number of ms. Instead TIM6 raises an interrupt every period, any whole
+ * number of us from LOOP_SCHEDULER_MIN_PERIOD_US (e.g. 2, 4 or 8 kHz), and
+ * the interrupt notifies each task that is due directly. A task due every
+ * n releases is added with divider n, for stages slower than the loop.
+ *
+ * TIM6 counts on the same 1 MHz clock as TIM5, the us counter used for all
+ * loop timing, so the two never drift. The releases fall at phaseUs past a
+ * multiple of the period on TIM5, e.g. to line up with the gyro's data.
+ *
+ * The tick counting and dividers build for the host, see
+ * test/loop_scheduler_unittest.cpp for a model of the release jitter.
+ */
+
+// Keep the compiler from moving the new task's stores past taskCount
+#define LOOP_SCHEDULER_BARRIER() __asm volatile ("" ::: "memory")
+
+typedef struct LoopSchedulerTask_t {
+    void     *task;
+    uint32_t  divider;
+} LoopSchedulerTask_t;
+
+static LoopSchedulerTask_t tasks[LOOP_SCHEDULER_MAX_TASKS];
+static volatile uint32_t taskCount = 0;
+static uint32_t tick = 0;
+
+/**
+ * @return The period of a rate, or 0 if it isn't a whole number of us
+ * within the timer's range
+ */
+uint32_t loopSchedulerPeriodUs(uint32_t rateHz)
+{
+    if (rateHz == 0 || 1000000 % rateHz != 0) {
+        return 0;
+    }
+
+    uint32_t periodUs = 1000000 / rateHz;
+
+    if (periodUs < LOOP_SCHEDULER_MIN_PERIOD_US
+        || periodUs > LOOP_SCHEDULER_MAX_PERIOD_US) {
+        return 0;
+    }
+
+    return periodUs;
+}
+
+/**
+ * @brief The count to start the timer at so it releases at the phase
+ *
+ * The timer releases as it wraps from periodUs - 1 to 0
+ *
+ * @param nowUs    The us counter as the timer starts
+ * @param periodUs
+ * @param phaseUs  Releases are at this offset from a multiple of periodUs
+ */
+uint32_t loopSchedulerStartCount(uint32_t nowUs, uint32_t periodUs,
+                                 uint32_t phaseUs)
+{
+    return (nowUs % periodUs + periodUs - phaseUs % periodUs) % periodUs;
+}
+
+/**
+ * @brief Forget every task and start counting releases from 0
+ */
+void loopSchedulerReset(void)
+{
+    taskCount = 0;
+    tick = 0;
+}
+
+/**
+ * @brief Release a task every divider releases, starting with the next
+ * multiple of divider
+ *
+ * @param task    Notified when due
+ * @param divider
+ *
+ * @return FC_ERROR if there is no room or the divider is 0
+ */
+FC_Status loopSchedulerAddTask(void *task, uint32_t divider)
+{
+    if (divider == 0 || taskCount >= LOOP_SCHEDULER_MAX_TASKS) {
+        return FC_ERROR;
+    }
+
+    tasks[taskCount].task = task;
+    tasks[taskCount].divider = divider;
+    // Make the task visible to the interrupt last
+    LOOP_SCHEDULER_BARRIER();
+    taskCount++;
+
+    return FC_OK;
+}
+
+/**
+ * @brief Count one release of the timer
+ *
+ * @return Bit n set if task n (in the order added) is due
+ */
+FAST_CODE uint32_t loopSchedulerRelease(void)
+{
+    uint32_t due = 0;
+    uint32_t count = taskCount;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (tick % tasks[i].divider == 0) {
+            due |= 1U << i;
+        }
+    }
+    tick++;
+
+    return due;
+}
+
+#ifndef __UNIT_TEST
+
+/**
+ * @brief Start releasing at rateHz. TIM5 must already be running (see
+ * ppmInit)
+ *
+ * @param rateHz  See loopSchedulerPeriodUs
+ * @param phaseUs Offset of the releases, see loopSchedulerStartCount
+ *
+ * @return FC_ERROR if the rate can't be timed exactly
+ */
+FC_Status loopSchedulerInit(uint32_t rateHz, uint32_t phaseUs)
+{
+    uint32_t periodUs = loopSchedulerPeriodUs(rateHz);
+
+    if (periodUs == 0 || (TIM5->CR1 & TIM_CR1_CEN) == 0) {
+        return FC_ERROR;
+    }
+
+    __HAL_RCC_TIM6_CLK_ENABLE();
+
+    TIM6->CR1 = 0;
+    // Both on APB1, so the same prescaler gives the same 1 MHz
+    TIM6->PSC = TIM5->PSC;
+    TIM6->ARR = periodUs - 1;
+    // Load the prescaler now, rather than at the first update
+    TIM6->EGR = TIM_EGR_UG;
+    TIM6->SR = 0;
+    TIM6->DIER = TIM_DIER_UIE;
+
+    HAL_NVIC_SetPriority(TIM6_DAC_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(TIM6_DAC_IRQn);
+
+    TIM6->CNT = loopSchedulerStartCount(TIM5->CNT, periodUs, phaseUs);
+    TIM6->CR1 = TIM_CR1_CEN;
+
+    return FC_OK;
+}
+
+/**
+ * @brief Block the calling task until it is next released
+ *
+ * @return The number of releases since the last call, more than 1 if the
+ * task missed some, 0 if the timer has stopped
+ */
+uint32_t loopSchedulerWait(void)
+{
+    return ulTaskNotifyTake(pdTRUE, LOOP_SCHEDULER_TIMEOUT_MS / portTICK_PERIOD_MS);
+}
+
+/**
+ * @brief The us counter the releases are timed against, wraps at 2^32
+ */
+FAST_CODE uint32_t loopSchedulerNowUs(void)
+{
+    return TIM5->CNT;
+}
+
+/**
+ * @brief The TIM6 interrupt, notifies the tasks that are due
+ */
+FAST_CODE void loopSchedulerIrqHandler(void)
+{
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+
+    if ((TIM6->SR & TIM_SR_UIF) == 0) {
+        return;
+    }
+    TIM6->SR = ~TIM_SR_UIF;
+
+    uint32_t due = loopSchedulerRelease();
+
+    for (uint32_t i = 0; due != 0; i++, due >>= 1) {
+        if (due & 1) {
+            vTaskNotifyGiveFromISR(tasks[i].task, &higherPriorityTaskWoken);
+        }
+    }
+
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
+#endif
@@ -0,0 +1,143 @@
+#include <string.h>
+
+#include "fc.h"
+#include "loopTiming.h"
+
+/**
+ * @file Src/loopTiming.c
+ *
+ * @brief Period, jitter and deadline accounting for the control loop
+ *
+ * Each iteration is released one nominal period after the previous one, on
+ * a fixed grid (the same one vTaskDelayUntil keeps), and its deadline is the
+ * next release. Every iteration records:
+ * +     Its period, start to start, in a histogram of fixed width buckets
+ *       around the nominal period
+ * +     How late it started and how long it ran
+ * +     Whether it missed its deadline, and how many have been missed in a
+ *       row
+ *
+ * A run of misses is answered in steps (see LoopTimingLevel), so a one off
+ * miss is only counted and a reset is the last resort. The grid starts at
+ * the first iteration and moves earlier if an iteration starts before its
+ * release, so it ends up on the earliest phase the loop runs at.
+ *
+ * Times are 32 bit us and may wrap.
+ */
+
+static uint32_t nominalUs;
+static uint32_t releaseUs;
+static uint32_t lastStartUs;
+static bool started = false;
+static TelemetryLoopTiming_t stats;
+
+/**
+ * @brief Start again, with no history
+ *
+ * @param periodUs The nominal period
+ */
+void loopTimingInit(uint32_t periodUs)
+{
+    nominalUs = periodUs;
+    started = false;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.minPeriodUs = UINT32_MAX;
+}
+
+/**
+ * @brief Histogram bucket of a period
+ *
+ * Bucket LOOP_TIMING_BUCKETS / 2 starts at the nominal period, each bucket
+ * is LOOP_TIMING_BUCKET_US wide
+ */
+uint32_t loopTimingBucket(uint32_t periodUs)
+{
+    int32_t offset = (int32_t)(periodUs - nominalUs)
+                     + (LOOP_TIMING_BUCKETS / 2) * LOOP_TIMING_BUCKET_US;
+
+    if (offset < 0) {
+        return 0;
+    }
+
+    uint32_t bucket = offset / LOOP_TIMING_BUCKET_US;
+
+    return (bucket < LOOP_TIMING_BUCKETS) ? bucket : LOOP_TIMING_BUCKETS - 1;
+}
+
+/**
+ * @brief Account for one iteration
+ *
+ * @param startUs When it started
+ * @param endUs   When it finished
+ *
+ * @return How the loop is keeping up
+ */
+LoopTimingLevel loopTimingUpdate(uint32_t startUs, uint32_t endUs)
+{
+    if (!started) {
+        releaseUs = startUs;
+        started = true;
+    } else {
+        uint32_t periodUs = startUs - lastStartUs;
+
+        stats.periodUs = periodUs;
+        if (periodUs < stats.minPeriodUs) {
+            stats.minPeriodUs = periodUs;
+        }
+        if (periodUs > stats.maxPeriodUs) {
+            stats.maxPeriodUs = periodUs;
+        }
+        stats.histogram[loopTimingBucket(periodUs)]++;
+
+        releaseUs += nominalUs;
+    }
+    lastStartUs = startUs;
+
+    int32_t lateUs = (int32_t)(startUs - releaseUs);
+
+    if (lateUs < 0 || lateUs > LOOP_TIMING_STALL_PERIODS * (int32_t)nominalUs) {
+        releaseUs = startUs;
+        lateUs = 0;
+    }
+    if ((uint32_t)lateUs > stats.maxLateUs) {
+        stats.maxLateUs = lateUs;
+    }
+
+    stats.executionUs = endUs - startUs;
+    if (stats.executionUs > stats.maxExecutionUs) {
+        stats.maxExecutionUs = stats.executionUs;
+    }
+    stats.iterations++;
+
+    // The deadline is the next release
+    if (endUs - releaseUs > nominalUs) {
+        stats.deadlineMisses++;
+        if (stats.consecutiveMisses < UINT16_MAX) {
+            stats.consecutiveMisses++;
+        }
+        if (stats.consecutiveMisses > stats.maxConsecutiveMisses) {
+            stats.maxConsecutiveMisses = stats.consecutiveMisses;
+        }
+    } else {
+        stats.consecutiveMisses = 0;
+    }
+
+    if (stats.consecutiveMisses >= LOOP_TIMING_FAIL_MISSES) {
+        return LOOP_TIMING_FAIL;
+    } else if (stats.consecutiveMisses >= LOOP_TIMING_WARN_MISSES) {
+        return LOOP_TIMING_WARN;
+    } else if (stats.consecutiveMisses > 0) {
+        return LOOP_TIMING_MISSED;
+    }
+
+    return LOOP_TIMING_OK;
+}
+
+/**
+ * @brief The statistics, also sent as the LOOP_TIMING telemetry message
+ */
+const TelemetryLoopTiming_t *loopTimingStats(void)
+{
+    return &stats;
+}
@@ -15,6 +15,17 @@
 #include "ppm.h"
 #include "motors.h"
 #include "controlLoop.h"
+#include "blackbox.h"
+#include "sd.h"
+#include "telemetry.h"
+#include "uartTx.h"
+#include "params.h"
+#include "taskStats.h"
+#include "trace.h"
+#include "kernelObjects.h"
+#include "fastCodeBenchmark.h"
+#include "loopScheduler.h"
+#include "topics.h"
 
 void vPrintTask1( void *pvParameters )
 {
@@ -64,11 +75,14 @@ void setup(void){
     // System interrupt init
     HAL_MspInit();
 
+    // Before any writer advertises its topic
+    topicsInit();
+
     hardware_init();
 
     HAL_NVIC_SetPriorityGrouping( NVIC_PRIORITYGROUP_4 ); // see http://www.freertos.org/RTOS-Cortex-M3-M4.html
 
-    printf("Free heap size after setup: %d\n", xPortGetFreeHeapSize());
+    kernelRamReport();
 
     return;
 }
@@ -78,14 +92,29 @@ int main(void)
     setup();
     printf("System start up. Hardware initialized.\n");
 
-    xTaskCreate(vBlinkTask, "blinkTask", 50, NULL, 2 /* priority */, NULL);
-    /*xTaskCreate(vPrintTask1, "printTask1", 300, NULL, 2 [> priority <], NULL);*/
-    /*xTaskCreate(vPrintTask2, "printTask2", 300, NULL, 2 [> priority <], NULL);*/
-    xTaskCreate(vDebugTask, "debugTask", 300, NULL, 1 /* priority */, NULL);
-    /*xTaskCreate(vPressureSensorTask, "pressureSensorTask", 300, NULL, 3 [> priority <], NULL);*/
-    xTaskCreate(vIMUTask, "IMUTask", 300, NULL, 4 /* priority */, NULL);
-    /*xTaskCreate(vRCTask, "RCTask", 200, NULL, 4 [> priority <], NULL);*/
-    xTaskCreate(vControlLoopTask, "ControlLoopTask", 400, NULL, 3 /* priority */, NULL);
+    // Record the first ring full of events once the scheduler starts
+    traceInit();
+
+    // Before the tasks start, loading may erase flash
+    if (paramsInit() != FC_OK) {
+        Error_Handler("Invalid param table");
+    }
+    if (paramsLoad() != FC_OK) {
+        printf("Param load fail, using defaults\n");
+    }
+
+    // Bring-up, compare running the control code from flash and RAM
+    /*fastCodeBenchmark();*/
+
+    telemetryInit(UART_TX_BAUD_RATE / 10);
+
+    // Releases the control loop and IMU tasks, needs TIM5 from ppmInit
+    if (loopSchedulerInit(CONTROL_LOOP_RATE_HZ, 0) != FC_OK) {
+        Error_Handler("Failed to start loop timer");
+    }
+
+    // See the task table in kernelObjects.c
+    kernelTasksCreate();
 
     vTaskStartScheduler();
 
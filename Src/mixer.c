@@ -0,0 +1,40 @@
+#include "fc.h"
+#include "mixer.h"
+
+/**
+ * @file Src/mixer.c
+ *
+ * @brief Quad X mixer, from the throttle and rate outputs to motor outputs
+ *
+ * Only computes the values, motorsWriteAll sets them, so this builds and
+ * runs on the host too
+ */
+
+/**
+ * @brief Mix the throttle and rate controller outputs for all four motors
+ *
+ * @param[out] compare Motor outputs in us, indexed by MOTOR_INDEX(motor) and
+ *                     limited with motorLimit, ready for motorsWriteAll
+ */
+FAST_CODE void mixMotors(uint32_t rcThrottle, const RotationAxisOutputs_t *outputs,
+                         uint32_t compare[MOTOR_COUNT])
+{
+    int throttle = rcThrottle;
+
+    compare[MOTOR_INDEX(MOTOR_FRONT_LEFT)] = motorLimit(throttle
+                                                        - outputs->roll
+                                                        + outputs->pitch
+                                                        - outputs->yaw);
+    compare[MOTOR_INDEX(MOTOR_BACK_LEFT)] = motorLimit(throttle
+                                                       - outputs->roll
+                                                       - outputs->pitch
+                                                       + outputs->yaw);
+    compare[MOTOR_INDEX(MOTOR_FRONT_RIGHT)] = motorLimit(throttle
+                                                         + outputs->roll
+                                                         + outputs->pitch
+                                                         + outputs->yaw);
+    compare[MOTOR_INDEX(MOTOR_BACK_RIGHT)] = motorLimit(throttle
+                                                        + outputs->roll
+                                                        - outputs->pitch
+                                                        - outputs->yaw);
+}
@@ -97,6 +97,13 @@ void motorsInit(void)
     Error_Handler();
   }
 
+  // Buffer the compare registers so new values only take effect on an update
+  // event. Together with the UDIS gating in motorsWriteAll this means all four
+  // motors always switch to their new values in the same PWM period
+  htim1.Instance->CCMR1 |= TIM_CCMR1_OC1PE | TIM_CCMR1_OC2PE;
+  htim1.Instance->CCMR2 |= TIM_CCMR2_OC3PE | TIM_CCMR2_OC4PE;
+  htim1.Instance->CR1   |= TIM_CR1_ARPE;
+
   sBreakDeadTimeConfig.OffStateRunMode = TIM_OSSR_DISABLE;
   sBreakDeadTimeConfig.OffStateIDLEMode = TIM_OSSI_DISABLE;
   sBreakDeadTimeConfig.LockLevel = TIM_LOCKLEVEL_OFF;
@@ -185,12 +192,40 @@ FC_Status motorsDeinit()
 
 FC_Status motorsStop()
 {
-  __HAL_TIM_SET_COMPARE(&htim1, MOTOR_FRONT_LEFT, MOTOR_LOW_VAL_US);
-  __HAL_TIM_SET_COMPARE(&htim1, MOTOR_FRONT_RIGHT, MOTOR_LOW_VAL_US);
-  __HAL_TIM_SET_COMPARE(&htim1, MOTOR_BACK_LEFT, MOTOR_LOW_VAL_US);
-  __HAL_TIM_SET_COMPARE(&htim1, MOTOR_BACK_RIGHT, MOTOR_LOW_VAL_US);
+  static const uint32_t stopCompare[MOTOR_COUNT] = {
+      MOTOR_LOW_VAL_US, MOTOR_LOW_VAL_US, MOTOR_LOW_VAL_US, MOTOR_LOW_VAL_US
+  };
 
-  return FC_OK;
+  return motorsWriteAll(stopCompare);
+}
+
+/**
+ * @brief Commit new compare values for all four motors at once
+ *
+ * The compare registers are preloaded (see motorsInit), so writes only go to
+ * the shadow registers. Update events are disabled while the four values are
+ * written, so the timer can never latch a mix of old and new values. The new
+ * values take effect together at the next natural update event, without
+ * cutting the current PWM period short.
+ *
+ * @param compare Compare values in us, indexed by MOTOR_INDEX(motor). These
+ *                must already be limited to [MOTOR_LOW_VAL_US,
+ *                MOTOR_HIGH_VAL_US], see motorLimit
+ *
+ * @return Status
+ */
+FAST_CODE FC_Status motorsWriteAll(const uint32_t compare[MOTOR_COUNT])
+{
+    TIM_TypeDef *tim = htim1.Instance;
+
+    tim->CR1 |= TIM_CR1_UDIS;
+    tim->CCR1 = compare[0];
+    tim->CCR2 = compare[1];
+    tim->CCR3 = compare[2];
+    tim->CCR4 = compare[3];
+    tim->CR1 &= ~TIM_CR1_UDIS;
+
+    return FC_OK;
 }
 
 FC_Status setMotor(MotorNum motor, uint32_t val)
@@ -212,6 +247,20 @@ FC_Status setMotor(MotorNum motor, uint32_t val)
     return rc;
 }
 
+/**
+ * @brief Read back the compare values most recently written for all motors
+ *
+ * @param[out] compare Compare values in us, indexed by MOTOR_INDEX(motor)
+ */
+void motorsGetAll(uint32_t compare[MOTOR_COUNT])
+{
+    TIM_TypeDef *tim = htim1.Instance;
+
+    compare[0] = tim->CCR1;
+    compare[1] = tim->CCR2;
+    compare[2] = tim->CCR3;
+    compare[3] = tim->CCR4;
+}
 
 void vMotorsTask(void *pvParameters)
 {
@@ -0,0 +1,343 @@
+#include <string.h>
+
+#include "fc.h"
+#include "paramStore.h"
+
+#ifndef __UNIT_TEST
+#include "stm32f4xx_hal.h"
+#endif
+
+/**
+ * @file Src/paramStore.c
+ *
+ * @brief Saves parameter values in flash as a log of records
+ *
+ * Saving appends a record (name hash, value) for each value that changed
+ * since it was last saved, and loading replays the log so the newest record
+ * for each parameter wins. Nothing is erased until a bank is full, then all
+ * the current values are written to the other bank and it becomes the active
+ * one. Erases alternate between the two banks, and with around 1300 records
+ * per bank a sector is only erased every few hundred saves of a typical
+ * tuning change.
+ *
+ * A reset at any point leaves the last complete save readable:
+ * +     A record cut short is ignored, its check word doesn't match
+ * +     A compaction only takes effect when it writes the new bank's header,
+ *       after all its records. Until then the old bank has the higher
+ *       generation and is still used
+ *
+ * Records are keyed by name hash rather than table index, so values survive
+ * parameters being added, removed or reordered in a firmware update.
+ */
+
+static int activeBank = -1;
+static uint32_t nextRecord = 0;
+static ParamStoreStats_t stats;
+
+static uint32_t recordCheck(uint32_t hash, uint32_t value)
+{
+    // Rotated so an erased record (all ones) never checks out
+    return hash ^ ((value << 16) | (value >> 16)) ^ PARAM_STORE_MAGIC;
+}
+
+static const ParamStoreRecord_t *bankRecords(int bank)
+{
+    return (const ParamStoreRecord_t *)paramFlashBank(bank);
+}
+
+static bool recordErased(const ParamStoreRecord_t *record)
+{
+    return record->hash == UINT32_MAX && record->value == UINT32_MAX
+           && record->check == UINT32_MAX;
+}
+
+static bool recordValid(const ParamStoreRecord_t *record)
+{
+    return record->check == recordCheck(record->hash, record->value);
+}
+
+/**
+ * @return true if the bank has a valid header, with its generation in
+ * generation
+ */
+static bool bankGeneration(int bank, uint32_t *generation)
+{
+    const ParamStoreRecord_t *header = &bankRecords(bank)[0];
+
+    if (!recordValid(header) || header->hash != PARAM_STORE_MAGIC) {
+        return false;
+    }
+
+    (*generation) = header->value;
+    return true;
+}
+
+static FC_Status writeRecord(int bank, uint32_t index, uint32_t hash,
+                             uint32_t value)
+{
+    const ParamStoreRecord_t *record = &bankRecords(bank)[index];
+    uint32_t offset = index * (sizeof(ParamStoreRecord_t) / sizeof(uint32_t));
+
+    if (paramFlashProgram(bank, offset, hash) != FC_OK
+        || paramFlashProgram(bank, offset + 1, value) != FC_OK
+        || paramFlashProgram(bank, offset + 2, recordCheck(hash, value)) != FC_OK)
+    {
+        return FC_ERROR;
+    }
+
+    stats.recordsWritten++;
+
+    // Catches programming over a slot that wasn't erased
+    if (record->hash != hash || record->value != value || !recordValid(record)) {
+        return FC_ERROR;
+    }
+
+    return FC_OK;
+}
+
+/**
+ * @brief Replay the active bank
+ *
+ * @param[out] found Set for each hash with a saved value
+ *
+ * @return The number of hashes found
+ */
+static uint32_t loadRecords(const uint32_t *hashes, uint32_t *values,
+                            bool *found, uint32_t count)
+{
+    uint32_t foundCount = 0;
+
+    memset(found, 0, count * sizeof(found[0]));
+
+    if (activeBank < 0) {
+        return 0;
+    }
+
+    const ParamStoreRecord_t *records = bankRecords(activeBank);
+
+    for (uint32_t r = 1; r < nextRecord; r++) {
+        if (!recordValid(&records[r])) {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            if (hashes[i] == records[r].hash) {
+                values[i] = records[r].value;
+                if (!found[i]) {
+                    found[i] = true;
+                    foundCount++;
+                }
+                break;
+            }
+        }
+    }
+
+    return foundCount;
+}
+
+/**
+ * @brief Write every value to the other bank, then switch to it
+ */
+static FC_Status compact(const uint32_t *hashes, const uint32_t *values,
+                         uint32_t count)
+{
+    int bank = (activeBank + 1) % PARAM_STORE_BANK_COUNT;
+    uint32_t generation = stats.generation + 1;
+
+    if (paramFlashErase(bank) != FC_OK) {
+        return FC_ERROR;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (writeRecord(bank, i + 1, hashes[i], values[i]) != FC_OK) {
+            return FC_ERROR;
+        }
+    }
+
+    // Commit
+    if (writeRecord(bank, 0, PARAM_STORE_MAGIC, generation) != FC_OK) {
+        return FC_ERROR;
+    }
+
+    activeBank = bank;
+    nextRecord = count + 1;
+    stats.generation = generation;
+    stats.recordsUsed = nextRecord;
+    stats.compactions++;
+
+    return FC_OK;
+}
+
+/**
+ * @brief Find the active bank, and set up an empty store if there isn't one
+ *
+ * @return FC_OK, or FC_ERROR if a blank store couldn't be written
+ */
+FC_Status paramStoreInit(void)
+{
+    uint32_t generation;
+
+    activeBank = -1;
+    nextRecord = 0;
+    memset(&stats, 0, sizeof(stats));
+
+    for (int bank = 0; bank < PARAM_STORE_BANK_COUNT; bank++) {
+        if (bankGeneration(bank, &generation)
+            && (activeBank < 0 || (int32_t)(generation - stats.generation) > 0))
+        {
+            activeBank = bank;
+            stats.generation = generation;
+        }
+    }
+
+    if (activeBank < 0) {
+        // Blank flash
+        return compact(NULL, NULL, 0);
+    }
+
+    // Records are appended in order, so everything after the last used slot
+    // is erased
+    const ParamStoreRecord_t *records = bankRecords(activeBank);
+
+    nextRecord = PARAM_STORE_BANK_RECORDS;
+    while (nextRecord > 1 && recordErased(&records[nextRecord - 1])) {
+        nextRecord--;
+    }
+    stats.recordsUsed = nextRecord;
+
+    return FC_OK;
+}
+
+/**
+ * @brief Read saved values
+ *
+ * @param hashes The name hash of each parameter
+ * @param[in,out] values Set to the saved value of each parameter found, the
+ *                       others are left alone
+ * @param count  Number of parameters, at most PARAM_STORE_MAX_PARAMS
+ *
+ * @return The number of parameters with a saved value
+ */
+uint32_t paramStoreLoad(const uint32_t *hashes, uint32_t *values,
+                        uint32_t count)
+{
+    bool found[PARAM_STORE_MAX_PARAMS];
+
+    if (count > PARAM_STORE_MAX_PARAMS) {
+        count = PARAM_STORE_MAX_PARAMS;
+    }
+
+    return loadRecords(hashes, values, found, count);
+}
+
+/**
+ * @brief Save the current value of every parameter
+ *
+ * Only values that differ from the saved ones are written. This programs
+ * and possibly erases flash, which stalls the cpu (see paramsUpdate)
+ *
+ * @param hashes The name hash of each parameter
+ * @param values The value of each parameter
+ * @param count  Number of parameters, at most PARAM_STORE_MAX_PARAMS
+ *
+ * @return FC_OK, or FC_ERROR if the flash couldn't be written. The previous
+ * save is still intact after an error
+ */
+FC_Status paramStoreSave(const uint32_t *hashes, const uint32_t *values,
+                         uint32_t count)
+{
+    uint32_t saved[PARAM_STORE_MAX_PARAMS];
+    bool found[PARAM_STORE_MAX_PARAMS];
+    uint32_t changed = 0;
+
+    if (count > PARAM_STORE_MAX_PARAMS) {
+        return FC_ERROR;
+    }
+
+    loadRecords(hashes, saved, found, count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!found[i] || saved[i] != values[i]) {
+            changed++;
+        }
+    }
+
+    if (changed == 0) {
+        return FC_OK;
+    }
+
+    if (activeBank < 0 || nextRecord + changed > PARAM_STORE_BANK_RECORDS) {
+        return compact(hashes, values, count);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (found[i] && saved[i] == values[i]) {
+            continue;
+        }
+
+        // The slot is used even if the write fails, don't retry it
+        uint32_t index = nextRecord++;
+        stats.recordsUsed = nextRecord;
+
+        if (writeRecord(activeBank, index, hashes[i], values[i]) != FC_OK) {
+            // Start again on a freshly erased bank
+            return compact(hashes, values, count);
+        }
+    }
+
+    return FC_OK;
+}
+
+const ParamStoreStats_t *paramStoreStats(void)
+{
+    return &stats;
+}
+
+#ifndef __UNIT_TEST
+
+// Start of the reserved sectors, from the linker script
+extern uint32_t _sparam_store[];
+
+#define PARAM_FLASH_FIRST_SECTOR  FLASH_SECTOR_1
+
+const uint32_t *paramFlashBank(int bank)
+{
+    return &_sparam_store[bank * (PARAM_STORE_BANK_SIZE / sizeof(uint32_t))];
+}
+
+FC_Status paramFlashErase(int bank)
+{
+    FLASH_EraseInitTypeDef erase;
+    uint32_t sectorError;
+    HAL_StatusTypeDef res;
+
+    erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+    erase.Sector = PARAM_FLASH_FIRST_SECTOR + bank;
+    erase.NbSectors = 1;
+    erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+
+    HAL_FLASH_Unlock();
+    res = HAL_FLASHEx_Erase(&erase, &sectorError);
+    HAL_FLASH_Lock();
+
+    return (res == HAL_OK) ? FC_OK : FC_ERROR;
+}
+
+FC_Status paramFlashProgram(int bank, uint32_t offset, uint32_t word)
+{
+    HAL_StatusTypeDef res;
+
+    HAL_FLASH_Unlock();
+    res = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD,
+                            (uint32_t)&paramFlashBank(bank)[offset], word);
+    HAL_FLASH_Lock();
+
+    // The data cache may still hold the erased value
+    __HAL_FLASH_DATA_CACHE_DISABLE();
+    __HAL_FLASH_DATA_CACHE_RESET();
+    __HAL_FLASH_DATA_CACHE_ENABLE();
+
+    return (res == HAL_OK) ? FC_OK : FC_ERROR;
+}
+
+#endif
@@ -0,0 +1,510 @@
+#include <string.h>
+
+#include "fc.h"
+#include "params.h"
+#include "paramStore.h"
+#include "rate_control.h"
+#include "telemetry.h"
+
+#ifndef __UNIT_TEST
+#include "freertos.h"
+#include "task.h"
+#include "debug.h"
+#include "uartRx.h"
+#endif
+
+/**
+ * @file Src/params.c
+ *
+ * @brief Parameters that can be tuned at run time over the telemetry link
+ *
+ * Each parameter has an entry in paramTable, indexed by ParamId, and is
+ * looked up by name through a small hash table of precomputed name hashes.
+ * The ground station gets and sets them with the MAVLink parameter protocol
+ * (PARAM_REQUEST_LIST, PARAM_REQUEST_READ, PARAM_SET, replies are
+ * PARAM_VALUE).
+ *
+ * The code that uses a parameter registers the variable it reads
+ * (paramRegister). paramSet only records the new value, the control loop
+ * copies it into the variable with paramsApply at the start of an iteration,
+ * so a parameter never changes part way through an iteration and the loop
+ * doesn't have to lock anything to read it.
+ *
+ * Changed values are saved to flash (see paramStore.c) once they have
+ * settled, and only while disarmed: programming and erasing flash stalls
+ * every instruction fetch, an erase for a few hundred ms.
+ */
+
+// Name and precomputed hash of a table entry
+#define PARAM_NAME(name)  (name), PARAM_HASH(name)
+
+static const ParamInfo_t paramTable[PARAM_COUNT] = {
+    [PARAM_RATE_P] = {PARAM_NAME("RATE_P"), PARAM_TYPE_FLOAT,
+                      {.f = RATE_P_DEFAULT}, {.f = 0}, {.f = 50}},
+    [PARAM_RATE_I] = {PARAM_NAME("RATE_I"), PARAM_TYPE_FLOAT,
+                      {.f = RATE_I_DEFAULT}, {.f = 0}, {.f = 1}},
+    [PARAM_RATE_D] = {PARAM_NAME("RATE_D"), PARAM_TYPE_FLOAT,
+                      {.f = RATE_D_DEFAULT}, {.f = 0}, {.f = 20}},
+};
+
+// Open addressing on the low bits of the hash. Must be a power of 2, and at
+// least twice PARAM_COUNT to keep probes short
+#define PARAM_HASH_SLOTS  16
+#define PARAM_HASH_MASK   (PARAM_HASH_SLOTS - 1)
+
+#if (PARAM_HASH_SLOTS & PARAM_HASH_MASK) != 0
+#error "PARAM_HASH_SLOTS must be a power of 2"
+#endif
+
+#ifndef __UNIT_TEST
+#define PARAM_LOCK()    taskENTER_CRITICAL()
+#define PARAM_UNLOCK()  taskEXIT_CRITICAL()
+#else
+#define PARAM_LOCK()
+#define PARAM_UNLOCK()
+#endif
+
+static int8_t hashSlots[PARAM_HASH_SLOTS];
+
+// Latest value of each parameter
+static ParamValue_t values[PARAM_COUNT];
+// The variable each one is applied to, NULL until registered
+static void *live[PARAM_COUNT];
+// Parameters set but not yet applied, one bit per ParamId
+static volatile uint32_t pending = 0;
+// Parameters changed since they were last saved
+static uint32_t unsaved = 0;
+
+static bool changed = false;
+static uint32_t saveAtMs = 0;
+static volatile bool armed = false;
+// Next parameter to send in reply to PARAM_REQUEST_LIST, PARAM_COUNT if not
+// listing
+static uint32_t listNext = PARAM_COUNT;
+
+/**
+ * @brief Hash a name, reading at most PARAM_NAME_LENGTH characters
+ *
+ * Matches PARAM_HASH, names shorter than PARAM_NAME_LENGTH are hashed as if
+ * padded with zeros
+ */
+uint32_t paramHashName(const char *name)
+{
+    uint32_t hash = PARAM_HASH_OFFSET;
+    bool ended = false;
+
+    for (int i = 0; i < PARAM_NAME_LENGTH; i++) {
+        uint8_t c = ended ? 0 : (uint8_t)name[i];
+
+        ended = (c == 0);
+        hash = (hash ^ c) * PARAM_HASH_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Reset every parameter to its default and build the name lookup
+ *
+ * Registered variables are forgotten, so this must be called before the
+ * owners register
+ *
+ * @return FC_OK, or FC_ERROR if the table is invalid: too many parameters,
+ * a name too long, a wrong precomputed hash or two names with the same hash
+ */
+FC_Status paramsInit(void)
+{
+    if (PARAM_COUNT > 32 || PARAM_COUNT > PARAM_STORE_MAX_PARAMS
+        || PARAM_COUNT * 2 > PARAM_HASH_SLOTS)
+    {
+        return FC_ERROR;
+    }
+
+    memset(hashSlots, -1, sizeof(hashSlots));
+
+    for (int id = 0; id < PARAM_COUNT; id++) {
+        const ParamInfo_t *info = &paramTable[id];
+        uint32_t slot = info->hash & PARAM_HASH_MASK;
+
+        if (strlen(info->name) > PARAM_NAME_LENGTH
+            || paramHashName(info->name) != info->hash)
+        {
+            return FC_ERROR;
+        }
+
+        while (hashSlots[slot] >= 0) {
+            if (paramTable[hashSlots[slot]].hash == info->hash) {
+                return FC_ERROR;
+            }
+            slot = (slot + 1) & PARAM_HASH_MASK;
+        }
+        hashSlots[slot] = id;
+
+        values[id] = info->defaultValue;
+        live[id] = NULL;
+    }
+
+    pending = 0;
+    unsaved = 0;
+    changed = false;
+    armed = false;
+    listNext = PARAM_COUNT;
+
+    return FC_OK;
+}
+
+const ParamInfo_t *paramInfo(ParamId id)
+{
+    return (id < PARAM_COUNT) ? &paramTable[id] : NULL;
+}
+
+/**
+ * @brief Look up a parameter by name
+ *
+ * @param name Up to PARAM_NAME_LENGTH characters, only null terminated if
+ *             shorter
+ *
+ * @return The ParamId, or -1 if there is no parameter with that name
+ */
+int paramFind(const char *name)
+{
+    uint32_t hash = paramHashName(name);
+    uint32_t slot = hash & PARAM_HASH_MASK;
+
+    while (hashSlots[slot] >= 0) {
+        int id = hashSlots[slot];
+
+        if (paramTable[id].hash == hash
+            && strncmp(paramTable[id].name, name, PARAM_NAME_LENGTH) == 0)
+        {
+            return id;
+        }
+        slot = (slot + 1) & PARAM_HASH_MASK;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Set the variable a parameter is applied to, and set it to the
+ * current value
+ *
+ * @param value A float for PARAM_TYPE_FLOAT, int32_t for PARAM_TYPE_INT32.
+ *              Must only be read by the task that calls paramsApply
+ */
+void paramRegister(ParamId id, void *value)
+{
+    if (id >= PARAM_COUNT) {
+        return;
+    }
+
+    PARAM_LOCK();
+    live[id] = value;
+    memcpy(value, &values[id], sizeof(values[id]));
+    PARAM_UNLOCK();
+}
+
+ParamValue_t paramGet(ParamId id)
+{
+    ParamValue_t value = {0};
+
+    if (id < PARAM_COUNT) {
+        value = values[id];
+    }
+
+    return value;
+}
+
+/**
+ * @brief Change a parameter
+ *
+ * The registered variable is updated by the next paramsApply
+ *
+ * @return FC_OK, or FC_ERROR if the id is unknown or the value out of range,
+ * in which case the parameter is unchanged
+ */
+FC_Status paramSet(ParamId id, ParamValue_t value)
+{
+    const ParamInfo_t *info = paramInfo(id);
+
+    if (info == NULL) {
+        return FC_ERROR;
+    }
+
+    if (info->type == PARAM_TYPE_FLOAT) {
+        // Also rejects NaN
+        if (!(value.f >= info->min.f && value.f <= info->max.f)) {
+            return FC_ERROR;
+        }
+    } else if (value.i < info->min.i || value.i > info->max.i) {
+        return FC_ERROR;
+    }
+
+    if (value.raw == values[id].raw) {
+        return FC_OK;
+    }
+
+    PARAM_LOCK();
+    values[id] = value;
+    pending |= (1UL << id);
+    PARAM_UNLOCK();
+
+    unsaved |= (1UL << id);
+    changed = true;
+
+    return FC_OK;
+}
+
+/**
+ * @brief Copy parameters set since the last call into their variables
+ *
+ * Called by the control loop at the start of every iteration
+ */
+void paramsApply(void)
+{
+    // Nothing to do almost every time, don't take the lock for that
+    if (pending == 0) {
+        return;
+    }
+
+    PARAM_LOCK();
+    for (int id = 0; id < PARAM_COUNT; id++) {
+        if ((pending & (1UL << id)) && live[id] != NULL) {
+            memcpy(live[id], &values[id], sizeof(values[id]));
+        }
+    }
+    pending = 0;
+    PARAM_UNLOCK();
+}
+
+/**
+ * @return A bit per ParamId for each parameter changed but not yet saved
+ */
+uint32_t paramsUnsaved(void)
+{
+    return unsaved;
+}
+
+/**
+ * @brief Load saved values, replacing the defaults
+ *
+ * Call after paramsInit. Saved values that are out of range for the current
+ * firmware are ignored
+ *
+ * @return FC_OK, or FC_ERROR if the flash store couldn't be set up, in which
+ * case the defaults are kept
+ */
+FC_Status paramsLoad(void)
+{
+    uint32_t hashes[PARAM_COUNT];
+    uint32_t raw[PARAM_COUNT];
+
+    if (paramStoreInit() != FC_OK) {
+        return FC_ERROR;
+    }
+
+    for (int id = 0; id < PARAM_COUNT; id++) {
+        hashes[id] = paramTable[id].hash;
+        raw[id] = values[id].raw;
+    }
+
+    paramStoreLoad(hashes, raw, PARAM_COUNT);
+
+    for (int id = 0; id < PARAM_COUNT; id++) {
+        ParamValue_t value = {.raw = raw[id]};
+        paramSet(id, value);
+    }
+
+    // Only what changes from here on needs saving
+    unsaved = 0;
+    changed = false;
+
+    return FC_OK;
+}
+
+void paramsSetArmed(bool isArmed)
+{
+    armed = isArmed;
+}
+
+static FC_Status sendValue(ParamId id)
+{
+    const ParamInfo_t *info = &paramTable[id];
+    TelemetryParamValue_t reply;
+
+    memset(&reply, 0, sizeof(reply));
+
+    if (info->type == PARAM_TYPE_FLOAT) {
+        reply.paramValue = values[id].f;
+        reply.paramType = TELEMETRY_MAV_PARAM_TYPE_REAL32;
+    } else {
+        reply.paramValue = values[id].i;
+        reply.paramType = TELEMETRY_MAV_PARAM_TYPE_INT32;
+    }
+    reply.paramCount = PARAM_COUNT;
+    reply.paramIndex = id;
+    // paramsInit checked it fits, a name of PARAM_NAME_LENGTH isn't terminated
+    memcpy(reply.paramId, info->name, strlen(info->name));
+
+    return telemetrySend(TELEMETRY_MSG_PARAM_VALUE, &reply);
+}
+
+static bool forUs(uint8_t targetSystem)
+{
+    return targetSystem == TELEMETRY_SYSTEM_ID || targetSystem == 0;
+}
+
+/**
+ * @brief Handle a message from the ground station
+ *
+ * @param msg     The message, others than the parameter protocol are ignored
+ * @param payload Its payload, need not be aligned
+ */
+void paramsHandleMessage(TelemetryMessage msg, const uint8_t *payload)
+{
+    switch (msg)
+    {
+        case TELEMETRY_MSG_PARAM_REQUEST_LIST:
+        {
+            TelemetryParamRequestList_t request;
+            memcpy(&request, payload, sizeof(request));
+
+            if (forUs(request.targetSystem)) {
+                // Sent a few at a time by paramsUpdate
+                listNext = 0;
+            }
+            break;
+        }
+        case TELEMETRY_MSG_PARAM_REQUEST_READ:
+        {
+            TelemetryParamRequestRead_t request;
+            int id;
+            memcpy(&request, payload, sizeof(request));
+
+            if (!forUs(request.targetSystem)) {
+                break;
+            }
+
+            id = (request.paramIndex >= 0) ? request.paramIndex
+                                           : paramFind(request.paramId);
+            if (id >= 0 && id < PARAM_COUNT) {
+                sendValue(id);
+            }
+            break;
+        }
+        case TELEMETRY_MSG_PARAM_SET:
+        {
+            TelemetryParamSet_t request;
+            ParamValue_t value;
+            int id;
+            memcpy(&request, payload, sizeof(request));
+
+            if (!forUs(request.targetSystem)) {
+                break;
+            }
+
+            id = paramFind(request.paramId);
+            if (id < 0) {
+                break;
+            }
+
+            if (paramTable[id].type == PARAM_TYPE_FLOAT) {
+                value.f = request.paramValue;
+            } else {
+                // Round, integers are sent as the nearest float
+                value.i = request.paramValue
+                          + ((request.paramValue < 0) ? -0.5f : 0.5f);
+            }
+
+            // Reply with the value now in use, so a rejected value shows the
+            // ground station what it still is
+            paramSet(id, value);
+            sendValue(id);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Send list replies and save changed values. Called every
+ * PARAM_PERIOD_MS
+ */
+void paramsUpdate(uint32_t nowMs)
+{
+    for (int i = 0; i < PARAM_LIST_BURST && listNext < PARAM_COUNT; i++) {
+        if (sendValue(listNext) != FC_OK) {
+            // Uart is full, try again next time
+            break;
+        }
+        listNext++;
+    }
+
+    if (changed) {
+        saveAtMs = nowMs + PARAM_SAVE_DELAY_MS;
+        changed = false;
+    }
+
+    if (unsaved == 0 || armed || (int32_t)(nowMs - saveAtMs) < 0) {
+        return;
+    }
+
+    uint32_t hashes[PARAM_COUNT];
+    uint32_t raw[PARAM_COUNT];
+
+    for (int id = 0; id < PARAM_COUNT; id++) {
+        hashes[id] = paramTable[id].hash;
+        raw[id] = values[id].raw;
+    }
+
+    if (paramStoreSave(hashes, raw, PARAM_COUNT) == FC_OK) {
+        unsaved = 0;
+    } else {
+        saveAtMs = nowMs + PARAM_SAVE_DELAY_MS;
+    }
+}
+
+#ifndef __UNIT_TEST
+
+void vParamTask(void *pvParameters)
+{
+    // Too big for the task stack
+    static TelemetryParser_t parser;
+    const TelemetryMessageInfo_t *info;
+    const uint8_t *data;
+    uint32_t length;
+
+    uartRxInit();
+    telemetryParserReset(&parser);
+
+    TickType_t lastWakeTime = xTaskGetTickCount();
+    for ( ;; )
+    {
+        while ((length = uartRxPeek(&data)) != 0) {
+            const uint8_t *next = data;
+            uint32_t remaining = length;
+
+            while ((info = telemetryParse(&parser, &next, &remaining)) != NULL) {
+                paramsHandleMessage(info - telemetryMessageInfo(0),
+                                    &parser.frame[TELEMETRY_HEADER_LENGTH]);
+            }
+
+            uartRxRelease(length);
+        }
+
+        uint32_t wasUnsaved = paramsUnsaved();
+
+        paramsUpdate(xTaskGetTickCount() * portTICK_PERIOD_MS);
+
+        if (wasUnsaved != 0 && paramsUnsaved() == 0) {
+            DEBUG_PRINT("Params saved, gen %lu used %lu\n",
+                        paramStoreStats()->generation,
+                        paramStoreStats()->recordsUsed);
+        }
+
+        vTaskDelayUntil(&lastWakeTime, PARAM_PERIOD_MS / portTICK_PERIOD_MS);
+    }
+}
+
+#endif
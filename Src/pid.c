@@ -1,7 +1,7 @@
 #include "pid.h"
 #include "fc.h"
 
-int satLimit(int val, int min, int max, int *saturated)
+FAST_CODE int satLimit(int val, int min, int max, int *saturated)
 {
     ASSERT(saturated);
 
@@ -18,8 +18,8 @@ int satLimit(int val, int min, int max, int *saturated)
 }
 
 
-int controlLoop(int error, ControlInfo_t *info, PID_Gains_t *gain,
-                Limits_t* limits)
+FAST_CODE int controlLoop(int error, ControlInfo_t *info, PID_Gains_t *gain,
+                          Limits_t* limits)
 {
     ASSERT(gain);
     ASSERT(info);
@@ -35,6 +35,10 @@ int controlLoop(int error, ControlInfo_t *info, PID_Gains_t *gain,
                                          limits->max, &info->saturated);
     }
 
+    info->pTerm = error * gain->K_P;
+    info->iTerm = info->integratedError;
+    info->dTerm = (error - info->lastError) * gain->K_D * info->dt;
+
     int ret = error * gain->K_P + info->integratedError
         + (error - info->lastError) * gain->K_D * info->dt;
 
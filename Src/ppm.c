@@ -7,6 +7,7 @@
 #include "pins.h"
 #include "debug.h"
 #include "rc.h"
+#include "topics.h"
 
 #define PPM_IN_PIN GPIO_PIN_0
 #define PPM_IN_PORT GPIOA
@@ -14,12 +15,7 @@
 #define MINIMUM_FRAME_SPACE_US 4000
 #define MAXIMUM_PULSE_SPACE_US 2100 // Channel values range from 1000-2000, set this slightly higher so don't resync unnecessarily
 
-// Only care about most recent value, so length one and value is overwritten if
-// not read
-#define PPM_QUEUE_LENGTH       1
-
 TIM_HandleTypeDef htim5;
-QueueHandle_t ppmSignalQueue;
 
 /* TIM5 init function */
 void ppmInit(void)
@@ -89,11 +85,9 @@ void ppmInit(void)
     Error_Handler("Failed to init timer\n");
   }
 
-  ppmSignalQueue = xQueueCreate(PPM_QUEUE_LENGTH, sizeof(tPpmSignal));
-
-  if (ppmSignalQueue == NULL)
+  if (topicAdvertise(&rcInputTopic) != FC_OK)
   {
-      Error_Handler("Failed to create ppm signal queue\n");
+      Error_Handler("Failed to advertise rc input\n");
   }
 
   if(HAL_TIM_IC_Start_IT(&htim5, TIM_CHANNEL_1) != HAL_OK)
@@ -112,7 +106,7 @@ void ppmReSync(void)
     ppmCurrentInputChannel = RC_CHANNEL_IN_COUNT;
 }
 
-void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef *htim)
+FAST_CODE void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef *htim)
 {
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
 
@@ -151,8 +145,8 @@ void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef *htim)
                 {
                     // We have gone through all the channels
                     // This means we received a valid ppm frame
-                    // Post this to the queue
-                    xQueueOverwriteFromISR(ppmSignalQueue, (void *)&ppmSignal, &xHigherPriorityTaskWoken);
+                    // Publish it
+                    topicWriteFromISR(&rcInputTopic, (void *)&ppmSignal, &xHigherPriorityTaskWoken);
                 }
 
             }
@@ -214,9 +208,13 @@ void vRCTask(void *pvParameters)
     DEBUG_PRINT("Starting RC Task\n");
 
     tPpmSignal ppmSignal = {0};
+    TopicReader_t rcReader;
+
+    topicSubscribe(&rcReader, &rcInputTopic);
     for ( ;; )
     {
-        if (xQueueReceive(ppmSignalQueue, &ppmSignal, portMAX_DELAY) != pdTRUE)
+        if (topicWait(&rcReader, portMAX_DELAY) != FC_OK
+            || !topicUpdate(&rcReader, &ppmSignal))
         {
             DEBUG_PRINT("Failed to receive ppm signal\n");
         }
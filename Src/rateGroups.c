@@ -0,0 +1,171 @@
+#include <stddef.h>
+
+#include "fc.h"
+#include "rateGroups.h"
+
+/**
+ * @file Src/rateGroups.c
+ *
+ * @brief Run the work of a loop at rates divided down from the loop's own
+ *
+ * A loop's work is declared as a table of rate groups (see RATE_GROUP), each
+ * with a divider, a phase and a budget. Every iteration, rateGroupsRun runs
+ * the groups that are due, in table order, and times each against its
+ * budget with the loop's us clock.
+ *
+ * Slow groups are spread across iterations by giving them different phases,
+ * e.g. two groups every 4 iterations at phases 1 and 3 never run together.
+ * rateGroupsInit checks the worst iteration, where the most budget is due at
+ * once, still fits in the loop.
+ *
+ * The clock is passed in, so the same tables run on the host with a
+ * simulated clock, see test/rate_groups_unittest.cpp
+ */
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0) {
+        uint32_t r = a % b;
+        a = b;
+        b = r;
+    }
+
+    return a;
+}
+
+/**
+ * @brief The iterations after which the groups repeat, the lowest common
+ * multiple of their dividers
+ *
+ * @return 0 if longer than RATE_GROUPS_MAX_HYPERPERIOD
+ */
+static uint32_t hyperperiodOf(const RateGroup_t *groups, uint32_t count)
+{
+    uint32_t hyperperiod = 1;
+
+    for (uint32_t i = 0; i < count; i++) {
+        hyperperiod = hyperperiod / gcd(hyperperiod, groups[i].divider)
+                      * groups[i].divider;
+        if (hyperperiod > RATE_GROUPS_MAX_HYPERPERIOD) {
+            return 0;
+        }
+    }
+
+    return hyperperiod;
+}
+
+/**
+ * @brief The most budget due in any one iteration
+ *
+ * @return The budget in us, or UINT32_MAX if the groups take longer than
+ * RATE_GROUPS_MAX_HYPERPERIOD iterations to repeat
+ */
+uint32_t rateGroupsPeakBudgetUs(const RateGroup_t *groups, uint32_t count)
+{
+    uint32_t hyperperiod = hyperperiodOf(groups, count);
+
+    if (hyperperiod == 0) {
+        return UINT32_MAX;
+    }
+
+    uint32_t peakUs = 0;
+
+    for (uint32_t iteration = 0; iteration < hyperperiod; iteration++) {
+        uint32_t dueUs = 0;
+
+        for (uint32_t i = 0; i < count; i++) {
+            if (iteration % groups[i].divider == groups[i].phase) {
+                dueUs += groups[i].budgetUs;
+            }
+        }
+
+        if (dueUs > peakUs) {
+            peakUs = dueUs;
+        }
+    }
+
+    return peakUs;
+}
+
+/**
+ * @brief Check a table and start running it from iteration 0
+ *
+ * @param set               State of the loop, filled in
+ * @param groups            The table, kept by reference
+ * @param stats             One per group, zeroed
+ * @param count             Groups in the table
+ * @param iterationBudgetUs The most any one iteration may take
+ * @param clockUs           Times the groups
+ *
+ * @return FC_ERROR if a divider is 0, a phase isn't less than its divider,
+ * or the worst iteration is over budget
+ */
+FC_Status rateGroupsInit(RateGroupSet_t *set, const RateGroup_t *groups,
+                         RateGroupStats_t *stats, uint32_t count,
+                         uint32_t iterationBudgetUs, RateGroupClock clockUs)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (groups[i].divider == 0 || groups[i].phase >= groups[i].divider) {
+            return FC_ERROR;
+        }
+    }
+
+    if (rateGroupsPeakBudgetUs(groups, count) > iterationBudgetUs) {
+        return FC_ERROR;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        stats[i] = (RateGroupStats_t) {0};
+    }
+
+    set->groups = groups;
+    set->stats = stats;
+    set->count = count;
+    set->iteration = 0;
+    set->hyperperiod = hyperperiodOf(groups, count);
+    set->clockUs = clockUs;
+
+    return FC_OK;
+}
+
+/**
+ * @brief Run one iteration, the groups due in it
+ *
+ * @return The first group to overrun its budget this iteration, or NULL
+ */
+FAST_CODE const RateGroup_t *rateGroupsRun(RateGroupSet_t *set)
+{
+    const RateGroup_t *overrun = NULL;
+
+    for (uint32_t i = 0; i < set->count; i++) {
+        const RateGroup_t *group = &set->groups[i];
+
+        if (set->iteration % group->divider != group->phase) {
+            continue;
+        }
+
+        RateGroupStats_t *stats = &set->stats[i];
+        uint32_t startUs = set->clockUs();
+
+        group->run();
+
+        stats->lastUs = set->clockUs() - startUs;
+        stats->runs++;
+        if (stats->lastUs > stats->maxUs) {
+            stats->maxUs = stats->lastUs;
+        }
+        if (stats->lastUs > group->budgetUs) {
+            stats->overruns++;
+            if (overrun == NULL) {
+                overrun = group;
+            }
+        }
+    }
+
+    // Wrap where the groups repeat, so the phases hold however long it runs
+    if (++set->iteration == set->hyperperiod) {
+        set->iteration = 0;
+    }
+
+    return overrun;
+}
@@ -6,6 +6,7 @@
 #include "rate_control.h"
 #include "string.h"
 #include "controlLoop.h"
+#include "params.h"
 
 #ifndef __UNIT_TEST
 #include "debug.h"
@@ -14,20 +15,13 @@
 /*#define RATE_LOOP_PERIOD_US (CONTROL_LOOP_PERIOD_MS * 1000)*/
 #define RATE_LOOP_PERIOD_MS (5)
 
-// Testing on bench
+// Tuned at run time with the RATE_P/I/D parameters, see rateControlInit
 PID_Gains_t gains = {
-    2, // K_P
-    0.01, // K_I
-    1, // K_D
+    RATE_P_DEFAULT, // K_P
+    RATE_I_DEFAULT, // K_I
+    RATE_D_DEFAULT, // K_D
 };
 
-// Real
-/*PID_Gains_t gains = {*/
-    /*10, // K_P*/
-    /*0.01, // K_I*/
-    /*1 // K_D*/
-/*};*/
-
 Limits_t rateLimits = {
     ROTATION_AXIS_OUTPUT_MIN, // MIN
     ROTATION_AXIS_OUTPUT_MAX // MAX
@@ -54,6 +48,17 @@ ControlInfo_t yawInfo = {
 
 RotationAxisOutputs_t rotationOutputs = {0,0,0};
 
+/**
+ * @brief Take the gains from their parameters. New values are applied by
+ * paramsApply, which must be called from the task that calls controlRates
+ */
+void rateControlInit(void)
+{
+    paramRegister(PARAM_RATE_P, &gains.K_P);
+    paramRegister(PARAM_RATE_I, &gains.K_I);
+    paramRegister(PARAM_RATE_D, &gains.K_D);
+}
+
 void resetRateInfo()
 {
     rollInfo.integratedError = 0;
@@ -69,7 +74,7 @@ void resetRateInfo()
     yawInfo.lastError = 0;
 }
 
-RotationAxisOutputs_t* controlRates(Rates_t* actualRates, Rates_t* desiredRates)
+FAST_CODE RotationAxisOutputs_t* controlRates(Rates_t* actualRates, Rates_t* desiredRates)
 {
     ASSERT(actualRates);
     ASSERT(desiredRates);
@@ -85,3 +90,21 @@ RotationAxisOutputs_t* controlRates(Rates_t* actualRates, Rates_t* desiredRates)
     return &rotationOutputs;
 }
 
+
+/**
+ * @brief Get the pid state of one axis, including the terms from the last
+ * controlRates call
+ */
+const ControlInfo_t *getRateControlInfo(RateAxis axis)
+{
+    switch (axis)
+    {
+        case RATE_AXIS_ROLL:
+            return &rollInfo;
+        case RATE_AXIS_PITCH:
+            return &pitchInfo;
+        case RATE_AXIS_YAW:
+        default:
+            return &yawInfo;
+    }
+}
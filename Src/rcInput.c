@@ -0,0 +1,73 @@
+#include <stdbool.h>
+
+#include "fc.h"
+#include "rc.h"
+#include "rcInput.h"
+
+/**
+ * @file Src/rcInput.c
+ *
+ * @brief Turns a ppm frame into the rate setpoints, throttle and arm state
+ *
+ * Doesn't touch the hardware or the RTOS, so the same code runs in the
+ * control loop, the unit tests and the replay tool (see tools/replay.c)
+ */
+
+/**
+ * @brief Take the setpoints, throttle and arm state from a ppm frame
+ *
+ * @param[in,out] armedOut Left as it was if the arm switch is in between, or
+ *                         low with the throttle up
+ */
+FC_Status processPpmSignal(tPpmSignal *ppmSignal, Rates_t *desiredRatesOut,
+                           uint32_t *rcThrottleOut, bool *armedOut)
+{
+    uint32_t rcThrottle = ppmSignal->signals[THROTTLE_CHANNEL];
+    rcThrottle = limit(rcThrottle, MOTOR_LOW_VAL_US, MOTOR_HIGH_VAL_US);
+    (*rcThrottleOut) = rcThrottle;
+
+    // Check if we are still armed
+    // only disarm if throttle is low, so don't accidentally disarm in
+    // flight
+    if (ppmSignal->signals[ARMED_SWITCH_CHANNEL] >= SWITCH_HIGH_THRESHOLD) {
+        (*armedOut) = true;
+    } else if (ppmSignal->signals[ARMED_SWITCH_CHANNEL] <= SWITCH_LOW_THRESHOLD
+               && rcThrottle <= THROTTLE_LOW_THRESHOLD ) {
+        (*armedOut) = false;
+    }
+
+
+    /*DEBUG_PRINT("rin: %d, pin: %d, yin: %d\n", ppmSignal->signals[ROLL_CHANNEL],*/
+    /*ppmSignal->signals[PITCH_CHANNEL],ppmSignal->signals[YAW_CHANNEL]);*/
+    desiredRatesOut->roll = limit(map(ppmSignal->signals[ROLL_CHANNEL],
+                                  MIN_RC_VAL, MAX_RC_VAL,
+                                  ROTATION_AXIS_OUTPUT_MIN,
+                                  ROTATION_AXIS_OUTPUT_MAX),
+                              ROTATION_AXIS_OUTPUT_MIN,
+                              ROTATION_AXIS_OUTPUT_MAX);
+    desiredRatesOut->pitch= limit(map(ppmSignal->signals[PITCH_CHANNEL],
+                                  MIN_RC_VAL, MAX_RC_VAL,
+                                  ROTATION_AXIS_OUTPUT_MIN,
+                                  ROTATION_AXIS_OUTPUT_MAX),
+                              ROTATION_AXIS_OUTPUT_MIN,
+                              ROTATION_AXIS_OUTPUT_MAX);
+    desiredRatesOut->yaw= limit(map(ppmSignal->signals[YAW_CHANNEL],
+                                MIN_RC_VAL, MAX_RC_VAL,
+                                ROTATION_AXIS_OUTPUT_MIN,
+                                ROTATION_AXIS_OUTPUT_MAX),
+                            ROTATION_AXIS_OUTPUT_MIN,
+                            ROTATION_AXIS_OUTPUT_MAX);
+    /*DEBUG_PRINT("rd: %d, pd: %d, yd: %d\n", desiredRatesOut->roll,*/
+    /*desiredRatesOut->pitch, desiredRatesOut->yaw);*/
+
+    return FC_OK;
+}
+
+/**
+ * @return Whether the rate controller drives the motors. Otherwise they are
+ * held low and the integral terms reset, so nothing winds up on the ground
+ */
+bool rcRatesActive(bool armed, uint32_t rcThrottle)
+{
+    return armed && rcThrottle >= THROTTLE_LOW_THRESHOLD;
+}
@@ -1,3 +1,5 @@
+#include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "diskio.h"
@@ -6,6 +8,10 @@
 #include "task.h"
 
 #include "fc.h"
+#include "sd.h"
+#include "sdCard.h"
+#include "diskCache.h"
+#include "kernelObjects.h"
 
 /**
  * @file Src/sd.c
@@ -32,6 +38,7 @@
 #define SPIx_SCK_GPIO_CLK_ENABLE()       __HAL_RCC_GPIOA_CLK_ENABLE()
 #define SPIx_MISO_GPIO_CLK_ENABLE()      __HAL_RCC_GPIOA_CLK_ENABLE()
 #define SPIx_MOSI_GPIO_CLK_ENABLE()      __HAL_RCC_GPIOA_CLK_ENABLE()
+#define SPIx_DMAx_CLK_ENABLE()           __HAL_RCC_DMA2_CLK_ENABLE()
 
 #define SPIx_FORCE_RESET()               __HAL_RCC_SPI1_FORCE_RESET()
 #define SPIx_RELEASE_RESET()             __HAL_RCC_SPI1_RELEASE_RESET()
@@ -49,6 +56,12 @@
 #define SPIx_NSS_GPIO_PIN                GPIO_PIN_4
 #define SPIx_NSS_GPIO_PORT               GPIOA
 
+/* Definition for SPIx's DMA */
+#define SPIx_TX_DMA_CHANNEL              DMA_CHANNEL_3
+#define SPIx_TX_DMA_STREAM               DMA2_Stream3
+#define SPIx_RX_DMA_CHANNEL              DMA_CHANNEL_3
+#define SPIx_RX_DMA_STREAM               DMA2_Stream0
+
 
 #define SD_SPI_TIMEOUT                   5000
 // Number of retries after incorrect response
@@ -57,6 +70,13 @@
 // Length of time to wait for data start
 #define SD_READ_TIMEOUT_TICKS            200
 
+// Length of time to wait for a DMA block transfer to complete. A block takes
+// about 11ms at the slowest spi clock
+#define SD_DMA_TIMEOUT_MS                100
+
+// Length of time to wait for an erase (CTRL_TRIM) to complete
+#define SD_ERASE_TIMEOUT_MS              30000
+
 // Various SD Card protocol parameters
 
 /* MMC/SD command */
@@ -78,6 +98,7 @@
 #define CMD55	(55)		/**< APP_CMD */
 #define CMD58	(58)		/**< READ_OCR */
 /* ACMD, need to send CMD55 first */
+#define ACMD13   (0x80+13)	/**< SD_STATUS */
 #define ACMD41   (0x80+41)
 #define ACMD23   (0x80+23)
 
@@ -93,6 +114,7 @@
 #define SD_RESPONSE_R1_LENGTH_BYTES      1
 
 #define SD_CMD_ARG_CRC_LENGTH_BYTES      6
+#define SD_DATA_CRC_LENGTH_BYTES         2
 
 #define SPI_TX_BUFFER_R1_LENGTH_BYTES    (SD_CMD_ARG_CRC_LENGTH_BYTES        \
                                          + SD_NCR_LENGTH_BYTES               \
@@ -120,6 +142,13 @@
 /* Private variables */
 
 SPI_HandleTypeDef SpiHandle;
+SemaphoreHandle_t SD_DMA_CompleteSem = NULL;
+
+static DMA_HandleTypeDef hdma_tx;
+static DMA_HandleTypeDef hdma_rx;
+
+// Set from the SPI error callback, checked once the DMA semaphore is taken
+static volatile bool dmaError = false;
 
 // A array of BLOCK_SIZE bytes, initialized to 0xFF in SD_Init, used to keep
 // the DOUT line high during block reads
@@ -131,6 +160,9 @@ uint8_t rxBufferWrite[BLOCK_SIZE];
 
 static volatile DSTATUS Stat = STA_NOINIT;
 
+// Filled in by disk_initialize
+static SdCardInfo_t cardInfo;
+
 
 
 /* Private Functions */
@@ -155,6 +187,34 @@ void SPI_Init(void) {
   {
     /* Initialization Error */
   }
+
+  // disk_initialize can be called more than once, the semaphore is only
+  // created the first time
+  SD_DMA_CompleteSem = kernelQueueCreate(KERNEL_QUEUE_SD_DMA);
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+  if (hspi->Instance != SPIx) return;
+
+  xSemaphoreGiveFromISR(SD_DMA_CompleteSem, &xHigherPriorityTaskWoken);
+
+  portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+  BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+  if (hspi->Instance != SPIx) return;
+
+  // Wake the waiting task straight away rather than letting it time out
+  dmaError = true;
+  xSemaphoreGiveFromISR(SD_DMA_CompleteSem, &xHigherPriorityTaskWoken);
+
+  portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
 void HAL_SPI_MspInit(SPI_HandleTypeDef *hspi)
@@ -198,6 +258,53 @@ void HAL_SPI_MspInit(SPI_HandleTypeDef *hspi)
     GPIO_InitStruct.Mode      = GPIO_MODE_OUTPUT_PP;
     GPIO_InitStruct.Mode      = GPIO_PULLUP;
     HAL_GPIO_Init(SPIx_NSS_GPIO_PORT, &GPIO_InitStruct);
+
+    /*##-3- Configure the DMA streams ##########################################*/
+    SPIx_DMAx_CLK_ENABLE();
+
+    hdma_tx.Instance                 = SPIx_TX_DMA_STREAM;
+    hdma_tx.Init.Channel             = SPIx_TX_DMA_CHANNEL;
+    hdma_tx.Init.Direction           = DMA_MEMORY_TO_PERIPH;
+    hdma_tx.Init.PeriphInc           = DMA_PINC_DISABLE;
+    hdma_tx.Init.MemInc              = DMA_MINC_ENABLE;
+    hdma_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_tx.Init.MemDataAlignment    = DMA_MDATAALIGN_BYTE;
+    hdma_tx.Init.Mode                = DMA_NORMAL;
+    hdma_tx.Init.Priority            = DMA_PRIORITY_LOW;
+    hdma_tx.Init.FIFOMode            = DMA_FIFOMODE_DISABLE;
+    hdma_tx.Init.FIFOThreshold       = DMA_FIFO_THRESHOLD_FULL;
+    hdma_tx.Init.MemBurst            = DMA_MBURST_SINGLE;
+    hdma_tx.Init.PeriphBurst         = DMA_PBURST_SINGLE;
+
+    HAL_DMA_Init(&hdma_tx);
+    __HAL_LINKDMA(hspi, hdmatx, hdma_tx);
+
+    hdma_rx.Instance                 = SPIx_RX_DMA_STREAM;
+    hdma_rx.Init.Channel             = SPIx_RX_DMA_CHANNEL;
+    hdma_rx.Init.Direction           = DMA_PERIPH_TO_MEMORY;
+    hdma_rx.Init.PeriphInc           = DMA_PINC_DISABLE;
+    hdma_rx.Init.MemInc              = DMA_MINC_ENABLE;
+    hdma_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_rx.Init.MemDataAlignment    = DMA_MDATAALIGN_BYTE;
+    hdma_rx.Init.Mode                = DMA_NORMAL;
+    // Rx must win over tx, or the rx register can overrun
+    hdma_rx.Init.Priority            = DMA_PRIORITY_HIGH;
+    hdma_rx.Init.FIFOMode            = DMA_FIFOMODE_DISABLE;
+    hdma_rx.Init.FIFOThreshold       = DMA_FIFO_THRESHOLD_FULL;
+    hdma_rx.Init.MemBurst            = DMA_MBURST_SINGLE;
+    hdma_rx.Init.PeriphBurst         = DMA_PBURST_SINGLE;
+
+    HAL_DMA_Init(&hdma_rx);
+    __HAL_LINKDMA(hspi, hdmarx, hdma_rx);
+
+    /*##-4- Configure the NVIC for DMA #########################################*/
+    // Priority must be numerically >= configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY
+    // to use the FreeRTOS FromISR functions
+    HAL_NVIC_SetPriority(SPIx_DMA_TX_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(SPIx_DMA_TX_IRQn);
+
+    HAL_NVIC_SetPriority(SPIx_DMA_RX_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(SPIx_DMA_RX_IRQn);
   }
 }
 
@@ -216,6 +323,13 @@ void HAL_SPI_MspDeInit(SPI_HandleTypeDef *hspi)
     HAL_GPIO_DeInit(SPIx_MISO_GPIO_PORT, SPIx_MISO_PIN);
     /* Configure SPI MOSI as alternate function  */
     HAL_GPIO_DeInit(SPIx_MOSI_GPIO_PORT, SPIx_MOSI_PIN);
+
+    /*##-3- Disable the DMA Streams ############################################*/
+    HAL_DMA_DeInit(&hdma_tx);
+    HAL_DMA_DeInit(&hdma_rx);
+
+    HAL_NVIC_DisableIRQ(SPIx_DMA_TX_IRQn);
+    HAL_NVIC_DisableIRQ(SPIx_DMA_RX_IRQn);
   }
 }
 
@@ -246,6 +360,78 @@ BYTE xchg_spi(BYTE send) {
     return rx;
 }
 
+/**
+ * @brief Transfer one data block, using DMA once the scheduler is running
+ *
+ * The calling task blocks on SD_DMA_CompleteSem while the block is
+ * transferred, so the cpu is free for other tasks. Before the scheduler starts
+ * there is nothing else to run, so a polled transfer is used instead
+ *
+ * @param[in]  tx  BLOCK_SIZE bytes to send
+ * @param[out] rx  BLOCK_SIZE bytes received
+ *
+ * @return Indicates if the transfer succeeded
+ * +     0  = Success
+ * +     -2 = SPI Error, or the transfer timed out
+ */
+static int8_t SD_Transfer_Block(const uint8_t *tx, uint8_t *rx)
+{
+    if (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING) {
+        if (HAL_SPI_TransmitReceive(&SpiHandle, (uint8_t *)tx, rx, BLOCK_SIZE,
+                                    SD_SPI_TIMEOUT) != HAL_OK)
+        {
+            return -2;
+        }
+        return 0;
+    }
+
+    // Clear any completion left over from a transfer that timed out
+    xSemaphoreTake(SD_DMA_CompleteSem, 0);
+    dmaError = false;
+
+    if (HAL_SPI_TransmitReceive_DMA(&SpiHandle, (uint8_t *)tx, rx,
+                                    BLOCK_SIZE) != HAL_OK)
+    {
+        return -2;
+    }
+
+    if (xSemaphoreTake(SD_DMA_CompleteSem,
+                       SD_DMA_TIMEOUT_MS / portTICK_PERIOD_MS) != pdTRUE)
+    {
+        printf("SD DMA timeout\n");
+        HAL_SPI_Abort(&SpiHandle);
+        return -2;
+    }
+
+    if (dmaError) {
+        printf("SD DMA error %lu\n", (unsigned long)SpiHandle.ErrorCode);
+        return -2;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Clock the two data crc bytes after a block in one transfer
+ *
+ * The crc is ignored in spi mode, so the received bytes are discarded
+ *
+ * @return 0 on success, -2 on SPI error
+ */
+static int8_t SD_Skip_Crc(void)
+{
+    uint8_t rxBuffer[SD_DATA_CRC_LENGTH_BYTES];
+
+    if (HAL_SPI_TransmitReceive(&SpiHandle, txBufferRead, rxBuffer,
+                                SD_DATA_CRC_LENGTH_BYTES,
+                                SD_SPI_TIMEOUT) != HAL_OK)
+    {
+        return -2;
+    }
+
+    return 0;
+}
+
 /**
  * @brief Wait for the card to be ready
  *
@@ -454,6 +640,175 @@ int8_t SD_Command_R7(uint8_t cmd, uint32_t arg, uint8_t crc,
     return 0;
 }
 
+/**
+ * @brief Read a register that the card returns in a data block (CSD, CID or
+ * SD status)
+ *
+ * @param[in]  cmd    CMD9, CMD10 or ACMD13
+ * @param[out] buffer Buffer for the register contents
+ * @param[in]  length Length of the register in bytes
+ * @return Indicates if the register was read
+ * +     0  = Success
+ * +     -1 = R1 contains error, or timeout
+ * +     -2 = SPI Error
+ */
+static int8_t SD_Read_Register(uint8_t cmd, uint8_t *buffer, uint16_t length)
+{
+    uint8_t ret;
+    uint8_t token = 0xFF;
+
+    ret = SD_Command_R1(cmd, 0, 0xFF);
+    if (ret != 0x00) {
+        printf("CMD%d R1 error reading register: %d\n", cmd & 0x7F, ret);
+        return -1;
+    }
+
+    // ACMD13 has an R2 response, discard the second byte
+    if (cmd == ACMD13) xchg_spi(0xFF);
+
+    TickType_t startTime = HAL_GetTick();
+
+    // Wait for data start
+    while (HAL_GetTick() < startTime + SD_READ_TIMEOUT_TICKS) {
+        token = xchg_spi(0xFF);
+        if (token != 0xFF) {
+            break;
+        }
+    }
+
+    if (token != 0xFE) {
+        printf("Timed out waiting for register data start token\n");
+        return -1;
+    }
+
+    // Registers are short, so don't bother with DMA
+    if (HAL_SPI_TransmitReceive(&SpiHandle, txBufferRead, buffer, length,
+                                SD_SPI_TIMEOUT) != HAL_OK
+        || SD_Skip_Crc() != 0)
+    {
+        return -2;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Change the spi clock
+ *
+ * @param divider The spi clock divider, a power of 2 from 2 to 256
+ */
+static void SD_Set_Clock_Divider(uint32_t divider)
+{
+    // Baud rate prescaler n divides by 2^(n+1)
+    uint32_t prescaler = (__builtin_ctz(divider) - 1) << 3;
+
+    __HAL_SPI_DISABLE(&SpiHandle);
+    MODIFY_REG(SpiHandle.Instance->CR1, SPI_CR1_BR, prescaler);
+    SpiHandle.Init.BaudRatePrescaler = prescaler;
+    // The HAL re-enables the spi at the start of the next transfer
+
+    cardInfo.spiClockHz = HAL_RCC_GetPCLK2Freq() / divider;
+}
+
+/**
+ * @brief Read the card registers, and switch to the fastest spi clock the card
+ * supports
+ *
+ * Must be called after the card has left the idle state (ACMD41)
+ *
+ * @return 0 on success, -1 if a register couldn't be read or decoded
+ */
+static int8_t SD_Identify_Card(void)
+{
+    uint8_t reg[SD_STATUS_LENGTH_BYTES];
+
+    if (SD_Read_Register(CMD9, reg, SD_CSD_LENGTH_BYTES) != 0
+        || SD_Parse_CSD(reg, &cardInfo) != FC_OK)
+    {
+        printf("Failed to read CSD\n");
+        return -1;
+    }
+
+    if (SD_Read_Register(CMD10, reg, SD_CID_LENGTH_BYTES) != 0) {
+        printf("Failed to read CID\n");
+        return -1;
+    }
+    SD_Parse_CID(reg, &cardInfo);
+
+    // The CSD erase sector size is fixed for SDHC, the allocation unit in the
+    // SD status is the real erase block size. Keep the CSD value if the card
+    // doesn't report one
+    if (cardInfo.highCapacity
+        && SD_Read_Register(ACMD13, reg, SD_STATUS_LENGTH_BYTES) == 0)
+    {
+        uint32_t auSectors = SD_Parse_AU_Sectors(reg);
+        if (auSectors != 0) {
+            cardInfo.eraseBlockSectors = auSectors;
+        }
+    }
+
+    SD_Set_Clock_Divider(SD_Select_Clock_Divider(HAL_RCC_GetPCLK2Freq(),
+                                                 cardInfo.maxClockHz));
+
+    printf("Card %s rev %d.%d, %lu sectors, erase block %lu sectors\n",
+           cardInfo.productName, cardInfo.productRevision >> 4,
+           cardInfo.productRevision & 0x0F,
+           (unsigned long)cardInfo.sectorCount,
+           (unsigned long)cardInfo.eraseBlockSectors);
+    printf("Card max clock %lu Hz, spi clock %lu Hz\n",
+           (unsigned long)cardInfo.maxClockHz,
+           (unsigned long)cardInfo.spiClockHz);
+
+    return 0;
+}
+
+/**
+ * @brief Convert a sector number to a command address argument
+ *
+ * SDHC cards are addressed by sector, SDSC cards by byte
+ */
+static uint32_t SD_Sector_Address(DWORD sector)
+{
+    return cardInfo.highCapacity ? sector : sector * BLOCK_SIZE;
+}
+
+/**
+ * @brief Erase a range of sectors
+ *
+ * @param[in] start First sector to erase
+ * @param[in] end   Last sector to erase (inclusive)
+ * @return 0 on success, -1 on error or if the card can't erase single sectors
+ */
+static int8_t SD_Erase(DWORD start, DWORD end)
+{
+    if (!cardInfo.sectorErase || start > end) {
+        return -1;
+    }
+
+    if (SD_Command_R1(CMD32, SD_Sector_Address(start), 0xFF) != 0x00
+        || SD_Command_R1(CMD33, SD_Sector_Address(end), 0xFF) != 0x00
+        || SD_Command_R1(CMD38, 0, 0xFF) != 0x00)
+    {
+        printf("Erase command error\n");
+        return -1;
+    }
+
+    if (!wait_ready(SD_ERASE_TIMEOUT_MS)) {
+        printf("Erase timeout\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Get the properties of the card, valid once disk_initialize succeeds
+ */
+const SdCardInfo_t *SD_Get_Card_Info(void)
+{
+    return &cardInfo;
+}
+
 /**
  * @brief Read a block from the SD Card
  *
@@ -468,7 +823,7 @@ int8_t SD_Command_R7(uint8_t cmd, uint32_t arg, uint8_t crc,
  * +     -2 = SPI Error
  */
 int8_t SD_Read_Block(uint32_t block, uint8_t *data) {
-    uint8_t i, ret;
+    uint8_t ret;
     uint8_t rxBuffer[1] = {0xFF};
     uint8_t txBuffer[1] = {0xFF};
 
@@ -499,23 +854,14 @@ int8_t SD_Read_Block(uint32_t block, uint8_t *data) {
         return -1;
     }
 
-    // Read in the data
-    if (HAL_SPI_TransmitReceive(&SpiHandle, txBufferRead, data, BLOCK_SIZE,
-                            SD_SPI_TIMEOUT) != 0) {
+    // Read in the data, followed by the checksum
+    if (SD_Transfer_Block(txBufferRead, data) != 0
+        || SD_Skip_Crc() != 0)
+    {
         printf("Spi send failed\n");
         return -2;
     }
 
-    // Read in the checksum
-    for (i=0; i<2; i++) {
-        if (HAL_SPI_TransmitReceive(&SpiHandle, txBuffer, rxBuffer,
-                                    sizeof(rxBuffer), SD_SPI_TIMEOUT) != 0)
-        {
-            printf("Spi send failed\n");
-            return -2;
-        }
-    }
-
     return 0;
 }
 
@@ -534,7 +880,7 @@ int8_t SD_Read_Block(uint32_t block, uint8_t *data) {
  * +     -2 = SPI Error
  */
 int8_t SD_Read_Multiple_Blocks(uint32_t block, uint8_t *data, uint32_t count) {
-    uint8_t i, ret;
+    uint8_t ret;
     uint8_t rxBuffer[1] = {0xFF};
     uint8_t txBuffer[1] = {0xFF};
 
@@ -545,44 +891,37 @@ int8_t SD_Read_Multiple_Blocks(uint32_t block, uint8_t *data, uint32_t count) {
         return -1;
     }
 
-    TickType_t startTime = HAL_GetTick();
-
-    // Wait for data start
-    while (HAL_GetTick() < startTime + SD_READ_TIMEOUT_TICKS) {
-        if (HAL_SPI_TransmitReceive(&SpiHandle, txBuffer, rxBuffer,
-                            sizeof(rxBuffer), SD_SPI_TIMEOUT) != 0)
-        {
-            printf("Spi send failed\n");
-            return -2;
-        }
-        if (rxBuffer[0] != 0xFF) {
-            break;
-        }
-    }
-
-    if (rxBuffer[0] != 0xFE) {
-        printf("Timed out waiting for data start token\n");
-        return -1;
-    }
-
     // TODO: Maybe could use the CRC peripheral to discard the CRC bytes?
     // This means this could all be done in one transfer
     while (count != 0) {
-        // Read in the data
-        if (HAL_SPI_TransmitReceive(&SpiHandle, txBufferRead, data, BLOCK_SIZE,
-                            SD_SPI_TIMEOUT) != 0) {
-            printf("SPI error during multi block read\n");
-            return -2;
-        }
+        TickType_t startTime = HAL_GetTick();
 
-        // Read in the checksum
-        for (i=0; i<2; i++) {
+        // Every block has its own data start token, after a gap while the
+        // card reads it
+        rxBuffer[0] = 0xFF;
+        while (HAL_GetTick() < startTime + SD_READ_TIMEOUT_TICKS) {
             if (HAL_SPI_TransmitReceive(&SpiHandle, txBuffer, rxBuffer,
                                 sizeof(rxBuffer), SD_SPI_TIMEOUT) != 0)
             {
-                printf("SPI error during multi block read\n");
+                printf("Spi send failed\n");
                 return -2;
             }
+            if (rxBuffer[0] != 0xFF) {
+                break;
+            }
+        }
+
+        if (rxBuffer[0] != 0xFE) {
+            printf("Timed out waiting for data start token\n");
+            return -1;
+        }
+
+        // Read in the data, followed by the checksum
+        if (SD_Transfer_Block(txBufferRead, data) != 0
+            || SD_Skip_Crc() != 0)
+        {
+            printf("SPI error during multi block read\n");
+            return -2;
         }
 
         count--;
@@ -611,7 +950,7 @@ int8_t SD_Read_Multiple_Blocks(uint32_t block, uint8_t *data, uint32_t count) {
  * +     -2 = SPI Error
  */
 int8_t SD_Write_Block(uint32_t block, const uint8_t *data) {
-    uint8_t i, ret;
+    uint8_t ret;
     HAL_StatusTypeDef rc;
     uint8_t rxBuffer[1] = {0xFF};
     uint8_t txBuffer[1] = {0xFF};
@@ -639,25 +978,19 @@ int8_t SD_Write_Block(uint32_t block, const uint8_t *data) {
 
 
     // Write the data
-    rc = HAL_SPI_TransmitReceive(&SpiHandle, (uint8_t *)data,
-                                 rxBufferWrite, BLOCK_SIZE,
-                                 SD_SPI_TIMEOUT);
-    if (rc != HAL_OK) {
-        printf("2 SPI error during single block write %d\n", rc);
+    if (SD_Transfer_Block(data, rxBufferWrite) != 0) {
+        printf("2 SPI error during single block write\n");
         return -2;
     }
 
-    txBuffer[0] = 0xFF;
     // Send dummy checksum
-    for (i=0; i<2; i++) {
-        rc = HAL_SPI_TransmitReceive(&SpiHandle, txBuffer, rxBuffer,
-                                    sizeof(rxBuffer), SD_SPI_TIMEOUT);
-        if (rc != HAL_OK) {
-            printf("3 SPI error during single block write %d\n", rc);
-            return -2;
-        }
+    if (SD_Skip_Crc() != 0) {
+        printf("3 SPI error during single block write\n");
+        return -2;
     }
 
+    txBuffer[0] = 0xFF;
+
     rc = HAL_SPI_TransmitReceive(&SpiHandle, txBuffer,
                                  rxBuffer,
                                  sizeof(rxBuffer),
@@ -678,20 +1011,21 @@ int8_t SD_Write_Block(uint32_t block, const uint8_t *data) {
 }
 
 /**
- * @brief Write multiple blocks to the SD Card
+ * @brief Write multiple blocks to the SD Card with one CMD25
  *
- * @param[in] block    The block address of the block to start reading from
- * (SDHC cards are indexed by block, so the byte address would be block*512?
- * //TODO: Check this)
- * @param[in]  data    A pointer to a portion of memory to store the read block
- * @param[in]  count   The number of sectors to read
- * @return Indicates if the SD Card was succesfully initialized
+ * @param[in] block    The address of the first block (see SD_Sector_Address)
+ * @param[in] blocks   A pointer to the data for each block, or NULL if the
+ *                     blocks are contiguous in data
+ * @param[in] data     The data to write if blocks is NULL
+ * @param[in] count    The number of blocks to write
+ * @return Indicates if the blocks were succesfully written
  * +     0  = Success
  * +     -1 = R1 contains error, or timeout
  * +     -2 = SPI Error
  */
-int8_t SD_Write_Multiple_Blocks(uint32_t block, const uint8_t *data, uint32_t count) {
-    uint8_t i, ret;
+static int8_t SD_Write_Blocks(uint32_t block, const uint8_t *const *blocks,
+                              const uint8_t *data, uint32_t count) {
+    uint8_t ret;
     uint8_t rxBuffer[1] = {0xFF};
     uint8_t txBuffer[1] = {0xFF};
 
@@ -715,23 +1049,19 @@ int8_t SD_Write_Multiple_Blocks(uint32_t block, const uint8_t *data, uint32_t co
             return -2;
         }
 
-        // Write the data
-        if (HAL_SPI_TransmitReceive(&SpiHandle, (uint8_t *)data, rxBufferWrite, BLOCK_SIZE,
-                                    SD_SPI_TIMEOUT) != 0) {
+        if (blocks != NULL) {
+            data = *blocks++;
+        }
+
+        // Write the data, followed by a dummy checksum
+        if (SD_Transfer_Block(data, rxBufferWrite) != 0
+            || SD_Skip_Crc() != 0)
+        {
             printf("SPI error during multi block write\n");
             return -2;
         }
 
         txBuffer[0] = 0xFF;
-        // Send dummy checksum
-        for (i=0; i<2; i++) {
-            if (HAL_SPI_TransmitReceive(&SpiHandle, txBuffer, rxBuffer,
-                                        sizeof(rxBuffer), SD_SPI_TIMEOUT) != 0)
-            {
-                printf("SPI error during multi block write\n");
-                return -2;
-            }
-        }
 
         // Receive data response
         if (HAL_SPI_TransmitReceive(&SpiHandle, txBuffer, rxBuffer,
@@ -768,6 +1098,73 @@ int8_t SD_Write_Multiple_Blocks(uint32_t block, const uint8_t *data, uint32_t co
     return 0;
 }
 
+/**
+ * @brief Write multiple contiguous blocks to the SD Card
+ *
+ * @param[in] block    The address of the first block (see SD_Sector_Address)
+ * @param[in]  data    The data to write, count * 512 bytes
+ * @param[in]  count   The number of blocks to write
+ * @return Indicates if the blocks were succesfully written
+ * +     0  = Success
+ * +     -1 = R1 contains error, or timeout
+ * +     -2 = SPI Error
+ */
+int8_t SD_Write_Multiple_Blocks(uint32_t block, const uint8_t *data, uint32_t count) {
+    return SD_Write_Blocks(block, NULL, data, count);
+}
+
+/* Sector access used by the sector cache (diskCache.c) */
+
+DRESULT SD_Read_Sectors(BYTE *buff, DWORD sector, UINT count)
+{
+    int8_t ret;
+
+    if (count == 1) {
+        ret = SD_Read_Block(SD_Sector_Address(sector), buff);
+    } else {
+        ret = SD_Read_Multiple_Blocks(SD_Sector_Address(sector), buff, count);
+    }
+    deselect_card();
+
+    return (ret == 0) ? RES_OK : RES_ERROR;
+}
+
+/**
+ * @brief Write sectors that are not contiguous in memory, with a single
+ * multi block write if there is more than one
+ */
+DRESULT SD_Write_Sectors_Gather(const BYTE *const *buffers, DWORD sector,
+                                UINT count)
+{
+    int8_t ret;
+
+    if (count == 1) {
+        ret = SD_Write_Block(SD_Sector_Address(sector), buffers[0]);
+    } else {
+        // Let the card pre-erase the blocks it is about to receive
+        SD_Command_R1(ACMD23, count, 0xFF);
+        ret = SD_Write_Blocks(SD_Sector_Address(sector), buffers, NULL, count);
+    }
+    deselect_card();
+
+    return (ret == 0) ? RES_OK : RES_ERROR;
+}
+
+DRESULT SD_Write_Sectors(const BYTE *buff, DWORD sector, UINT count)
+{
+    int8_t ret;
+
+    if (count == 1) {
+        ret = SD_Write_Block(SD_Sector_Address(sector), buff);
+    } else {
+        SD_Command_R1(ACMD23, count, 0xFF);
+        ret = SD_Write_Multiple_Blocks(SD_Sector_Address(sector), buff, count);
+    }
+    deselect_card();
+
+    return (ret == 0) ? RES_OK : RES_ERROR;
+}
+
 /* Public functions used by FatFS */
 
 DSTATUS disk_initialize(BYTE drv) {
@@ -875,6 +1272,13 @@ DSTATUS disk_initialize(BYTE drv) {
         printf("Card type SDSC\n");
     }
 
+    if (SD_Identify_Card() != 0) {
+        return STA_NOINIT;
+    }
+
+    // Nothing cached from a previous card is valid any more
+    diskCacheInit();
+
     deselect_card();
 
     // Successfully initialized
@@ -896,19 +1300,7 @@ DRESULT disk_read(BYTE drv, BYTE *buff, DWORD sector, UINT count)
     if (Stat & STA_NOINIT) return RES_NOTRDY;
     // TODO: Check if card inserted
 
-    if (count == 1) {
-        if (SD_Read_Block(sector, buff) != 0) {
-            return RES_ERROR;
-        }
-        count = 0;
-    } else {
-        if (SD_Read_Multiple_Blocks(sector, buff, count) != 0) {
-            return RES_ERROR;
-        }
-    }
-    deselect_card();
-
-    return RES_OK;
+    return diskCacheRead(buff, sector, count);
 }
 
 DRESULT disk_write(BYTE drv, const BYTE *buff, DWORD sector, UINT count)
@@ -916,20 +1308,7 @@ DRESULT disk_write(BYTE drv, const BYTE *buff, DWORD sector, UINT count)
     if (drv != 0 || count == 0) return RES_PARERR;
     if (Stat & STA_NOINIT) return RES_NOTRDY;
 
-    if (count == 1) {
-        if (SD_Write_Block(sector, buff) != 0) {
-            return RES_ERROR;
-        }
-        count = 0;
-    } else {
-        SD_Command_R1(ACMD23, count, 0xFF);
-        if (SD_Write_Multiple_Blocks(sector, buff, count) != 0) {
-            return RES_ERROR;
-        }
-    }
-    deselect_card();
-
-    return RES_OK;
+    return diskCacheWrite(buff, sector, count);
 }
 
 DRESULT disk_ioctl (
@@ -946,8 +1325,23 @@ DRESULT disk_ioctl (
 	res = RES_ERROR;
 
 	switch (cmd) {
-	case CTRL_SYNC :		/* Wait for end of internal write process of the drive */
-		if (select_card()) res = RES_OK;
+	case CTRL_SYNC :		/* Write back cached sectors and wait for end of internal write process of the drive */
+		if (diskCacheSync() == RES_OK && select_card()) res = RES_OK;
+		break;
+
+	case GET_SECTOR_COUNT :	/* Get number of sectors on the disk (DWORD) */
+		*(DWORD*)buff = cardInfo.sectorCount;
+		res = RES_OK;
+		break;
+
+	case GET_BLOCK_SIZE :	/* Get erase block size in unit of sector (DWORD) */
+		*(DWORD*)buff = cardInfo.eraseBlockSectors;
+		res = RES_OK;
+		break;
+
+	case CTRL_TRIM :		/* Erase a block of sectors (used when _USE_TRIM == 1) */
+		diskCacheInvalidate(((DWORD*)buff)[0], ((DWORD*)buff)[1]);
+		if (SD_Erase(((DWORD*)buff)[0], ((DWORD*)buff)[1]) == 0) res = RES_OK;
 		break;
 
 	default:
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos.h"
+#include "task.h"
+
+#include "fc.h"
+#include "debug.h"
+#include "ff.h"
+#include "sd.h"
+#include "logFile.h"
+#include "diskCache.h"
+
+/**
+ * @file Src/sdBenchmark.c
+ *
+ * @brief Measure sustained sd card throughput through FatFs
+ *
+ * Writes a test file in large chunks, then reads it back, and prints the
+ * throughput and the slowest chunk. Then writes a pre-allocated log file (see
+ * logFile.c) in small pieces, the way the blackbox does. This is a bring-up tool, create
+ * vSdBenchmarkTask in main.c instead of vBlackboxTask to run it (both mount
+ * the card).
+ */
+
+#define SD_BENCH_FILE_NAME     "SDBENCH.BIN"
+#define SD_BENCH_FILE_SIZE     (1024 * 1024)
+// Multiple of the sector size, so FatFs writes straight from this buffer with
+// multi block commands
+#define SD_BENCH_CHUNK_SIZE    2048
+
+#define SD_BENCH_LOG_NAME      "SDBENCH.LOG"
+// About the size of an encoded blackbox frame
+#define SD_BENCH_LOG_PIECE     64
+
+static FATFS benchFileSystem;
+static FIL benchFile;
+static uint8_t benchBuffer[SD_BENCH_CHUNK_SIZE];
+static LogFile_t benchLog;
+
+/**
+ * @brief Print the throughput of a test phase
+ *
+ * @param name      Name of the test phase
+ * @param bytes     Number of bytes transferred
+ * @param elapsedMs Total time taken
+ * @param worstMs   Longest time for a single chunk
+ */
+static void printResult(const char *name, uint32_t bytes, uint32_t elapsedMs,
+                        uint32_t worstMs)
+{
+    // Bytes per ms is (decimal) KB/s
+    uint32_t kbPerSec = (elapsedMs != 0) ? bytes / elapsedMs : 0;
+
+    DEBUG_PRINT("SD %s %lu.%03lu MB/s\n", name, kbPerSec / 1000,
+                kbPerSec % 1000);
+    DEBUG_PRINT("SD %s worst chunk %lu ms\n", name, worstMs);
+}
+
+/**
+ * @brief Write or read the whole test file, timing each chunk
+ *
+ * @param write True to write the file, false to read it
+ *
+ * @return FC_OK, or FC_ERROR if FatFs returned an error
+ */
+static FC_Status runPhase(bool write)
+{
+    uint32_t worstMs = 0;
+    uint32_t startMs;
+    UINT transferred;
+    FRESULT res;
+
+    res = f_open(&benchFile, SD_BENCH_FILE_NAME,
+                 write ? (FA_WRITE | FA_CREATE_ALWAYS) : FA_READ);
+    if (res != FR_OK) {
+        DEBUG_PRINT("SD bench open fail %d\n", res);
+        return FC_ERROR;
+    }
+
+    startMs = HAL_GetTick();
+
+    for (uint32_t done = 0; done < SD_BENCH_FILE_SIZE;
+         done += SD_BENCH_CHUNK_SIZE)
+    {
+        uint32_t chunkStartMs = HAL_GetTick();
+
+        if (write) {
+            res = f_write(&benchFile, benchBuffer, SD_BENCH_CHUNK_SIZE,
+                          &transferred);
+        } else {
+            res = f_read(&benchFile, benchBuffer, SD_BENCH_CHUNK_SIZE,
+                         &transferred);
+        }
+
+        if (res != FR_OK || transferred != SD_BENCH_CHUNK_SIZE) {
+            DEBUG_PRINT("SD bench %s fail %d\n", write ? "write" : "read",
+                        res);
+            f_close(&benchFile);
+            return FC_ERROR;
+        }
+
+        uint32_t chunkMs = HAL_GetTick() - chunkStartMs;
+        if (chunkMs > worstMs) {
+            worstMs = chunkMs;
+        }
+    }
+
+    // Include flushing the last data and directory entry in the write time
+    res = f_close(&benchFile);
+    if (res != FR_OK) {
+        DEBUG_PRINT("SD bench close fail %d\n", res);
+        return FC_ERROR;
+    }
+
+    printResult(write ? "write" : "read", SD_BENCH_FILE_SIZE,
+                HAL_GetTick() - startMs, worstMs);
+
+    return FC_OK;
+}
+
+/**
+ * @brief Stream the test file through a pre-allocated log file
+ *
+ * @return FC_OK, or FC_ERROR if FatFs returned an error
+ */
+static FC_Status runLogPhase(void)
+{
+    uint32_t worstMs = 0;
+    uint32_t startMs;
+    FRESULT res;
+
+    // Left over from the last run, logFileOpen only creates new files
+    f_unlink(SD_BENCH_LOG_NAME);
+
+    res = logFileOpen(&benchLog, SD_BENCH_LOG_NAME, SD_BENCH_FILE_SIZE);
+    if (res != FR_OK) {
+        DEBUG_PRINT("SD bench log open fail %d\n", res);
+        return FC_ERROR;
+    }
+
+    startMs = HAL_GetTick();
+
+    for (uint32_t done = 0; done < SD_BENCH_FILE_SIZE;
+         done += SD_BENCH_LOG_PIECE)
+    {
+        uint32_t pieceStartMs = HAL_GetTick();
+
+        res = logFileWrite(&benchLog, &benchBuffer[done % SD_BENCH_CHUNK_SIZE],
+                           SD_BENCH_LOG_PIECE);
+        if (res != FR_OK) {
+            DEBUG_PRINT("SD bench log fail %d\n", res);
+            logFileClose(&benchLog);
+            return FC_ERROR;
+        }
+
+        uint32_t pieceMs = HAL_GetTick() - pieceStartMs;
+        if (pieceMs > worstMs) {
+            worstMs = pieceMs;
+        }
+    }
+
+    res = logFileClose(&benchLog);
+    if (res != FR_OK) {
+        DEBUG_PRINT("SD bench log close fail %d\n", res);
+        return FC_ERROR;
+    }
+
+    printResult("log", SD_BENCH_FILE_SIZE, HAL_GetTick() - startMs, worstMs);
+
+    return FC_OK;
+}
+
+/**
+ * @brief Print the sector cache statistics (see diskCache.c) for everything
+ * since the card was mounted
+ */
+static void printCacheStats(void)
+{
+    const DiskCacheStats_t *stats = diskCacheStats();
+
+    DEBUG_PRINT("SD cache rd hit %lu miss %lu\n",
+                stats->readHits, stats->readMisses);
+    DEBUG_PRINT("SD cache wr hit %lu miss %lu\n",
+                stats->writeHits, stats->writeMisses);
+    DEBUG_PRINT("SD cache bypass rd %lu wr %lu\n",
+                stats->bypassReads, stats->bypassWrites);
+    DEBUG_PRINT("SD cache evict %lu\n", stats->evictions);
+    DEBUG_PRINT("SD cache flush %lu sect %lu cmd\n",
+                stats->flushedSectors, stats->flushCommands);
+}
+
+void vSdBenchmarkTask(void *pvParameters)
+{
+    FRESULT res;
+
+    res = f_mount(&benchFileSystem, "", 1 /* mount now */);
+    if (res != FR_OK) {
+        DEBUG_PRINT("SD bench mount fail %d\n", res);
+        vTaskDelete(NULL);
+    }
+
+    DEBUG_PRINT("SD spi clock %lu kHz\n",
+                SD_Get_Card_Info()->spiClockHz / 1000);
+
+    for (uint32_t i = 0; i < SD_BENCH_CHUNK_SIZE; i++) {
+        benchBuffer[i] = i;
+    }
+
+    if (runPhase(true) == FC_OK) {
+        runPhase(false);
+    }
+
+    runLogPhase();
+    printCacheStats();
+
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,189 @@
+#include <string.h>
+
+#include "fc.h"
+#include "sdCard.h"
+
+/**
+ * @file Src/sdCard.c
+ *
+ * @brief Decoding of the sd card CSD, CID and SD status registers
+ *
+ * Registers are passed in as read from the card, most significant byte first.
+ * Bit positions below are as numbered in the SD physical layer specification,
+ * where bit 0 is the lsb of the last byte.
+ *
+ * This file doesn't touch the hardware, so it can be unit tested.
+ */
+
+#define CSD_STRUCTURE_V1   0
+#define CSD_STRUCTURE_V2   1
+
+// Smallest and largest spi baud rate prescalers, as powers of 2
+#define SPI_MIN_DIVIDER_LOG2   1
+#define SPI_MAX_DIVIDER_LOG2   8
+
+/**
+ * @brief Extract a field from a register
+ *
+ * @param reg    The register, most significant byte first
+ * @param length Length of the register in bytes
+ * @param msb    Highest bit of the field
+ * @param lsb    Lowest bit of the field, the field must be at most 32 bits
+ */
+static uint32_t getBits(const uint8_t *reg, int length, int msb, int lsb)
+{
+    uint32_t val = 0;
+
+    for (int bit = msb; bit >= lsb; bit--) {
+        int byte = length - 1 - bit / 8;
+        val = (val << 1) | ((reg[byte] >> (bit % 8)) & 1);
+    }
+
+    return val;
+}
+
+#define CSD_BITS(msb, lsb) getBits(csd, SD_CSD_LENGTH_BYTES, (msb), (lsb))
+#define CID_BITS(msb, lsb) getBits(cid, SD_CID_LENGTH_BYTES, (msb), (lsb))
+
+/**
+ * @brief Decode TRAN_SPEED, the maximum data transfer rate
+ *
+ * @return The maximum clock rate in Hz, or 0 if reserved values are used
+ */
+static uint32_t decodeTranSpeed(uint8_t tranSpeed)
+{
+    // Multipliers are 10 times the value in the spec
+    static const uint8_t timeValue[16] = {
+        0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80
+    };
+    static const uint32_t rateUnit[4] = {
+        100000 / 10, 1000000 / 10, 10000000 / 10, 100000000 / 10
+    };
+    uint8_t unit = tranSpeed & 0x07;
+
+    if (unit > 3) {
+        return 0;
+    }
+
+    return rateUnit[unit] * timeValue[(tranSpeed >> 3) & 0x0F];
+}
+
+/**
+ * @brief Decode the CSD register
+ *
+ * Fills in the capacity, erase and speed fields of info
+ *
+ * @return Indicates if the CSD could be decoded
+ * +     0  = Success
+ * +     1  = Unknown CSD structure version or invalid contents
+ */
+FC_Status SD_Parse_CSD(const uint8_t csd[SD_CSD_LENGTH_BYTES],
+                       SdCardInfo_t *info)
+{
+    uint32_t structure = CSD_BITS(127, 126);
+
+    if (structure == CSD_STRUCTURE_V1) {
+        uint32_t cSize = CSD_BITS(73, 62);
+        uint32_t cSizeMult = CSD_BITS(49, 47);
+        uint32_t readBlLen = CSD_BITS(83, 80);
+
+        if (readBlLen < 9 || readBlLen > 11) {
+            return FC_ERROR;
+        }
+
+        // capacity = (C_SIZE + 1) * 2^(C_SIZE_MULT + 2) * 2^READ_BL_LEN bytes
+        info->sectorCount = (cSize + 1) << (cSizeMult + 2 + readBlLen - 9);
+        info->csdVersion = 1;
+        info->highCapacity = false;
+    } else if (structure == CSD_STRUCTURE_V2) {
+        // capacity = (C_SIZE + 1) * 512 KB
+        info->sectorCount = (CSD_BITS(69, 48) + 1) << 10;
+        info->csdVersion = 2;
+        info->highCapacity = true;
+    } else {
+        return FC_ERROR;
+    }
+
+    info->sectorErase = CSD_BITS(46, 46);
+    // SECTOR_SIZE is in units of the write block length, which is always 512
+    // bytes for the cards we support
+    info->eraseBlockSectors = CSD_BITS(45, 39) + 1;
+    info->maxClockHz = decodeTranSpeed(CSD_BITS(103, 96));
+
+    if (info->maxClockHz == 0) {
+        return FC_ERROR;
+    }
+
+    return FC_OK;
+}
+
+/**
+ * @brief Decode the CID register, for identifying the card in logs
+ */
+void SD_Parse_CID(const uint8_t cid[SD_CID_LENGTH_BYTES], SdCardInfo_t *info)
+{
+    info->manufacturerId = cid[0];
+    memcpy(info->oemId, &cid[1], 2);
+    info->oemId[2] = '\0';
+    memcpy(info->productName, &cid[3], 5);
+    info->productName[5] = '\0';
+    info->productRevision = cid[8];
+    info->serialNumber = CID_BITS(55, 24);
+}
+
+/**
+ * @brief Get the allocation unit size from the SD status register (ACMD13)
+ *
+ * This is the erase block size for SDHC cards, where the CSD SECTOR_SIZE field
+ * is fixed
+ *
+ * @return The allocation unit size in sectors, or 0 if not defined
+ */
+uint32_t SD_Parse_AU_Sectors(const uint8_t status[SD_STATUS_LENGTH_BYTES])
+{
+    // AU_SIZE is bits [431:428]. 1 = 16 KB, doubling up to 9 = 4 MB. Higher
+    // values are only used by SDXC cards and don't double, these are in MB
+    static const uint32_t largeAuSectors[] = {
+        8 * 2048, 12 * 2048, 16 * 2048, 24 * 2048, 32 * 2048, 64 * 2048,
+    };
+    uint32_t auSize = getBits(status, SD_STATUS_LENGTH_BYTES, 431, 428);
+
+    if (auSize == 0) {
+        return 0;
+    } else if (auSize <= 9) {
+        return 32u << (auSize - 1);
+    } else if (auSize - 10 < sizeof(largeAuSectors) / sizeof(largeAuSectors[0])) {
+        return largeAuSectors[auSize - 10];
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Pick the spi baud rate prescaler for a card
+ *
+ * @param pclkHz     The spi peripheral clock
+ * @param maxClockHz The maximum clock the card supports
+ *
+ * @return The smallest supported divider (2 to 256) that keeps the spi clock at
+ *         or below both maxClockHz and SD_SPI_MAX_CLOCK_HZ
+ */
+uint32_t SD_Select_Clock_Divider(uint32_t pclkHz, uint32_t maxClockHz)
+{
+    uint32_t log2Divider;
+
+    if (maxClockHz > SD_SPI_MAX_CLOCK_HZ) {
+        maxClockHz = SD_SPI_MAX_CLOCK_HZ;
+    }
+
+    for (log2Divider = SPI_MIN_DIVIDER_LOG2;
+         log2Divider < SPI_MAX_DIVIDER_LOG2;
+         log2Divider++)
+    {
+        if ((pclkHz >> log2Divider) <= maxClockHz) {
+            break;
+        }
+    }
+
+    return 1u << log2Divider;
+}
@@ -0,0 +1,229 @@
+#include <string.h>
+
+#include "fc.h"
+#include "taskStats.h"
+#include "telemetry.h"
+
+#ifndef __UNIT_TEST
+#include "freertos.h"
+#include "task.h"
+#include "debug.h"
+#include "motors.h"
+#endif
+
+/**
+ * @file Src/taskStats.c
+ *
+ * @brief Cpu use and stack margin of each task
+ *
+ * The kernel counts the time each task runs on TIM5, the same 1 MHz counter
+ * used for loop timing (see portGET_RUN_TIME_COUNTER_VALUE in
+ * FreeRTOSConfig.h). Every TASK_STATS_PERIOD_MS the counters are read and
+ * the share of the interval each task used is sent as the TASK_STATS
+ * telemetry message, along with the least free stack each task has had.
+ * The load of everything but the idle task is the headroom left for the
+ * control loop. Time spent in interrupts is counted against the task they
+ * interrupted.
+ *
+ * A stack overflow, caught by the kernel on a context switch, stops the
+ * motors and halts (see vApplicationStackOverflowHook).
+ */
+
+static uint32_t lastNowUs;
+static uint32_t lastNumber[TELEMETRY_MAX_TASKS];
+static uint32_t lastRunTimeUs[TELEMETRY_MAX_TASKS];
+static uint32_t lastCount;
+
+/**
+ * @brief Start a new interval, forgetting any previous one
+ *
+ * @param nowUs The run time counter
+ */
+void taskStatsReset(uint32_t nowUs)
+{
+    lastNowUs = nowUs;
+    lastCount = 0;
+}
+
+static bool sampleBefore(const TaskStatsSample_t *a, const TaskStatsSample_t *b)
+{
+    // Idle goes last, so it is kept if there are too many tasks to report
+    if (a->idle != b->idle) {
+        return b->idle;
+    }
+    return a->number < b->number;
+}
+
+static uint32_t previousRunTime(uint32_t number)
+{
+    for (uint32_t i = 0; i < lastCount; i++) {
+        if (lastNumber[i] == number) {
+            return lastRunTimeUs[i];
+        }
+    }
+
+    // Created during the interval, its counter started at 0
+    return 0;
+}
+
+static uint16_t loadPermille(uint32_t runUs, uint32_t intervalUs)
+{
+    if (intervalUs == 0) {
+        return 0;
+    }
+
+    uint64_t load = (uint64_t)runUs * 1000 / intervalUs;
+
+    return (load > 1000) ? 1000 : load;
+}
+
+/**
+ * @brief Work out the share of the cpu each task used since the last call
+ *
+ * Counters are 32 bit us and wrap every 71 minutes, the interval must be
+ * shorter than that
+ *
+ * @param samples Every task, in any order
+ * @param count   Number of samples. If more than TELEMETRY_MAX_TASKS, the
+ *                newest tasks are left out, but never the idle task
+ * @param nowUs   The run time counter when the samples were read
+ * @param[out] out The report
+ */
+void taskStatsCompute(const TaskStatsSample_t *samples, uint32_t count,
+                      uint32_t nowUs, TelemetryTaskStats_t *out)
+{
+    const TaskStatsSample_t *sorted[TASK_STATS_MAX_KERNEL_TASKS];
+    uint32_t sortedCount = 0;
+    uint32_t intervalUs = nowUs - lastNowUs;
+
+    if (count > TASK_STATS_MAX_KERNEL_TASKS) {
+        count = TASK_STATS_MAX_KERNEL_TASKS;
+    }
+
+    // Insertion sort, there are only a few tasks
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t j = sortedCount++;
+
+        while (j > 0 && sampleBefore(&samples[i], sorted[j - 1])) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = &samples[i];
+    }
+
+    if (sortedCount > TELEMETRY_MAX_TASKS) {
+        if (sorted[sortedCount - 1]->idle) {
+            sorted[TELEMETRY_MAX_TASKS - 1] = sorted[sortedCount - 1];
+        }
+        sortedCount = TELEMETRY_MAX_TASKS;
+    }
+
+    memset(out, 0, sizeof(*out));
+    out->timeUs = nowUs;
+    out->intervalUs = intervalUs;
+    out->taskCount = sortedCount;
+
+    bool haveIdle = false;
+    uint32_t busy = 0;
+
+    for (uint32_t i = 0; i < sortedCount; i++) {
+        const TaskStatsSample_t *sample = sorted[i];
+        uint32_t runUs = sample->runTimeUs - previousRunTime(sample->number);
+        uint16_t load = loadPermille(runUs, intervalUs);
+
+        out->taskNumber[i] = sample->number;
+        out->taskLoad[i] = load;
+        out->stackFree[i] = sample->stackFree;
+
+        if (sample->idle) {
+            haveIdle = true;
+            out->cpuLoad = 1000 - load;
+        } else {
+            busy += load;
+        }
+    }
+
+    if (!haveIdle) {
+        out->cpuLoad = (busy > 1000) ? 1000 : busy;
+    }
+
+    for (uint32_t i = 0; i < sortedCount; i++) {
+        lastNumber[i] = sorted[i]->number;
+        lastRunTimeUs[i] = sorted[i]->runTimeUs;
+    }
+    lastCount = sortedCount;
+    lastNowUs = nowUs;
+}
+
+#ifndef __UNIT_TEST
+
+/**
+ * @brief Called by the kernel when a task has overrun its stack
+ *
+ * Memory past the stack may have been overwritten, so nothing can be
+ * trusted. Force the motors low, straight through the timer registers,
+ * then halt
+ */
+void vApplicationStackOverflowHook(TaskHandle_t xTask, char *pcTaskName)
+{
+    (void)xTask;
+
+    motorsStop();
+    Error_Handler(pcTaskName);
+}
+
+void vTaskStatsTask(void *pvParameters)
+{
+    // Too big for the task stack
+    static TaskStatus_t status[TASK_STATS_MAX_KERNEL_TASKS];
+    static TaskStatsSample_t samples[TASK_STATS_MAX_KERNEL_TASKS];
+    static TelemetryTaskStats_t report;
+    TelemetryTaskStats_t latest;
+    uint32_t lastNumberPrinted = 0;
+    uint32_t nowUs;
+    UBaseType_t count;
+
+    telemetrySetSource(TELEMETRY_MSG_TASK_STATS, 0, &report, sizeof(report));
+
+    uxTaskGetSystemState(status, TASK_STATS_MAX_KERNEL_TASKS, &nowUs);
+    taskStatsReset(nowUs);
+
+    TickType_t lastWakeTime = xTaskGetTickCount();
+    for ( ;; )
+    {
+        vTaskDelayUntil(&lastWakeTime, TASK_STATS_PERIOD_MS / portTICK_PERIOD_MS);
+
+        count = uxTaskGetSystemState(status, TASK_STATS_MAX_KERNEL_TASKS,
+                                     &nowUs);
+
+        for (UBaseType_t i = 0; i < count; i++) {
+            samples[i].name = status[i].pcTaskName;
+            samples[i].number = status[i].xTaskNumber;
+            samples[i].runTimeUs = status[i].ulRunTimeCounter;
+            samples[i].stackFree = status[i].usStackHighWaterMark;
+            samples[i].idle = (status[i].xHandle == xTaskGetIdleTaskHandle());
+        }
+
+        taskStatsCompute(samples, count, nowUs, &latest);
+
+        // Telemetry copies the report with interrupts disabled
+        taskENTER_CRITICAL();
+        report = latest;
+        taskEXIT_CRITICAL();
+
+        // TASK_STATS only has task numbers, name each task once
+        uint32_t highestNumber = lastNumberPrinted;
+        for (UBaseType_t i = 0; i < count; i++) {
+            if (samples[i].number > lastNumberPrinted) {
+                DEBUG_PRINT("Task %lu %s\n", samples[i].number,
+                            samples[i].name);
+            }
+            if (samples[i].number > highestNumber) {
+                highestNumber = samples[i].number;
+            }
+        }
+        lastNumberPrinted = highestNumber;
+    }
+}
+
+#endif
@@ -0,0 +1,514 @@
+#include <string.h>
+
+#include "fc.h"
+#include "telemetry.h"
+#include "uartTx.h"
+
+#ifndef __UNIT_TEST
+#include "freertos.h"
+#include "task.h"
+#include "debug.h"
+#endif
+
+/**
+ * @file Src/telemetry.c
+ *
+ * @brief Binary telemetry on the debug uart
+ *
+ * Each message is sent at its own rate, from live data registered by its
+ * owner with telemetrySetSource. Frames are written straight from the live
+ * data into the uart ring (see uartTxBegin), with interrupts disabled, so
+ * every frame is a consistent snapshot and there is no intermediate copy.
+ *
+ * The total rate is kept within TELEMETRY_LINK_SHARE_PERCENT of the uart
+ * bandwidth: if the configured rates would exceed it, the message using the
+ * most bandwidth is slowed until they fit.
+ *
+ * Messages with a default rate of 0 are only sent on request, with
+ * telemetrySend. Frames from the ground station are read with
+ * telemetryParse.
+ *
+ * tools/telemetry_decode reads the stream on the host.
+ */
+
+static const TelemetryMessageInfo_t messageInfo[TELEMETRY_MSG_COUNT] = {
+    [TELEMETRY_MSG_HEARTBEAT]  = {"HEARTBEAT", 0, 50,
+                                  sizeof(TelemetryHeartbeat_t), 1},
+    [TELEMETRY_MSG_ATTITUDE]   = {"ATTITUDE", 180, 117,
+                                  3 * sizeof(int32_t), 10},
+    [TELEMETRY_MSG_RATES]      = {"RATES", 181, 201,
+                                  6 * sizeof(int32_t), 50},
+    [TELEMETRY_MSG_RC_INPUT]   = {"RC_INPUT", 182, 73,
+                                  TELEMETRY_RC_INPUT_LENGTH, 10},
+    [TELEMETRY_MSG_MOTORS]     = {"MOTORS", 183, 158,
+                                  TELEMETRY_MOTORS_LENGTH, 50},
+    [TELEMETRY_MSG_LOOP_STATS] = {"LOOP_STATS", 184, 39,
+                                  sizeof(TelemetryLoopStats_t), 5},
+    [TELEMETRY_MSG_PARAM_REQUEST_READ] = {"PARAM_REQUEST_READ", 20, 214,
+                                          sizeof(TelemetryParamRequestRead_t), 0},
+    [TELEMETRY_MSG_PARAM_REQUEST_LIST] = {"PARAM_REQUEST_LIST", 21, 159,
+                                          sizeof(TelemetryParamRequestList_t), 0},
+    [TELEMETRY_MSG_PARAM_VALUE]        = {"PARAM_VALUE", 22, 220,
+                                          sizeof(TelemetryParamValue_t), 0},
+    [TELEMETRY_MSG_PARAM_SET]          = {"PARAM_SET", 23, 168,
+                                          sizeof(TelemetryParamSet_t), 0},
+    [TELEMETRY_MSG_TASK_STATS] = {"TASK_STATS", 185, 91,
+                                  sizeof(TelemetryTaskStats_t), 1},
+    [TELEMETRY_MSG_TRACE_EVENTS] = {"TRACE_EVENTS", 186, 12,
+                                    sizeof(TelemetryTraceEvents_t), 0},
+    [TELEMETRY_MSG_TRACE_NAME]   = {"TRACE_NAME", 187, 230,
+                                    sizeof(TelemetryTraceName_t), 0},
+    [TELEMETRY_MSG_LOOP_TIMING]  = {"LOOP_TIMING", 188, 147,
+                                    sizeof(TelemetryLoopTiming_t), 1},
+};
+
+typedef struct TelemetrySource_t {
+    const void *data;
+    uint32_t    length;
+} TelemetrySource_t;
+
+typedef struct TelemetrySchedule_t {
+    uint32_t rateHz;
+    uint32_t periodMs;
+    uint32_t nextMs;
+    bool     started;
+} TelemetrySchedule_t;
+
+static TelemetrySource_t sources[TELEMETRY_MSG_COUNT][TELEMETRY_MAX_SOURCES];
+static TelemetrySchedule_t schedule[TELEMETRY_MSG_COUNT];
+static TelemetryHeartbeat_t heartbeat;
+static bool heartbeatArmed = false;
+static bool heartbeatCritical = false;
+static TelemetryStats_t stats;
+static uint32_t linkBudget = 0;
+static uint8_t sequence = 0;
+
+const TelemetryMessageInfo_t *telemetryMessageInfo(TelemetryMessage msg)
+{
+    if (msg >= TELEMETRY_MSG_COUNT) {
+        return NULL;
+    }
+
+    return &messageInfo[msg];
+}
+
+/**
+ * @brief Find a message by its MAVLink message id
+ *
+ * @return The message, or NULL if it isn't one of ours
+ */
+const TelemetryMessageInfo_t *telemetryFindMessage(uint8_t id)
+{
+    for (int i = 0; i < TELEMETRY_MSG_COUNT; i++) {
+        if (messageInfo[i].id == id) {
+            return &messageInfo[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief CRC-16/MCRF4XX, as used by MAVLink
+ */
+uint16_t telemetryCrcAccumulate(uint16_t crc, const void *data,
+                                uint32_t length)
+{
+    const uint8_t *bytes = data;
+
+    for (uint32_t i = 0; i < length; i++) {
+        uint8_t tmp = bytes[i] ^ (uint8_t)(crc & 0xFF);
+        tmp ^= (tmp << 4);
+        crc = (crc >> 8) ^ ((uint16_t)tmp << 8) ^ ((uint16_t)tmp << 3)
+              ^ (tmp >> 4);
+    }
+
+    return crc;
+}
+
+static uint32_t messageLoad(TelemetryMessage msg, uint32_t rateHz)
+{
+    return rateHz * (messageInfo[msg].payloadLength + TELEMETRY_FRAME_OVERHEAD);
+}
+
+static uint32_t totalLoad(void)
+{
+    uint32_t load = 0;
+
+    for (int i = 0; i < TELEMETRY_MSG_COUNT; i++) {
+        load += messageLoad(i, schedule[i].rateHz);
+    }
+
+    return load;
+}
+
+static void applyRate(TelemetryMessage msg, uint32_t rateHz)
+{
+    schedule[msg].rateHz = rateHz;
+    schedule[msg].periodMs = (rateHz != 0) ? 1000 / rateHz : 0;
+    schedule[msg].started = false;
+}
+
+/**
+ * @brief Slow the heaviest messages until the total fits the link budget
+ */
+static void enforceBudget(void)
+{
+    while (totalLoad() > linkBudget) {
+        TelemetryMessage heaviest = TELEMETRY_MSG_HEARTBEAT;
+
+        for (int i = 0; i < TELEMETRY_MSG_COUNT; i++) {
+            if (messageLoad(i, schedule[i].rateHz)
+                > messageLoad(heaviest, schedule[heaviest].rateHz))
+            {
+                heaviest = i;
+            }
+        }
+
+        applyRate(heaviest, schedule[heaviest].rateHz / 2);
+    }
+}
+
+/**
+ * @brief Reset to the default message rates
+ *
+ * Registered sources are kept, so this can be called after the data owners
+ * have registered
+ *
+ * @param linkBytesPerSecond The uart bandwidth (baud / 10)
+ */
+void telemetryInit(uint32_t linkBytesPerSecond)
+{
+    linkBudget = linkBytesPerSecond * TELEMETRY_LINK_SHARE_PERCENT / 100;
+    sequence = 0;
+    memset(&stats, 0, sizeof(stats));
+
+    for (int i = 0; i < TELEMETRY_MSG_COUNT; i++) {
+        applyRate(i, messageInfo[i].defaultRateHz);
+    }
+    enforceBudget();
+
+    heartbeat.customMode = 0;
+    heartbeat.type = TELEMETRY_MAV_TYPE_QUADROTOR;
+    heartbeat.autopilot = TELEMETRY_MAV_AUTOPILOT_GENERIC;
+    heartbeat.mavlinkVersion = TELEMETRY_MAVLINK_VERSION;
+    telemetrySetArmed(false);
+    telemetrySetCritical(false);
+    telemetrySetSource(TELEMETRY_MSG_HEARTBEAT, 0, &heartbeat,
+                       sizeof(heartbeat));
+}
+
+/**
+ * @brief Set where part of a message payload is sent from
+ *
+ * The data is read every time the message is sent, so it must stay valid. A
+ * message is only sent once the lengths of its sources add up to its payload
+ * length
+ *
+ * @param msg    The message
+ * @param index  Which piece of the payload, in order from 0
+ * @param data   The live data
+ * @param length Number of bytes of data to send
+ */
+void telemetrySetSource(TelemetryMessage msg, int index, const void *data,
+                        uint32_t length)
+{
+    if (msg >= TELEMETRY_MSG_COUNT || index < 0
+        || index >= TELEMETRY_MAX_SOURCES)
+    {
+        return;
+    }
+
+    sources[msg][index].data = data;
+    sources[msg][index].length = length;
+}
+
+/**
+ * @brief Change how often a message is sent
+ *
+ * @param rateHz Up to TELEMETRY_MAX_RATE_HZ, 0 to stop sending it
+ *
+ * @return FC_OK if set, FC_ERROR if the rate is too high or would take the
+ * total over the link budget
+ */
+FC_Status telemetrySetRate(TelemetryMessage msg, uint32_t rateHz)
+{
+    uint32_t oldRate;
+
+    if (msg >= TELEMETRY_MSG_COUNT || rateHz > TELEMETRY_MAX_RATE_HZ) {
+        return FC_ERROR;
+    }
+
+    oldRate = schedule[msg].rateHz;
+    applyRate(msg, rateHz);
+
+    if (totalLoad() > linkBudget) {
+        applyRate(msg, oldRate);
+        return FC_ERROR;
+    }
+
+    return FC_OK;
+}
+
+uint32_t telemetryGetRate(TelemetryMessage msg)
+{
+    return (msg < TELEMETRY_MSG_COUNT) ? schedule[msg].rateHz : 0;
+}
+
+static void updateHeartbeat(void)
+{
+    heartbeat.baseMode = heartbeatArmed ? TELEMETRY_MAV_MODE_FLAG_ARMED : 0;
+
+    if (heartbeatCritical) {
+        heartbeat.systemStatus = TELEMETRY_MAV_STATE_CRITICAL;
+    } else {
+        heartbeat.systemStatus = heartbeatArmed ? TELEMETRY_MAV_STATE_ACTIVE
+                                                : TELEMETRY_MAV_STATE_STANDBY;
+    }
+}
+
+void telemetrySetArmed(bool armed)
+{
+    heartbeatArmed = armed;
+    updateHeartbeat();
+}
+
+/**
+ * @brief Report a problem to the ground station, as MAV_STATE_CRITICAL in
+ * the heartbeat, until cleared
+ */
+void telemetrySetCritical(bool critical)
+{
+    heartbeatCritical = critical;
+    updateHeartbeat();
+}
+
+static FC_Status sendFrame(TelemetryMessage msg,
+                           const TelemetrySource_t *source)
+{
+    const TelemetryMessageInfo_t *info = &messageInfo[msg];
+    uint32_t frameLength = info->payloadLength + TELEMETRY_FRAME_OVERHEAD;
+    uint8_t header[TELEMETRY_HEADER_LENGTH];
+    UartTxFrame_t frame;
+    uint16_t crc;
+
+    if (uartTxBegin(&frame, frameLength) != FC_OK) {
+        stats.framesDropped++;
+        return FC_BUSY;
+    }
+
+    header[0] = TELEMETRY_STX;
+    header[1] = info->payloadLength;
+    header[2] = sequence++;
+    header[3] = TELEMETRY_SYSTEM_ID;
+    header[4] = TELEMETRY_COMPONENT_ID;
+    header[5] = info->id;
+
+    uartTxPut(&frame, header, sizeof(header));
+    crc = telemetryCrcAccumulate(0xFFFF, &header[1], sizeof(header) - 1);
+
+    // Interrupts are off until uartTxEnd, so the data can't change between
+    // the crc and the copy
+    for (int i = 0; i < TELEMETRY_MAX_SOURCES; i++) {
+        if (source[i].length != 0) {
+            crc = telemetryCrcAccumulate(crc, source[i].data, source[i].length);
+            uartTxPut(&frame, source[i].data, source[i].length);
+        }
+    }
+
+    crc = telemetryCrcAccumulate(crc, &info->crcExtra, 1);
+    uint8_t crcBytes[TELEMETRY_CRC_LENGTH] = {crc & 0xFF, crc >> 8};
+    uartTxPut(&frame, crcBytes, sizeof(crcBytes));
+
+    uartTxEnd(&frame);
+
+    stats.framesSent++;
+    stats.bytesSent += frameLength;
+
+    return FC_OK;
+}
+
+static void sendMessage(TelemetryMessage msg)
+{
+    uint32_t sourceLength = 0;
+
+    for (int i = 0; i < TELEMETRY_MAX_SOURCES; i++) {
+        sourceLength += sources[msg][i].length;
+    }
+    if (sourceLength != messageInfo[msg].payloadLength) {
+        // Not registered yet
+        return;
+    }
+
+    sendFrame(msg, sources[msg]);
+}
+
+/**
+ * @brief Send a message straight away, outside of its schedule
+ *
+ * Used for replies to the ground station. These aren't counted in the link
+ * budget, they should be rare enough to fit in the share left for debug
+ * messages
+ *
+ * @param msg     The message
+ * @param payload The whole payload, the length is fixed by the message
+ *
+ * @return FC_OK if queued, FC_BUSY if the uart ring is full
+ */
+FC_Status telemetrySend(TelemetryMessage msg, const void *payload)
+{
+    TelemetrySource_t source[TELEMETRY_MAX_SOURCES] = {
+        {payload, messageInfo[msg].payloadLength},
+    };
+
+    return sendFrame(msg, source);
+}
+
+/**
+ * @brief Send every message that is due
+ *
+ * @param nowMs The current time, must increase by at most the shortest
+ * message period between calls to keep to the rates exactly
+ */
+void telemetryUpdate(uint32_t nowMs)
+{
+    for (int i = 0; i < TELEMETRY_MSG_COUNT; i++) {
+        TelemetrySchedule_t *s = &schedule[i];
+
+        if (s->rateHz == 0) {
+            continue;
+        }
+
+        if (!s->started) {
+            s->nextMs = nowMs;
+            s->started = true;
+        }
+
+        if ((int32_t)(nowMs - s->nextMs) >= 0) {
+            sendMessage(i);
+
+            s->nextMs += s->periodMs;
+            // Don't try to catch up after a long stall
+            if ((int32_t)(nowMs - s->nextMs) >= 0) {
+                s->nextMs = nowMs + s->periodMs;
+            }
+        }
+    }
+}
+
+const TelemetryStats_t *telemetryStats(void)
+{
+    return &stats;
+}
+
+void telemetryParserReset(TelemetryParser_t *parser)
+{
+    memset(parser, 0, sizeof(*parser));
+}
+
+/**
+ * @brief Drop the start of the frame buffer up to the next start byte after
+ * the first byte
+ */
+static void parserResync(TelemetryParser_t *parser)
+{
+    uint8_t *next = memchr(&parser->frame[1], TELEMETRY_STX,
+                           parser->length - 1);
+    uint32_t skip = (next != NULL) ? (uint32_t)(next - parser->frame)
+                                   : parser->length;
+
+    parser->skippedBytes += skip;
+    parser->length -= skip;
+    memmove(parser->frame, &parser->frame[skip], parser->length);
+}
+
+/**
+ * @brief Find the next valid frame in received data
+ *
+ * Anything that isn't a frame of a known message with a good crc is skipped,
+ * so other traffic on the same uart is ignored. A false start byte never
+ * hides a real frame after it.
+ *
+ * @param parser Receive state, kept between calls
+ * @param[in,out] data   The received data, advanced past the bytes used
+ * @param[in,out] length Number of bytes at data, reduced by the bytes used
+ *
+ * @return The message received, with the frame in parser->frame (payload at
+ * TELEMETRY_HEADER_LENGTH), valid until the next call. NULL once all the data
+ * has been used without completing a frame
+ */
+const TelemetryMessageInfo_t *telemetryParse(TelemetryParser_t *parser,
+                                             const uint8_t **data,
+                                             uint32_t *length)
+{
+    // Drop the frame returned last time
+    parser->length -= parser->consumed;
+    memmove(parser->frame, &parser->frame[parser->consumed], parser->length);
+    parser->consumed = 0;
+
+    for ( ;; ) {
+        while (parser->length >= TELEMETRY_HEADER_LENGTH) {
+            const TelemetryMessageInfo_t *info =
+                telemetryFindMessage(parser->frame[5]);
+            uint32_t frameLength = parser->frame[1] + TELEMETRY_FRAME_OVERHEAD;
+
+            if (info == NULL || info->payloadLength != parser->frame[1]) {
+                parser->unknown++;
+                parserResync(parser);
+                continue;
+            }
+
+            if (parser->length < frameLength) {
+                break;
+            }
+
+            uint16_t crc = telemetryCrcAccumulate(0xFFFF, &parser->frame[1],
+                                                  frameLength - 3);
+            crc = telemetryCrcAccumulate(crc, &info->crcExtra, 1);
+
+            if (parser->frame[frameLength - 2] != (crc & 0xFF)
+                || parser->frame[frameLength - 1] != (crc >> 8))
+            {
+                parser->badCrc++;
+                parserResync(parser);
+                continue;
+            }
+
+            parser->consumed = frameLength;
+            return info;
+        }
+
+        if (*length == 0) {
+            return NULL;
+        }
+
+        uint8_t byte = **data;
+        (*data)++;
+        (*length)--;
+
+        if (parser->length == 0 && byte != TELEMETRY_STX) {
+            parser->skippedBytes++;
+            continue;
+        }
+
+        parser->frame[parser->length++] = byte;
+    }
+}
+
+#ifndef __UNIT_TEST
+
+void vTelemetryTask(void *pvParameters)
+{
+    TickType_t lastWakeTime = xTaskGetTickCount();
+
+    for ( ;; )
+    {
+        telemetryUpdate(xTaskGetTickCount() * portTICK_PERIOD_MS);
+        // Shares the link, a trace is only sent once it stops
+        traceUpdate(xTaskGetTickCount() * portTICK_PERIOD_MS);
+
+        vTaskDelayUntil(&lastWakeTime, TELEMETRY_PERIOD_MS / portTICK_PERIOD_MS);
+    }
+}
+
+#endif
@@ -0,0 +1,324 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "fc.h"
+#include "topicBus.h"
+
+#ifndef __UNIT_TEST
+#include "task.h"
+#endif
+
+/**
+ * @file Src/topicBus.c
+ *
+ * @brief Pass the latest sample of each kind of data from its one writer to
+ * any number of readers
+ *
+ * Each topic (see TOPIC_DEFINE, and Inc/topics.h for the firmware's) holds
+ * one sample. The writer advertises the topic once, then each sample is
+ * either written in place between topicClaim and topicPublish, or copied in
+ * with topicWrite. Readers subscribe with their own TopicReader_t and either
+ * copy the sample out (topicUpdate), or read it in place (topicPeek) and
+ * check afterwards that it wasn't overwritten meanwhile (topicPeekValid).
+ * Nothing blocks or locks, so the writer can be an interrupt.
+ *
+ * Each sample is numbered by its generation. The writer fills the other of
+ * two buffers from the one last published, so a reader's sample is only
+ * overwritten once the writer has claimed two more. A reader that takes
+ * longer than that to read sees the claims have moved on, and tries again.
+ *
+ * A task can block until a new sample with topicWait, which uses the task's
+ * notification. Don't wait on a topic from a task released by the
+ * loop scheduler, which uses it too.
+ */
+
+// Keep the compiler from moving buffer accesses across the counters. The
+// cpu is single core, and doesn't reorder its own accesses to normal memory
+#define TOPIC_BARRIER() __asm volatile ("" ::: "memory")
+
+static TopicClock topicClockUs = NULL;
+
+/**
+ * @brief Start timing publishes for the statistics
+ *
+ * @param clockUs NULL leaves the times at 0
+ */
+void topicBusInit(TopicClock clockUs)
+{
+    topicClockUs = clockUs;
+}
+
+/**
+ * @brief Become the topic's one writer
+ *
+ * @return FC_ERROR if it already has one
+ */
+FC_Status topicAdvertise(Topic_t *topic)
+{
+    if (topic->advertised) {
+        return FC_ERROR;
+    }
+
+    topic->advertised = true;
+
+    return FC_OK;
+}
+
+static inline uint8_t *topicBuffer(const Topic_t *topic, uint32_t generation)
+{
+    return topic->buffers + (generation & 1) * topic->size;
+}
+
+/**
+ * @brief Start writing the next sample, in place
+ *
+ * @return The buffer to write it to, published with topicPublish
+ */
+FAST_CODE void *topicClaim(Topic_t *topic)
+{
+    ASSERT(topic->advertised);
+
+    topic->claims = topic->generation + 1;
+    TOPIC_BARRIER();
+
+    return topicBuffer(topic, topic->claims);
+}
+
+static void topicCountPublish(Topic_t *topic)
+{
+    TopicStats_t *stats = &topic->stats;
+    uint32_t nowUs = (topicClockUs != NULL) ? topicClockUs() : 0;
+
+    if (stats->publishes == 0) {
+        stats->firstUs = nowUs;
+        stats->minIntervalUs = UINT32_MAX;
+    } else {
+        uint32_t intervalUs = nowUs - stats->lastUs;
+
+        if (intervalUs < stats->minIntervalUs) {
+            stats->minIntervalUs = intervalUs;
+        }
+        if (intervalUs > stats->maxIntervalUs) {
+            stats->maxIntervalUs = intervalUs;
+        }
+    }
+    stats->lastUs = nowUs;
+    stats->publishes++;
+}
+
+/**
+ * @brief Make the claimed sample the latest
+ */
+FAST_CODE void topicPublish(Topic_t *topic)
+{
+    TOPIC_BARRIER();
+    topic->generation = topic->claims;
+    topicCountPublish(topic);
+
+#ifndef __UNIT_TEST
+    for (int i = 0; i < TOPIC_MAX_WAITERS; i++) {
+        TaskHandle_t waiter = topic->waiters[i];
+
+        if (waiter != NULL) {
+            topic->waiters[i] = NULL;
+            xTaskNotifyGive(waiter);
+        }
+    }
+#endif
+}
+
+/**
+ * @brief Copy a sample in and publish it
+ */
+FAST_CODE void topicWrite(Topic_t *topic, const void *data)
+{
+    memcpy(topicClaim(topic), data, topic->size);
+    topicPublish(topic);
+}
+
+/**
+ * @brief Start reading a topic from its latest sample
+ */
+void topicSubscribe(TopicReader_t *reader, Topic_t *topic)
+{
+    reader->topic = topic;
+    reader->generation = topic->generation;
+    reader->missed = 0;
+}
+
+/**
+ * @return true if a sample has been published since the reader last took
+ * one
+ */
+bool topicUpdated(const TopicReader_t *reader)
+{
+    return reader->topic->generation != reader->generation;
+}
+
+static void topicTake(TopicReader_t *reader, uint32_t generation)
+{
+    reader->missed += generation - reader->generation - 1;
+    reader->generation = generation;
+}
+
+/**
+ * @brief Read the latest sample in place
+ *
+ * The sample is only valid until the writer claims two more, check with
+ * topicPeekValid once done with it
+ *
+ * @param[out] generation The sample's, for topicPeekValid
+ *
+ * @return The sample, or NULL if none has been published
+ */
+FAST_CODE const void *topicPeek(TopicReader_t *reader, uint32_t *generation)
+{
+    Topic_t *topic = reader->topic;
+
+    *generation = topic->generation;
+    TOPIC_BARRIER();
+
+    if (*generation == 0) {
+        return NULL;
+    }
+
+    if (*generation != reader->generation) {
+        topicTake(reader, *generation);
+    }
+
+    return topicBuffer(topic, *generation);
+}
+
+/**
+ * @return true if the sample from topicPeek hasn't been overwritten
+ */
+FAST_CODE bool topicPeekValid(const TopicReader_t *reader, uint32_t generation)
+{
+    TOPIC_BARRIER();
+
+    return reader->topic->claims - generation < 2;
+}
+
+/**
+ * @brief Copy out the latest sample, if the reader hasn't taken it yet
+ *
+ * @return true if a new sample was copied, false if there isn't one or it
+ * kept being overwritten
+ */
+FAST_CODE bool topicUpdate(TopicReader_t *reader, void *data)
+{
+    Topic_t *topic = reader->topic;
+
+    for (int attempt = 0; attempt < TOPIC_READ_RETRIES; attempt++) {
+        uint32_t generation = topic->generation;
+        TOPIC_BARRIER();
+
+        if (generation == reader->generation) {
+            return false;
+        }
+
+        memcpy(data, topicBuffer(topic, generation), topic->size);
+
+        if (topicPeekValid(reader, generation)) {
+            topicTake(reader, generation);
+            return true;
+        }
+        topic->stats.tornReads++;
+    }
+
+    return false;
+}
+
+/**
+ * @return The mean rate samples have been published at, 0 until there are
+ * two
+ */
+uint32_t topicRateHz(const Topic_t *topic)
+{
+    const TopicStats_t *stats = &topic->stats;
+    uint32_t spanUs = stats->lastUs - stats->firstUs;
+
+    if (stats->publishes < 2 || spanUs == 0) {
+        return 0;
+    }
+
+    return (uint32_t)((uint64_t)(stats->publishes - 1) * 1000000 / spanUs);
+}
+
+#ifndef __UNIT_TEST
+
+/**
+ * @brief topicPublish, from an interrupt
+ */
+FAST_CODE void topicPublishFromISR(Topic_t *topic,
+                                   BaseType_t *higherPriorityTaskWoken)
+{
+    TOPIC_BARRIER();
+    topic->generation = topic->claims;
+    topicCountPublish(topic);
+
+    for (int i = 0; i < TOPIC_MAX_WAITERS; i++) {
+        TaskHandle_t waiter = topic->waiters[i];
+
+        if (waiter != NULL) {
+            topic->waiters[i] = NULL;
+            vTaskNotifyGiveFromISR(waiter, higherPriorityTaskWoken);
+        }
+    }
+}
+
+/**
+ * @brief topicWrite, from an interrupt
+ */
+FAST_CODE void topicWriteFromISR(Topic_t *topic, const void *data,
+                                 BaseType_t *higherPriorityTaskWoken)
+{
+    memcpy(topicClaim(topic), data, topic->size);
+    topicPublishFromISR(topic, higherPriorityTaskWoken);
+}
+
+/**
+ * @brief Block until there is a sample the reader hasn't taken
+ *
+ * @return FC_TIMEOUT if none was published in time, or FC_ERROR if the
+ * topic already has TOPIC_MAX_WAITERS
+ */
+FC_Status topicWait(TopicReader_t *reader, uint32_t timeoutMs)
+{
+    Topic_t *topic = reader->topic;
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    int slot = -1;
+
+    taskENTER_CRITICAL();
+    if (!topicUpdated(reader)) {
+        for (int i = 0; i < TOPIC_MAX_WAITERS && slot < 0; i++) {
+            if (topic->waiters[i] == NULL) {
+                topic->waiters[i] = self;
+                slot = i;
+            }
+        }
+        if (slot < 0) {
+            taskEXIT_CRITICAL();
+            return FC_ERROR;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if (slot < 0) {
+        return FC_OK;
+    }
+
+    ulTaskNotifyTake(pdTRUE, timeoutMs / portTICK_PERIOD_MS);
+
+    // Clear the slot and any notification given after the timeout
+    taskENTER_CRITICAL();
+    if (topic->waiters[slot] == self) {
+        topic->waiters[slot] = NULL;
+    }
+    taskEXIT_CRITICAL();
+    ulTaskNotifyTake(pdTRUE, 0);
+
+    return topicUpdated(reader) ? FC_OK : FC_TIMEOUT;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#include "fc.h"
+#include "topics.h"
+
+#include "ppm.h"
+#include "rate_control.h"
+#include "loopScheduler.h"
+
+/**
+ * @file Src/topics.c
+ *
+ * @brief The data passed between the firmware's tasks and interrupts, see
+ * topicBus.c
+ *
+ * A new topic is added here and declared in topics.h. Its writer advertises
+ * it before the first write, and any number of readers subscribe to it.
+ */
+
+TOPIC_DEFINE(rcInputTopic, tPpmSignal);
+TOPIC_DEFINE(gyroRatesTopic, Rates_t);
+TOPIC_DEFINE(rotationOutputsTopic, RotationAxisOutputs_t);
+
+/**
+ * @brief Time the publishes with the loop timebase
+ */
+void topicsInit(void)
+{
+    topicBusInit(loopSchedulerNowUs);
+}
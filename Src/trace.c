@@ -0,0 +1,298 @@
+#include <string.h>
+
+#include "fc.h"
+#include "trace.h"
+
+#ifndef __UNIT_TEST
+#include "freertos.h"
+#include "task.h"
+#include "queue.h"
+#include "telemetry.h"
+#include "taskStats.h"
+#include "i2c.h"
+#include "sd.h"
+#include "uartTx.h"
+#endif
+
+/**
+ * @file Src/trace.c
+ *
+ * @brief Records scheduler, queue and interrupt events in a RAM ring
+ *
+ * The FreeRTOS trace hooks (defined in trace.h, included by
+ * FreeRTOSConfig.h), TRACE_ISR_ENTER/EXIT in the interrupt handlers and the
+ * TRACE_BEGIN/END marks in the control loop each store one timestamped
+ * event. Together they show which task runs when, what it is waiting for
+ * and who holds the mutex it wants, e.g. a priority inversion between the
+ * I2C mutex, its DMA semaphore and the control loop.
+ *
+ * The ring keeps the most recent TRACE_RING_LENGTH events. traceTrigger
+ * (called on a control loop overrun) lets TRACE_POST_TRIGGER_EVENTS more in
+ * and then stops recording. The first ring full after start up is always
+ * kept. A stopped trace is sent as telemetry frames by traceUpdate, names
+ * first, then recording starts again.
+ *
+ * tools/trace_to_chrome turns a telemetry capture into a Chrome trace
+ * (chrome://tracing or ui.perfetto.dev).
+ */
+
+#if (TRACE_RING_LENGTH & (TRACE_RING_LENGTH - 1)) != 0
+#error "TRACE_RING_LENGTH must be a power of 2"
+#endif
+
+TraceEvent_t traceRing[TRACE_RING_LENGTH];
+volatile uint32_t traceIndex = 0;
+volatile uint32_t traceStopIndex = 0;
+// Nothing is recorded until traceInit
+volatile TraceState traceState = TRACE_STOPPED;
+
+static const char *markNames[TRACE_MARK_COUNT] = {
+    [TRACE_MARK_CONTROL_LOOP]  = "Control loop",
+    [TRACE_MARK_PPM]           = "PPM",
+    [TRACE_MARK_CONTROL_RATES] = "Control rates",
+    [TRACE_MARK_MOTORS]        = "Motors",
+    [TRACE_MARK_LOG]           = "Log",
+};
+
+/**
+ * @brief Start recording, stopping once the ring is full so start up is kept
+ */
+void traceInit(void)
+{
+    uint32_t lockState;
+
+    TRACE_LOCK(lockState);
+    traceIndex = 0;
+    traceStopIndex = TRACE_RING_LENGTH;
+    traceState = TRACE_TRIGGERED;
+    TRACE_UNLOCK(lockState);
+}
+
+/**
+ * @brief Keep the events leading up to now
+ *
+ * Recording stops after TRACE_POST_TRIGGER_EVENTS more events. Ignored if
+ * already triggered or stopped
+ */
+void traceTrigger(void)
+{
+    uint32_t lockState;
+
+    TRACE_LOCK(lockState);
+    if (traceState == TRACE_RECORDING) {
+        traceStopIndex = traceIndex + TRACE_POST_TRIGGER_EVENTS;
+        traceState = TRACE_TRIGGERED;
+    }
+    TRACE_UNLOCK(lockState);
+}
+
+TraceState traceGetState(void)
+{
+    return traceState;
+}
+
+/**
+ * @return The number of events held, at most TRACE_RING_LENGTH
+ */
+uint32_t traceEventCount(void)
+{
+    return (traceIndex < TRACE_RING_LENGTH) ? traceIndex : TRACE_RING_LENGTH;
+}
+
+/**
+ * @brief Copy out events held by a stopped trace
+ *
+ * @param first  Index of the first event to copy, 0 is the oldest
+ * @param[out] events
+ * @param count  Most events to copy
+ *
+ * @return The number of events copied, 0 if the trace is still recording
+ */
+uint32_t traceRead(uint32_t first, TraceEvent_t *events, uint32_t count)
+{
+    uint32_t held = traceEventCount();
+    uint32_t oldest = traceIndex - held;
+
+    if (traceState != TRACE_STOPPED || first >= held) {
+        return 0;
+    }
+
+    if (count > held - first) {
+        count = held - first;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        events[i] = traceRing[(oldest + first + i) & (TRACE_RING_LENGTH - 1)];
+    }
+
+    return count;
+}
+
+/**
+ * @brief Drop the events held and start recording again
+ */
+void traceRestart(void)
+{
+    uint32_t lockState;
+
+    TRACE_LOCK(lockState);
+    traceIndex = 0;
+    traceState = TRACE_RECORDING;
+    TRACE_UNLOCK(lockState);
+}
+
+const char *traceMarkName(TraceMark mark)
+{
+    if (mark >= TRACE_MARK_COUNT) {
+        return NULL;
+    }
+
+    return markNames[mark];
+}
+
+#ifndef __UNIT_TEST
+
+// Queues named with traceNameQueue, queue number n is queueNames[n - 1]
+#define TRACE_MAX_QUEUES  configQUEUE_REGISTRY_SIZE
+
+static const char *queueNames[TRACE_MAX_QUEUES];
+static uint32_t queueCount = 0;
+
+typedef struct TraceIsrName_t {
+    uint8_t     exception;    // IRQn + 16, as read from IPSR
+    const char *name;
+} TraceIsrName_t;
+
+// The handlers with TRACE_ISR_ENTER, see interrupt.c
+static const TraceIsrName_t isrNames[] = {
+    {I2Cx_EV_IRQn + 16,      "I2C event"},
+    {I2Cx_ER_IRQn + 16,      "I2C error"},
+    {I2Cx_DMA_RX_IRQn + 16,  "I2C DMA rx"},
+    {I2Cx_DMA_TX_IRQn + 16,  "I2C DMA tx"},
+    {SPIx_DMA_RX_IRQn + 16,  "SD DMA rx"},
+    {SPIx_DMA_TX_IRQn + 16,  "SD DMA tx"},
+    {UARTx_DMA_TX_IRQn + 16, "Uart DMA tx"},
+    {UARTx_IRQn + 16,        "Uart"},
+    {TIM5_IRQn + 16,         "PPM capture"},
+};
+
+#define TRACE_ISR_NAME_COUNT (sizeof(isrNames) / sizeof(isrNames[0]))
+
+/**
+ * @brief Give a queue, semaphore or mutex a number for its trace events and
+ * a name for the dump (and the debugger's queue registry)
+ *
+ * Call once per queue, after creating it. Unnamed queues are traced as
+ * number 0
+ */
+void traceNameQueue(void *queue, const char *name)
+{
+    if (queue == NULL || queueCount >= TRACE_MAX_QUEUES) {
+        return;
+    }
+
+    queueNames[queueCount++] = name;
+    vQueueSetQueueNumber(queue, queueCount);
+    vQueueAddToRegistry(queue, name);
+}
+
+#define TRACE_NAMES_PER_UPDATE 4
+
+// Progress through a dump
+static TaskStatus_t dumpTasks[TASK_STATS_MAX_KERNEL_TASKS];
+static uint32_t dumpTaskCount;
+static uint32_t dumpStep = 0;
+static uint32_t lastDumpMs = 0;
+
+static void setName(TelemetryTraceName_t *msg, TraceNameKind kind,
+                    uint32_t number, const char *name)
+{
+    memset(msg, 0, sizeof(*msg));
+    msg->kind = kind;
+    msg->number = number;
+    memcpy(msg->name, name, strnlen(name, TRACE_NAME_LENGTH));
+}
+
+/**
+ * @brief Send name number n of the dump, tasks then queues, interrupts and
+ * marks
+ *
+ * @return FC_OK if sent, FC_BUSY if the uart ring is full
+ */
+static FC_Status sendName(uint32_t n)
+{
+    TelemetryTraceName_t msg;
+
+    if (n < dumpTaskCount) {
+        setName(&msg, TRACE_NAME_TASK, dumpTasks[n].xTaskNumber,
+                dumpTasks[n].pcTaskName);
+    } else if ((n -= dumpTaskCount) < queueCount) {
+        setName(&msg, TRACE_NAME_QUEUE, n + 1, queueNames[n]);
+    } else if ((n -= queueCount) < TRACE_ISR_NAME_COUNT) {
+        setName(&msg, TRACE_NAME_ISR, isrNames[n].exception, isrNames[n].name);
+    } else {
+        n -= TRACE_ISR_NAME_COUNT;
+        setName(&msg, TRACE_NAME_MARK, n, markNames[n]);
+    }
+
+    return telemetrySend(TELEMETRY_MSG_TRACE_NAME, &msg);
+}
+
+static FC_Status sendEvents(uint32_t index)
+{
+    TelemetryTraceEvents_t msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.index = index;
+    msg.total = traceEventCount();
+    traceRead(index, msg.events, TRACE_EVENTS_PER_FRAME);
+
+    return telemetrySend(TELEMETRY_MSG_TRACE_EVENTS, &msg);
+}
+
+/**
+ * @brief Send a stopped trace, a few frames at a time. Called from the
+ * telemetry task
+ *
+ * @param nowMs The current time
+ */
+void traceUpdate(uint32_t nowMs)
+{
+    if (traceState != TRACE_STOPPED || nowMs - lastDumpMs < TRACE_DUMP_PERIOD_MS) {
+        return;
+    }
+    lastDumpMs = nowMs;
+
+    if (dumpStep == 0) {
+        dumpTaskCount = uxTaskGetSystemState(dumpTasks,
+                                             TASK_STATS_MAX_KERNEL_TASKS, NULL);
+    }
+
+    uint32_t nameCount = dumpTaskCount + queueCount + TRACE_ISR_NAME_COUNT
+                         + TRACE_MARK_COUNT;
+
+    // Names are short, send a few per period
+    if (dumpStep < nameCount) {
+        for (int i = 0; i < TRACE_NAMES_PER_UPDATE && dumpStep < nameCount; i++) {
+            if (sendName(dumpStep) != FC_OK) {
+                return;
+            }
+            dumpStep++;
+        }
+        return;
+    }
+
+    uint32_t index = (dumpStep - nameCount) * TRACE_EVENTS_PER_FRAME;
+
+    if (index < traceEventCount()) {
+        if (sendEvents(index) == FC_OK) {
+            dumpStep++;
+        }
+        return;
+    }
+
+    dumpStep = 0;
+    traceRestart();
+}
+
+#endif
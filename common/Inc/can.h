@@ -8,7 +8,7 @@
 #ifndef CAN_H_
 #define CAN_H_
 
-#include "stm32f4xx_hal.h"
+#include "stdint.h"
 #include "stdbool.h"
 #include "can_comm.h"
 
@@ -31,11 +31,91 @@ void setupCanFilters();         // You must implement this in can_data.c
 
 #define CAN_ID_MAX              0x7FF      // 11 bits is ID max
 #define CAN_NUM_ADDR_PER_FILTER 4
+#define CAN_NUM_FILTER_BANKS    28
+
+// IDs that can be received, from handlers and addCanFilter
+#define CAN_MAX_SUBSCRIPTIONS   128
+
+#define CAN_TX_MAILBOXES        3
+
+// Frames queued in software each way, a power of 2
+#define CAN_TX_QUEUE_SIZE       32
+#define CAN_RX_QUEUE_SIZE       32
+
+// IDs that can have a handler, see canRegisterHandler
+#define CAN_MAX_HANDLERS        16
+
+typedef struct
+{
+	uint16_t id;
+	uint8_t length;
+	uint8_t data[CAN_MAX_BYTE_LEN];
+} CanFrame;
+
+typedef void (*CanHandler)(const CanFrame *frame);
+
+typedef enum
+{
+	CAN_FILTER_LIST,            // Matches 4 IDs
+	CAN_FILTER_MASK,            // Matches 2 ID and mask pairs
+} CanFilterMode;
+
+/*
+ * One 16 bit filter bank. A mask bit set means the ID bit must match
+ */
+typedef struct
+{
+	CanFilterMode mode;
+	uint16_t ids[CAN_NUM_ADDR_PER_FILTER];     // List: 4 IDs. Mask: ID, mask, ID, mask
+} CanFilterBank;
+
+/*
+ * What the driver needs from the controller, so it can run against the bxCAN
+ * registers (canBxCanHal) or the host tests' loopback bus.
+ *
+ * The controller calls canTxIrqHandler when a mailbox empties, and
+ * canRxIrqHandler when a frame arrives.
+ */
+typedef struct
+{
+	bool (*init)(void);
+	bool (*txMailboxEmpty)(uint8_t mailbox);
+	void (*txMailboxLoad)(uint8_t mailbox, const CanFrame *frame);
+	bool (*rxFifoRead)(CanFrame *frame);        // Pop the oldest received frame
+	void (*txIrqPend)(void);                    // Run canTxIrqHandler soon
+	void (*configFilters)(const CanFilterBank *banks, uint8_t count);   // Turns off the rest
+	uint32_t (*tickMs)(void);
+} CanHal;
+
+typedef struct
+{
+	uint32_t txQueued;
+	uint32_t txDropped;         // sendCanMessage found the queue full
+	uint32_t txLoaded;          // Put in a mailbox
+	uint32_t txQueueHighWater;
+	uint32_t rxQueued;
+	uint32_t rxDropped;         // Received with the queue full
+	uint32_t rxDispatched;
+	uint32_t rxUnhandled;       // No handler for the ID
+	uint16_t filterBanks;       // Used by the last canApplyFilters
+	uint16_t filterFalseAccepts; // IDs the filters let through unasked
+} CanStats;
+
+#ifndef __UNIT_TEST
+extern const CanHal canBxCanHal;
+#endif
 
 void addCanFilter(uint16_t addresses[CAN_NUM_ADDR_PER_FILTER]);
-void canInit(const uint16_t thisIdBase);
+bool canInit(const CanHal *hal, const uint16_t thisIdBase);
+bool canRegisterHandler(const uint16_t id, CanHandler handler);
+bool canSubscribe(const uint16_t id);
+bool canApplyFilters(void);
 bool sendCanMessage(const uint16_t id, const uint8_t *data, const uint8_t length);
-bool sendCanMessageTimeoutMs(const uint16_t id, const uint8_t *data,
-                             const uint8_t length, const uint32_t timeout);
+uint32_t canProcessRx(void);
+uint32_t canTickMs(void);
+void canGetStats(CanStats *stats);
+
+void canTxIrqHandler(void);
+void canRxIrqHandler(void);
 
 #endif /* CAN_H_ */
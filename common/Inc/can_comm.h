@@ -5,6 +5,11 @@
 // For static asserts
 #include "assert.h"
 
+// Defined by CMSIS on the target
+#ifndef __packed
+#define __packed __attribute__((__packed__))
+#endif
+
 #define CAN_MAX_BYTE_LEN        8
 
 // Addresses of boards, OR them together (e.g, when BMS sends to VCU, ID would be CAN_ID_BMS | CAN_ID_VCU == 0x3)
@@ -0,0 +1,28 @@
+/*
+ * can_filter.h
+ *
+ * Packs a set of CAN IDs into as few filter banks as possible
+ */
+
+#ifndef CAN_FILTER_H_
+#define CAN_FILTER_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "can.h"
+
+#define CAN_FILTER_MASK_ALL     CAN_ID_MAX      // A mask that matches one ID
+
+typedef struct
+{
+	CanFilterBank banks[CAN_NUM_FILTER_BANKS];
+	uint8_t count;
+	uint16_t falseAccepts;      // IDs accepted that weren't asked for
+} CanFilterPlan;
+
+bool canFilterPlan(const uint16_t *ids, const uint16_t count, const uint8_t maxBanks,
+                   CanFilterPlan *plan);
+bool canFilterBankAccepts(const CanFilterBank *bank, const uint16_t id);
+bool canFilterPlanAccepts(const CanFilterPlan *plan, const uint16_t id);
+
+#endif /* CAN_FILTER_H_ */
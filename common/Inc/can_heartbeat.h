@@ -8,9 +8,9 @@
 #ifndef CAN_HEARTBEAT_H_
 #define CAN_HEARTBEAT_H_
 
-#include "stm32f4xx_hal.h"
 #include "stdint.h"
 #include "stdbool.h"
+#include "can.h"
 
 typedef struct
 {
@@ -19,8 +19,7 @@ typedef struct
 } CanHeartbeatData;
 
 void canHeartBeatProcessing();
-void receiveHeartBeat(CanRxMsgTypeDef *rxMessage);
-void setupHeartbeatFilters();
+void receiveHeartBeat(const CanFrame *frame);
 void initHeartBeat (uint16_t thisIdBase);
 bool hasHeartBeatExpired(uint16_t canIdBase);
 bool hasAnyHeartBeatExpired ();
@@ -2,7 +2,8 @@
 #define CAN_RT_H
 
 #define CAN_RT_MAX_BYTES_PER_MESSAGE 8
-#define CAN_RT_NUM_FILTERS_MAX 28
+#define CAN_RT_NUM_FILTERS_MAX 128        // IDs, packed into the banks by canFilterPlan
+#define CAN_RT_NUM_FILTER_BANKS 14       // On the F0
 
 // CAN setup function, handles bxCAN peripheral setup, filter setup, and GPIO setup for CAN_TX/CAN_RX
 // NOTE: TO BE CALLED ONCE IN APPLICATION
@@ -3,56 +3,95 @@
 #ifndef DEBUG_H
 #define DEBUG_H
 
-#include "freertos.h"
-#include "queue.h"
+#include <stdint.h>
 
-extern QueueHandle_t printQueue;
+#include "debugLog.h"
 
-#define PRINT_QUEUE_LENGTH        15
-#define PRINT_QUEUE_STRING_SIZE   40
-#define QUEUE_SEND_TIMEOUT_TICKS  10
+// Longest line the debug task will print, including the terminator
+#define DEBUG_LINE_MAX_LENGTH     128
+
+// How often the debug task checks the log ring for new messages
+#define DEBUG_POLL_PERIOD_MS      10
+
+// Define to send messages unformatted, to be decoded on the host with
+// tools/debug_decode and the elf file. Saves the formatting time and uart
+// bandwidth
+//#define DEBUG_LOG_BINARY
+
+// Start of each message sent when DEBUG_LOG_BINARY is defined, followed by
+// the argument count (1 byte), the format id and the arguments (4 bytes each,
+// little endian)
+#define DEBUG_BINARY_SYNC_0       0xA5
+#define DEBUG_BINARY_SYNC_1       0x5A
+
+// Format strings are kept in their own section, so the address of a string
+// identifies it and can be looked up in the elf file
+#define DEBUG_FORMAT_SECTION      __attribute__((section(".rodata.debug_fmt")))
 
 //#define printf DONT USE PRINTF, USE DEBUG_PRINT
 
+/* Argument counting and casting helpers, for up to DEBUG_LOG_MAX_ARGS
+ * arguments */
+#define DEBUG_NARGS(...) DEBUG_NARGS_(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define DEBUG_NARGS_(_, a1, a2, a3, a4, a5, a6, a7, a8, n, ...) n
+
+#define DEBUG_CONCAT(a, b) DEBUG_CONCAT_(a, b)
+#define DEBUG_CONCAT_(a, b) a##b
+
+#define DEBUG_WORDS_0()
+#define DEBUG_WORDS_1(a)      , (uint32_t)(uintptr_t)(a)
+#define DEBUG_WORDS_2(a, ...) , (uint32_t)(uintptr_t)(a) DEBUG_WORDS_1(__VA_ARGS__)
+#define DEBUG_WORDS_3(a, ...) , (uint32_t)(uintptr_t)(a) DEBUG_WORDS_2(__VA_ARGS__)
+#define DEBUG_WORDS_4(a, ...) , (uint32_t)(uintptr_t)(a) DEBUG_WORDS_3(__VA_ARGS__)
+#define DEBUG_WORDS_5(a, ...) , (uint32_t)(uintptr_t)(a) DEBUG_WORDS_4(__VA_ARGS__)
+#define DEBUG_WORDS_6(a, ...) , (uint32_t)(uintptr_t)(a) DEBUG_WORDS_5(__VA_ARGS__)
+#define DEBUG_WORDS_7(a, ...) , (uint32_t)(uintptr_t)(a) DEBUG_WORDS_6(__VA_ARGS__)
+#define DEBUG_WORDS_8(a, ...) , (uint32_t)(uintptr_t)(a) DEBUG_WORDS_7(__VA_ARGS__)
+#define DEBUG_WORDS(...) \
+    DEBUG_CONCAT(DEBUG_WORDS_, DEBUG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+// Never called, only lets the compiler check the arguments against the format
+static inline __attribute__((format(printf, 1, 2)))
+void debugFormatCheck(const char *format, ...)
+{
+    (void)format;
+}
+
 /**
- * @brief Send a debug string to the uart
+ * @brief Send a debug message to the uart
  *
- * @param ... the format string and any arguments
+ * @param format A string literal printf format
+ * @param ...    Up to DEBUG_LOG_MAX_ARGS arguments, each at most 32 bits.
+ *               Floating point arguments are not supported. %s arguments
+ *               must point to constant strings, since they are read later
  *
- * This creates a string from the format and arguments, then copies it to a
- * queue for future printing over the uart by the debug task
- * This will trim any resultant string to PRINT_QUEUE_STRING_SIZE characters
- * It will silently fail if the queue is full after waiting for
- * QUEUE_SEND_TIMEOUT_TICKS
+ * This only copies the address of the format string and the raw arguments
+ * into the log ring (see debugLog.c). The debug task formats and prints the
+ * message later. It never blocks, so it can be called from any task or
+ * interrupt. If the ring is full the message is dropped, and the debug task
+ * reports the number of dropped messages
  *
  * @return Nothing
  */
-#define DEBUG_PRINT(...) \
+#define DEBUG_PRINT(format, ...) \
     do { \
-        char buf[PRINT_QUEUE_STRING_SIZE] = {0}; \
-        snprintf(buf, PRINT_QUEUE_STRING_SIZE, __VA_ARGS__); \
-        xQueueSend(printQueue, buf, QUEUE_SEND_TIMEOUT_TICKS); \
+        static const char debugFormat[] DEBUG_FORMAT_SECTION = format; \
+        const uint32_t debugArgs[] = { 0 DEBUG_WORDS(__VA_ARGS__) }; \
+        if (0) { \
+            debugFormatCheck(format, ##__VA_ARGS__); \
+        } \
+        debugLogWrite((uint32_t)(uintptr_t)debugFormat, &debugArgs[1], \
+                      DEBUG_NARGS(__VA_ARGS__)); \
     } while(0)
 
 /**
- * @brief Send a debug string to the uart
- *
- * @param ... the format string and any arguments
+ * @brief Send a debug message to the uart from an interrupt
  *
- * This creates a string from the format and arguments, then copies it to a
- * queue for future printing over the uart by the debug task
- * This will trim any resultant string to PRINT_QUEUE_STRING_SIZE characters
- * It will silently fail if the queue is full after waiting for
- * QUEUE_SEND_TIMEOUT_TICKS
+ * Same as DEBUG_PRINT, which is interrupt safe
  *
  * @return Nothing
  */
-#define DEBUG_PRINT_ISR(...) \
-    do { \
-        char buf[PRINT_QUEUE_STRING_SIZE] = {0}; \
-        snprintf(buf, PRINT_QUEUE_STRING_SIZE, __VA_ARGS__); \
-        xQueueSendFromISR(printQueue, buf, NULL); \
-    } while(0)
+#define DEBUG_PRINT_ISR(...) DEBUG_PRINT(__VA_ARGS__)
 
 void vDebugTask(void *pvParameters);
 void debug_init(void);
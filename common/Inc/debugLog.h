@@ -0,0 +1,31 @@
+#ifndef DEBUG_LOG_H
+#define DEBUG_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Size of the log ring in 32 bit words. Each message takes 2 words plus one
+// per argument. Must be a power of 2
+#define DEBUG_LOG_RING_WORDS   256
+
+// Most arguments a single message can have
+#define DEBUG_LOG_MAX_ARGS     8
+
+/**
+ * @brief One message read back from the log ring
+ *
+ * id identifies the format string. On the target it is the address of the
+ * string in flash, so it can be looked up in the elf file
+ */
+typedef struct DebugLogEntry_t {
+    uint32_t argCount;
+    uint32_t id;                        // id and args must stay adjacent, the
+    uint32_t args[DEBUG_LOG_MAX_ARGS];  // debug task sends them as one block
+} DebugLogEntry_t;
+
+void debugLogInit(void);
+bool debugLogWrite(uint32_t id, const uint32_t *args, uint32_t argCount);
+bool debugLogRead(DebugLogEntry_t *entry);
+uint32_t debugLogDroppedCount(void);
+
+#endif /* DEBUG_LOG_H */
@@ -1,8 +1,20 @@
 #ifndef SCHED_H
 #define SCHED_H
 
+#include "stdint.h"
+
 #define SCH_MAX_TASKS (20)
 
+/* Priorities, tasks due together run highest first, then in the order added */
+#define SCH_PRIORITIES      (4)
+#define SCH_PRIORITY_HIGH   (0)
+#define SCH_PRIORITY_LOW    (SCH_PRIORITIES - 1)
+
+/* Timing wheel, two levels of 64 slots. The first level is one tick per */
+/* slot, the second one turn of the first per slot */
+#define SCH_WHEEL_BITS      (6)
+#define SCH_WHEEL_SLOTS     (1 << SCH_WHEEL_BITS)
+
 /* Limitations: */
 /* The ONLY INTERRUPT in the whole system shall be the systick (scheduling) interrupt */
 /* ALL tasks have to finish in under the scheduler tick period time (e.g. 1ms usually) */
@@ -12,22 +24,66 @@ typedef struct
 {
     /* Pointer to the task (must be a 'void (void)' function)*/
     void (*p_task)(void);
-    
-    /* Delay (ticks) until the function will (next) be run*/
-    /* - see SCH_Add_Task() for further details*/
-    uint32_t delay;
-    
+
+    /* Tick the task is (next) due, see sch_add_task() */
+    uint32_t expires;
+
     /* Interval (ticks) between subsequent runs.*/
     /* - see SCH_Add_Task() for further details*/
     uint32_t period;
-    
+
     /* Incremented (by scheduler) when task is due to execute*/
     uint32_t runme;
+
+    uint32_t priority;
+
+    /* Next task (index + 1, 0 for none) in the same wheel slot */
+    uint8_t next;
+
+    /* Execution time in cycles, see sch_set_cycle_counter() */
+    uint32_t runs;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+    uint32_t budget_cycles;     /* 0 for no budget */
+
+    /* Runs longer than the budget */
+    uint32_t budget_overruns;
+    /* Still running when the next tick came */
+    uint32_t tick_overruns;
 } task_info;
 
+typedef struct
+{
+    uint32_t runs;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint32_t avg_cycles;
+    uint32_t budget_overruns;
+    uint32_t tick_overruns;
+} sch_task_stats;
+
 /* Add tasks to scheduler, initial delay and period are in TICKS */
 uint32_t sch_add_task(void (*p_function)(), const uint32_t delay, const uint32_t period);
 
+/* As sch_add_task(), returns the task id or -1 */
+int32_t sch_add_task_priority(void (*p_function)(void), const uint32_t delay,
+                              const uint32_t period, const uint32_t priority);
+
+/* Count a run longer than budget_cycles as an overrun of the task */
+uint32_t sch_set_task_budget(const int32_t id, const uint32_t budget_cycles);
+
+/* Measure execution time with this free running counter, e.g. DWT->CYCCNT */
+void sch_set_cycle_counter(uint32_t (*p_cycles)(void));
+
+uint32_t sch_get_task_stats(const int32_t id, sch_task_stats *p_stats);
+
+/* Ticks since the scheduler started */
+uint32_t sch_get_ticks(void);
+
+/* Remove every task and start again from tick 0 */
+void sch_reset(void);
+
 /* Add this to a while(1) loop in main code, tasks are running from here */
 void sch_dispatch_tasks(void);
 
@@ -0,0 +1,20 @@
+#ifndef UART_RX_H
+#define UART_RX_H
+
+#include <stdint.h>
+
+#include "fc.h"
+
+// Bytes buffered from the uart between polls. At 115200 baud this holds
+// about 20 ms of continuous data
+#define UART_RX_BUFFER_SIZE       256
+
+#ifndef __UNIT_TEST
+
+void uartRxInit(void);
+uint32_t uartRxPeek(const uint8_t **data);
+void uartRxRelease(uint32_t length);
+
+#endif
+
+#endif /* UART_RX_H */
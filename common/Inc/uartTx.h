@@ -0,0 +1,59 @@
+#ifndef UART_TX_H
+#define UART_TX_H
+
+#include <stdint.h>
+
+#include "fc.h"
+
+// Bytes buffered for transmission. Must be a power of 2
+#define UART_TX_RING_SIZE         1024
+
+// Default baud rate of the debug/telemetry uart. Can be raised to PCLK2 / 8
+// (12.5 Mbaud) if the adapter on the other end supports it
+#ifndef UART_TX_BAUD_RATE
+#define UART_TX_BAUD_RATE         115200
+#endif
+
+#ifndef __UNIT_TEST
+
+#include "stm32f4xx_hal.h"
+
+#define UARTx_IRQn                USART6_IRQn
+#define UARTx_IRQHandler          USART6_IRQHandler
+#define UARTx_DMA_TX_IRQn         DMA2_Stream6_IRQn
+#define UARTx_DMA_TX_IRQHandler   DMA2_Stream6_IRQHandler
+
+extern UART_HandleTypeDef UartHandle;
+
+void uartTxInit(uint32_t baudRate);
+
+#endif
+
+typedef struct UartTxStats_t {
+    uint32_t bytesQueued;
+    uint32_t bytesDropped;
+    uint32_t writesDropped;  // Writes that didn't fit and were discarded
+    uint32_t transfers;      // DMA transfers started
+} UartTxStats_t;
+
+/**
+ * @brief A write built up from several pieces (see uartTxBegin)
+ */
+typedef struct UartTxFrame_t {
+    uint32_t index;      // Ring index of the next byte to write
+    uint32_t end;        // Ring index after the last byte of the frame
+    uint32_t lockState;  // Interrupt mask to restore in uartTxEnd
+} UartTxFrame_t;
+
+void uartTxReset(void);
+FC_Status uartTxBegin(UartTxFrame_t *frame, uint32_t length);
+void uartTxPut(UartTxFrame_t *frame, const void *data, uint32_t length);
+void uartTxEnd(UartTxFrame_t *frame);
+FC_Status uartTxWrite(const void *data, uint32_t length);
+uint32_t uartTxSpace(void);
+const UartTxStats_t *uartTxStats(void);
+
+uint32_t uartTxPeek(const uint8_t **data);
+void uartTxRelease(uint32_t length);
+
+#endif /* UART_TX_H */
@@ -3,6 +3,6 @@
 
 int32_t log_assert_violation(char *file, uint32_t line, char *condition)
 {
-    printf("ASSERT FAILURE: (%s): %s:%lu\n", condition, file, line);
+    printf("ASSERT FAILURE: (%s): %s:%lu\n", condition, file, (unsigned long)line);
     return 1;
 }
@@ -5,204 +5,309 @@
  *      Author: KabooHahahein
  */
 
-#include "stm32f0xx_hal.h"
+#include "string.h"
 #include "can.h"
+#include "can_filter.h"
 #include "can_heartbeat.h"
-#include "pins_common.h"
-#include "stdbool.h"
-#include "interrupt.h"
 
-CanRxMsgTypeDef currentRxMessage;
-CAN_HandleTypeDef canHandle =
-{
-	.Instance = CAN,
-	.Init = {
-		.Prescaler = 6,        // For 48 MHz
-		.Mode = CAN_MODE_NORMAL,
-		.SJW = CAN_SJW_1TQ,
-		.BS1 = CAN_BS1_12TQ,
-		.BS2 = CAN_BS2_3TQ,
-		.TTCM = DISABLE,
-		.ABOM = DISABLE,
-		.AWUM = DISABLE,
-		.NART = DISABLE,
-		.RFLM = DISABLE,
-		.TXFP = DISABLE
-	}
-};
+/*
+ * Nothing here waits on the bus:
+ *
+ * - sendCanMessage() queues the frame and pends the TX interrupt, which keeps
+ *   all the empty mailboxes loaded from the queue. The controller raises it
+ *   again each time a mailbox empties, until the queue runs dry.
+ * - The RX FIFO interrupt copies each frame into the RX queue.
+ * - canProcessRx(), called from the main loop, passes each received frame to
+ *   the handler registered for its ID, found by binary search of a table kept
+ *   sorted by ID.
+ *
+ * Each queue has one writer and one reader (the main loop and an interrupt),
+ * so neither needs a lock. Only send from one context.
+ *
+ * The controller's filters only let through the IDs subscribed to, which are
+ * every ID with a handler and any added with addCanFilter. They are planned
+ * into as few banks as possible by canFilterPlan.
+ */
+
+#define CAN_TX_QUEUE_MASK       (CAN_TX_QUEUE_SIZE - 1)
+#define CAN_RX_QUEUE_MASK       (CAN_RX_QUEUE_SIZE - 1)
+
+STATIC_ASSERT((CAN_TX_QUEUE_SIZE & CAN_TX_QUEUE_MASK) == 0, can_tx_queue_size_power_of_2);
+STATIC_ASSERT((CAN_RX_QUEUE_SIZE & CAN_RX_QUEUE_MASK) == 0, can_rx_queue_size_power_of_2);
 
-void HAL_CAN_MspInit(CAN_HandleTypeDef* hcan)
+// Keep the compiler from moving frame accesses across the indexes
+#define CAN_BARRIER() __asm volatile ("" ::: "memory")
+
+typedef struct
 {
+	uint16_t id;
+	CanHandler handler;
+} CanDispatchEntry;
+
+static const CanHal *canHal = 0;
+
+static CanFrame txQueue[CAN_TX_QUEUE_SIZE];
+static volatile uint32_t txHead;        // Written by sendCanMessage
+static volatile uint32_t txTail;        // Written by the TX interrupt
 
-	GPIO_InitTypeDef GPIO_InitStruct;
-	if (hcan->Instance == CAN)
+static CanFrame rxQueue[CAN_RX_QUEUE_SIZE];
+static volatile uint32_t rxHead;        // Written by the RX interrupt
+static volatile uint32_t rxTail;        // Written by canProcessRx
+
+static CanDispatchEntry dispatchTable[CAN_MAX_HANDLERS];
+static uint8_t dispatchCount;
+
+static uint16_t subscribedIds[CAN_MAX_SUBSCRIPTIONS];
+static uint16_t subscribedCount;
+static bool filtersApplied;
+
+static CanStats canStats;
+
+bool canInit(const CanHal *hal, const uint16_t thisIdBase)
+{
+	canHal = hal;
+	txHead = txTail = 0;
+	rxHead = rxTail = 0;
+	dispatchCount = 0;
+	subscribedCount = 0;
+	filtersApplied = false;
+	memset(&canStats, 0, sizeof(canStats));
+
+	if (!canHal->init())
 	{
+		canHal = 0;
+		return false;
+	}
+
+	initHeartBeat(thisIdBase);
+	setupCanFilters();      // You must implement this in can_data.c
+
+	return canApplyFilters();
+}
 
-		/* Peripheral clock enable */
-		__CAN_CLK_ENABLE();
-
-		/**CAN GPIO Configuration
-		 PB8     ------> CAN_RX
-		 PB9     ------> CAN_TX
-		 */
-		GPIO_InitStruct.Pin = CAN_N_PIN | CAN_P_PIN;
-		GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
-		GPIO_InitStruct.Pull = GPIO_NOPULL;
-		GPIO_InitStruct.Speed = GPIO_SPEED_LOW;
-		GPIO_InitStruct.Alternate = GPIO_AF4_CAN;
-		HAL_GPIO_Init(CAN_PORT, &GPIO_InitStruct);
-
-		/* System interrupt init*/
-		HAL_NVIC_SetPriority(CAN_INTERRUPT, CAN_PRIORITY_BASE, 0);
-		HAL_NVIC_EnableIRQ(CAN_INTERRUPT);
+/*
+ * Receive these IDs, 0 is ignored as it pads lists of fewer than 4
+ */
+void addCanFilter(uint16_t addresses[CAN_NUM_ADDR_PER_FILTER])
+{
+	for (uint8_t i = 0; i < CAN_NUM_ADDR_PER_FILTER; i++)
+	{
+		if (addresses[i] != 0)
+			canSubscribe(addresses[i]);
 	}
 }
 
-void HAL_CAN_MspDeInit(CAN_HandleTypeDef* hcan)
+/*
+ * Receive frames with this ID, once the filters are next applied
+ */
+bool canSubscribe(const uint16_t id)
 {
+	if (id > CAN_ID_MAX)
+		return false;
 
-	if (hcan->Instance == CAN)
+	for (uint16_t i = 0; i < subscribedCount; i++)
 	{
-		/* Peripheral clock disable */
-		__CAN_CLK_DISABLE();
+		if (subscribedIds[i] == id)
+			return true;
+	}
 
-		/**CAN GPIO Configuration
-		 PB8     ------> CAN_RX
-		 PB9     ------> CAN_TX
-		 */
-		HAL_GPIO_DeInit(CAN_PORT, CAN_N_PIN | CAN_P_PIN);
+	if (subscribedCount == CAN_MAX_SUBSCRIPTIONS)
+		return false;
 
-		/* Peripheral interrupt DeInit*/
-		HAL_NVIC_DisableIRQ(CAN_INTERRUPT);
+	subscribedIds[subscribedCount++] = id;
 
-	}
+	return true;
 }
 
-void setupAllCanFilters()
+/*
+ * Set the controller's filters to the IDs subscribed to. canInit does this,
+ * and canRegisterHandler does again for an ID registered afterwards
+ */
+bool canApplyFilters(void)
 {
-	setupHeartbeatFilters();
-	setupCanFilters();      // You must implement this in can_data.c
-}
+	static CanFilterPlan plan;
 
-HAL_StatusTypeDef initStatus;
-void canInit(const uint16_t thisIdBase)
-{
-	initStatus = HAL_CAN_Init(&canHandle);
-	initHeartBeat(thisIdBase);
-	setupAllCanFilters();
+	if (canHal == 0 || !canFilterPlan(subscribedIds, subscribedCount, CAN_NUM_FILTER_BANKS, &plan))
+		return false;
 
-	canHandle.pRxMsg = &currentRxMessage;
-	HAL_CAN_Receive_IT(&canHandle, CAN_FIFO0);
+	canHal->configFilters(plan.banks, plan.count);
+	canStats.filterBanks = plan.count;
+	canStats.filterFalseAccepts = plan.falseAccepts;
+	filtersApplied = true;
+
+	return true;
 }
 
-uint16_t currentFilterNumber = 0;
-void addCanFilter(uint16_t addresses[CAN_NUM_ADDR_PER_FILTER])
+/*
+ * Index of the first entry with an ID of at least id
+ */
+static uint8_t findHandler(const uint16_t id)
 {
+	uint8_t low = 0;
+	uint8_t high = dispatchCount;
 
-	// In list-16 bit mode, you can add a chain of 4 addresses
-	CAN_FilterConfTypeDef canFilter =
+	while (low < high)
 	{
-		.BankNumber = 0,
-		.FilterNumber = currentFilterNumber,
-		.FilterMode = CAN_FILTERMODE_IDLIST,
-		.FilterScale = CAN_FILTERSCALE_16BIT,
-		.FilterFIFOAssignment = CAN_FILTER_FIFO0,
-		.FilterActivation = ENABLE,
-		.FilterIdLow = addresses[0] << NUM_ID_BIT_SHIFT,
-		.FilterIdHigh = addresses[1] << NUM_ID_BIT_SHIFT,
-		.FilterMaskIdLow = addresses[2] << NUM_ID_BIT_SHIFT,
-		.FilterMaskIdHigh = addresses[3] << NUM_ID_BIT_SHIFT
-	};
-
-	HAL_CAN_ConfigFilter(&canHandle, &canFilter);
-
-	if (currentFilterNumber < 27)   // Max number of filters
-		currentFilterNumber ++;
+		uint8_t mid = (low + high) / 2;
+
+		if (dispatchTable[mid].id < id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
 }
 
-bool sendCanMessageTimeoutMs(const uint16_t id, const uint8_t *data,
-                             const uint8_t length, const uint32_t timeout)
+/*
+ * Call handler from canProcessRx for each frame received with this ID,
+ * replacing any handler it already has
+ */
+bool canRegisterHandler(const uint16_t id, CanHandler handler)
 {
-	uint32_t beginTime = HAL_GetTick();
-	bool success = false;
-	while (HAL_GetTick() < beginTime + timeout && !success)
+	if (id > CAN_ID_MAX || handler == 0)
+		return false;
+
+	uint8_t index = findHandler(id);
+
+	if (index < dispatchCount && dispatchTable[index].id == id)
 	{
-		success = sendCanMessage(id, data, length);
+		dispatchTable[index].handler = handler;
+		return true;
 	}
-	return success;
+
+	if (dispatchCount == CAN_MAX_HANDLERS)
+		return false;
+
+	memmove(&dispatchTable[index + 1], &dispatchTable[index],
+	        (dispatchCount - index) * sizeof(dispatchTable[0]));
+	dispatchTable[index].id = id;
+	dispatchTable[index].handler = handler;
+	dispatchCount++;
+
+	if (!canSubscribe(id))
+		return false;
+
+	return filtersApplied ? canApplyFilters() : true;
 }
 
+/*
+ * Queue a frame, returns false if it isn't valid or the queue is full
+ */
 bool sendCanMessage(const uint16_t id, const uint8_t *data, const uint8_t length)
 {
-	if (length > CAN_MAX_BYTE_LEN)
+	if (length > CAN_MAX_BYTE_LEN || id > CAN_ID_MAX)
 		return false;    // Programmer error
-	if (initStatus != HAL_OK)
-		return false;
-	if (canHandle.Instance->MSR == CAN_MCR_RESET)
+	if (canHal == 0)
 		return false;
 
-	HAL_Delay(1);	// Wait for a previous message to flush out HW
+	uint32_t head = txHead;
+	uint32_t used = head - txTail;
 
-	CanTxMsgTypeDef txMessage =
+	if (used == CAN_TX_QUEUE_SIZE)
 	{
-		.StdId = id,
-		.IDE = CAN_ID_STD,
-		.RTR = CAN_RTR_DATA,
-		.DLC = length
-	};
+		canStats.txDropped++;
+		return false;
+	}
 
-	uint8_t i;
-	for (i = 0; i < length; i++)
-		txMessage.Data[i] = data[i];
+	CanFrame *frame = &txQueue[head & CAN_TX_QUEUE_MASK];
+	frame->id = id;
+	frame->length = length;
+	memcpy(frame->data, data, length);
 
-	canHandle.pTxMsg = &txMessage;
-	HAL_StatusTypeDef status = HAL_CAN_Transmit_IT(&canHandle);
+	CAN_BARRIER();
+	txHead = head + 1;
 
-	if (status == HAL_OK)
-	{
-		return true;
-	}
-	else
+	canStats.txQueued++;
+	if (used + 1 > canStats.txQueueHighWater)
+		canStats.txQueueHighWater = used + 1;
+
+	canHal->txIrqPend();
+
+	return true;
+}
+
+/*
+ * Pass each received frame to its handler, returns the number of frames
+ */
+uint32_t canProcessRx(void)
+{
+	uint32_t processed = 0;
+	uint32_t tail = rxTail;
+
+	while (tail != rxHead)
 	{
-		return false;
+		CAN_BARRIER();
+		CanFrame frame = rxQueue[tail & CAN_RX_QUEUE_MASK];
+		CAN_BARRIER();
+		rxTail = ++tail;
+
+		uint8_t index = findHandler(frame.id);
+		if (index < dispatchCount && dispatchTable[index].id == frame.id)
+		{
+			dispatchTable[index].handler(&frame);
+			canStats.rxDispatched++;
+		}
+		else
+		{
+			canStats.rxUnhandled++;
+		}
+		processed++;
 	}
+
+	return processed;
 }
 
-/**
-* @brief This function handles HDMI_CEC and CAN interrupts (combined with EXTI line 27).
-*/
-void CEC_CAN_IRQHandler(void)
+uint32_t canTickMs(void)
 {
-	currentRxMessage = (CanRxMsgTypeDef)
-	{
-		0
-	};
-	HAL_CAN_IRQHandler(&canHandle);
-	receiveHeartBeat(&currentRxMessage);
-	HAL_CAN_Receive_IT(&canHandle, CAN_FIFO0);
+	return canHal ? canHal->tickMs() : 0;
 }
 
-uint32_t error = HAL_CAN_ERROR_NONE;
-void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan)
+void canGetStats(CanStats *stats)
 {
-	// Deal with error
-
-	error = hcan->ErrorCode;
-//#define HAL_CAN_ERROR_NONE              ((uint32_t)0x00000000)  /*!< No error             */
-//#define HAL_CAN_ERROR_EWG               ((uint32_t)0x00000001)  /*!< EWG error            */
-//#define HAL_CAN_ERROR_EPV               ((uint32_t)0x00000002)  /*!< EPV error            */
-//#define HAL_CAN_ERROR_BOF               ((uint32_t)0x00000004)  /*!< BOF error            */
-//#define HAL_CAN_ERROR_STF               ((uint32_t)0x00000008)  /*!< Stuff error          */
-//#define HAL_CAN_ERROR_FOR               ((uint32_t)0x00000010)  /*!< Form error           */
-//#define HAL_CAN_ERROR_ACK               ((uint32_t)0x00000020)  /*!< Acknowledgment error */
-//#define HAL_CAN_ERROR_BR                ((uint32_t)0x00000040)  /*!< Bit recessive        */
-//#define HAL_CAN_ERROR_BD                ((uint32_t)0x00000080)  /*!< LEC dominant         */
-//#define HAL_CAN_ERROR_CRC               ((uint32_t)0x00000100)  /*!< LEC transfer error   */
-
-	__HAL_CAN_CANCEL_TRANSMIT(hcan, CAN_TXMAILBOX_0);
-	__HAL_CAN_CANCEL_TRANSMIT(hcan, CAN_TXMAILBOX_1);
-	__HAL_CAN_CANCEL_TRANSMIT(hcan, CAN_TXMAILBOX_2);
-	hcan->Instance->MSR |= CAN_MCR_RESET;
+	*stats = canStats;
+}
 
+/*
+ * Load every empty mailbox from the TX queue
+ */
+void canTxIrqHandler(void)
+{
+	uint32_t tail = txTail;
+
+	for (uint8_t mailbox = 0; mailbox < CAN_TX_MAILBOXES && tail != txHead; mailbox++)
+	{
+		if (!canHal->txMailboxEmpty(mailbox))
+			continue;
+
+		CAN_BARRIER();
+		canHal->txMailboxLoad(mailbox, &txQueue[tail & CAN_TX_QUEUE_MASK]);
+		CAN_BARRIER();
+		txTail = ++tail;
+		canStats.txLoaded++;
+	}
 }
 
+/*
+ * Empty the controller's FIFO into the RX queue
+ */
+void canRxIrqHandler(void)
+{
+	CanFrame frame;
+
+	while (canHal->rxFifoRead(&frame))
+	{
+		uint32_t head = rxHead;
+
+		if (head - rxTail == CAN_RX_QUEUE_SIZE)
+		{
+			canStats.rxDropped++;
+			continue;
+		}
+
+		rxQueue[head & CAN_RX_QUEUE_MASK] = frame;
+		CAN_BARRIER();
+		rxHead = head + 1;
+		canStats.rxQueued++;
+	}
+}
@@ -0,0 +1,194 @@
+/*
+ * can_bxcan.c
+ *
+ * The CAN driver's controller, the bxCAN CAN1 of the STM32F4 parts that have
+ * one (RX on PB8, TX on PB9), at 500 kbit/s
+ */
+
+#include "stm32f4xx_hal.h"
+#include "can.h"
+#include "interrupt.h"
+
+#define CAN_BITRATE             500000
+#define CAN_BS1_TQ              11
+#define CAN_BS2_TQ              2
+#define CAN_TQ_PER_BIT          (1 + CAN_BS1_TQ + CAN_BS2_TQ)
+
+// Entering and leaving init mode takes 11 recessive bits on the bus
+#define CAN_INIT_TIMEOUT_MS     10
+
+#define CAN_STID_SHIFT          21
+#define CAN_FILTER_RTR_IDE_BITS 0x18
+
+static bool bxCanWaitInit(const bool inInit)
+{
+	uint32_t start = HAL_GetTick();
+
+	while (((CAN1->MSR & CAN_MSR_INAK) != 0) != inInit)
+	{
+		if (HAL_GetTick() - start > CAN_INIT_TIMEOUT_MS)
+			return false;
+	}
+
+	return true;
+}
+
+static bool bxCanInit(void)
+{
+	GPIO_InitTypeDef GPIO_InitStruct;
+	GPIO_InitStruct.Pin = GPIO_PIN_8 | GPIO_PIN_9;
+	GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+	GPIO_InitStruct.Pull = GPIO_PULLUP;
+	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+	GPIO_InitStruct.Alternate = GPIO_AF9_CAN1;
+
+	__HAL_RCC_GPIOB_CLK_ENABLE();
+	HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+	__HAL_RCC_CAN1_CLK_ENABLE();
+
+	// Leave sleep for init mode
+	CAN1->MCR = CAN_MCR_INRQ;
+	if (!bxCanWaitInit(true))
+		return false;
+
+	// Automatic bus off recovery, and send the mailboxes in the order they
+	// were loaded, so frames go out in the order they were queued
+	CAN1->MCR |= CAN_MCR_ABOM | CAN_MCR_TXFP;
+
+	uint32_t prescaler = HAL_RCC_GetPCLK1Freq() / (CAN_BITRATE * CAN_TQ_PER_BIT);
+	CAN1->BTR = (prescaler - 1) |
+	            ((CAN_BS1_TQ - 1) << CAN_BTR_TS1_Pos) |
+	            ((CAN_BS2_TQ - 1) << CAN_BTR_TS2_Pos);
+
+	// No banks until canApplyFilters, all 16 bit into FIFO 0
+	CAN1->FMR |= CAN_FMR_FINIT;
+	CAN1->FA1R = 0;
+	CAN1->FS1R = 0;
+	CAN1->FM1R = (1UL << CAN_NUM_FILTER_BANKS) - 1;
+	CAN1->FFA1R = 0;
+	CAN1->FMR &= ~CAN_FMR_FINIT;
+
+	// A mailbox emptied, and a frame received
+	CAN1->IER = CAN_IER_TMEIE | CAN_IER_FMPIE0;
+
+	HAL_NVIC_SetPriority(CAN_TX_INTERRUPT, CAN_PRIORITY_BASE, 0);
+	HAL_NVIC_SetPriority(CAN_RX_INTERRUPT, CAN_PRIORITY_BASE, 0);
+	HAL_NVIC_EnableIRQ(CAN_TX_INTERRUPT);
+	HAL_NVIC_EnableIRQ(CAN_RX_INTERRUPT);
+
+	CAN1->MCR &= ~CAN_MCR_INRQ;
+	return bxCanWaitInit(false);
+}
+
+static bool bxCanTxMailboxEmpty(uint8_t mailbox)
+{
+	return (CAN1->TSR & (CAN_TSR_TME0 << mailbox)) != 0;
+}
+
+static void bxCanTxMailboxLoad(uint8_t mailbox, const CanFrame *frame)
+{
+	CAN_TxMailBox_TypeDef *box = &CAN1->sTxMailBox[mailbox];
+	const uint8_t *data = frame->data;
+
+	box->TDTR = frame->length;
+	box->TDLR = (uint32_t)data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+	box->TDHR = (uint32_t)data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t)data[7] << 24);
+	box->TIR = ((uint32_t)frame->id << CAN_STID_SHIFT) | CAN_TI0R_TXRQ;
+}
+
+static bool bxCanRxFifoRead(CanFrame *frame)
+{
+	if ((CAN1->RF0R & CAN_RF0R_FMP0) == 0)
+		return false;
+
+	CAN_FIFOMailBox_TypeDef *box = &CAN1->sFIFOMailBox[0];
+	uint32_t low = box->RDLR;
+	uint32_t high = box->RDHR;
+
+	frame->id = (box->RIR >> CAN_STID_SHIFT) & CAN_ID_MAX;
+	frame->length = box->RDTR & CAN_RDT0R_DLC;
+	if (frame->length > CAN_MAX_BYTE_LEN)
+		frame->length = CAN_MAX_BYTE_LEN;
+
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		frame->data[i] = low >> (8 * i);
+		frame->data[i + 4] = high >> (8 * i);
+	}
+
+	// Release it, without clearing the full and overrun flags
+	CAN1->RF0R = CAN_RF0R_RFOM0;
+
+	return true;
+}
+
+static void bxCanTxIrqPend(void)
+{
+	NVIC_SetPendingIRQ(CAN_TX_INTERRUPT);
+}
+
+// 16 bit filter fields: the ID above the RTR and IDE bits
+static uint32_t bxCanFilterId(const uint16_t id)
+{
+	return (uint32_t)id << NUM_ID_BIT_SHIFT;
+}
+
+// Masks also match RTR and IDE, so only standard data frames pass
+static uint32_t bxCanFilterMask(const uint16_t mask)
+{
+	return ((uint32_t)mask << NUM_ID_BIT_SHIFT) | CAN_FILTER_RTR_IDE_BITS;
+}
+
+static void bxCanConfigFilters(const CanFilterBank *banks, uint8_t count)
+{
+	CAN1->FMR |= CAN_FMR_FINIT;
+	CAN1->FA1R = 0;
+
+	for (uint8_t i = 0; i < count; i++)
+	{
+		uint32_t bankBit = 1UL << i;
+		const uint16_t *ids = banks[i].ids;
+
+		if (banks[i].mode == CAN_FILTER_MASK)
+		{
+			// Each register holds a mask above its ID
+			CAN1->FM1R &= ~bankBit;
+			CAN1->sFilterRegister[i].FR1 = (bxCanFilterMask(ids[1]) << 16) | bxCanFilterId(ids[0]);
+			CAN1->sFilterRegister[i].FR2 = (bxCanFilterMask(ids[3]) << 16) | bxCanFilterId(ids[2]);
+		}
+		else
+		{
+			// In list-16 bit mode, each bank matches 4 addresses
+			CAN1->FM1R |= bankBit;
+			CAN1->sFilterRegister[i].FR1 = (bxCanFilterId(ids[1]) << 16) | bxCanFilterId(ids[0]);
+			CAN1->sFilterRegister[i].FR2 = (bxCanFilterId(ids[3]) << 16) | bxCanFilterId(ids[2]);
+		}
+		CAN1->FA1R |= bankBit;
+	}
+
+	CAN1->FMR &= ~CAN_FMR_FINIT;
+}
+
+const CanHal canBxCanHal =
+{
+	.init = bxCanInit,
+	.txMailboxEmpty = bxCanTxMailboxEmpty,
+	.txMailboxLoad = bxCanTxMailboxLoad,
+	.rxFifoRead = bxCanRxFifoRead,
+	.txIrqPend = bxCanTxIrqPend,
+	.configFilters = bxCanConfigFilters,
+	.tickMs = HAL_GetTick
+};
+
+void CAN1_TX_IRQHandler(void)
+{
+	// Clear the request completed flags, which raise this interrupt
+	CAN1->TSR = CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2;
+	canTxIrqHandler();
+}
+
+void CAN1_RX0_IRQHandler(void)
+{
+	canRxIrqHandler();
+}
@@ -0,0 +1,389 @@
+/*
+ * can_filter.c
+ *
+ * Packs a set of CAN IDs into as few filter banks as possible
+ */
+
+#include "string.h"
+#include "can_filter.h"
+
+/*
+ * A 16 bit bank holds either 4 IDs (list mode) or 2 ID and mask pairs (mask
+ * mode). A pair matches every ID that equals the ID in the bits the mask has
+ * set, so 2^n IDs for n clear bits. The planner:
+ *
+ * - Merges the IDs into pairs that match only requested IDs, as long as they
+ *   match at least 4 (less than that, the IDs fit a list in the same space).
+ * - While that needs more banks than there are, merges the two entries that
+ *   save the most space for the fewest unrequested IDs let through, until it
+ *   fits. A merged pair replaces any entries it also matches.
+ * - Packs the pairs into mask banks and the single IDs into list banks,
+ *   moving IDs into a spare mask slot where that saves a bank.
+ *
+ * The merging is greedy, so the plan is small rather than the smallest
+ * possible. It uses static buffers, plan from one context at a time.
+ */
+
+typedef struct
+{
+	uint16_t id;
+	uint16_t mask;              // Bits set must match
+	uint16_t falseAccepts;
+} FilterEntry;
+
+static uint16_t requested[CAN_MAX_SUBSCRIPTIONS];
+static uint16_t requestedCount;
+
+static FilterEntry entries[CAN_MAX_SUBSCRIPTIONS];
+static uint16_t entryCount;
+
+static bool isExact(const FilterEntry *entry)
+{
+	return entry->mask == CAN_FILTER_MASK_ALL;
+}
+
+static bool entryMatches(const FilterEntry *entry, const uint16_t id)
+{
+	return (id & entry->mask) == entry->id;
+}
+
+// Whether a matches everything b does
+static bool entryContains(const FilterEntry *a, const FilterEntry *b)
+{
+	return (b->mask & a->mask) == a->mask && (b->id & a->mask) == a->id;
+}
+
+static uint16_t entrySize(const FilterEntry *entry)
+{
+	return 1 << (11 - __builtin_popcount(entry->mask));
+}
+
+static uint16_t entryFalseAccepts(const FilterEntry *entry)
+{
+	uint16_t matched = 0;
+
+	for (uint16_t i = 0; i < requestedCount; i++)
+	{
+		if (entryMatches(entry, requested[i]))
+			matched++;
+	}
+
+	return entrySize(entry) - matched;
+}
+
+static bool isRequested(const uint16_t id)
+{
+	uint16_t low = 0;
+	uint16_t high = requestedCount;
+
+	while (low < high)
+	{
+		uint16_t mid = (low + high) / 2;
+
+		if (requested[mid] < id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low < requestedCount && requested[low] == id;
+}
+
+static void removeEntry(const uint16_t index)
+{
+	memmove(&entries[index], &entries[index + 1],
+	        (entryCount - index - 1) * sizeof(entries[0]));
+	entryCount--;
+}
+
+// Banks for lists IDs and masks pairs, with the best number of IDs moved
+// into mask slots
+static uint16_t banksNeeded(const uint16_t lists, const uint16_t masks, uint16_t *moved)
+{
+	uint16_t best = UINT16_MAX;
+
+	for (uint16_t k = 0; k <= lists; k++)
+	{
+		uint16_t banks = (masks + k + 1) / 2 + (lists - k + 3) / 4;
+
+		if (banks < best)
+		{
+			best = banks;
+			if (moved)
+				*moved = k;
+		}
+	}
+
+	return best;
+}
+
+static void countEntries(uint16_t *lists, uint16_t *masks)
+{
+	*lists = 0;
+	*masks = 0;
+
+	for (uint16_t i = 0; i < entryCount; i++)
+	{
+		if (isExact(&entries[i]))
+			(*lists)++;
+		else
+			(*masks)++;
+	}
+}
+
+// Pairs of entries differing in one bit, which match exactly what both did
+static void mergeExact(void)
+{
+	bool merged;
+
+	do
+	{
+		merged = false;
+		for (uint16_t i = 0; i < entryCount; i++)
+		{
+			for (uint16_t j = i + 1; j < entryCount; j++)
+			{
+				uint16_t diff = entries[i].id ^ entries[j].id;
+
+				if (entries[i].mask == entries[j].mask && __builtin_popcount(diff) == 1)
+				{
+					entries[i].id &= ~diff;
+					entries[i].mask &= ~diff;
+					removeEntry(j);
+					merged = true;
+					j = i;      // Look again with the bigger entry
+				}
+			}
+		}
+	} while (merged);
+
+	// Two IDs take the same space as a list, where they can share a bank
+	for (uint16_t i = 0; i < entryCount; )
+	{
+		if (entrySize(&entries[i]) == 2 && entryCount < CAN_MAX_SUBSCRIPTIONS)
+		{
+			uint16_t bit = ~entries[i].mask & CAN_FILTER_MASK_ALL;
+
+			entries[i].mask = CAN_FILTER_MASK_ALL;
+			entries[entryCount].id = entries[i].id | bit;
+			entries[entryCount].mask = CAN_FILTER_MASK_ALL;
+			entries[entryCount].falseAccepts = 0;
+			entryCount++;
+		}
+		i++;
+	}
+}
+
+typedef struct
+{
+	FilterEntry entry;
+	uint16_t saved;             // Quarter banks
+	uint16_t added;             // False accepts
+} MergeCandidate;
+
+static MergeCandidate evaluateMerge(const FilterEntry *a, const FilterEntry *b)
+{
+	MergeCandidate candidate;
+	int32_t added;
+	uint16_t saved = 0;
+
+	candidate.entry.mask = a->mask & b->mask & ~(a->id ^ b->id);
+	candidate.entry.id = a->id & candidate.entry.mask;
+
+	candidate.entry.falseAccepts = entryFalseAccepts(&candidate.entry);
+	added = candidate.entry.falseAccepts;
+	for (uint16_t i = 0; i < entryCount; i++)
+	{
+		if (entryContains(&candidate.entry, &entries[i]))
+		{
+			saved += isExact(&entries[i]) ? 1 : 2;
+			added -= entries[i].falseAccepts;
+		}
+	}
+
+	candidate.saved = saved - 2;
+	candidate.added = (added > 0) ? added : 0;
+
+	return candidate;
+}
+
+// Whether a is a better merge than b: the fewest false accepts for the
+// space it saves, and any saving over none
+static bool betterMerge(const MergeCandidate *a, const MergeCandidate *b)
+{
+	if ((a->saved > 0) != (b->saved > 0))
+		return a->saved > 0;
+
+	if (a->saved == 0)
+		return a->added < b->added;
+
+	return (uint32_t)a->added * b->saved < (uint32_t)b->added * a->saved;
+}
+
+static void mergeUntilFits(const uint8_t maxBanks)
+{
+	uint16_t lists;
+	uint16_t masks;
+
+	countEntries(&lists, &masks);
+	while (banksNeeded(lists, masks, 0) > maxBanks)
+	{
+		MergeCandidate best;
+		bool found = false;
+
+		for (uint16_t i = 0; i < entryCount; i++)
+		{
+			for (uint16_t j = i + 1; j < entryCount; j++)
+			{
+				MergeCandidate candidate = evaluateMerge(&entries[i], &entries[j]);
+
+				if (!found || betterMerge(&candidate, &best))
+				{
+					best = candidate;
+					found = true;
+				}
+			}
+		}
+
+		for (uint16_t i = 0; i < entryCount; )
+		{
+			if (entryContains(&best.entry, &entries[i]))
+				removeEntry(i);
+			else
+				i++;
+		}
+		entries[entryCount++] = best.entry;
+
+		countEntries(&lists, &masks);
+	}
+}
+
+static void packBanks(CanFilterPlan *plan)
+{
+	uint16_t lists;
+	uint16_t masks;
+	uint16_t moved = 0;
+	static FilterEntry listed[CAN_MAX_SUBSCRIPTIONS];
+	static FilterEntry masked[CAN_MAX_SUBSCRIPTIONS];
+	uint16_t listCount = 0;
+	uint16_t maskCount = 0;
+
+	countEntries(&lists, &masks);
+	banksNeeded(lists, masks, &moved);
+
+	for (uint16_t i = 0; i < entryCount; i++)
+	{
+		if (isExact(&entries[i]) && listCount < lists - moved)
+			listed[listCount++] = entries[i];
+		else
+			masked[maskCount++] = entries[i];
+	}
+
+	plan->count = 0;
+	for (uint16_t i = 0; i < maskCount; i += 2)
+	{
+		CanFilterBank *bank = &plan->banks[plan->count++];
+		const FilterEntry *second = &masked[(i + 1 < maskCount) ? i + 1 : i];
+
+		bank->mode = CAN_FILTER_MASK;
+		bank->ids[0] = masked[i].id;
+		bank->ids[1] = masked[i].mask;
+		bank->ids[2] = second->id;
+		bank->ids[3] = second->mask;
+	}
+	for (uint16_t i = 0; i < listCount; i += CAN_NUM_ADDR_PER_FILTER)
+	{
+		CanFilterBank *bank = &plan->banks[plan->count++];
+
+		// Unused slots repeat the last ID, 0 is a real ID
+		bank->mode = CAN_FILTER_LIST;
+		for (uint16_t j = 0; j < CAN_NUM_ADDR_PER_FILTER; j++)
+		{
+			uint16_t index = (i + j < listCount) ? i + j : listCount - 1;
+			bank->ids[j] = listed[index].id;
+		}
+	}
+}
+
+/*
+ * Plan filter banks that accept every one of ids, in at most maxBanks
+ *
+ * Returns false if there are more than CAN_MAX_SUBSCRIPTIONS IDs, an ID isn't
+ * valid or maxBanks is out of range. Duplicate IDs are fine
+ */
+bool canFilterPlan(const uint16_t *ids, const uint16_t count, const uint8_t maxBanks,
+                   CanFilterPlan *plan)
+{
+	if (count > CAN_MAX_SUBSCRIPTIONS || maxBanks == 0 || maxBanks > CAN_NUM_FILTER_BANKS)
+		return false;
+
+	// Sorted, without duplicates
+	requestedCount = 0;
+	for (uint16_t i = 0; i < count; i++)
+	{
+		uint16_t id = ids[i];
+		uint16_t j = requestedCount;
+
+		if (id > CAN_ID_MAX)
+			return false;
+		if (isRequested(id))
+			continue;
+
+		while (j > 0 && requested[j - 1] > id)
+		{
+			requested[j] = requested[j - 1];
+			j--;
+		}
+		requested[j] = id;
+		requestedCount++;
+	}
+
+	entryCount = requestedCount;
+	for (uint16_t i = 0; i < requestedCount; i++)
+	{
+		entries[i].id = requested[i];
+		entries[i].mask = CAN_FILTER_MASK_ALL;
+		entries[i].falseAccepts = 0;
+	}
+
+	mergeExact();
+	mergeUntilFits(maxBanks);
+	packBanks(plan);
+
+	plan->falseAccepts = 0;
+	for (uint16_t id = 0; id <= CAN_ID_MAX; id++)
+	{
+		if (canFilterPlanAccepts(plan, id) && !isRequested(id))
+			plan->falseAccepts++;
+	}
+
+	return true;
+}
+
+bool canFilterBankAccepts(const CanFilterBank *bank, const uint16_t id)
+{
+	if (bank->mode == CAN_FILTER_MASK)
+	{
+		return (id & bank->ids[1]) == bank->ids[0] ||
+		       (id & bank->ids[3]) == bank->ids[2];
+	}
+
+	for (uint8_t i = 0; i < CAN_NUM_ADDR_PER_FILTER; i++)
+	{
+		if (bank->ids[i] == id)
+			return true;
+	}
+
+	return false;
+}
+
+bool canFilterPlanAccepts(const CanFilterPlan *plan, const uint16_t id)
+{
+	for (uint8_t i = 0; i < plan->count; i++)
+	{
+		if (canFilterBankAccepts(&plan->banks[i], id))
+			return true;
+	}
+
+	return false;
+}
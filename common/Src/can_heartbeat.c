@@ -37,52 +37,36 @@ CanHeartbeatData canHeartbeatData[CAN_NETWORK_SIZE] =
 	}
 };
 
-void setupHeartbeatFilters()
+void initHeartBeat (uint16_t thisIdBase)
 {
-	uint16_t addresses [CAN_NUM_ADDR_PER_FILTER];
-	uint8_t networkCounter = 0;
-	while (networkCounter < CAN_NETWORK_SIZE)
+	lastSendTick = 0;
+	thisId = thisIdBase + CAN_HBADDR_OFFSET;
+
+	// Received from canProcessRx, not the interrupt. Registering lets the
+	// heartbeats through the filters
+	uint8_t i;
+	for (i = 0; i < CAN_NETWORK_SIZE; i ++)
 	{
-		for (uint8_t i = 0; i < CAN_NUM_ADDR_PER_FILTER; )
+		if (canHeartbeatData[i].canId != thisId)
 		{
-			if (networkCounter < CAN_NETWORK_SIZE)
-			{
-				if (thisId != canHeartbeatData[networkCounter].canId)
-				{
-					addresses[i] = canHeartbeatData[networkCounter].canId;
-					i++;
-				}
-				networkCounter ++;
-			}
-			else
-			{
-				addresses[i] = 0;
-				i++;
-			}
+			canRegisterHandler(canHeartbeatData[i].canId, receiveHeartBeat);
 		}
-		addCanFilter(addresses);
 	}
 }
 
-void initHeartBeat (uint16_t thisIdBase)
-{
-	lastSendTick = 0;
-	thisId = thisIdBase + CAN_HBADDR_OFFSET;
-}
-
-void receiveHeartBeat(CanRxMsgTypeDef *rxMessage)
+void receiveHeartBeat(const CanFrame *frame)
 {
-	if (rxMessage->StdId == 0)
+	if (frame->id == 0 || frame->length == 0)
 		return;
 
 	uint8_t i;
 	for (i = 0; i < CAN_NETWORK_SIZE; i ++)
 	{
-		if (rxMessage->StdId == canHeartbeatData[i].canId &&
-		        rxMessage->StdId != thisId &&
-		        rxMessage->Data[0] == HEARTBEAT_CHECK_BYTE)
+		if (frame->id == canHeartbeatData[i].canId &&
+		        frame->id != thisId &&
+		        frame->data[0] == HEARTBEAT_CHECK_BYTE)
 		{
-			canHeartbeatData[i].lastTickMs = HAL_GetTick();
+			canHeartbeatData[i].lastTickMs = canTickMs();
 		}
 	}
 }
@@ -90,11 +74,11 @@ void receiveHeartBeat(CanRxMsgTypeDef *rxMessage)
 void canHeartBeatProcessing()
 {
 	// Send heartbeat
-	if (HAL_GetTick() > HEARTBEAT_DELAY_MS + lastSendTick)
+	if (canTickMs() > HEARTBEAT_DELAY_MS + lastSendTick)
 	{
 		uint8_t byte = HEARTBEAT_CHECK_BYTE;
 		sendCanMessage(thisId, &byte, 1);
-		lastSendTick = HAL_GetTick();
+		lastSendTick = canTickMs();
 	}
 }
 
@@ -107,7 +91,7 @@ bool hasHeartBeatExpired(uint16_t canIdBase)
 	for (i = 0; i < CAN_NETWORK_SIZE; i ++)
 	{
 		if (canHeartbeatData[i].canId == canId &&
-		        HAL_GetTick() < canHeartbeatData[i].lastTickMs + TIMEOUT_MS)
+		        canTickMs() < canHeartbeatData[i].lastTickMs + TIMEOUT_MS)
 		{
 			isHeartBeatExpired = false;
 		}
@@ -122,7 +106,7 @@ bool hasAnyHeartBeatExpired ()
 	for (i = 0; i < CAN_NETWORK_SIZE; i ++)
 	{
 		if (canHeartbeatData[i].canId != thisId &&
-		        HAL_GetTick() > canHeartbeatData[i].lastTickMs + TIMEOUT_MS)
+		        canTickMs() > canHeartbeatData[i].lastTickMs + TIMEOUT_MS)
 		{
 			isHeartBeatExpired = true;
 		}
@@ -4,6 +4,7 @@
 
 #include "pins_common.h"
 #include "can_rt.h"
+#include "can_filter.h"
 #include "assert.h"
 
 static int32_t can_rt_addfilterids(const uint16_t *filters, const uint16_t filter_num);
@@ -11,7 +12,7 @@ static int32_t can_rt_addfilterids(const uint16_t *filters, const uint16_t filte
 int32_t can_rt_setup(const uint16_t *filters, const uint16_t filter_num)
 {
     // Assert paramaters
-    if(c_assert(filters) || c_assert(filter_num < CAN_RT_NUM_FILTERS_MAX))
+    if(c_assert(filters) || c_assert(filter_num <= CAN_RT_NUM_FILTERS_MAX))
     {
         return 1;
     }
@@ -141,8 +142,14 @@ int32_t can_rt_setup(const uint16_t *filters, const uint16_t filter_num)
 
 static int32_t can_rt_addfilterids(const uint16_t *filters, const uint16_t filter_num)
 {
-    // Filter index in for-loop
-    uint32_t fi = 0;
+    static CanFilterPlan plan;
+    uint32_t i = 0;
+
+    // Pack the IDs into as few banks as fit, reporting any that can't be
+    if(c_assert(canFilterPlan(filters, filter_num, CAN_RT_NUM_FILTER_BANKS, &plan)))
+    {
+        return 1;
+    }
 
     // Enter filter initialization mode
     CAN->FMR |= CAN_FMR_FINIT;
@@ -150,54 +157,34 @@ static int32_t can_rt_addfilterids(const uint16_t *filters, const uint16_t filte
     // Deactivate all banks so we can set the filters (FACTx=0). NOTE: don't use CAN_FA1R_FACT, has wrong bits from STM32F4
     CAN->FA1R &= ~(uint32_t)0x3FFF;
     
-    // Filter scale for all banks: 4 IDs per bank (FSCx=0). NOTE: don't use CAN_FS1R_FSC
+    // Filter scale for all banks: 16 bit (FSCx=0). NOTE: don't use CAN_FS1R_FSC
     CAN->FS1R &= ~(uint32_t)0x3FFF;
 
-    // Identifier List Mask for all banks (FBMx=0). NOTE: don't use CAN_FM1R_FBM
-    CAN->FM1R &= ~(uint32_t)0x3FFF;
-
     // All banks use FIFO0 (FFAx=0). NOTE: don't use CAN_FFA1R_FFA
     CAN->FFA1R &= ~(uint32_t)0x3FFF;
-    
-    // Reset all registers to safe values that will only match IDs of 0
-    for(fi = 0; fi < 28; fi++)
-    {
-        CAN->sFilterRegister[fi].FR1 = (uint32_t)(0xFFFF0000);
-        CAN->sFilterRegister[fi].FR2 = (uint32_t)(0xFFFF0000);
-    }
 
-    // Add the filters
-    for(fi = 0; fi < filter_num; fi++)
+    for(i = 0; i < plan.count; i++)
     {
-        // Calculate bank i [0:27]
-        uint32_t i = fi / 2;
-
-        // Calculate bank register x [1:2]
-        uint32_t x = fi % 2 + 1;
+        const uint16_t *ids = plan.banks[i].ids;
 
-        // For each filter, set the filter value, and activate the appropriate bank
-        // Bits 31:16 are mask
-        // Bits 15:0 are ID
-        if(x == 1)
+        // Bits 31:16 are the second ID (list) or the mask (mask mode), bits 15:0 the ID
+        // The mask also covers the RTR and IDE bits, so only standard data frames match
+        if(plan.banks[i].mode == CAN_FILTER_MASK)
         {
-            // Set both filter registers to requested ID since when we activate the bank they BOTH become active
-            // If we only set FR1, whatever garbage is left in FR2 will be interpreted as an active filter ID
-            CAN->sFilterRegister[i].FR1 = (uint32_t)(0xFFFF0000 | ((uint32_t)filters[fi] << 5));
-            CAN->sFilterRegister[i].FR2 = (uint32_t)(0xFFFF0000 | ((uint32_t)filters[fi] << 5));
-        }
-        else if(x == 2)
-        {
-            CAN->sFilterRegister[i].FR2 = (uint32_t)(0xFFFF0000 | ((uint32_t)filters[fi] << 5));
+            CAN->FM1R &= ~(uint32_t)(1 << i);
+            CAN->sFilterRegister[i].FR1 = (uint32_t)(((ids[1] << 5) | 0x18) << 16 | (ids[0] << 5));
+            CAN->sFilterRegister[i].FR2 = (uint32_t)(((ids[3] << 5) | 0x18) << 16 | (ids[2] << 5));
         }
         else
         {
-            return 1;
+            CAN->FM1R |= (uint32_t)(1 << i);
+            CAN->sFilterRegister[i].FR1 = (uint32_t)((ids[1] << 5) << 16 | (ids[0] << 5));
+            CAN->sFilterRegister[i].FR2 = (uint32_t)((ids[3] << 5) << 16 | (ids[2] << 5));
         }
 
         // Activate bank
         CAN->FA1R |= (uint32_t)(1 << i);
     }
-    
 
     // Exit filter initialization mode
     CAN->FMR &= ~CAN_FMR_FINIT;
@@ -5,108 +5,125 @@
 
 #include "stm32f4xx_hal.h"
 
+#include "freertos.h"
+#include "task.h"
+
 #include "fc.h"
 #include "pins_common.h"
 #include "pins.h"
 #include "debug.h"
+#include "uartTx.h"
 
-QueueHandle_t printQueue;
-
-#define UARTx_BAUD_RATE            115200
-#define UARTx_TIMEOUT              1000
-#define UARTx                      USART6
-
-#define UARTx_CLK_ENABLE           __HAL_RCC_USART6_CLK_ENABLE
-
-#define UARTx_TX_GPIO_CLK_ENABLE   __HAL_RCC_GPIOC_CLK_ENABLE
-#define UARTx_RX_GPIO_CLK_ENABLE   __HAL_RCC_GPIOC_CLK_ENABLE
-
-#define UARTx_ALTERNATE_FUNCTION   GPIO_AF8_USART6
-
-#define UARTx_TX_GPIO_PIN          GPIO_PIN_6
-#define UARTx_TX_GPIO_PORT         GPIOC
-
-#define UARTx_RX_GPIO_PIN          GPIO_PIN_7
-#define UARTx_RX_GPIO_PORT         GPIOC
-
-
-UART_HandleTypeDef UartHandle;
-
-void uart_init(void) {
-    GPIO_InitTypeDef  GPIO_InitStruct;
-
-    /*##-1- Enable peripherals and GPIO Clocks #################################*/
-    /* Enable GPIO TX/RX clock */
-    UARTx_TX_GPIO_CLK_ENABLE();
-    UARTx_RX_GPIO_CLK_ENABLE();
+// How long the debug task waits between checks for space in the uart ring
+#define DEBUG_TX_WAIT_MS           2
 
-    /* Enable USARTx clock */
-    UARTx_CLK_ENABLE();
+void debug_init(void)
+{
+    // The log ring needs no setup (it is zero initialised), so messages
+    // logged before this are kept
+    uartTxInit(UART_TX_BAUD_RATE);
+}
 
-    /*##-2- Configure peripheral GPIO ##########################################*/
-    /* UART TX GPIO pin configuration  */
-    GPIO_InitStruct.Pin       = UARTx_TX_GPIO_PIN;
-    GPIO_InitStruct.Mode      = GPIO_MODE_AF_PP;
-    GPIO_InitStruct.Pull      = GPIO_PULLUP;
-    GPIO_InitStruct.Speed     = GPIO_SPEED_FAST;
-    GPIO_InitStruct.Alternate = UARTx_ALTERNATE_FUNCTION;
+ /*Function to enable printf for debugging*/
+int _write(int file, char* data, int len) {
+    // Never blocks, output that doesn't fit in the uart ring is dropped and
+    // counted (see uartTxStats)
+    uartTxWrite(data, len);
+    return len;
+}
 
-    HAL_GPIO_Init(UARTx_TX_GPIO_PORT, &GPIO_InitStruct);
+/**
+ * @brief Queue data on the uart, waiting for space rather than dropping it
+ *
+ * Only the debug task does this, the log ring holds messages meanwhile
+ */
+static void sendBlocking(const void *data, uint32_t length)
+{
+    while (uartTxSpace() < length && length <= UART_TX_RING_SIZE)
+    {
+        vTaskDelay(DEBUG_TX_WAIT_MS / portTICK_PERIOD_MS);
+    }
 
-    /* UART RX GPIO pin configuration  */
-    GPIO_InitStruct.Pin = UARTx_RX_GPIO_PIN;
-    GPIO_InitStruct.Alternate = UARTx_ALTERNATE_FUNCTION;
+    uartTxWrite(data, length);
+}
 
-    HAL_GPIO_Init(UARTx_RX_GPIO_PORT, &GPIO_InitStruct);
 
-    UartHandle.Instance          = UARTx;
+#ifdef DEBUG_LOG_BINARY
 
-    UartHandle.Init.BaudRate     = UARTx_BAUD_RATE;
-    UartHandle.Init.WordLength   = UART_WORDLENGTH_8B;
-    UartHandle.Init.StopBits     = UART_STOPBITS_1;
-    UartHandle.Init.Parity       = UART_PARITY_NONE;
-    UartHandle.Init.HwFlowCtl    = UART_HWCONTROL_NONE;
-    UartHandle.Init.Mode         = UART_MODE_TX_RX;
-    UartHandle.Init.OverSampling = UART_OVERSAMPLING_16;
+/**
+ * @brief Send a message unformatted, for tools/debug_decode
+ */
+static void sendMessage(const DebugLogEntry_t *entry)
+{
+    uint8_t frame[3 + sizeof(uint32_t) * (1 + DEBUG_LOG_MAX_ARGS)];
+    uint32_t length = sizeof(uint32_t) * (1 + entry->argCount);
 
-    if(HAL_UART_Init(&UartHandle) != HAL_OK)
-    {
-        Error_Handler("UART init fail");
-    }
+    frame[0] = DEBUG_BINARY_SYNC_0;
+    frame[1] = DEBUG_BINARY_SYNC_1;
+    frame[2] = entry->argCount;
+    // The id and args are contiguous little endian words
+    memcpy(&frame[3], &entry->id, length);
 
+    sendBlocking(frame, 3 + length);
 }
 
-void debug_init(void)
+#else
+
+/**
+ * @brief Format a message and send it
+ *
+ * Every argument is a 32 bit word, the same size as everything printf reads
+ * for the supported formats, so all of them can be passed and printf will use
+ * the ones the format needs
+ */
+static void sendMessage(const DebugLogEntry_t *entry)
 {
-    uart_init();
-    printQueue = xQueueCreate(PRINT_QUEUE_LENGTH, PRINT_QUEUE_STRING_SIZE);
-    if (!printQueue)
-    {
-        Error_Handler("no print queue");
+    char line[DEBUG_LINE_MAX_LENGTH];
+    const uint32_t *a = entry->args;
+    int len;
+
+    len = snprintf(line, sizeof(line), (const char*)(uintptr_t)entry->id,
+                   a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+    if (len < 0) {
+        return;
+    } else if (len >= (int)sizeof(line)) {
+        len = sizeof(line) - 1;
     }
-}
 
- /*Function to enable printf for debugging*/
-int _write(int file, char* data, int len) {
-    if (HAL_UART_Transmit(&UartHandle, (uint8_t*)data, len, 5000) != HAL_OK)
-    {
-        DEBUG_PRINT("Uart Transmit failure\n");
-    }
-    return len;
+    sendBlocking(line, len);
 }
 
+#endif
 
 void vDebugTask(void *pvParameters)
 {
-    char buffer[PRINT_QUEUE_STRING_SIZE] = {0};
+    DebugLogEntry_t entry = {0};
+    uint32_t lastDropped = 0;
+    uint32_t lastUartDropped = 0;
 
     for ( ;; )
     {
-        if (xQueueReceive(printQueue, buffer, portMAX_DELAY) == pdTRUE)
+        while (debugLogRead(&entry))
+        {
+            sendMessage(&entry);
+        }
+
+        uint32_t droppedNow = debugLogDroppedCount();
+        if (droppedNow != lastDropped)
         {
-            int len = strlen(buffer);
-            HAL_UART_Transmit(&UartHandle, (uint8_t*)buffer, len, UARTx_TIMEOUT);
+            DEBUG_PRINT("Debug log dropped %lu\n", droppedNow - lastDropped);
+            lastDropped = droppedNow;
         }
+
+        // printf output that didn't fit in the uart ring
+        uint32_t uartDroppedNow = uartTxStats()->writesDropped;
+        if (uartDroppedNow != lastUartDropped)
+        {
+            DEBUG_PRINT("Uart dropped %lu writes\n",
+                        uartDroppedNow - lastUartDropped);
+            lastUartDropped = uartDroppedNow;
+        }
+
+        vTaskDelay(DEBUG_POLL_PERIOD_MS / portTICK_PERIOD_MS);
     }
 }
-
@@ -0,0 +1,138 @@
+#include <string.h>
+
+#include "debugLog.h"
+
+/**
+ * @file common/Src/debugLog.c
+ *
+ * @brief Lock free ring buffer of deferred debug messages
+ *
+ * A message is a format string id followed by its raw argument words. Writers
+ * never format anything and never block, so DEBUG_PRINT can be used from any
+ * task or interrupt. Formatting happens later in the debug task, or on the
+ * host (see tools/debug_decode.c).
+ *
+ * Any number of writers, one reader. A writer reserves space by advancing
+ * head with a compare and swap, fills in the arguments, then writes the
+ * header word last to mark the message complete. The reader stops at the
+ * first message whose header is still 0, and clears each message before
+ * freeing it by advancing tail.
+ *
+ * Each message is laid out as:
+ * +     header   DEBUG_LOG_HEADER_MARK | argument count
+ * +     id
+ * +     args     argument count words
+ */
+
+#define DEBUG_LOG_RING_MASK      (DEBUG_LOG_RING_WORDS - 1)
+
+#if (DEBUG_LOG_RING_WORDS & DEBUG_LOG_RING_MASK) != 0
+#error "DEBUG_LOG_RING_WORDS must be a power of 2"
+#endif
+
+#define DEBUG_LOG_HEADER_MARK    0xD0600000
+#define DEBUG_LOG_COUNT_MASK     0x000000FF
+
+static volatile uint32_t ring[DEBUG_LOG_RING_WORDS];
+
+// Both count up forever and are masked on use, so head - tail is the number
+// of words used (reserved or not yet freed)
+static uint32_t head = 0;
+static uint32_t tail = 0;
+static uint32_t dropped = 0;
+
+void debugLogInit(void)
+{
+    memset((void *)ring, 0, sizeof(ring));
+    __atomic_store_n(&head, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&tail, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&dropped, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Add a message to the log. Safe to call from any task or interrupt
+ *
+ * @param id       Identifies the format string
+ * @param args     The raw argument words
+ * @param argCount Number of words in args, at most DEBUG_LOG_MAX_ARGS
+ *
+ * @return true if the message was added, false if the ring is full (the
+ * message is dropped and counted)
+ */
+bool debugLogWrite(uint32_t id, const uint32_t *args, uint32_t argCount)
+{
+    uint32_t length = 2 + argCount;
+    uint32_t start = __atomic_load_n(&head, __ATOMIC_RELAXED);
+
+    if (argCount > DEBUG_LOG_MAX_ARGS) {
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    do {
+        uint32_t used = start - __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+
+        if (used + length > DEBUG_LOG_RING_WORDS) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &start, start + length,
+                                          true /* weak */,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    ring[(start + 1) & DEBUG_LOG_RING_MASK] = id;
+    for (uint32_t i = 0; i < argCount; i++) {
+        ring[(start + 2 + i) & DEBUG_LOG_RING_MASK] = args[i];
+    }
+
+    // Publish the message only once its contents are written
+    __atomic_store_n(&ring[start & DEBUG_LOG_RING_MASK],
+                     DEBUG_LOG_HEADER_MARK | argCount, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/**
+ * @brief Take the oldest complete message from the log. Must only be called
+ * from one task
+ *
+ * @param[out] entry The message
+ *
+ * @return true if a message was read, false if there are none ready
+ */
+bool debugLogRead(DebugLogEntry_t *entry)
+{
+    uint32_t start = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+    uint32_t header;
+
+    if (start == __atomic_load_n(&head, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    // 0 until the writer has finished filling it in
+    header = __atomic_load_n(&ring[start & DEBUG_LOG_RING_MASK],
+                             __ATOMIC_ACQUIRE);
+    if (header == 0) {
+        return false;
+    }
+
+    entry->argCount = header & DEBUG_LOG_COUNT_MASK;
+    entry->id = ring[(start + 1) & DEBUG_LOG_RING_MASK];
+    for (uint32_t i = 0; i < entry->argCount; i++) {
+        entry->args[i] = ring[(start + 2 + i) & DEBUG_LOG_RING_MASK];
+    }
+
+    // Clear every word so a stale header is never mistaken for a new one
+    for (uint32_t i = 0; i < 2 + entry->argCount; i++) {
+        ring[(start + i) & DEBUG_LOG_RING_MASK] = 0;
+    }
+
+    __atomic_store_n(&tail, start + 2 + entry->argCount, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+uint32_t debugLogDroppedCount(void)
+{
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -1,26 +1,115 @@
 #include "stdint.h"
+#include "string.h"
+#include "fc.h"
 #include "sched.h"
 #include "assert.h"
 
+/*
+ * Tasks are kept on a hierarchical timing wheel, so the tick interrupt only
+ * looks at the tasks due on that tick rather than at every task:
+ *
+ * - A task due within SCH_WHEEL_SLOTS ticks is in the first level, in the
+ *   slot for its tick.
+ * - A task due later is in the second level, in the slot for its tick
+ *   divided by SCH_WHEEL_SLOTS. Each time the first level turns, the next
+ *   second level slot is moved down into it (or back up, if the task is
+ *   more than a whole second level turn away).
+ *
+ * Due tasks are marked ready by priority, and sch_dispatch_tasks() always
+ * runs the highest priority ready task next. Each run is timed with the
+ * cycle counter, and a task still running when the tick interrupt comes is
+ * counted as the cause of the overrun.
+ */
+
+#define SCH_WHEEL_MASK  (SCH_WHEEL_SLOTS - 1)
+#define SCH_NO_TASK     (-1)
+
+STATIC_ASSERT(SCH_MAX_TASKS <= 32, ready_mask_too_small);
+STATIC_ASSERT(SCH_MAX_TASKS < 255, task_links_too_small);
+
 static volatile uint32_t sched_cycles = 0;          /* Scheduler cycle count */
 static volatile task_info sch_tasks[SCH_MAX_TASKS]; /* Task list, modified in ISR */
 static volatile int32_t task_overrun = 0;           /* Task overrun flag, set in ISR */
-static int32_t dispatch_active = 0;                 /* Flag set by dispatch functions, used to detect overruns in ISR */
+static volatile int32_t running_task = SCH_NO_TASK; /* Task being dispatched, used to detect overruns in ISR */
+
+/* Wheel slots, each the first task (index + 1, 0 for none) of a list */
+static volatile uint8_t wheel_ticks[SCH_WHEEL_SLOTS];
+static volatile uint8_t wheel_turns[SCH_WHEEL_SLOTS];
+
+/* Bit n set if task n is ready, one mask per priority */
+static volatile uint32_t ready_mask[SCH_PRIORITIES];
+
+static uint32_t (*p_cycle_counter)(void) = 0;
+
+/* The tick interrupt modifies the task list, the dispatcher keeps it out */
+static inline uint32_t sch_lock(void)
+{
+#ifndef __UNIT_TEST
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return primask;
+#else
+    return 0;
+#endif
+}
+
+static inline void sch_unlock(uint32_t primask)
+{
+#ifndef __UNIT_TEST
+    __set_PRIMASK(primask);
+#else
+    (void)primask;
+#endif
+}
+
+static uint32_t sch_read_cycles(void)
+{
+    return p_cycle_counter ? p_cycle_counter() : 0;
+}
+
+/* Put a task in the wheel slot for its expiry tick. Called from the ISR, or with it locked out */
+static void sch_insert(const uint32_t index)
+{
+    volatile task_info *p_task = &sch_tasks[index];
+    uint32_t delta = p_task->expires - sched_cycles;
+    volatile uint8_t *p_slot;
+
+    if (delta < SCH_WHEEL_SLOTS)
+    {
+        p_slot = &wheel_ticks[p_task->expires & SCH_WHEEL_MASK];
+    }
+    else
+    {
+        p_slot = &wheel_turns[(p_task->expires >> SCH_WHEEL_BITS) & SCH_WHEEL_MASK];
+    }
+
+    p_task->next = *p_slot;
+    *p_slot = index + 1;
+}
 
 /* Schedule task for execution */
 uint32_t sch_add_task(void (*p_function)(), const uint32_t delay, const uint32_t period)
+{
+    return (sch_add_task_priority(p_function, delay, period, SCH_PRIORITY_LOW) < 0) ? 1 : 0;
+}
+
+/* Schedule task for execution, first after delay + 1 ticks then every period ticks */
+int32_t sch_add_task_priority(void (*p_function)(void), const uint32_t delay,
+                              const uint32_t period, const uint32_t priority)
 {
     uint32_t index = 0;
+    uint32_t primask;
 
     /* Check parameters */
     if( c_assert(p_function) ||
-        c_assert(period > 0))
+        c_assert(period > 0) ||
+        c_assert(priority < SCH_PRIORITIES))
     {
-        return 1;
+        return -1;
     }
 
     /* First find a gap in the array (if there is one)*/
-    while ((sch_tasks[index].p_task != 0) && (index < SCH_MAX_TASKS))
+    while ((index < SCH_MAX_TASKS) && (sch_tasks[index].p_task != 0))
     {
         index++;
     }
@@ -28,71 +117,198 @@ uint32_t sch_add_task(void (*p_function)(), const uint32_t delay, const uint32_t
     /* Have we reached the end of the list?*/
     if (index == SCH_MAX_TASKS)
     {
-        return 1;
+        return -1;
     }
 
     /* If we're here, there is a space in the task array*/
+    primask = sch_lock();
+
+    memset((void *)&sch_tasks[index], 0, sizeof(sch_tasks[index]));
     sch_tasks[index].p_task = p_function;
-    sch_tasks[index].delay = delay;
-    sch_tasks[index].period = period - 1; // -1 to account for the fact that 0 is actually every 1 timer tick
-    sch_tasks[index].runme = 0;
+    sch_tasks[index].expires = sched_cycles + delay + 1;
+    sch_tasks[index].period = period;
+    sch_tasks[index].priority = priority;
+    sch_tasks[index].min_cycles = UINT32_MAX;
+    sch_insert(index);
+
+    sch_unlock(primask);
+
+    return index;
+}
+
+uint32_t sch_set_task_budget(const int32_t id, const uint32_t budget_cycles)
+{
+    if (c_assert(id >= 0 && id < SCH_MAX_TASKS && sch_tasks[id].p_task))
+    {
+        return 1;
+    }
+
+    sch_tasks[id].budget_cycles = budget_cycles;
+
+    return 0;
+}
+
+void sch_set_cycle_counter(uint32_t (*p_cycles)(void))
+{
+    p_cycle_counter = p_cycles;
+}
+
+uint32_t sch_get_task_stats(const int32_t id, sch_task_stats *p_stats)
+{
+    volatile task_info *p_task;
+    uint32_t primask;
+
+    if (c_assert(id >= 0 && id < SCH_MAX_TASKS && sch_tasks[id].p_task))
+    {
+        return 1;
+    }
+
+    p_task = &sch_tasks[id];
+
+    /* The overrun counts are written in the ISR */
+    primask = sch_lock();
+
+    p_stats->runs = p_task->runs;
+    p_stats->min_cycles = p_task->runs ? p_task->min_cycles : 0;
+    p_stats->max_cycles = p_task->max_cycles;
+    p_stats->avg_cycles = p_task->runs ? (uint32_t)(p_task->total_cycles / p_task->runs) : 0;
+    p_stats->budget_overruns = p_task->budget_overruns;
+    p_stats->tick_overruns = p_task->tick_overruns;
+
+    sch_unlock(primask);
 
     return 0;
 }
 
+uint32_t sch_get_ticks(void)
+{
+    return sched_cycles;
+}
+
+void sch_reset(void)
+{
+    uint32_t primask = sch_lock();
+
+    memset((void *)sch_tasks, 0, sizeof(sch_tasks));
+    memset((void *)wheel_ticks, 0, sizeof(wheel_ticks));
+    memset((void *)wheel_turns, 0, sizeof(wheel_turns));
+    memset((void *)ready_mask, 0, sizeof(ready_mask));
+    sched_cycles = 0;
+    task_overrun = 0;
+    running_task = SCH_NO_TASK;
+
+    sch_unlock(primask);
+}
+
 /* Timer ISR (one ISR in whole application) invoked every scheduler tick */
-void sch_update(void) 
+void sch_update(void)
 {
-    uint32_t index = 0;
+    uint32_t index;
+    uint8_t link;
 
-    /* Check if task is overrun */
-    if(dispatch_active)
+    /* Check if task is overrun, and blame the task still running */
+    if (running_task != SCH_NO_TASK)
     {
         task_overrun = 1;
+        sch_tasks[running_task].tick_overruns++;
     }
 
     sched_cycles++;
 
     /* NOTE: calculations are in *TICKS* (not milliseconds) */
-    for (index = 0; index < SCH_MAX_TASKS; index++)
+
+    /* The first level has turned, move the next second level slot down */
+    if ((sched_cycles & SCH_WHEEL_MASK) == 0)
+    {
+        volatile uint8_t *p_slot = &wheel_turns[(sched_cycles >> SCH_WHEEL_BITS) & SCH_WHEEL_MASK];
+
+        link = *p_slot;
+        *p_slot = 0;
+        while (link)
+        {
+            index = link - 1;
+            link = sch_tasks[index].next;
+            sch_insert(index);
+        }
+    }
+
+    /* Run the tasks due on this tick */
+    volatile uint8_t *p_slot = &wheel_ticks[sched_cycles & SCH_WHEEL_MASK];
+
+    link = *p_slot;
+    *p_slot = 0;
+    while (link)
+    {
+        index = link - 1;
+        link = sch_tasks[index].next;
+
+        /* The task is due to run */
+        sch_tasks[index].runme += 1; /* Inc. the 'runme' flag */
+        ready_mask[sch_tasks[index].priority] |= 1UL << index;
+
+        /* Schedule periodic tasks to run again */
+        sch_tasks[index].expires += sch_tasks[index].period;
+        sch_insert(index);
+    }
+}
+
+/* The highest priority ready task, or SCH_NO_TASK */
+static int32_t sch_next_ready(void)
+{
+    uint32_t priority;
+
+    for (priority = 0; priority < SCH_PRIORITIES; priority++)
     {
-        /* Check if there is a task at this location */
-        if (sch_tasks[index].p_task)
+        if (ready_mask[priority])
         {
-            if (sch_tasks[index].delay == 0)
-            {
-                /* The task is due to run */
-                sch_tasks[index].runme += 1; /* Inc. the 'runme' flag */
-                if (sch_tasks[index].period)
-                {
-                    /* Schedule periodic tasks to run again */
-                    sch_tasks[index].delay = sch_tasks[index].period;
-                }
-            }
-            else
-            {
-                /* Not yet ready to run: just decrement the delay */
-                sch_tasks[index].delay -= 1;
-            }
+            return __builtin_ctz(ready_mask[priority]);
         }
     }
+
+    return SCH_NO_TASK;
 }
 
 /* Scheduler update function, this is what calls the actual tasks */
 void sch_dispatch_tasks(void)
 {
-    uint32_t index;
-    
-    /* Dispatches (runs) the next task (if one is ready) */
-    for (index = 0; index < SCH_MAX_TASKS; index++)
+    int32_t index;
+    uint32_t primask;
+    uint32_t start;
+    uint32_t cycles;
+
+    /* Dispatches (runs) the ready tasks, highest priority first */
+    while ((index = sch_next_ready()) != SCH_NO_TASK)
     {
-        if (sch_tasks[index].runme > 0)
+        volatile task_info *p_task = &sch_tasks[index];
+
+        running_task = index;
+        start = sch_read_cycles();
+        (*p_task->p_task)(); /* Run the task */
+        cycles = sch_read_cycles() - start;
+        running_task = SCH_NO_TASK;
+
+        p_task->runs++;
+        p_task->total_cycles += cycles;
+        if (cycles < p_task->min_cycles)
+        {
+            p_task->min_cycles = cycles;
+        }
+        if (cycles > p_task->max_cycles)
+        {
+            p_task->max_cycles = cycles;
+        }
+        if (p_task->budget_cycles && cycles > p_task->budget_cycles)
         {
-            dispatch_active = 1;
-            (*sch_tasks[index].p_task)(); /* Run the task */
-            sch_tasks[index].runme -= 1; /* Reset / reduce RunMe flag */
-            dispatch_active = 0;
+            p_task->budget_overruns++;
         }
+
+        primask = sch_lock();
+        p_task->runme -= 1; /* Reset / reduce RunMe flag */
+        if (p_task->runme == 0)
+        {
+            ready_mask[p_task->priority] &= ~(1UL << index);
+        }
+        sch_unlock(primask);
     }
 
     /* Log and reset task overrun flag */
@@ -101,13 +317,3 @@ void sch_dispatch_tasks(void)
         task_overrun = 0;
     }
 }
-
-
-
-
-
-
-
-
-
-
@@ -0,0 +1,96 @@
+#include "fc.h"
+#include "uartRx.h"
+#include "uartTx.h"
+
+/**
+ * @file common/Src/uartRx.c
+ *
+ * @brief Receive on the debug uart (USART6)
+ *
+ * A circular DMA transfer writes everything received into a buffer, with no
+ * interrupts at all. The reader polls how far the DMA has got, so it must
+ * read at least every UART_RX_BUFFER_SIZE byte times, anything older is
+ * overwritten without warning. Callers are expected to check their data
+ * (for example the telemetry crc).
+ *
+ * The uart itself is set up by uartTxInit.
+ */
+
+#ifndef __UNIT_TEST
+
+#define UARTx_RX_DMA_CHANNEL       DMA_CHANNEL_5
+#define UARTx_RX_DMA_STREAM        DMA2_Stream1
+
+static uint8_t buffer[UART_RX_BUFFER_SIZE];
+static DMA_HandleTypeDef hdma_rx;
+static uint32_t tail = 0;
+
+/**
+ * @brief Start receiving, call after uartTxInit
+ *
+ * The DMA is started directly rather than with HAL_UART_Receive_DMA, which
+ * turns on the uart error interrupts and stops receiving on the first
+ * framing error
+ */
+void uartRxInit(void)
+{
+    hdma_rx.Instance                 = UARTx_RX_DMA_STREAM;
+    hdma_rx.Init.Channel             = UARTx_RX_DMA_CHANNEL;
+    hdma_rx.Init.Direction           = DMA_PERIPH_TO_MEMORY;
+    hdma_rx.Init.PeriphInc           = DMA_PINC_DISABLE;
+    hdma_rx.Init.MemInc              = DMA_MINC_ENABLE;
+    hdma_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_rx.Init.MemDataAlignment    = DMA_MDATAALIGN_BYTE;
+    hdma_rx.Init.Mode                = DMA_CIRCULAR;
+    hdma_rx.Init.Priority            = DMA_PRIORITY_LOW;
+    hdma_rx.Init.FIFOMode            = DMA_FIFOMODE_DISABLE;
+    hdma_rx.Init.FIFOThreshold       = DMA_FIFO_THRESHOLD_FULL;
+    hdma_rx.Init.MemBurst            = DMA_MBURST_SINGLE;
+    hdma_rx.Init.PeriphBurst         = DMA_PBURST_SINGLE;
+
+    if (HAL_DMA_Init(&hdma_rx) != HAL_OK)
+    {
+        Error_Handler("UART RX DMA init fail");
+    }
+
+    tail = 0;
+
+    if (HAL_DMA_Start(&hdma_rx, (uint32_t)&UartHandle.Instance->DR,
+                      (uint32_t)buffer, sizeof(buffer)) != HAL_OK)
+    {
+        Error_Handler("UART RX DMA start fail");
+    }
+
+    SET_BIT(UartHandle.Instance->CR3, USART_CR3_DMAR);
+}
+
+/**
+ * @brief Get the oldest received bytes
+ *
+ * @param[out] data Set to point at the oldest unread byte
+ *
+ * @return The number of bytes that can be read contiguously from data
+ */
+uint32_t uartRxPeek(const uint8_t **data)
+{
+    // The counter counts down to 0 then reloads
+    uint32_t head = sizeof(buffer) - __HAL_DMA_GET_COUNTER(&hdma_rx);
+
+    if (head == sizeof(buffer)) {
+        head = 0;
+    }
+
+    (*data) = &buffer[tail];
+
+    return (head >= tail) ? head - tail : sizeof(buffer) - tail;
+}
+
+/**
+ * @brief Free bytes returned by uartRxPeek once they have been used
+ */
+void uartRxRelease(uint32_t length)
+{
+    tail = (tail + length) % sizeof(buffer);
+}
+
+#endif
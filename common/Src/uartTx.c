@@ -0,0 +1,371 @@
+#include <string.h>
+
+#include "fc.h"
+#include "uartTx.h"
+
+#ifndef __UNIT_TEST
+#include "freertos.h"
+#endif
+
+/**
+ * @file common/Src/uartTx.c
+ *
+ * @brief Non blocking transmit on the debug uart (USART6)
+ *
+ * Writers copy their data into a ring buffer and return straight away. The
+ * ring is drained by DMA: each transfer sends the longest contiguous block
+ * in the ring, and its completion interrupt frees that block and starts the
+ * next one, so the cpu is only involved once per block rather than once per
+ * byte.
+ *
+ * A write that doesn't fit is dropped whole and counted, it never waits for
+ * space. Callers that can afford to wait (like the debug task) can check
+ * uartTxSpace first.
+ *
+ * Writers and the completion interrupt share the ring indexes, so they are
+ * updated with interrupts disabled. This is only held for the copy of one
+ * write. A write can also be built from several pieces straight from where
+ * the data lives (uartTxBegin/uartTxPut/uartTxEnd), nothing else can run
+ * until uartTxEnd so the pieces are a consistent snapshot.
+ */
+
+#define UART_TX_RING_MASK (UART_TX_RING_SIZE - 1)
+
+#if (UART_TX_RING_SIZE & UART_TX_RING_MASK) != 0
+#error "UART_TX_RING_SIZE must be a power of 2"
+#endif
+
+#ifndef __UNIT_TEST
+#define UART_TX_LOCK(state)   do { (state) = __get_PRIMASK(); __disable_irq(); } while (0)
+#define UART_TX_UNLOCK(state) __set_PRIMASK(state)
+#else
+#define UART_TX_LOCK(state)   ((state) = 0)
+#define UART_TX_UNLOCK(state) ((void)(state))
+#endif
+
+static uint8_t ring[UART_TX_RING_SIZE];
+
+// Both count up forever and are masked on use, so head - tail is the number
+// of bytes queued (including any being sent)
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+static UartTxStats_t stats;
+
+static void uartTxStart(void);
+
+void uartTxReset(void)
+{
+    head = 0;
+    tail = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * @brief Start a write of length bytes, to be filled in with uartTxPut
+ *
+ * On success interrupts stay disabled until uartTxEnd, so the frame must be
+ * filled in straight away
+ *
+ * @param[out] frame Filled in for uartTxPut and uartTxEnd
+ * @param length     The total number of bytes that will be written
+ *
+ * @return FC_OK if there is space, FC_BUSY if not, in which case the write is
+ * counted as dropped and uartTxEnd must not be called
+ */
+FC_Status uartTxBegin(UartTxFrame_t *frame, uint32_t length)
+{
+    UART_TX_LOCK(frame->lockState);
+
+    if (length > UART_TX_RING_SIZE - (head - tail)) {
+        stats.writesDropped++;
+        stats.bytesDropped += length;
+        UART_TX_UNLOCK(frame->lockState);
+        return FC_BUSY;
+    }
+
+    frame->index = head;
+    frame->end = head + length;
+
+    return FC_OK;
+}
+
+/**
+ * @brief Copy the next piece of a frame into the ring
+ *
+ * Writing more than the length given to uartTxBegin is ignored
+ */
+void uartTxPut(UartTxFrame_t *frame, const void *data, uint32_t length)
+{
+    const uint8_t *bytes = data;
+    uint32_t index = frame->index & UART_TX_RING_MASK;
+    uint32_t first = UART_TX_RING_SIZE - index;
+
+    if (length > frame->end - frame->index) {
+        length = frame->end - frame->index;
+    }
+    if (first > length) {
+        first = length;
+    }
+
+    // May wrap around the end of the ring
+    memcpy(&ring[index], bytes, first);
+    memcpy(&ring[0], &bytes[first], length - first);
+
+    frame->index += length;
+}
+
+/**
+ * @brief Publish a frame and start sending it
+ */
+void uartTxEnd(UartTxFrame_t *frame)
+{
+    stats.bytesQueued += frame->end - head;
+    head = frame->end;
+
+    uartTxStart();
+
+    UART_TX_UNLOCK(frame->lockState);
+}
+
+/**
+ * @brief Queue data for transmission. Can be called from any task or
+ * interrupt
+ *
+ * @param data   The data to send
+ * @param length Number of bytes in data
+ *
+ * @return FC_OK if queued, FC_BUSY if there isn't space for all of it, in
+ * which case none of it is sent
+ */
+FC_Status uartTxWrite(const void *data, uint32_t length)
+{
+    UartTxFrame_t frame;
+
+    if (uartTxBegin(&frame, length) != FC_OK) {
+        return FC_BUSY;
+    }
+
+    uartTxPut(&frame, data, length);
+    uartTxEnd(&frame);
+
+    return FC_OK;
+}
+
+/**
+ * @return The largest write that would currently be accepted
+ */
+uint32_t uartTxSpace(void)
+{
+    return UART_TX_RING_SIZE - (head - tail);
+}
+
+const UartTxStats_t *uartTxStats(void)
+{
+    return &stats;
+}
+
+/**
+ * @brief Get the oldest queued bytes
+ *
+ * @param[out] data Set to point at the oldest queued byte
+ *
+ * @return The number of bytes that can be read contiguously from data
+ */
+uint32_t uartTxPeek(const uint8_t **data)
+{
+    uint32_t available = head - tail;
+    uint32_t index = tail & UART_TX_RING_MASK;
+
+    if (index + available > UART_TX_RING_SIZE) {
+        available = UART_TX_RING_SIZE - index;
+    }
+
+    (*data) = &ring[index];
+
+    return available;
+}
+
+/**
+ * @brief Free bytes returned by uartTxPeek once they have been sent
+ */
+void uartTxRelease(uint32_t length)
+{
+    tail = tail + length;
+}
+
+#ifndef __UNIT_TEST
+
+#define UARTx                      USART6
+
+#define UARTx_CLK_ENABLE           __HAL_RCC_USART6_CLK_ENABLE
+#define UARTx_DMAx_CLK_ENABLE      __HAL_RCC_DMA2_CLK_ENABLE
+
+#define UARTx_TX_GPIO_CLK_ENABLE   __HAL_RCC_GPIOC_CLK_ENABLE
+#define UARTx_RX_GPIO_CLK_ENABLE   __HAL_RCC_GPIOC_CLK_ENABLE
+
+#define UARTx_ALTERNATE_FUNCTION   GPIO_AF8_USART6
+
+#define UARTx_TX_GPIO_PIN          GPIO_PIN_6
+#define UARTx_TX_GPIO_PORT         GPIOC
+
+#define UARTx_RX_GPIO_PIN          GPIO_PIN_7
+#define UARTx_RX_GPIO_PORT         GPIOC
+
+#define UARTx_TX_DMA_CHANNEL       DMA_CHANNEL_5
+#define UARTx_TX_DMA_STREAM        DMA2_Stream6
+
+// Below the FreeRTOS syscall priority, nothing time critical waits on this
+#define UARTx_IRQ_PRIORITY         (configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 2)
+
+UART_HandleTypeDef UartHandle;
+static DMA_HandleTypeDef hdma_tx;
+
+// Length of the transfer in progress, 0 if the DMA is idle
+static volatile uint32_t sending = 0;
+
+/**
+ * @brief Start sending the oldest queued block if the DMA is idle. Called
+ * with interrupts disabled or from the completion interrupt
+ */
+static void uartTxStart(void)
+{
+    const uint8_t *data;
+    uint32_t length;
+
+    if (sending != 0 || UartHandle.Instance == NULL) {
+        return;
+    }
+
+    length = uartTxPeek(&data);
+    if (length == 0) {
+        return;
+    }
+
+    // The DMA counter is 16 bits
+    if (length > UINT16_MAX) {
+        length = UINT16_MAX;
+    }
+
+    if (HAL_UART_Transmit_DMA(&UartHandle, (uint8_t*)data, length) == HAL_OK) {
+        sending = length;
+        stats.transfers++;
+    }
+}
+
+/**
+ * @brief Set up USART6 and its transmit DMA
+ *
+ * @param baudRate Up to PCLK2 / 8. Above PCLK2 / 16, 8x oversampling is used,
+ * which is less tolerant of clock mismatch on receive
+ */
+void uartTxInit(uint32_t baudRate)
+{
+    GPIO_InitTypeDef  GPIO_InitStruct;
+    uint32_t pclk = HAL_RCC_GetPCLK2Freq();
+
+    if (baudRate > pclk / 8) {
+        Error_Handler("UART baud too high");
+    }
+
+    /*##-1- Enable peripherals and GPIO Clocks #################################*/
+    /* Enable GPIO TX/RX clock */
+    UARTx_TX_GPIO_CLK_ENABLE();
+    UARTx_RX_GPIO_CLK_ENABLE();
+
+    /* Enable USARTx and DMA clocks */
+    UARTx_CLK_ENABLE();
+    UARTx_DMAx_CLK_ENABLE();
+
+    /*##-2- Configure peripheral GPIO ##########################################*/
+    /* UART TX GPIO pin configuration  */
+    GPIO_InitStruct.Pin       = UARTx_TX_GPIO_PIN;
+    GPIO_InitStruct.Mode      = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull      = GPIO_PULLUP;
+    GPIO_InitStruct.Speed     = GPIO_SPEED_FAST;
+    GPIO_InitStruct.Alternate = UARTx_ALTERNATE_FUNCTION;
+
+    HAL_GPIO_Init(UARTx_TX_GPIO_PORT, &GPIO_InitStruct);
+
+    /* UART RX GPIO pin configuration  */
+    GPIO_InitStruct.Pin = UARTx_RX_GPIO_PIN;
+    GPIO_InitStruct.Alternate = UARTx_ALTERNATE_FUNCTION;
+
+    HAL_GPIO_Init(UARTx_RX_GPIO_PORT, &GPIO_InitStruct);
+
+    /*##-3- Configure the DMA stream ###########################################*/
+    hdma_tx.Instance                 = UARTx_TX_DMA_STREAM;
+    hdma_tx.Init.Channel             = UARTx_TX_DMA_CHANNEL;
+    hdma_tx.Init.Direction           = DMA_MEMORY_TO_PERIPH;
+    hdma_tx.Init.PeriphInc           = DMA_PINC_DISABLE;
+    hdma_tx.Init.MemInc              = DMA_MINC_ENABLE;
+    hdma_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_tx.Init.MemDataAlignment    = DMA_MDATAALIGN_BYTE;
+    hdma_tx.Init.Mode                = DMA_NORMAL;
+    hdma_tx.Init.Priority            = DMA_PRIORITY_LOW;
+    hdma_tx.Init.FIFOMode            = DMA_FIFOMODE_DISABLE;
+    hdma_tx.Init.FIFOThreshold       = DMA_FIFO_THRESHOLD_FULL;
+    hdma_tx.Init.MemBurst            = DMA_MBURST_SINGLE;
+    hdma_tx.Init.PeriphBurst         = DMA_PBURST_SINGLE;
+
+    if (HAL_DMA_Init(&hdma_tx) != HAL_OK)
+    {
+        Error_Handler("UART DMA init fail");
+    }
+    __HAL_LINKDMA(&UartHandle, hdmatx, hdma_tx);
+
+    /*##-4- Configure the UART #################################################*/
+    UartHandle.Instance          = UARTx;
+
+    UartHandle.Init.BaudRate     = baudRate;
+    UartHandle.Init.WordLength   = UART_WORDLENGTH_8B;
+    UartHandle.Init.StopBits     = UART_STOPBITS_1;
+    UartHandle.Init.Parity       = UART_PARITY_NONE;
+    UartHandle.Init.HwFlowCtl    = UART_HWCONTROL_NONE;
+    UartHandle.Init.Mode         = UART_MODE_TX_RX;
+    UartHandle.Init.OverSampling = (baudRate > pclk / 16) ?
+                                   UART_OVERSAMPLING_8 : UART_OVERSAMPLING_16;
+
+    if(HAL_UART_Init(&UartHandle) != HAL_OK)
+    {
+        Error_Handler("UART init fail");
+    }
+
+    /*##-5- Configure the NVIC #################################################*/
+    // The DMA interrupt signals the last byte was loaded, the uart interrupt
+    // that it has been sent and the next block can start
+    HAL_NVIC_SetPriority(UARTx_DMA_TX_IRQn, UARTx_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(UARTx_DMA_TX_IRQn);
+
+    HAL_NVIC_SetPriority(UARTx_IRQn, UARTx_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(UARTx_IRQn);
+
+    // Send anything queued before the uart was ready
+    uint32_t lockState;
+    UART_TX_LOCK(lockState);
+    uartTxStart();
+    UART_TX_UNLOCK(lockState);
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+    uartTxRelease(sending);
+    sending = 0;
+    uartTxStart();
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+    // Whatever was being sent is lost, move on to the next block
+    stats.bytesDropped += sending;
+    uartTxRelease(sending);
+    sending = 0;
+    uartTxStart();
+}
+
+#else
+
+static void uartTxStart(void)
+{
+}
+
+#endif
@@ -0,0 +1,171 @@
+#include "gtest/gtest.h"
+#include <string.h>
+
+extern "C" {
+#include "fc.h"
+#include "blackbox.h"
+#include "blackboxEncoder.h"
+}
+
+#define TEST_FRAMES 100
+
+class BlackboxEncoderTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            blackboxCodecReset(&encoder);
+            blackboxCodecReset(&decoder);
+            memset(records, 0, sizeof(records));
+            length = 0;
+
+            for (int i = 0; i < TEST_FRAMES; i++) {
+                BlackboxRecord_t *r = &records[i];
+                r->sequence = i + (i > 50 ? 3 : 0); // Some dropped records
+                r->timeUs = 1000 * i + (i % 3);
+                r->loopTimeUs = 200 + (i % 7);
+                r->throttle = 1300 + i;
+                for (int axis = 0; axis < BLACKBOX_AXIS_COUNT; axis++) {
+                    r->gyro[axis] = (i * 7 * (axis + 1)) % 200 - 100;
+                    r->setpoint[axis] = -50 * axis;
+                    r->pidP[axis] = i - 50;
+                    r->pidI[axis] = i / 4;
+                    r->pidD[axis] = (i % 2) ? -3 : 3;
+                }
+                for (int motor = 0; motor < BLACKBOX_MOTOR_COUNT; motor++) {
+                    r->motor[motor] = 1300 + i + motor * 10;
+                }
+            }
+        }
+
+        void encodeAll(void) {
+            for (int i = 0; i < TEST_FRAMES; i++) {
+                size_t used = blackboxEncode(&encoder, &records[i],
+                                             &encoded[length]);
+                ASSERT_LE(used, (size_t)BLACKBOX_ENCODED_MAX_BYTES);
+                starts[i] = length;
+                length += used;
+            }
+        }
+
+        BlackboxCodec_t encoder;
+        BlackboxCodec_t decoder;
+        BlackboxRecord_t records[TEST_FRAMES];
+        uint8_t encoded[TEST_FRAMES * BLACKBOX_ENCODED_MAX_BYTES];
+        size_t starts[TEST_FRAMES];
+        size_t length;
+};
+
+TEST_F(BlackboxEncoderTest, roundTrip)
+{
+    BlackboxRecord_t decoded;
+    size_t pos = 0;
+
+    encodeAll();
+
+    for (int i = 0; i < TEST_FRAMES; i++) {
+        int used = blackboxDecode(&decoder, &encoded[pos], length - pos,
+                                  &decoded);
+        ASSERT_GT(used, 0);
+        EXPECT_EQ(0, memcmp(&decoded, &records[i], sizeof(decoded)));
+        pos += used;
+    }
+    EXPECT_EQ(length, pos);
+}
+
+TEST_F(BlackboxEncoderTest, keyframeInterval)
+{
+    encodeAll();
+
+    for (int i = 0; i < TEST_FRAMES; i++) {
+        uint8_t expected = (i % BLACKBOX_KEYFRAME_INTERVAL == 0)
+                           ? BLACKBOX_FRAME_KEY : BLACKBOX_FRAME_DELTA;
+        EXPECT_EQ(expected, encoded[starts[i]]);
+    }
+}
+
+TEST_F(BlackboxEncoderTest, smallerThanRawRecords)
+{
+    encodeAll();
+
+    EXPECT_LT(length, sizeof(records) / 2);
+}
+
+TEST_F(BlackboxEncoderTest, worstCaseFitsBound)
+{
+    BlackboxRecord_t low, high;
+    uint8_t out[BLACKBOX_ENCODED_MAX_BYTES];
+    BlackboxRecord_t decoded;
+
+    // Alternate between the extremes of every field so every residual is as
+    // large as possible
+    memset(&low, 0, sizeof(low));
+    memset(&high, 0, sizeof(high));
+    low.sequence = 0xFFFFFFFF;
+    high.timeUs = 0xFFFFFFFF;
+    high.loopTimeUs = high.throttle = 0xFFFF;
+    for (int axis = 0; axis < BLACKBOX_AXIS_COUNT; axis++) {
+        low.gyro[axis] = low.setpoint[axis] = low.pidP[axis] = INT16_MIN;
+        low.pidI[axis] = low.pidD[axis] = INT16_MIN;
+        high.gyro[axis] = high.setpoint[axis] = high.pidP[axis] = INT16_MAX;
+        high.pidI[axis] = high.pidD[axis] = INT16_MAX;
+    }
+    for (int motor = 0; motor < BLACKBOX_MOTOR_COUNT; motor++) {
+        high.motor[motor] = 0xFFFF;
+    }
+
+    for (int i = 0; i < 2 * BLACKBOX_KEYFRAME_INTERVAL; i++) {
+        const BlackboxRecord_t *record = (i % 2) ? &high : &low;
+        size_t used = blackboxEncode(&encoder, record, out);
+
+        ASSERT_LE(used, (size_t)BLACKBOX_ENCODED_MAX_BYTES);
+        ASSERT_EQ((int)used, blackboxDecode(&decoder, out, used, &decoded));
+        EXPECT_EQ(0, memcmp(&decoded, record, sizeof(decoded)));
+    }
+}
+
+TEST_F(BlackboxEncoderTest, truncatedFrameNeedsMoreData)
+{
+    BlackboxRecord_t decoded;
+
+    encodeAll();
+
+    size_t frameLength = starts[1] - starts[0];
+    for (size_t i = 0; i < frameLength; i++) {
+        EXPECT_EQ(0, blackboxDecode(&decoder, encoded, i, &decoded));
+    }
+    EXPECT_EQ((int)frameLength,
+              blackboxDecode(&decoder, encoded, frameLength, &decoded));
+}
+
+TEST_F(BlackboxEncoderTest, deltaWithoutHistoryIsRejected)
+{
+    BlackboxRecord_t decoded;
+
+    encodeAll();
+
+    EXPECT_EQ(-1, blackboxDecode(&decoder, &encoded[starts[1]],
+                                 length - starts[1], &decoded));
+}
+
+TEST_F(BlackboxEncoderTest, resyncsAtNextKeyframe)
+{
+    BlackboxRecord_t decoded;
+
+    encodeAll();
+
+    // Start decoding part way through a frame, as if the start of the log
+    // was lost
+    size_t pos = starts[3] + 2;
+    int used;
+    while ((used = blackboxDecode(&decoder, &encoded[pos], length - pos,
+                                  &decoded)) < 0)
+    {
+        blackboxCodecReset(&decoder);
+        pos++;
+    }
+
+    // Every byte value a delta can contain isn't a valid frame type, so the
+    // first frame found must be a real keyframe
+    ASSERT_EQ(starts[BLACKBOX_KEYFRAME_INTERVAL], pos);
+    EXPECT_EQ(0, memcmp(&decoded, &records[BLACKBOX_KEYFRAME_INTERVAL],
+                        sizeof(decoded)));
+}
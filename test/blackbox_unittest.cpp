@@ -0,0 +1,102 @@
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "fc.h"
+#include "blackbox.h"
+}
+
+class BlackboxTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            blackboxInit();
+            blackboxStart();
+        }
+
+        void push(uint16_t throttle) {
+            BlackboxRecord_t *record = blackboxClaim();
+            ASSERT_TRUE(record != NULL);
+            record->throttle = throttle;
+            blackboxCommit();
+        }
+};
+
+TEST_F(BlackboxTest, notRecordingDoesNotClaim)
+{
+    blackboxStop();
+
+    EXPECT_TRUE(blackboxClaim() == NULL);
+    EXPECT_EQ(0u, blackboxDroppedCount());
+}
+
+TEST_F(BlackboxTest, emptyRingPeeksNothing)
+{
+    const BlackboxRecord_t *records;
+
+    EXPECT_EQ(0u, blackboxPeek(&records));
+}
+
+TEST_F(BlackboxTest, recordsReadBackInOrder)
+{
+    const BlackboxRecord_t *records;
+
+    push(1000);
+    push(1100);
+    push(1200);
+
+    ASSERT_EQ(3u, blackboxPeek(&records));
+    EXPECT_EQ(1000, records[0].throttle);
+    EXPECT_EQ(1100, records[1].throttle);
+    EXPECT_EQ(1200, records[2].throttle);
+    EXPECT_EQ(0u, records[0].sequence);
+    EXPECT_EQ(2u, records[2].sequence);
+
+    blackboxRelease(3);
+    EXPECT_EQ(0u, blackboxPeek(&records));
+}
+
+TEST_F(BlackboxTest, fullRingDropsAndCounts)
+{
+    const BlackboxRecord_t *records;
+
+    for (int i = 0; i < BLACKBOX_RING_LENGTH; i++) {
+        push(i);
+    }
+
+    EXPECT_TRUE(blackboxClaim() == NULL);
+    EXPECT_TRUE(blackboxClaim() == NULL);
+    EXPECT_EQ(2u, blackboxDroppedCount());
+
+    // Free one slot, the next record shows the gap in its sequence number
+    ASSERT_EQ((uint32_t)BLACKBOX_RING_LENGTH, blackboxPeek(&records));
+    blackboxRelease(1);
+    push(5000);
+
+    blackboxRelease(BLACKBOX_RING_LENGTH - 1);
+    ASSERT_EQ(1u, blackboxPeek(&records));
+    EXPECT_EQ(5000, records[0].throttle);
+    EXPECT_EQ((uint32_t)BLACKBOX_RING_LENGTH + 2, records[0].sequence);
+}
+
+TEST_F(BlackboxTest, peekStopsAtWrap)
+{
+    const BlackboxRecord_t *records;
+
+    for (int i = 0; i < BLACKBOX_RING_LENGTH - 2; i++) {
+        push(i);
+    }
+    blackboxRelease(BLACKBOX_RING_LENGTH - 2);
+
+    push(1);
+    push(2);
+    push(3);
+    push(4);
+
+    // Only the two records before the end of the buffer are contiguous
+    ASSERT_EQ(2u, blackboxPeek(&records));
+    EXPECT_EQ(1, records[0].throttle);
+    blackboxRelease(2);
+
+    ASSERT_EQ(2u, blackboxPeek(&records));
+    EXPECT_EQ(3, records[0].throttle);
+    EXPECT_EQ(4, records[1].throttle);
+}
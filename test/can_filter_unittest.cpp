@@ -0,0 +1,184 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+extern "C" {
+#include "fc.h"
+#include "can.h"
+#include "can_filter.h"
+}
+
+class CanFilterTest : public ::testing::Test {
+    protected:
+        CanFilterPlan plan;
+        uint32_t seed;
+
+        virtual void SetUp() {
+            seed = 1;
+        }
+
+        uint32_t random(uint32_t range) {
+            seed = seed * 1664525u + 1013904223u;
+            return (seed >> 8) % range;
+        }
+
+        std::vector<uint16_t> randomIds(uint32_t count) {
+            std::set<uint16_t> ids;
+
+            while (ids.size() < count) {
+                ids.insert(random(CAN_ID_MAX + 1));
+            }
+            return std::vector<uint16_t>(ids.begin(), ids.end());
+        }
+
+        // Accepts every ID asked for, and counts the rest right
+        void checkPlan(const std::vector<uint16_t> &ids, uint8_t maxBanks) {
+            uint32_t falseAccepts = 0;
+
+            ASSERT_TRUE(canFilterPlan(ids.data(), ids.size(), maxBanks, &plan));
+            ASSERT_LE(plan.count, maxBanks);
+
+            for (uint16_t id = 0; id <= CAN_ID_MAX; id++) {
+                bool requested = std::find(ids.begin(), ids.end(), id) != ids.end();
+                bool accepted = canFilterPlanAccepts(&plan, id);
+
+                ASSERT_TRUE(accepted || !requested) << id;
+                if (accepted && !requested) {
+                    falseAccepts++;
+                }
+            }
+            EXPECT_EQ(falseAccepts, plan.falseAccepts);
+        }
+
+        static uint32_t listBanks(uint32_t ids) {
+            return (ids + CAN_NUM_ADDR_PER_FILTER - 1) / CAN_NUM_ADDR_PER_FILTER;
+        }
+};
+
+TEST_F(CanFilterTest, Empty)
+{
+    ASSERT_TRUE(canFilterPlan(NULL, 0, CAN_NUM_FILTER_BANKS, &plan));
+    EXPECT_EQ(0, plan.count);
+    EXPECT_EQ(0, plan.falseAccepts);
+}
+
+TEST_F(CanFilterTest, InvalidArguments)
+{
+    uint16_t ids[CAN_MAX_SUBSCRIPTIONS + 1] = {0};
+
+    EXPECT_FALSE(canFilterPlan(ids, CAN_MAX_SUBSCRIPTIONS + 1, CAN_NUM_FILTER_BANKS, &plan));
+    EXPECT_FALSE(canFilterPlan(ids, 1, 0, &plan));
+    EXPECT_FALSE(canFilterPlan(ids, 1, CAN_NUM_FILTER_BANKS + 1, &plan));
+
+    ids[0] = CAN_ID_MAX + 1;
+    EXPECT_FALSE(canFilterPlan(ids, 1, CAN_NUM_FILTER_BANKS, &plan));
+}
+
+TEST_F(CanFilterTest, Heartbeats)
+{
+    std::vector<uint16_t> ids = {0x201, 0x301, 0x401, 0x201};
+
+    checkPlan(ids, CAN_NUM_FILTER_BANKS);
+    EXPECT_EQ(1, plan.count);
+    EXPECT_EQ(0, plan.falseAccepts);
+
+    // Unused slots don't let ID 0 through
+    EXPECT_FALSE(canFilterPlanAccepts(&plan, 0));
+}
+
+TEST_F(CanFilterTest, BlocksBecomeMasks)
+{
+    // 16 and 8 IDs that share their upper bits, and two more
+    std::vector<uint16_t> ids;
+    for (uint16_t id = 0x100; id < 0x110; id++) {
+        ids.push_back(id);
+    }
+    for (uint16_t id = 0x208; id < 0x210; id++) {
+        ids.push_back(id);
+    }
+    ids.push_back(0x301);
+    ids.push_back(0x7FF);
+
+    checkPlan(ids, CAN_NUM_FILTER_BANKS);
+    EXPECT_EQ(2, plan.count);
+    EXPECT_EQ(0, plan.falseAccepts);
+}
+
+TEST_F(CanFilterTest, SpareMaskSlotTakesAnId)
+{
+    // One block takes half a mask bank, the single ID goes in the other half
+    std::vector<uint16_t> ids = {0x120, 0x121, 0x122, 0x123, 0x555};
+
+    checkPlan(ids, CAN_NUM_FILTER_BANKS);
+    EXPECT_EQ(1, plan.count);
+    EXPECT_EQ(CAN_FILTER_MASK, plan.banks[0].mode);
+    EXPECT_EQ(0, plan.falseAccepts);
+}
+
+TEST_F(CanFilterTest, RandomIdsThatFitAreExact)
+{
+    for (int trial = 0; trial < 50; trial++) {
+        uint32_t count = 1 + random(CAN_NUM_FILTER_BANKS * CAN_NUM_ADDR_PER_FILTER);
+        std::vector<uint16_t> ids = randomIds(count);
+
+        checkPlan(ids, CAN_NUM_FILTER_BANKS);
+        EXPECT_EQ(0, plan.falseAccepts) << "trial " << trial;
+        EXPECT_LE(plan.count, listBanks(count)) << "trial " << trial;
+    }
+}
+
+TEST_F(CanFilterTest, RandomIdsOverBudget)
+{
+    const uint8_t budgets[] = {1, 2, 4, 8, 14, 28};
+
+    for (uint8_t maxBanks : budgets) {
+        for (int trial = 0; trial < 3; trial++) {
+            uint32_t count = maxBanks * CAN_NUM_ADDR_PER_FILTER
+                             + 1 + random(CAN_MAX_SUBSCRIPTIONS - maxBanks * CAN_NUM_ADDR_PER_FILTER);
+            std::vector<uint16_t> ids = randomIds(count);
+
+            checkPlan(ids, maxBanks);
+
+            // Masks over IDs scattered this thinly let most IDs through
+            // whatever they are, only with every bank is it a few
+            if (maxBanks == CAN_NUM_FILTER_BANKS) {
+                EXPECT_LT(plan.falseAccepts, 32) << count << " IDs";
+            }
+        }
+    }
+}
+
+TEST_F(CanFilterTest, ClusteredIdsOverBudget)
+{
+    // Each board sends a handful of IDs from its base, the usual layout
+    std::vector<uint16_t> ids;
+    const uint16_t bases[] = {CAN_ID_BMS_BASE, CAN_ID_VCU_BASE, CAN_ID_DCU_BASE,
+                              CAN_ID_PDB_BASE, CAN_ID_DAU_BASE};
+
+    for (uint16_t base : bases) {
+        for (uint16_t offset = 1; offset <= 12; offset++) {
+            ids.push_back(base + offset);
+        }
+    }
+
+    // 60 IDs would need 15 list banks, in 3 no worse than a mask over each
+    // board's first 16
+    checkPlan(ids, 3);
+    EXPECT_EQ(3, plan.count);
+    EXPECT_LE(plan.falseAccepts, 5 * 4);
+}
+
+TEST_F(CanFilterTest, FewerFalseAcceptsWithMoreBanks)
+{
+    std::vector<uint16_t> ids = randomIds(100);
+    uint32_t previous = UINT32_MAX;
+
+    for (uint8_t maxBanks = 4; maxBanks <= CAN_NUM_FILTER_BANKS; maxBanks += 4) {
+        checkPlan(ids, maxBanks);
+        EXPECT_LE(plan.falseAccepts, previous) << (int)maxBanks;
+        previous = plan.falseAccepts;
+    }
+    EXPECT_EQ(0u, previous);
+}
@@ -0,0 +1,224 @@
+#include <string.h>
+
+#include "can.h"
+#include "can_filter.h"
+#include "can_loopback.h"
+
+/**
+ * @file test/can_loopback.c
+ *
+ * @brief In process CAN bus, replaces the bxCAN controller on the host
+ *
+ * Each frame loaded into a mailbox goes back to the same controller, as in
+ * bxCAN's loopback mode, so the whole driver (mailboxes, filters, both
+ * interrupts and the queues) runs in the unit tests. Nothing runs by itself:
+ * each canLoopbackStep puts the next frame on the bus, advancing the modelled
+ * time by the bits it takes, then raises the interrupts the controller would.
+ *
+ * Mailboxes are sent in the order they were loaded, as with TXFP set.
+ */
+
+typedef struct LoopbackMailbox_t {
+    bool     full;
+    uint32_t order;
+    CanFrame frame;
+} LoopbackMailbox_t;
+
+static uint32_t bitRate = 500000;
+static uint64_t nowBits = 0;
+
+static LoopbackMailbox_t mailboxes[CAN_TX_MAILBOXES];
+static uint32_t loadOrder = 0;
+
+static CanFrame rxFifo[CAN_LOOPBACK_RX_FIFO_DEPTH];
+static uint32_t rxFifoHead = 0;
+static uint32_t rxFifoCount = 0;
+static bool rxIrqHeld = false;
+
+static CanFilterBank filterBanks[CAN_NUM_FILTER_BANKS];
+static uint8_t filterBankCount = 0;
+
+static CanLoopbackStats_t stats;
+
+/**
+ * @brief Empty the bus and controller
+ *
+ * @param rate Bus speed in bits per second
+ */
+void canLoopbackReset(uint32_t rate)
+{
+    bitRate = rate;
+    nowBits = 0;
+    memset(mailboxes, 0, sizeof(mailboxes));
+    loadOrder = 0;
+    rxFifoHead = 0;
+    rxFifoCount = 0;
+    rxIrqHeld = false;
+    filterBankCount = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * @return Bit times a standard data frame takes on the bus, including the
+ * interframe space. Stuff bits aren't counted
+ */
+uint32_t canLoopbackFrameBits(uint8_t length)
+{
+    // SOF, ID, RTR, IDE, r0, DLC, CRC, delimiters, ACK, EOF, then 3 idle
+    return 1 + 11 + 3 + 4 + 8 * length + 16 + 2 + 7 + 3;
+}
+
+uint32_t canLoopbackNowUs(void)
+{
+    return (uint32_t)(nowBits * 1000000 / bitRate);
+}
+
+const CanLoopbackStats_t *canLoopbackStats(void)
+{
+    return &stats;
+}
+
+static bool loopbackAccepts(uint16_t id)
+{
+    for (int bank = 0; bank < filterBankCount; bank++) {
+        if (canFilterBankAccepts(&filterBanks[bank], id)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void loopbackRxIrq(void)
+{
+    if (rxFifoCount > 0 && !rxIrqHeld) {
+        canRxIrqHandler();
+    }
+}
+
+/**
+ * @brief Send the next frame, and raise the TX and RX interrupts
+ *
+ * @return false if no mailbox has a frame
+ */
+bool canLoopbackStep(void)
+{
+    LoopbackMailbox_t *next = NULL;
+
+    for (int i = 0; i < CAN_TX_MAILBOXES; i++) {
+        if (mailboxes[i].full
+            && (next == NULL || (int32_t)(mailboxes[i].order - next->order) < 0))
+        {
+            next = &mailboxes[i];
+        }
+    }
+
+    if (next == NULL) {
+        return false;
+    }
+
+    uint32_t bits = canLoopbackFrameBits(next->frame.length);
+    nowBits += bits;
+    stats.busyBits += bits;
+    stats.frames++;
+    next->full = false;
+
+    if (loopbackAccepts(next->frame.id)) {
+        stats.accepted++;
+        if (rxFifoCount == CAN_LOOPBACK_RX_FIFO_DEPTH) {
+            // bxCAN drops the new frame unless the FIFO is locked
+            stats.rxFifoOverruns++;
+        } else {
+            uint32_t slot = (rxFifoHead + rxFifoCount) % CAN_LOOPBACK_RX_FIFO_DEPTH;
+            rxFifo[slot] = next->frame;
+            rxFifoCount++;
+        }
+    }
+
+    canTxIrqHandler();
+    loopbackRxIrq();
+
+    return true;
+}
+
+/**
+ * @brief Send frames until the time, then leave the bus idle until it
+ *
+ * A frame started before the time finishes, so it can end a little later
+ */
+void canLoopbackRunUntilUs(uint32_t us)
+{
+    while (canLoopbackNowUs() < us && canLoopbackStep()) {
+    }
+
+    uint64_t bits = (uint64_t)us * bitRate / 1000000;
+    if (bits > nowBits) {
+        nowBits = bits;
+    }
+}
+
+/**
+ * @brief Model the RX interrupt being masked, frames stay in the FIFO
+ */
+void canLoopbackHoldRxIrq(bool held)
+{
+    rxIrqHeld = held;
+    loopbackRxIrq();
+}
+
+static bool loopbackInit(void)
+{
+    return true;
+}
+
+static bool loopbackTxMailboxEmpty(uint8_t mailbox)
+{
+    return !mailboxes[mailbox].full;
+}
+
+static void loopbackTxMailboxLoad(uint8_t mailbox, const CanFrame *frame)
+{
+    mailboxes[mailbox].frame = *frame;
+    mailboxes[mailbox].order = loadOrder++;
+    mailboxes[mailbox].full = true;
+}
+
+static bool loopbackRxFifoRead(CanFrame *frame)
+{
+    if (rxFifoCount == 0) {
+        return false;
+    }
+
+    *frame = rxFifo[rxFifoHead];
+    rxFifoHead = (rxFifoHead + 1) % CAN_LOOPBACK_RX_FIFO_DEPTH;
+    rxFifoCount--;
+
+    return true;
+}
+
+// The interrupt is higher priority than anything sending, so runs at once
+static void loopbackTxIrqPend(void)
+{
+    canTxIrqHandler();
+}
+
+static void loopbackConfigFilters(const CanFilterBank *banks, uint8_t count)
+{
+    memcpy(filterBanks, banks, count * sizeof(banks[0]));
+    filterBankCount = count;
+}
+
+static uint32_t loopbackTickMs(void)
+{
+    return canLoopbackNowUs() / 1000;
+}
+
+const CanHal canLoopbackHal = {
+    .init = loopbackInit,
+    .txMailboxEmpty = loopbackTxMailboxEmpty,
+    .txMailboxLoad = loopbackTxMailboxLoad,
+    .rxFifoRead = loopbackRxFifoRead,
+    .txIrqPend = loopbackTxIrqPend,
+    .configFilters = loopbackConfigFilters,
+    .tickMs = loopbackTickMs,
+};
@@ -0,0 +1,26 @@
+#ifndef __CAN_LOOPBACK_H
+#define __CAN_LOOPBACK_H
+
+#include "can.h"
+
+// Depth of the modelled controller's receive FIFO, as bxCAN
+#define CAN_LOOPBACK_RX_FIFO_DEPTH 3
+
+typedef struct CanLoopbackStats_t {
+    uint32_t frames;            // Sent on the bus
+    uint32_t accepted;          // Matched a filter bank and were received
+    uint32_t rxFifoOverruns;    // Received with the controller's FIFO full
+    uint64_t busyBits;          // Bit times the bus carried frames for
+} CanLoopbackStats_t;
+
+extern const CanHal canLoopbackHal;
+
+void canLoopbackReset(uint32_t bitRate);
+uint32_t canLoopbackFrameBits(uint8_t length);
+bool canLoopbackStep(void);
+void canLoopbackRunUntilUs(uint32_t us);
+void canLoopbackHoldRxIrq(bool held);
+uint32_t canLoopbackNowUs(void);
+const CanLoopbackStats_t *canLoopbackStats(void);
+
+#endif /* defined(__CAN_LOOPBACK_H) */
@@ -0,0 +1,331 @@
+#include "gtest/gtest.h"
+
+#include <string.h>
+#include <vector>
+
+extern "C" {
+#include "fc.h"
+#include "can.h"
+#include "can_heartbeat.h"
+#include "can_loopback.h"
+}
+
+#define BIT_RATE 500000
+
+typedef struct Received_t {
+    CanFrame frame;
+    uint32_t atUs;
+} Received_t;
+
+static std::vector<uint16_t> filterIds;
+static std::vector<Received_t> received;
+static std::vector<Received_t> otherReceived;
+
+// Called by canInit
+void setupCanFilters()
+{
+    for (size_t i = 0; i < filterIds.size(); i += CAN_NUM_ADDR_PER_FILTER) {
+        uint16_t addresses[CAN_NUM_ADDR_PER_FILTER] = {0, 0, 0, 0};
+
+        for (size_t j = 0; j < CAN_NUM_ADDR_PER_FILTER && i + j < filterIds.size(); j++) {
+            addresses[j] = filterIds[i + j];
+        }
+        addCanFilter(addresses);
+    }
+}
+
+static void record(const CanFrame *frame)
+{
+    Received_t r;
+    r.frame = *frame;
+    r.atUs = canLoopbackNowUs();
+    received.push_back(r);
+}
+
+static void recordOther(const CanFrame *frame)
+{
+    Received_t r;
+    r.frame = *frame;
+    r.atUs = canLoopbackNowUs();
+    otherReceived.push_back(r);
+}
+
+class CanTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            filterIds = {0x123, 0x124, 0x125, 0x126, 0x300};
+            received.clear();
+            otherReceived.clear();
+
+            canLoopbackReset(BIT_RATE);
+            ASSERT_TRUE(canInit(&canLoopbackHal, CAN_ID_BMS_BASE));
+            ASSERT_TRUE(canRegisterHandler(0x123, record));
+        }
+
+        // An 8 byte frame carrying value and the time it was sent
+        bool send(uint16_t id, uint32_t value) {
+            uint8_t data[CAN_MAX_BYTE_LEN];
+            uint32_t nowUs = canLoopbackNowUs();
+
+            memcpy(data, &value, 4);
+            memcpy(data + 4, &nowUs, 4);
+            return sendCanMessage(id, data, sizeof(data));
+        }
+
+        static uint32_t value(const Received_t &r) {
+            uint32_t v;
+            memcpy(&v, r.frame.data, 4);
+            return v;
+        }
+
+        static uint32_t latencyUs(const Received_t &r) {
+            uint32_t sentUs;
+            memcpy(&sentUs, r.frame.data + 4, 4);
+            return r.atUs - sentUs;
+        }
+
+        // Run the bus until it's idle, dispatching after every frame
+        void drain() {
+            while (canLoopbackStep()) {
+                canProcessRx();
+            }
+        }
+
+        CanStats stats() {
+            CanStats s;
+            canGetStats(&s);
+            return s;
+        }
+};
+
+TEST_F(CanTest, SendAndReceive)
+{
+    uint8_t data[3] = {1, 2, 3};
+
+    ASSERT_TRUE(sendCanMessage(0x123, data, sizeof(data)));
+    drain();
+
+    ASSERT_EQ(1u, received.size());
+    EXPECT_EQ(0x123, received[0].frame.id);
+    EXPECT_EQ(3, received[0].frame.length);
+    EXPECT_EQ(0, memcmp(data, received[0].frame.data, sizeof(data)));
+    EXPECT_EQ(canLoopbackFrameBits(3) * 1000000 / BIT_RATE, received[0].atUs);
+}
+
+TEST_F(CanTest, InvalidFrames)
+{
+    uint8_t data[CAN_MAX_BYTE_LEN + 1] = {0};
+
+    EXPECT_FALSE(sendCanMessage(0x123, data, CAN_MAX_BYTE_LEN + 1));
+    EXPECT_FALSE(sendCanMessage(CAN_ID_MAX + 1, data, 1));
+    EXPECT_EQ(0u, stats().txQueued);
+}
+
+TEST_F(CanTest, SendDoesNotWait)
+{
+    // Fills the mailboxes then the queue, without the bus moving
+    for (int i = 0; i < CAN_TX_QUEUE_SIZE + CAN_TX_MAILBOXES; i++) {
+        ASSERT_TRUE(send(0x123, i)) << i;
+    }
+    EXPECT_FALSE(send(0x123, 99));
+
+    EXPECT_EQ(0u, canLoopbackNowUs());
+    EXPECT_EQ((uint32_t)CAN_TX_MAILBOXES, stats().txLoaded);
+    EXPECT_EQ(1u, stats().txDropped);
+    EXPECT_EQ((uint32_t)CAN_TX_QUEUE_SIZE, stats().txQueueHighWater);
+
+    drain();
+
+    ASSERT_EQ((size_t)CAN_TX_QUEUE_SIZE + CAN_TX_MAILBOXES, received.size());
+    for (size_t i = 0; i < received.size(); i++) {
+        EXPECT_EQ(i, value(received[i]));
+    }
+}
+
+TEST_F(CanTest, Filters)
+{
+    ASSERT_TRUE(send(0x555, 1));        // No filter bank
+    ASSERT_TRUE(send(0x126, 2));        // No handler
+    ASSERT_TRUE(send(0x101, 3));        // Our own heartbeat
+    drain();
+
+    EXPECT_EQ(3u, canLoopbackStats()->frames);
+    EXPECT_EQ(1u, canLoopbackStats()->accepted);
+    EXPECT_EQ(1u, stats().rxUnhandled);
+    EXPECT_EQ(0u, received.size());
+
+    // The 3 other heartbeats and 5 IDs, exactly
+    EXPECT_EQ(2, stats().filterBanks);
+    EXPECT_EQ(0, stats().filterFalseAccepts);
+}
+
+TEST_F(CanTest, DispatchById)
+{
+    // Registered out of order, each gets only its own frames
+    ASSERT_TRUE(canRegisterHandler(0x300, recordOther));
+    ASSERT_TRUE(canRegisterHandler(0x125, recordOther));
+    ASSERT_TRUE(canRegisterHandler(0x124, record));
+
+    for (uint32_t i = 0; i < 20; i++) {
+        ASSERT_TRUE(send(filterIds[i % filterIds.size()], i));
+        drain();
+    }
+
+    for (size_t i = 0; i < received.size(); i++) {
+        uint16_t id = received[i].frame.id;
+        EXPECT_TRUE(id == 0x123 || id == 0x124) << id;
+    }
+    for (size_t i = 0; i < otherReceived.size(); i++) {
+        uint16_t id = otherReceived[i].frame.id;
+        EXPECT_TRUE(id == 0x125 || id == 0x300) << id;
+    }
+    EXPECT_EQ(8u, received.size());
+    EXPECT_EQ(8u, otherReceived.size());
+    EXPECT_EQ(4u, stats().rxUnhandled);
+
+    // Replacing a handler
+    ASSERT_TRUE(canRegisterHandler(0x123, recordOther));
+    ASSERT_TRUE(send(0x123, 0));
+    drain();
+    EXPECT_EQ(8u, received.size());
+    EXPECT_EQ(9u, otherReceived.size());
+}
+
+TEST_F(CanTest, HandlerTableFull)
+{
+    // The heartbeats of the other 3 boards and 0x123 are registered already
+    int free = CAN_MAX_HANDLERS - 4;
+    uint16_t id = CAN_ID_MAX;
+
+    for (int i = 0; i < free; i++) {
+        ASSERT_TRUE(canRegisterHandler(id, record));
+        id -= 7;
+    }
+    EXPECT_FALSE(canRegisterHandler(id, record));
+    EXPECT_TRUE(canRegisterHandler(0x123, recordOther));
+    EXPECT_FALSE(canRegisterHandler(0x123, NULL));
+    EXPECT_FALSE(canRegisterHandler(CAN_ID_MAX + 1, record));
+}
+
+TEST_F(CanTest, RxQueueOverflow)
+{
+    // Nothing is processed, so the queue fills then drops the newest
+    for (uint32_t i = 0; i < CAN_RX_QUEUE_SIZE + 8; i++) {
+        ASSERT_TRUE(send(0x123, i));
+        canLoopbackStep();
+    }
+
+    EXPECT_EQ(8u, stats().rxDropped);
+    EXPECT_EQ((uint32_t)CAN_RX_QUEUE_SIZE, canProcessRx());
+    ASSERT_EQ((size_t)CAN_RX_QUEUE_SIZE, received.size());
+    for (size_t i = 0; i < received.size(); i++) {
+        EXPECT_EQ(i, value(received[i]));
+    }
+}
+
+TEST_F(CanTest, HeldRxInterruptOverrunsFifo)
+{
+    canLoopbackHoldRxIrq(true);
+    for (uint32_t i = 0; i < 5; i++) {
+        ASSERT_TRUE(send(0x123, i));
+    }
+    drain();
+    EXPECT_EQ(0u, received.size());
+
+    canLoopbackHoldRxIrq(false);
+    canProcessRx();
+
+    EXPECT_EQ(2u, canLoopbackStats()->rxFifoOverruns);
+    ASSERT_EQ((size_t)CAN_LOOPBACK_RX_FIFO_DEPTH, received.size());
+    EXPECT_EQ(2u, value(received[2]));
+}
+
+TEST_F(CanTest, Throughput)
+{
+    const uint32_t frames = 5000;
+    uint32_t sent = 0;
+
+    // Keep the queue topped up, as a busy sender would
+    while (received.size() < frames) {
+        while (sent < frames && send(0x123, sent)) {
+            sent++;
+        }
+        ASSERT_TRUE(canLoopbackStep());
+        canProcessRx();
+    }
+
+    for (uint32_t i = 0; i < frames; i++) {
+        ASSERT_EQ(i, value(received[i]));
+    }
+
+    // Back to back, the bus never waits for the driver
+    uint64_t frameUs = canLoopbackFrameBits(CAN_MAX_BYTE_LEN) * 1000000ull / BIT_RATE;
+    EXPECT_EQ(frames * frameUs, canLoopbackNowUs());
+    EXPECT_EQ((uint64_t)frames * canLoopbackFrameBits(CAN_MAX_BYTE_LEN),
+              canLoopbackStats()->busyBits);
+
+    uint32_t framesPerSecond = (uint64_t)frames * 1000000 / canLoopbackNowUs();
+    EXPECT_EQ(BIT_RATE / canLoopbackFrameBits(CAN_MAX_BYTE_LEN), framesPerSecond);
+    EXPECT_EQ(0u, stats().rxDropped);
+    EXPECT_EQ(0u, canLoopbackStats()->rxFifoOverruns);
+}
+
+TEST_F(CanTest, Latency)
+{
+    uint32_t frameUs = canLoopbackFrameBits(CAN_MAX_BYTE_LEN) * 1000000 / BIT_RATE;
+
+    // One frame every ms goes straight out, the old driver waited 1 ms first
+    for (uint32_t i = 0; i < 100; i++) {
+        canLoopbackRunUntilUs((i + 1) * 1000);
+        ASSERT_TRUE(send(0x123, i));
+        drain();
+    }
+
+    ASSERT_EQ(100u, received.size());
+    for (size_t i = 0; i < received.size(); i++) {
+        EXPECT_EQ(frameUs, latencyUs(received[i]));
+    }
+
+    // A burst only waits for the frames ahead of it
+    received.clear();
+    canLoopbackRunUntilUs(200000);
+    for (uint32_t i = 0; i < 20; i++) {
+        ASSERT_TRUE(send(0x123, i));
+    }
+    drain();
+
+    ASSERT_EQ(20u, received.size());
+    for (size_t i = 0; i < received.size(); i++) {
+        EXPECT_EQ((i + 1) * frameUs, latencyUs(received[i]));
+    }
+}
+
+TEST_F(CanTest, HeartbeatProcessedOutsideInterrupt)
+{
+    uint8_t beat = 0x22;
+
+    canLoopbackRunUntilUs(2000000);
+    EXPECT_TRUE(hasHeartBeatExpired(CAN_ID_VCU_BASE));
+
+    ASSERT_TRUE(sendCanMessage(CAN_ID_VCU_BASE + CAN_HBADDR_OFFSET, &beat, 1));
+    while (canLoopbackStep()) {
+    }
+
+    // Received, but waits in the queue until processed
+    EXPECT_TRUE(hasHeartBeatExpired(CAN_ID_VCU_BASE));
+    EXPECT_EQ(1u, canProcessRx());
+    EXPECT_FALSE(hasHeartBeatExpired(CAN_ID_VCU_BASE));
+    EXPECT_TRUE(hasHeartBeatExpired(CAN_ID_DCU_BASE));
+
+    canLoopbackRunUntilUs(3100000);
+    EXPECT_TRUE(hasHeartBeatExpired(CAN_ID_VCU_BASE));
+
+    // Ours goes out, and isn't received
+    uint32_t frames = canLoopbackStats()->frames;
+    uint32_t dispatched = stats().rxDispatched;
+
+    canHeartBeatProcessing();
+    drain();
+    EXPECT_EQ(frames + 1, canLoopbackStats()->frames);
+    EXPECT_EQ(dispatched, stats().rxDispatched);
+}
@@ -0,0 +1,146 @@
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "debugLog.h"
+}
+
+class DebugLogTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            debugLogInit();
+        }
+};
+
+TEST_F(DebugLogTest, EmptyRingHasNothingToRead)
+{
+    DebugLogEntry_t entry;
+
+    EXPECT_FALSE(debugLogRead(&entry));
+}
+
+TEST_F(DebugLogTest, ReadsBackMessagesInOrder)
+{
+    const uint32_t args[3] = {1, 0xFFFFFFFF, 42};
+    DebugLogEntry_t entry;
+
+    ASSERT_TRUE(debugLogWrite(0x08001234, NULL, 0));
+    ASSERT_TRUE(debugLogWrite(0x08005678, args, 3));
+
+    ASSERT_TRUE(debugLogRead(&entry));
+    EXPECT_EQ(0x08001234u, entry.id);
+    EXPECT_EQ(0u, entry.argCount);
+
+    ASSERT_TRUE(debugLogRead(&entry));
+    EXPECT_EQ(0x08005678u, entry.id);
+    ASSERT_EQ(3u, entry.argCount);
+    EXPECT_EQ(1u, entry.args[0]);
+    EXPECT_EQ(0xFFFFFFFFu, entry.args[1]);
+    EXPECT_EQ(42u, entry.args[2]);
+
+    EXPECT_FALSE(debugLogRead(&entry));
+}
+
+TEST_F(DebugLogTest, MessagesWrapAroundRing)
+{
+    uint32_t args[DEBUG_LOG_MAX_ARGS];
+    DebugLogEntry_t entry;
+
+    // Odd sized messages so they straddle the end of the ring
+    for (uint32_t i = 0; i < 10 * DEBUG_LOG_RING_WORDS; i++) {
+        for (uint32_t arg = 0; arg < 5; arg++) {
+            args[arg] = i * 10 + arg;
+        }
+
+        ASSERT_TRUE(debugLogWrite(i, args, 5));
+        ASSERT_TRUE(debugLogRead(&entry));
+        ASSERT_EQ(i, entry.id);
+        ASSERT_EQ(5u, entry.argCount);
+        for (uint32_t arg = 0; arg < 5; arg++) {
+            ASSERT_EQ(i * 10 + arg, entry.args[arg]);
+        }
+    }
+
+    EXPECT_EQ(0u, debugLogDroppedCount());
+}
+
+TEST_F(DebugLogTest, FullRingDropsAndCounts)
+{
+    const uint32_t args[2] = {0, 0};
+    const uint32_t fits = DEBUG_LOG_RING_WORDS / 4;
+    DebugLogEntry_t entry;
+
+    for (uint32_t i = 0; i < fits; i++) {
+        ASSERT_TRUE(debugLogWrite(i, args, 2));
+    }
+
+    EXPECT_FALSE(debugLogWrite(fits, args, 2));
+    EXPECT_FALSE(debugLogWrite(fits, NULL, 0));
+    EXPECT_EQ(2u, debugLogDroppedCount());
+
+    // Reading one frees space for one more
+    ASSERT_TRUE(debugLogRead(&entry));
+    EXPECT_EQ(0u, entry.id);
+    EXPECT_TRUE(debugLogWrite(fits, args, 2));
+}
+
+TEST_F(DebugLogTest, TooManyArgsDropped)
+{
+    uint32_t args[DEBUG_LOG_MAX_ARGS + 1] = {0};
+    DebugLogEntry_t entry;
+
+    EXPECT_FALSE(debugLogWrite(1, args, DEBUG_LOG_MAX_ARGS + 1));
+    EXPECT_EQ(1u, debugLogDroppedCount());
+    EXPECT_FALSE(debugLogRead(&entry));
+}
+
+TEST_F(DebugLogTest, ConcurrentWritersLoseNothingSilently)
+{
+    const uint32_t writers = 4;
+    const uint32_t perWriter = 20000;
+    std::vector<std::thread> threads;
+    std::vector<uint32_t> nextExpected(writers, 0);
+    uint32_t received = 0;
+    DebugLogEntry_t entry;
+
+    for (uint32_t w = 0; w < writers; w++) {
+        threads.push_back(std::thread([w, perWriter]() {
+            for (uint32_t i = 0; i < perWriter; i++) {
+                const uint32_t args[3] = {i, ~i, w};
+                debugLogWrite(w, args, 1 + i % 3);
+            }
+        }));
+    }
+
+    // Messages from one writer must arrive in order, intact, with only
+    // counted drops between them
+    auto drain = [&]() {
+        while (debugLogRead(&entry)) {
+            ASSERT_LT(entry.id, writers);
+            ASSERT_EQ(1 + entry.args[0] % 3, entry.argCount);
+            ASSERT_GE(entry.args[0], nextExpected[entry.id]);
+            if (entry.argCount > 1) {
+                ASSERT_EQ(~entry.args[0], entry.args[1]);
+            }
+            if (entry.argCount > 2) {
+                ASSERT_EQ(entry.id, entry.args[2]);
+            }
+            nextExpected[entry.id] = entry.args[0] + 1;
+            received++;
+        }
+    };
+
+    // Every message is either received or counted as dropped
+    while (received + debugLogDroppedCount() < writers * perWriter) {
+        drain();
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+    drain();
+
+    EXPECT_EQ(writers * perWriter, received + debugLogDroppedCount());
+}
@@ -0,0 +1,247 @@
+#include <string.h>
+
+#include "gtest/gtest.h"
+#include "fff.h"
+
+extern "C" {
+#include "fc.h"
+#include "diskCache.h"
+}
+
+FAKE_VALUE_FUNC(DRESULT, SD_Read_Sectors, BYTE*, DWORD, UINT);
+FAKE_VALUE_FUNC(DRESULT, SD_Write_Sectors, const BYTE*, DWORD, UINT);
+FAKE_VALUE_FUNC(DRESULT, SD_Write_Sectors_Gather, const BYTE* const*, DWORD, UINT);
+
+// A small RAM disk behind the fakes
+#define TEST_DISK_SECTORS 64
+
+static BYTE disk[TEST_DISK_SECTORS][DISK_CACHE_SECTOR_SIZE];
+
+DRESULT SD_Read_Sectors_custom_fake(BYTE *buff, DWORD sector, UINT count)
+{
+    memcpy(buff, disk[sector], count * DISK_CACHE_SECTOR_SIZE);
+    return RES_OK;
+}
+
+DRESULT SD_Write_Sectors_custom_fake(const BYTE *buff, DWORD sector, UINT count)
+{
+    memcpy(disk[sector], buff, count * DISK_CACHE_SECTOR_SIZE);
+    return RES_OK;
+}
+
+DRESULT SD_Write_Sectors_Gather_custom_fake(const BYTE *const *buffers,
+                                            DWORD sector, UINT count)
+{
+    for (UINT i = 0; i < count; i++) {
+        memcpy(disk[sector + i], buffers[i], DISK_CACHE_SECTOR_SIZE);
+    }
+    return RES_OK;
+}
+
+static void fillSector(BYTE *buff, int value)
+{
+    memset(buff, value, DISK_CACHE_SECTOR_SIZE);
+}
+
+class DiskCacheTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            RESET_FAKE(SD_Read_Sectors);
+            RESET_FAKE(SD_Write_Sectors);
+            RESET_FAKE(SD_Write_Sectors_Gather);
+            FFF_RESET_HISTORY();
+
+            SD_Read_Sectors_fake.custom_fake = SD_Read_Sectors_custom_fake;
+            SD_Write_Sectors_fake.custom_fake = SD_Write_Sectors_custom_fake;
+            SD_Write_Sectors_Gather_fake.custom_fake = SD_Write_Sectors_Gather_custom_fake;
+
+            for (int i = 0; i < TEST_DISK_SECTORS; i++) {
+                fillSector(disk[i], i);
+            }
+
+            diskCacheInit();
+        }
+
+        BYTE buff[4 * DISK_CACHE_SECTOR_SIZE];
+        BYTE expected[4 * DISK_CACHE_SECTOR_SIZE];
+};
+
+TEST_F(DiskCacheTest, RepeatedReadsHitCache)
+{
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(RES_OK, diskCacheRead(buff, 5, 1));
+    }
+
+    fillSector(expected, 5);
+    EXPECT_EQ(0, memcmp(buff, expected, DISK_CACHE_SECTOR_SIZE));
+    EXPECT_EQ(1u, SD_Read_Sectors_fake.call_count);
+    EXPECT_EQ(1u, diskCacheStats()->readMisses);
+    EXPECT_EQ(9u, diskCacheStats()->readHits);
+}
+
+TEST_F(DiskCacheTest, WritesAreHeldUntilSync)
+{
+    fillSector(buff, 0xAA);
+
+    // The same FAT sector updated over and over only reaches the card once
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(RES_OK, diskCacheWrite(buff, 3, 1));
+    }
+
+    EXPECT_EQ(0u, SD_Write_Sectors_Gather_fake.call_count);
+    fillSector(expected, 3);
+    EXPECT_EQ(0, memcmp(disk[3], expected, DISK_CACHE_SECTOR_SIZE));
+
+    // Reads see the cached data
+    ASSERT_EQ(RES_OK, diskCacheRead(expected, 3, 1));
+    EXPECT_EQ(0, memcmp(buff, expected, DISK_CACHE_SECTOR_SIZE));
+
+    ASSERT_EQ(RES_OK, diskCacheSync());
+
+    EXPECT_EQ(1u, SD_Write_Sectors_Gather_fake.call_count);
+    EXPECT_EQ(0, memcmp(disk[3], buff, DISK_CACHE_SECTOR_SIZE));
+
+    // Nothing left to write
+    ASSERT_EQ(RES_OK, diskCacheSync());
+    EXPECT_EQ(1u, SD_Write_Sectors_Gather_fake.call_count);
+}
+
+TEST_F(DiskCacheTest, SyncCoalescesAdjacentSectors)
+{
+    // Written out of order, and spread over every set
+    const DWORD sectors[DISK_CACHE_LINES] = {11, 9, 8, 10};
+
+    for (int i = 0; i < DISK_CACHE_LINES; i++) {
+        fillSector(buff, 0x80 + i);
+        ASSERT_EQ(RES_OK, diskCacheWrite(buff, sectors[i], 1));
+    }
+
+    ASSERT_EQ(RES_OK, diskCacheSync());
+
+    ASSERT_EQ(1u, SD_Write_Sectors_Gather_fake.call_count);
+    EXPECT_EQ(8u, SD_Write_Sectors_Gather_fake.arg1_val);
+    EXPECT_EQ((UINT)DISK_CACHE_LINES, SD_Write_Sectors_Gather_fake.arg2_val);
+    EXPECT_EQ(1u, diskCacheStats()->flushCommands);
+    EXPECT_EQ((uint32_t)DISK_CACHE_LINES, diskCacheStats()->flushedSectors);
+
+    for (int i = 0; i < DISK_CACHE_LINES; i++) {
+        fillSector(expected, 0x80 + i);
+        EXPECT_EQ(0, memcmp(disk[sectors[i]], expected, DISK_CACHE_SECTOR_SIZE));
+    }
+}
+
+TEST_F(DiskCacheTest, SyncSplitsRunsAtGaps)
+{
+    fillSector(buff, 0x55);
+    ASSERT_EQ(RES_OK, diskCacheWrite(buff, 20, 1));
+    ASSERT_EQ(RES_OK, diskCacheWrite(buff, 21, 1));
+    ASSERT_EQ(RES_OK, diskCacheWrite(buff, 30, 1));
+
+    ASSERT_EQ(RES_OK, diskCacheSync());
+
+    ASSERT_EQ(2u, SD_Write_Sectors_Gather_fake.call_count);
+    EXPECT_EQ(20u, SD_Write_Sectors_Gather_fake.arg1_history[0]);
+    EXPECT_EQ(2u, SD_Write_Sectors_Gather_fake.arg2_history[0]);
+    EXPECT_EQ(30u, SD_Write_Sectors_Gather_fake.arg1_history[1]);
+    EXPECT_EQ(1u, SD_Write_Sectors_Gather_fake.arg2_history[1]);
+}
+
+TEST_F(DiskCacheTest, EvictionWritesBackDirtyData)
+{
+    // Every sector maps to the same set, one more than it can hold
+    for (int i = 0; i <= DISK_CACHE_WAYS; i++) {
+        fillSector(buff, 0xC0 + i);
+        ASSERT_EQ(RES_OK, diskCacheWrite(buff, i * DISK_CACHE_SETS, 1));
+    }
+
+    EXPECT_EQ(1u, diskCacheStats()->evictions);
+    EXPECT_EQ((uint32_t)DISK_CACHE_WAYS, diskCacheStats()->flushedSectors);
+
+    for (int i = 0; i < DISK_CACHE_WAYS; i++) {
+        fillSector(expected, 0xC0 + i);
+        EXPECT_EQ(0, memcmp(disk[i * DISK_CACHE_SETS], expected,
+                            DISK_CACHE_SECTOR_SIZE));
+    }
+
+    // The newest sector is still only in the cache
+    fillSector(expected, DISK_CACHE_WAYS * DISK_CACHE_SETS);
+    EXPECT_EQ(0, memcmp(disk[DISK_CACHE_WAYS * DISK_CACHE_SETS], expected,
+                        DISK_CACHE_SECTOR_SIZE));
+}
+
+TEST_F(DiskCacheTest, CleanLinesEvictedBeforeDirty)
+{
+    fillSector(buff, 0xEE);
+
+    // Set 0 holds one dirty and one clean line, the dirty one older
+    ASSERT_EQ(RES_OK, diskCacheWrite(buff, 0, 1));
+    ASSERT_EQ(RES_OK, diskCacheRead(expected, DISK_CACHE_SETS, 1));
+    for (int i = 2; i < DISK_CACHE_WAYS; i++) {
+        ASSERT_EQ(RES_OK, diskCacheRead(expected, i * DISK_CACHE_SETS, 1));
+    }
+
+    // Reading another sector in the set replaces a clean line without a write
+    ASSERT_EQ(RES_OK, diskCacheRead(expected, DISK_CACHE_WAYS * DISK_CACHE_SETS, 1));
+
+    EXPECT_EQ(0u, SD_Write_Sectors_Gather_fake.call_count);
+    ASSERT_EQ(RES_OK, diskCacheRead(expected, 0, 1));
+    EXPECT_EQ(0, memcmp(buff, expected, DISK_CACHE_SECTOR_SIZE));
+}
+
+TEST_F(DiskCacheTest, MultiSectorTransfersBypassCache)
+{
+    fillSector(buff, 0x11);
+    ASSERT_EQ(RES_OK, diskCacheWrite(buff, 41, 1));
+
+    // Bypassing reads still see the unwritten cached sector
+    ASSERT_EQ(RES_OK, diskCacheRead(buff, 40, 4));
+    EXPECT_EQ(1u, SD_Read_Sectors_fake.call_count);
+    EXPECT_EQ(4u, SD_Read_Sectors_fake.arg2_val);
+
+    fillSector(expected, 40);
+    fillSector(&expected[DISK_CACHE_SECTOR_SIZE], 0x11);
+    fillSector(&expected[2 * DISK_CACHE_SECTOR_SIZE], 42);
+    fillSector(&expected[3 * DISK_CACHE_SECTOR_SIZE], 43);
+    EXPECT_EQ(0, memcmp(buff, expected, sizeof(buff)));
+
+    // A bypassing write replaces the cached copy, which is then clean
+    memset(buff, 0x22, sizeof(buff));
+    ASSERT_EQ(RES_OK, diskCacheWrite(buff, 40, 4));
+    EXPECT_EQ(1u, SD_Write_Sectors_fake.call_count);
+
+    ASSERT_EQ(RES_OK, diskCacheSync());
+    EXPECT_EQ(0u, SD_Write_Sectors_Gather_fake.call_count);
+
+    ASSERT_EQ(RES_OK, diskCacheRead(expected, 41, 1));
+    EXPECT_EQ(0, memcmp(buff, expected, DISK_CACHE_SECTOR_SIZE));
+    EXPECT_EQ(1u, diskCacheStats()->readHits);
+}
+
+TEST_F(DiskCacheTest, InvalidateDropsCachedData)
+{
+    fillSector(buff, 0x33);
+    ASSERT_EQ(RES_OK, diskCacheWrite(buff, 50, 1));
+
+    diskCacheInvalidate(48, 55);
+
+    ASSERT_EQ(RES_OK, diskCacheSync());
+    EXPECT_EQ(0u, SD_Write_Sectors_Gather_fake.call_count);
+
+    ASSERT_EQ(RES_OK, diskCacheRead(buff, 50, 1));
+    fillSector(expected, 50);
+    EXPECT_EQ(0, memcmp(buff, expected, DISK_CACHE_SECTOR_SIZE));
+}
+
+TEST_F(DiskCacheTest, WriteErrorKeepsDataDirty)
+{
+    fillSector(buff, 0x44);
+    ASSERT_EQ(RES_OK, diskCacheWrite(buff, 7, 1));
+
+    SD_Write_Sectors_Gather_fake.custom_fake = NULL;
+    SD_Write_Sectors_Gather_fake.return_val = RES_ERROR;
+    EXPECT_EQ(RES_ERROR, diskCacheSync());
+
+    SD_Write_Sectors_Gather_fake.custom_fake = SD_Write_Sectors_Gather_custom_fake;
+    EXPECT_EQ(RES_OK, diskCacheSync());
+    EXPECT_EQ(0, memcmp(disk[7], buff, DISK_CACHE_SECTOR_SIZE));
+}
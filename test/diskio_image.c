@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "fc.h"
+#include "diskio.h"
+#include "diskio_image.h"
+
+/**
+ * @file test/diskio_image.c
+ *
+ * @brief FatFs disk interface backed by an image file, replaces Src/sd.c on
+ * the host
+ *
+ * Lets FatFs and the logging code run in the unit tests. The image is an
+ * ordinary file, so it can be inspected afterwards with standard tools (for
+ * example fsck.fat -n or mdir -i). An optional latency model adds up how
+ * long each command would take on a card.
+ */
+
+static FILE *image = NULL;
+static DWORD imageSectors = 0;
+static DSTATUS stat = STA_NOINIT;
+
+static DiskImageLatency_t latency;
+static DiskImageStats_t stats;
+static DWORD metadataBoundary = 0;
+static DWORD nextWriteSector = 0;
+
+/**
+ * @brief Create (or replace) the disk image
+ *
+ * @param path        Path of the image file
+ * @param sectorCount Size of the disk
+ *
+ * @return FC_OK, or FC_ERROR if the file couldn't be created
+ */
+FC_Status diskImageOpen(const char *path, DWORD sectorCount)
+{
+    diskImageClose();
+
+    image = fopen(path, "w+b");
+    if (image == NULL) {
+        return FC_ERROR;
+    }
+
+    // Size the file by writing the last byte, the rest reads as zeros
+    if (fseek(image, (long)sectorCount * DISK_IMAGE_SECTOR_SIZE - 1, SEEK_SET) != 0
+        || fputc(0, image) == EOF)
+    {
+        diskImageClose();
+        return FC_ERROR;
+    }
+
+    imageSectors = sectorCount;
+    memset(&latency, 0, sizeof(latency));
+    metadataBoundary = 0;
+    diskImageResetStats();
+
+    return FC_OK;
+}
+
+void diskImageClose(void)
+{
+    if (image != NULL) {
+        fclose(image);
+        image = NULL;
+    }
+    imageSectors = 0;
+    stat = STA_NOINIT;
+}
+
+void diskImageSetLatency(const DiskImageLatency_t *newLatency)
+{
+    latency = *newLatency;
+}
+
+/**
+ * @brief Count writes to sectors below this one as metadata (FAT and
+ * directory) writes. Usually set to the start of the data area
+ */
+void diskImageSetMetadataBoundary(DWORD sector)
+{
+    metadataBoundary = sector;
+}
+
+void diskImageResetStats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    nextWriteSector = 0;
+}
+
+const DiskImageStats_t *diskImageStats(void)
+{
+    return &stats;
+}
+
+static DRESULT checkAccess(BYTE pdrv, DWORD sector, UINT count)
+{
+    if (pdrv != 0 || count == 0) return RES_PARERR;
+    if (stat & STA_NOINIT) return RES_NOTRDY;
+    if (sector + count > imageSectors || sector + count < sector) return RES_PARERR;
+
+    if (fseek(image, (long)sector * DISK_IMAGE_SECTOR_SIZE, SEEK_SET) != 0) {
+        return RES_ERROR;
+    }
+
+    return RES_OK;
+}
+
+/* FatFs disk interface */
+
+DSTATUS disk_initialize(BYTE pdrv)
+{
+    if (pdrv != 0) return STA_NOINIT;
+
+    stat = (image != NULL) ? 0 : STA_NODISK | STA_NOINIT;
+
+    return stat;
+}
+
+DSTATUS disk_status(BYTE pdrv)
+{
+    if (pdrv != 0) return STA_NOINIT;
+
+    return stat;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
+{
+    DRESULT res = checkAccess(pdrv, sector, count);
+
+    if (res != RES_OK) return res;
+
+    if (fread(buff, DISK_IMAGE_SECTOR_SIZE, count, image) != count) {
+        return RES_ERROR;
+    }
+
+    stats.readCommands++;
+    stats.sectorsRead += count;
+    stats.totalUs += latency.commandUs + count * latency.sectorUs;
+
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
+{
+    DRESULT res = checkAccess(pdrv, sector, count);
+    uint32_t us;
+
+    if (res != RES_OK) return res;
+
+    if (fwrite(buff, DISK_IMAGE_SECTOR_SIZE, count, image) != count) {
+        return RES_ERROR;
+    }
+
+    us = latency.commandUs + count * latency.sectorUs + latency.writeBusyUs;
+    if (sector != nextWriteSector) {
+        us += latency.nonSequentialUs;
+    }
+    nextWriteSector = sector + count;
+
+    for (UINT i = 0; i < count; i++) {
+        if (sector + i < metadataBoundary) {
+            stats.metadataSectorsWritten++;
+        }
+    }
+
+    stats.writeCommands++;
+    stats.sectorsWritten += count;
+    stats.totalUs += us;
+    if (us > stats.worstWriteUs) {
+        stats.worstWriteUs = us;
+    }
+
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff)
+{
+    static const uint8_t erased[DISK_IMAGE_SECTOR_SIZE] = {0};
+    DWORD *range;
+
+    if (pdrv != 0) return RES_PARERR;
+    if (stat & STA_NOINIT) return RES_NOTRDY;
+
+    switch (cmd) {
+    case CTRL_SYNC:
+        return (fflush(image) == 0) ? RES_OK : RES_ERROR;
+
+    case GET_SECTOR_COUNT:
+        *(DWORD *)buff = imageSectors;
+        return RES_OK;
+
+    case GET_SECTOR_SIZE:
+        *(WORD *)buff = DISK_IMAGE_SECTOR_SIZE;
+        return RES_OK;
+
+    case GET_BLOCK_SIZE:
+        // Typical sd card allocation unit, 4 MB
+        *(DWORD *)buff = 8192;
+        return RES_OK;
+
+    case CTRL_TRIM:
+        // Erased sectors read back as zeros
+        range = buff;
+        if (checkAccess(pdrv, range[0], range[1] - range[0] + 1) != RES_OK) {
+            return RES_PARERR;
+        }
+        for (DWORD sector = range[0]; sector <= range[1]; sector++) {
+            if (fwrite(erased, sizeof(erased), 1, image) != 1) {
+                return RES_ERROR;
+            }
+        }
+        return RES_OK;
+
+    default:
+        return RES_PARERR;
+    }
+}
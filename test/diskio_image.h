@@ -0,0 +1,40 @@
+#ifndef __DISKIO_IMAGE_H
+#define __DISKIO_IMAGE_H
+
+#include "fc.h"
+#include "diskio.h"
+
+#define DISK_IMAGE_SECTOR_SIZE 512
+
+/**
+ * @brief Simple timing model of an sd card, all times in us
+ *
+ * Nothing actually waits, the modelled time is added up in DiskImageStats_t
+ */
+typedef struct DiskImageLatency_t {
+    uint32_t commandUs;        // Overhead of every read or write command
+    uint32_t sectorUs;         // Transfer time per sector
+    uint32_t writeBusyUs;      // Busy time after every write command
+    uint32_t nonSequentialUs;  // Extra busy time when a write doesn't follow on
+                               // from the last one (the card changes erase
+                               // block)
+} DiskImageLatency_t;
+
+typedef struct DiskImageStats_t {
+    uint32_t readCommands;
+    uint32_t writeCommands;
+    uint32_t sectorsRead;
+    uint32_t sectorsWritten;
+    uint32_t metadataSectorsWritten; // Written below the metadata boundary
+    uint64_t totalUs;                // Modelled time of all commands
+    uint32_t worstWriteUs;           // Slowest single write command
+} DiskImageStats_t;
+
+FC_Status diskImageOpen(const char *path, DWORD sectorCount);
+void diskImageClose(void);
+void diskImageSetLatency(const DiskImageLatency_t *latency);
+void diskImageSetMetadataBoundary(DWORD sector);
+void diskImageResetStats(void);
+const DiskImageStats_t *diskImageStats(void);
+
+#endif /* defined(__DISKIO_IMAGE_H) */
@@ -0,0 +1,73 @@
+#ifndef __FAKE_FREERTOS_H
+#define __FAKE_FREERTOS_H
+
+#include <stdint.h>
+
+/**
+ * @file test/fake_hal/FreeRTOS.h
+ *
+ * @brief The parts of the FreeRTOS api the drivers use, for one task on the
+ * simulated clock (fake_freertos.c)
+ *
+ * There is no scheduler. Blocking calls run the fake HAL's events until they
+ * would return, so a driver waiting on a semaphore sees the DMA complete
+ * interrupt give it at the right simulated time.
+ */
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE                 ((BaseType_t)0)
+#define pdTRUE                  ((BaseType_t)1)
+#define pdPASS                  pdTRUE
+#define pdFAIL                  pdFALSE
+
+#define configTICK_RATE_HZ      ((TickType_t)1000)
+#define configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY 5
+
+#define portMAX_DELAY           ((TickType_t)0xFFFFFFFFUL)
+#define portTICK_PERIOD_MS      ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
+
+typedef struct FakeQueue_t {
+    UBaseType_t count;
+    UBaseType_t max;
+} FakeQueue_t;
+
+typedef FakeQueue_t *QueueHandle_t;
+typedef QueueHandle_t SemaphoreHandle_t;
+typedef void *TaskHandle_t;
+
+/*
+ * Semaphores
+ */
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore,
+                                 BaseType_t *higherPriorityTaskWoken);
+
+/*
+ * Tasks
+ */
+#define taskSCHEDULER_SUSPENDED     ((BaseType_t)0)
+#define taskSCHEDULER_NOT_STARTED   ((BaseType_t)1)
+#define taskSCHEDULER_RUNNING       ((BaseType_t)2)
+
+BaseType_t xTaskGetSchedulerState(void);
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken);
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait);
+
+// Interrupts only run between driver calls, so there is nothing to mask
+#define taskENTER_CRITICAL()    do { } while (0)
+#define taskEXIT_CRITICAL()     do { } while (0)
+
+void fakeRtosYieldFromISR(BaseType_t higherPriorityTaskWoken);
+#define portYIELD_FROM_ISR(x)   fakeRtosYieldFromISR(x)
+
+#endif /* defined(__FAKE_FREERTOS_H) */
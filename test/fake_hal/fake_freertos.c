@@ -0,0 +1,197 @@
+#include <string.h>
+
+#include "fc.h"
+#include "fake_hal.h"
+#include "kernelObjects.h"
+
+/**
+ * @file test/fake_hal/fake_freertos.c
+ *
+ * @brief FreeRTOS for a single task, the test, on the fake HAL's clock
+ *
+ * Blocking calls run the fake HAL's events until what they wait for happens
+ * or they time out, so waits take the simulated time they would on the
+ * board. The kernel objects are the ones in kernelObjects.c, made here
+ * without the kernel's static buffers.
+ */
+
+#define NS_PER_TICK     (1000000000ULL / configTICK_RATE_HZ)
+
+static FakeQueue_t kernelQueues[KERNEL_QUEUE_COUNT];
+
+static BaseType_t schedulerState;
+static uint32_t yieldsFromISR;
+
+// The test's own task
+static volatile UBaseType_t notifyCount;
+static SemaphoreHandle_t blockedOn;
+static bool blockedOnNotify;
+static int taskHandle;
+
+void fakeRtosReset(void)
+{
+    memset(kernelQueues, 0, sizeof(kernelQueues));
+    schedulerState = taskSCHEDULER_NOT_STARTED;
+    yieldsFromISR = 0;
+    notifyCount = 0;
+    blockedOn = NULL;
+    blockedOnNotify = false;
+}
+
+void fakeRtosSetSchedulerState(BaseType_t state)
+{
+    schedulerState = state;
+}
+
+uint32_t fakeRtosYieldsFromISR(void)
+{
+    return yieldsFromISR;
+}
+
+void fakeRtosYieldFromISR(BaseType_t higherPriorityTaskWoken)
+{
+    if (higherPriorityTaskWoken) {
+        yieldsFromISR++;
+    }
+}
+
+/**
+ * @brief Run events until the count is non zero, or the timeout
+ *
+ * Waiting forever stops once there is nothing left that could give it, or
+ * a test would hang
+ *
+ * @return true if the count is non zero
+ */
+static bool waitForCount(volatile UBaseType_t *count, TickType_t ticksToWait)
+{
+    uint64_t deadline = (ticksToWait == portMAX_DELAY)
+                        ? UINT64_MAX
+                        : fakeHalNowNs() + ticksToWait * NS_PER_TICK;
+
+    while (*count == 0) {
+        if (!fakeHalRunNextEvent(deadline)) {
+            if (ticksToWait != portMAX_DELAY) {
+                fakeHalRunUntilNs(deadline);
+            }
+            return *count != 0;
+        }
+    }
+
+    return true;
+}
+
+QueueHandle_t kernelQueueCreate(KernelQueue queue)
+{
+    if (queue >= KERNEL_QUEUE_COUNT) {
+        Error_Handler("Invalid kernel queue");
+        return NULL;
+    }
+
+    // A mutex starts given, a binary semaphore taken
+    kernelQueues[queue].max = 1;
+    kernelQueues[queue].count = (queue == KERNEL_QUEUE_I2C_MUTEX) ? 1 : 0;
+
+    return &kernelQueues[queue];
+}
+
+/*
+ * Semaphores
+ */
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait)
+{
+    bool taken;
+
+    blockedOn = semaphore;
+    taken = waitForCount(&semaphore->count, ticksToWait);
+    blockedOn = NULL;
+
+    if (!taken) {
+        return pdFALSE;
+    }
+    semaphore->count--;
+
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    if (semaphore->count >= semaphore->max) {
+        return pdFAIL;
+    }
+    semaphore->count++;
+
+    return pdPASS;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore,
+                                 BaseType_t *higherPriorityTaskWoken)
+{
+    if (xSemaphoreGive(semaphore) != pdPASS) {
+        return pdFAIL;
+    }
+
+    if (higherPriorityTaskWoken != NULL && blockedOn == semaphore) {
+        *higherPriorityTaskWoken = pdTRUE;
+    }
+
+    return pdPASS;
+}
+
+/*
+ * Tasks
+ */
+
+BaseType_t xTaskGetSchedulerState(void)
+{
+    return schedulerState;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(fakeHalNowNs() / NS_PER_TICK);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    fakeHalRunUntilNs(fakeHalNowNs() + ticks * NS_PER_TICK);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return &taskHandle;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    ASSERT(task == &taskHandle);
+    notifyCount++;
+
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken)
+{
+    xTaskNotifyGive(task);
+
+    if (higherPriorityTaskWoken != NULL && blockedOnNotify) {
+        *higherPriorityTaskWoken = pdTRUE;
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait)
+{
+    uint32_t count;
+
+    blockedOnNotify = true;
+    waitForCount(&notifyCount, ticksToWait);
+    blockedOnNotify = false;
+
+    count = notifyCount;
+    if (count != 0) {
+        notifyCount = clearCountOnExit ? 0 : count - 1;
+    }
+
+    return count;
+}
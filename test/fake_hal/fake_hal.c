@@ -0,0 +1,1460 @@
+#include <string.h>
+
+#include "fc.h"
+#include "fake_hal.h"
+
+/**
+ * @file test/fake_hal/fake_hal.c
+ *
+ * @brief Register level stand-in for the ST HAL, run from a simulated clock
+ *
+ * The peripherals are the register structs in stm32f4xx.h, kept in RAM. The
+ * HAL functions here set them up as the real ones do, so a driver that
+ * reads or writes registers directly sees the same bits. Time is kept in ns
+ * and only advances when the test runs it or the driver waits (see
+ * fake_hal.h). On the way:
+ *
+ * - Running timers count from their kernel clock through PSC and ARR. Each
+ *   update event, unless UDIS is set, loads the preloaded compare values
+ *   into the active ones the outputs use
+ * - An input edge captures CNT into CCRx and raises the timer's interrupt,
+ *   which HAL_TIM_IRQHandler turns into HAL_TIM_IC_CaptureCallback
+ * - DMA transfers complete after the time their bytes take on the bus, and
+ *   the stream's interrupt calls the peripheral's complete or error callback
+ * - Polled transfers take their bus time before returning, running any
+ *   interrupts that come due meanwhile
+ *
+ * Devices on the buses are callbacks the tests attach. An I2C device is
+ * addressed by register, an SPI device is clocked a byte at a time while its
+ * chip select pin is driven low.
+ */
+
+#define NS_PER_S            1000000000ULL
+#define NS_PER_MS           1000000ULL
+
+#define TIM_CHANNELS        4
+#define I2C_MAX_DEVICES     4
+
+typedef struct FakeEvent_t {
+    bool            used;
+    uint64_t        atNs;
+    uint32_t        order;
+    FakeHalEventFn  fn;
+    void           *arg;
+} FakeEvent_t;
+
+typedef struct FakeTim_t {
+    TIM_TypeDef        *regs;
+    IRQn_Type           irq;
+    bool                apb2;
+    TIM_HandleTypeDef  *handle;
+    uint64_t            cycleRemainder;     // Kernel clock cycles * 1e9 not counted yet
+    uint32_t            prescalerCount;
+    uint32_t            active[TIM_CHANNELS];
+    FakeTimStats_t      stats;
+} FakeTim_t;
+
+typedef struct FakeDma_t {
+    DMA_Stream_TypeDef *regs;
+    IRQn_Type           irq;
+    FakeDmaFault        nextFault;
+    int                 event;
+    bool                complete;
+    bool                error;
+    void              (*done)(void *ctx, bool error);
+    void               *ctx;
+    uint32_t            transfers;
+} FakeDma_t;
+
+typedef struct FakeI2cSlot_t {
+    uint8_t                 address;
+    const FakeI2cDevice_t  *device;
+    void                   *ctx;
+} FakeI2cSlot_t;
+
+typedef struct FakeI2c_t {
+    I2C_TypeDef        *regs;
+    FakeI2cSlot_t       slots[I2C_MAX_DEVICES];
+    int                 slotCount;
+
+    // The DMA transfer in progress
+    I2C_HandleTypeDef  *handle;
+    FakeI2cSlot_t      *slot;
+    uint16_t            memAddress;
+    uint8_t            *data;
+    uint16_t            size;
+    bool                read;
+} FakeI2c_t;
+
+typedef struct FakeSpi_t {
+    SPI_TypeDef            *regs;
+    GPIO_TypeDef           *csPort;
+    uint16_t                csPin;
+    bool                    selected;
+    const FakeSpiDevice_t  *device;
+    void                   *ctx;
+    FakeSpiStats_t          stats;
+
+    // The DMA transfer in progress
+    SPI_HandleTypeDef      *handle;
+    const uint8_t          *tx;
+    uint8_t                *rx;
+    uint16_t                size;
+} FakeSpi_t;
+
+GPIO_TypeDef fakeGpioA, fakeGpioB, fakeGpioC;
+TIM_TypeDef fakeTim1, fakeTim5;
+I2C_TypeDef fakeI2c1;
+SPI_TypeDef fakeSpi1;
+DMA_Stream_TypeDef fakeDma1Stream5, fakeDma1Stream6;
+DMA_Stream_TypeDef fakeDma2Stream0, fakeDma2Stream3;
+
+static uint64_t nowNs;
+
+static FakeEvent_t events[FAKE_HAL_MAX_EVENTS];
+static uint32_t eventOrder;
+
+static bool irqEnabled[FAKE_IRQ_COUNT];
+static bool irqPending[FAKE_IRQ_COUNT];
+static bool irqActive[FAKE_IRQ_COUNT];
+
+static uint16_t gpioHeldLow[3];
+
+static FakeTim_t tims[] = {
+    {.regs = TIM1, .irq = TIM1_CC_IRQn, .apb2 = true},
+    {.regs = TIM5, .irq = TIM5_IRQn, .apb2 = false},
+};
+
+static FakeDma_t dmas[] = {
+    {.regs = DMA1_Stream5, .irq = DMA1_Stream5_IRQn},
+    {.regs = DMA1_Stream6, .irq = DMA1_Stream6_IRQn},
+    {.regs = DMA2_Stream0, .irq = DMA2_Stream0_IRQn},
+    {.regs = DMA2_Stream3, .irq = DMA2_Stream3_IRQn},
+};
+
+static FakeI2c_t i2cs[] = {
+    {.regs = I2C1},
+};
+
+static FakeSpi_t spis[] = {
+    {.regs = SPI1},
+};
+
+static uint32_t errorHandlerCalls;
+static uint32_t assertFailures;
+
+#define ARRAY_LENGTH(a) (sizeof(a) / sizeof((a)[0]))
+
+static void timAdvance(FakeTim_t *tim, uint64_t ns);
+
+/*
+ * Lookups, each peripheral by its registers
+ */
+
+static FakeTim_t *timFor(TIM_TypeDef *regs)
+{
+    for (unsigned i = 0; i < ARRAY_LENGTH(tims); i++) {
+        if (tims[i].regs == regs) {
+            return &tims[i];
+        }
+    }
+    ASSERT(false);
+    return NULL;
+}
+
+static FakeDma_t *dmaFor(DMA_Stream_TypeDef *regs)
+{
+    for (unsigned i = 0; i < ARRAY_LENGTH(dmas); i++) {
+        if (dmas[i].regs == regs) {
+            return &dmas[i];
+        }
+    }
+    ASSERT(false);
+    return NULL;
+}
+
+static FakeI2c_t *i2cFor(I2C_TypeDef *regs)
+{
+    for (unsigned i = 0; i < ARRAY_LENGTH(i2cs); i++) {
+        if (i2cs[i].regs == regs) {
+            return &i2cs[i];
+        }
+    }
+    ASSERT(false);
+    return NULL;
+}
+
+static FakeSpi_t *spiFor(SPI_TypeDef *regs)
+{
+    for (unsigned i = 0; i < ARRAY_LENGTH(spis); i++) {
+        if (spis[i].regs == regs) {
+            return &spis[i];
+        }
+    }
+    ASSERT(false);
+    return NULL;
+}
+
+static int gpioIndex(GPIO_TypeDef *port)
+{
+    if (port == GPIOA) {
+        return 0;
+    } else if (port == GPIOB) {
+        return 1;
+    }
+    ASSERT(port == GPIOC);
+    return 2;
+}
+
+/*
+ * Time and events
+ */
+
+/**
+ * @brief Power on: every register to 0, no events, time back to 0
+ *
+ * Devices are detached, and the fake FreeRTOS is reset too
+ */
+void fakeHalReset(void)
+{
+    nowNs = 0;
+    memset(events, 0, sizeof(events));
+    eventOrder = 0;
+    memset(irqEnabled, 0, sizeof(irqEnabled));
+    memset(irqPending, 0, sizeof(irqPending));
+    memset(irqActive, 0, sizeof(irqActive));
+    memset(gpioHeldLow, 0, sizeof(gpioHeldLow));
+
+    memset(&fakeGpioA, 0, sizeof(fakeGpioA));
+    memset(&fakeGpioB, 0, sizeof(fakeGpioB));
+    memset(&fakeGpioC, 0, sizeof(fakeGpioC));
+    memset(&fakeTim1, 0, sizeof(fakeTim1));
+    memset(&fakeTim5, 0, sizeof(fakeTim5));
+    memset(&fakeI2c1, 0, sizeof(fakeI2c1));
+    memset(&fakeSpi1, 0, sizeof(fakeSpi1));
+    memset(&fakeDma1Stream5, 0, sizeof(fakeDma1Stream5));
+    memset(&fakeDma1Stream6, 0, sizeof(fakeDma1Stream6));
+    memset(&fakeDma2Stream0, 0, sizeof(fakeDma2Stream0));
+    memset(&fakeDma2Stream3, 0, sizeof(fakeDma2Stream3));
+
+    for (unsigned i = 0; i < ARRAY_LENGTH(tims); i++) {
+        tims[i].handle = NULL;
+        tims[i].cycleRemainder = 0;
+        tims[i].prescalerCount = 0;
+        memset(tims[i].active, 0, sizeof(tims[i].active));
+        memset(&tims[i].stats, 0, sizeof(tims[i].stats));
+    }
+    for (unsigned i = 0; i < ARRAY_LENGTH(dmas); i++) {
+        dmas[i].nextFault = FAKE_DMA_OK;
+        dmas[i].event = -1;
+        dmas[i].complete = false;
+        dmas[i].done = NULL;
+        dmas[i].transfers = 0;
+    }
+    for (unsigned i = 0; i < ARRAY_LENGTH(i2cs); i++) {
+        i2cs[i].slotCount = 0;
+        i2cs[i].handle = NULL;
+    }
+    for (unsigned i = 0; i < ARRAY_LENGTH(spis); i++) {
+        spis[i].device = NULL;
+        spis[i].selected = false;
+        spis[i].handle = NULL;
+        memset(&spis[i].stats, 0, sizeof(spis[i].stats));
+    }
+
+    errorHandlerCalls = 0;
+    assertFailures = 0;
+
+    fakeRtosReset();
+}
+
+void fakeHalResetRegisters(void *peripheral, size_t size)
+{
+    memset(peripheral, 0, size);
+}
+
+uint64_t fakeHalNowNs(void)
+{
+    return nowNs;
+}
+
+uint32_t fakeHalNowUs(void)
+{
+    return (uint32_t)(nowNs / 1000);
+}
+
+static void advanceTo(uint64_t ns)
+{
+    if (ns <= nowNs) {
+        return;
+    }
+
+    for (unsigned i = 0; i < ARRAY_LENGTH(tims); i++) {
+        timAdvance(&tims[i], ns - nowNs);
+    }
+    nowNs = ns;
+}
+
+/**
+ * @brief Run the earliest event due by the deadline, moving time to it
+ *
+ * Events due at the same time run in the order they were scheduled
+ *
+ * @return false if there was none
+ */
+bool fakeHalRunNextEvent(uint64_t deadlineNs)
+{
+    FakeEvent_t *next = NULL;
+
+    for (int i = 0; i < FAKE_HAL_MAX_EVENTS; i++) {
+        FakeEvent_t *event = &events[i];
+
+        if (event->used && event->atNs <= deadlineNs
+            && (next == NULL || event->atNs < next->atNs
+                || (event->atNs == next->atNs
+                    && (int32_t)(event->order - next->order) < 0)))
+        {
+            next = event;
+        }
+    }
+
+    if (next == NULL) {
+        return false;
+    }
+
+    advanceTo(next->atNs);
+    next->used = false;
+    next->fn(next->arg);
+
+    return true;
+}
+
+void fakeHalRunUntilNs(uint64_t ns)
+{
+    while (fakeHalRunNextEvent(ns)) {
+    }
+    advanceTo(ns);
+}
+
+void fakeHalRunForUs(uint32_t us)
+{
+    fakeHalRunUntilNs(nowNs + (uint64_t)us * 1000);
+}
+
+// Code polling or waiting on a bus, interrupts still run meanwhile
+static void busyFor(uint64_t ns)
+{
+    fakeHalRunUntilNs(nowNs + ns);
+}
+
+/**
+ * @return The event's id for fakeHalCancel, or -1 if there are too many
+ */
+int fakeHalSchedule(uint64_t atNs, FakeHalEventFn fn, void *arg)
+{
+    for (int i = 0; i < FAKE_HAL_MAX_EVENTS; i++) {
+        if (!events[i].used) {
+            events[i].used = true;
+            events[i].atNs = (atNs < nowNs) ? nowNs : atNs;
+            events[i].order = eventOrder++;
+            events[i].fn = fn;
+            events[i].arg = arg;
+            return i;
+        }
+    }
+
+    ASSERT(false);
+    return -1;
+}
+
+void fakeHalCancel(int event)
+{
+    if (event >= 0 && event < FAKE_HAL_MAX_EVENTS) {
+        events[event].used = false;
+    }
+}
+
+/*
+ * Interrupts
+ */
+
+static void timIrqHandler(FakeTim_t *tim)
+{
+    if (tim->handle != NULL) {
+        HAL_TIM_IRQHandler(tim->handle);
+    }
+}
+
+static void dmaIrqHandler(FakeDma_t *dma)
+{
+    if (dma->complete) {
+        dma->complete = false;
+        if (dma->done != NULL) {
+            dma->done(dma->ctx, dma->error);
+        }
+    }
+}
+
+static void irqHandler(IRQn_Type irq)
+{
+    for (unsigned i = 0; i < ARRAY_LENGTH(tims); i++) {
+        if (tims[i].irq == irq) {
+            timIrqHandler(&tims[i]);
+        }
+    }
+    for (unsigned i = 0; i < ARRAY_LENGTH(dmas); i++) {
+        if (dmas[i].irq == irq) {
+            dmaIrqHandler(&dmas[i]);
+        }
+    }
+}
+
+// An interrupt doesn't preempt itself, raised again it runs once it returns
+static void irqService(IRQn_Type irq)
+{
+    while (irqPending[irq] && irqEnabled[irq] && !irqActive[irq]) {
+        irqPending[irq] = false;
+        irqActive[irq] = true;
+        irqHandler(irq);
+        irqActive[irq] = false;
+    }
+}
+
+void fakeIrqRaise(IRQn_Type irq)
+{
+    irqPending[irq] = true;
+    irqService(irq);
+}
+
+bool fakeIrqEnabled(IRQn_Type irq)
+{
+    return irqEnabled[irq];
+}
+
+bool fakeIrqPending(IRQn_Type irq)
+{
+    return irqPending[irq];
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority)
+{
+    (void)IRQn;
+    (void)PreemptPriority;
+    (void)SubPriority;
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+    irqEnabled[IRQn] = true;
+    irqService(IRQn);
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+    irqEnabled[IRQn] = false;
+}
+
+/*
+ * RCC and time base. HCLK is 100 MHz, APB1 half of it
+ */
+
+void HAL_RCC_GetClockConfig(RCC_ClkInitTypeDef *clkInit, uint32_t *flashLatency)
+{
+    memset(clkInit, 0, sizeof(*clkInit));
+    clkInit->AHBCLKDivider = RCC_HCLK_DIV1;
+    clkInit->APB1CLKDivider = RCC_HCLK_DIV2;
+    clkInit->APB2CLKDivider = RCC_HCLK_DIV1;
+    *flashLatency = 3;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void)
+{
+    return FAKE_HAL_PCLK1_HZ;
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void)
+{
+    return FAKE_HAL_PCLK2_HZ;
+}
+
+uint32_t HAL_GetTick(void)
+{
+    return (uint32_t)(nowNs / NS_PER_MS);
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+    // Waits at least the time asked, as the real one does
+    if (Delay < HAL_MAX_DELAY) {
+        Delay++;
+    }
+    busyFor(Delay * NS_PER_MS);
+}
+
+/*
+ * GPIO
+ */
+
+static uint32_t gpioModeBits(GPIO_TypeDef *port, uint32_t pinNumber)
+{
+    return (port->MODER >> (2 * pinNumber)) & 3U;
+}
+
+static void spiUpdateSelect(FakeSpi_t *spi);
+
+static void gpioUpdate(GPIO_TypeDef *port)
+{
+    uint32_t idr = 0;
+
+    for (uint32_t pin = 0; pin < 16; pin++) {
+        uint32_t mode = gpioModeBits(port, pin);
+        uint32_t pull = (port->PUPDR >> (2 * pin)) & 3U;
+        bool high;
+
+        if (mode == GPIO_MODE_OUTPUT_PP) {
+            high = (port->ODR >> pin) & 1U;
+        } else {
+            high = (pull == GPIO_PULLUP);
+        }
+        if (high) {
+            idr |= 1U << pin;
+        }
+    }
+    port->IDR = idr & ~gpioHeldLow[gpioIndex(port)];
+
+    for (unsigned i = 0; i < ARRAY_LENGTH(spis); i++) {
+        if (spis[i].csPort == port) {
+            spiUpdateSelect(&spis[i]);
+        }
+    }
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init)
+{
+    for (uint32_t pin = 0; pin < 16; pin++) {
+        if ((GPIO_Init->Pin & (1U << pin)) == 0) {
+            continue;
+        }
+
+        MODIFY_REG(GPIOx->MODER, 3U << (2 * pin), (GPIO_Init->Mode & 3U) << (2 * pin));
+        MODIFY_REG(GPIOx->OTYPER, 1U << pin, ((GPIO_Init->Mode >> 4) & 1U) << pin);
+        MODIFY_REG(GPIOx->PUPDR, 3U << (2 * pin), (GPIO_Init->Pull & 3U) << (2 * pin));
+        if ((GPIO_Init->Mode & 3U) == GPIO_MODE_AF_PP) {
+            MODIFY_REG(GPIOx->AFR[pin / 8], 0xFU << (4 * (pin % 8)),
+                       (GPIO_Init->Alternate & 0xFU) << (4 * (pin % 8)));
+        }
+    }
+
+    gpioUpdate(GPIOx);
+}
+
+void HAL_GPIO_DeInit(GPIO_TypeDef *GPIOx, uint32_t GPIO_Pin)
+{
+    for (uint32_t pin = 0; pin < 16; pin++) {
+        if (GPIO_Pin & (1U << pin)) {
+            CLEAR_BIT(GPIOx->MODER, 3U << (2 * pin));
+            CLEAR_BIT(GPIOx->OTYPER, 1U << pin);
+            CLEAR_BIT(GPIOx->PUPDR, 3U << (2 * pin));
+            CLEAR_BIT(GPIOx->AFR[pin / 8], 0xFU << (4 * (pin % 8)));
+        }
+    }
+
+    gpioUpdate(GPIOx);
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    busyFor(FAKE_HAL_POLL_NS);
+    return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+    GPIOx->BSRR = (PinState == GPIO_PIN_SET) ? GPIO_Pin : (uint32_t)GPIO_Pin << 16;
+    GPIOx->ODR = (GPIOx->ODR | (GPIOx->BSRR & 0xFFFFU)) & ~(GPIOx->BSRR >> 16);
+    gpioUpdate(GPIOx);
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    GPIOx->ODR ^= GPIO_Pin;
+    gpioUpdate(GPIOx);
+}
+
+/**
+ * @brief Model something else on the line pulling it low, such as an I2C
+ * slave stuck holding SDA
+ */
+void fakeGpioHoldLow(GPIO_TypeDef *port, uint16_t pin, bool held)
+{
+    if (held) {
+        gpioHeldLow[gpioIndex(port)] |= pin;
+    } else {
+        gpioHeldLow[gpioIndex(port)] &= ~pin;
+    }
+    gpioUpdate(port);
+}
+
+/**
+ * @return The pin's GPIO_MODE_, with the open drain bit
+ */
+uint32_t fakeGpioMode(GPIO_TypeDef *port, uint16_t pin)
+{
+    uint32_t pinNumber = __builtin_ctz(pin);
+
+    return gpioModeBits(port, pinNumber) | (((port->OTYPER >> pinNumber) & 1U) << 4);
+}
+
+/*
+ * DMA
+ */
+
+HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef *hdma)
+{
+    hdma->Instance->CR = hdma->Init.Channel | hdma->Init.Direction
+                         | hdma->Init.PeriphInc | hdma->Init.MemInc
+                         | hdma->Init.Mode | hdma->Init.Priority
+                         | hdma->Init.MemBurst | hdma->Init.PeriphBurst;
+    hdma->Instance->FCR = hdma->Init.FIFOMode | hdma->Init.FIFOThreshold;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_DeInit(DMA_HandleTypeDef *hdma)
+{
+    memset(hdma->Instance, 0, sizeof(*hdma->Instance));
+
+    return HAL_OK;
+}
+
+static void dmaEvent(void *arg)
+{
+    FakeDma_t *dma = arg;
+
+    dma->event = -1;
+    CLEAR_BIT(dma->regs->CR, DMA_SxCR_EN);
+    dma->regs->NDTR = 0;
+    dma->complete = true;
+    fakeIrqRaise(dma->irq);
+}
+
+static void dmaStart(DMA_HandleTypeDef *hdma, uint16_t size, uint64_t durationNs,
+                     void (*done)(void *ctx, bool error), void *ctx)
+{
+    FakeDma_t *dma = dmaFor(hdma->Instance);
+
+    dma->transfers++;
+    dma->done = done;
+    dma->ctx = ctx;
+    dma->error = (dma->nextFault == FAKE_DMA_ERROR);
+    dma->regs->NDTR = size;
+    SET_BIT(dma->regs->CR, DMA_SxCR_EN);
+
+    if (dma->nextFault != FAKE_DMA_STALL) {
+        dma->event = fakeHalSchedule(nowNs + durationNs, dmaEvent, dma);
+    }
+    dma->nextFault = FAKE_DMA_OK;
+}
+
+static void dmaStop(DMA_HandleTypeDef *hdma)
+{
+    FakeDma_t *dma = dmaFor(hdma->Instance);
+
+    fakeHalCancel(dma->event);
+    dma->event = -1;
+    dma->complete = false;
+    CLEAR_BIT(dma->regs->CR, DMA_SxCR_EN);
+}
+
+void fakeDmaFailNext(DMA_Stream_TypeDef *stream, FakeDmaFault fault)
+{
+    dmaFor(stream)->nextFault = fault;
+}
+
+uint32_t fakeDmaTransfers(DMA_Stream_TypeDef *stream)
+{
+    return dmaFor(stream)->transfers;
+}
+
+/*
+ * Timers
+ */
+
+static uint32_t timKernelHz(const FakeTim_t *tim)
+{
+    // Timers on a divided APB bus run at twice its clock
+    return tim->apb2 ? FAKE_HAL_PCLK2_HZ : 2 * FAKE_HAL_PCLK1_HZ;
+}
+
+static volatile uint32_t *timCcr(TIM_TypeDef *regs, uint32_t index)
+{
+    return &regs->CCR1 + index;
+}
+
+static uint32_t timCcmrChannelBits(TIM_TypeDef *regs, uint32_t index)
+{
+    uint32_t ccmr = (index < 2) ? regs->CCMR1 : regs->CCMR2;
+
+    return (ccmr >> (8 * (index % 2))) & 0xFFU;
+}
+
+static void timSetCcmrChannelBits(TIM_TypeDef *regs, uint32_t index, uint32_t bits)
+{
+    volatile uint32_t *ccmr = (index < 2) ? &regs->CCMR1 : &regs->CCMR2;
+
+    MODIFY_REG(*ccmr, 0xFFU << (8 * (index % 2)), (bits & 0xFFU) << (8 * (index % 2)));
+}
+
+static bool timIsCapture(TIM_TypeDef *regs, uint32_t index)
+{
+    return (timCcmrChannelBits(regs, index) & TIM_CCMR1_CC1S) != 0;
+}
+
+static bool timIsPreloaded(TIM_TypeDef *regs, uint32_t index)
+{
+    return (timCcmrChannelBits(regs, index) & TIM_CCMR1_OC1PE) != 0;
+}
+
+static void timUpdateEvent(FakeTim_t *tim)
+{
+    tim->stats.updates++;
+    for (uint32_t i = 0; i < TIM_CHANNELS; i++) {
+        tim->active[i] = *timCcr(tim->regs, i);
+    }
+}
+
+static void timAdvance(FakeTim_t *tim, uint64_t ns)
+{
+    TIM_TypeDef *regs = tim->regs;
+    uint64_t hz = timKernelHz(tim);
+
+    if ((regs->CR1 & TIM_CR1_CEN) == 0) {
+        return;
+    }
+
+    while (ns > 0) {
+        // A second at a time, so ns * hz can't overflow
+        uint64_t step = (ns > NS_PER_S) ? NS_PER_S : ns;
+        uint64_t scaled = step * hz + tim->cycleRemainder;
+        uint64_t cycles = scaled / NS_PER_S;
+        uint64_t prescaled = tim->prescalerCount + cycles;
+        uint64_t period = (uint64_t)regs->ARR + 1;
+        uint64_t count;
+
+        tim->cycleRemainder = scaled % NS_PER_S;
+        tim->prescalerCount = prescaled % ((uint64_t)regs->PSC + 1);
+        count = regs->CNT + prescaled / ((uint64_t)regs->PSC + 1);
+        regs->CNT = (uint32_t)(count % period);
+
+        // The outputs only see the last update's values, so one load will do
+        if (count >= period && (regs->CR1 & TIM_CR1_UDIS) == 0) {
+            SET_BIT(regs->SR, TIM_SR_UIF);
+            tim->stats.updates += (uint32_t)(count / period) - 1;
+            timUpdateEvent(tim);
+        }
+
+        ns -= step;
+    }
+}
+
+static void timRecordHandle(TIM_HandleTypeDef *htim)
+{
+    FakeTim_t *tim = timFor(htim->Instance);
+    TIM_TypeDef *regs = htim->Instance;
+
+    tim->handle = htim;
+
+    regs->PSC = htim->Init.Prescaler;
+    regs->ARR = htim->Init.Period;
+    regs->RCR = htim->Init.RepetitionCounter;
+    MODIFY_REG(regs->CR1, 0x370U, htim->Init.CounterMode | htim->Init.ClockDivision);
+
+    // Generate an update event, to load the prescaler
+    regs->CNT = 0;
+    tim->prescalerCount = 0;
+    timUpdateEvent(tim);
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef *htim)
+{
+    if (htim->State == HAL_TIM_STATE_RESET) {
+        HAL_TIM_Base_MspInit(htim);
+    }
+    timRecordHandle(htim);
+    htim->State = HAL_TIM_STATE_READY;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_IC_Init(TIM_HandleTypeDef *htim)
+{
+    if (htim->State == HAL_TIM_STATE_RESET) {
+        HAL_TIM_IC_MspInit(htim);
+    }
+    timRecordHandle(htim);
+    htim->State = HAL_TIM_STATE_READY;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_OC_Init(TIM_HandleTypeDef *htim)
+{
+    if (htim->State == HAL_TIM_STATE_RESET) {
+        HAL_TIM_OC_MspInit(htim);
+    }
+    timRecordHandle(htim);
+    htim->State = HAL_TIM_STATE_READY;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_ConfigClockSource(TIM_HandleTypeDef *htim,
+                                            TIM_ClockConfigTypeDef *sClockSourceConfig)
+{
+    // Only the internal clock is modelled, with the slave mode off
+    if (sClockSourceConfig->ClockSource != TIM_CLOCKSOURCE_INTERNAL) {
+        return HAL_ERROR;
+    }
+    htim->Instance->SMCR = 0;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization(TIM_HandleTypeDef *htim,
+                                                        TIM_MasterConfigTypeDef *sMasterConfig)
+{
+    MODIFY_REG(htim->Instance->CR2, 0x70U, sMasterConfig->MasterOutputTrigger);
+    MODIFY_REG(htim->Instance->SMCR, 0x80U, sMasterConfig->MasterSlaveMode);
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIMEx_ConfigBreakDeadTime(TIM_HandleTypeDef *htim,
+                                                TIM_BreakDeadTimeConfigTypeDef *sBreakDeadTimeConfig)
+{
+    // MOE is left clear, PWM_Start sets it
+    htim->Instance->BDTR = sBreakDeadTimeConfig->DeadTime
+                           | sBreakDeadTimeConfig->LockLevel
+                           | sBreakDeadTimeConfig->OffStateIDLEMode
+                           | sBreakDeadTimeConfig->OffStateRunMode
+                           | sBreakDeadTimeConfig->BreakState
+                           | sBreakDeadTimeConfig->BreakPolarity
+                           | sBreakDeadTimeConfig->AutomaticOutput;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_IC_ConfigChannel(TIM_HandleTypeDef *htim,
+                                           TIM_IC_InitTypeDef *sConfig, uint32_t Channel)
+{
+    uint32_t index = Channel >> 2;
+    TIM_TypeDef *regs = htim->Instance;
+
+    CLEAR_BIT(regs->CCER, TIM_CCER_CC1E << (4 * index));
+    timSetCcmrChannelBits(regs, index, sConfig->ICSelection
+                                       | ((sConfig->ICPrescaler & 3U) << 2)
+                                       | ((sConfig->ICFilter & 0xFU) << 4));
+    MODIFY_REG(regs->CCER, 0xAU << (4 * index), sConfig->ICPolarity << (4 * index));
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_OC_ConfigChannel(TIM_HandleTypeDef *htim,
+                                           TIM_OC_InitTypeDef *sConfig, uint32_t Channel)
+{
+    uint32_t index = Channel >> 2;
+    TIM_TypeDef *regs = htim->Instance;
+
+    CLEAR_BIT(regs->CCER, TIM_CCER_CC1E << (4 * index));
+    timSetCcmrChannelBits(regs, index, sConfig->OCMode | sConfig->OCFastMode);
+    MODIFY_REG(regs->CCER, 0x2U << (4 * index), sConfig->OCPolarity << (4 * index));
+
+    // Preload is off, so the output uses the value straight away
+    *timCcr(regs, index) = sConfig->Pulse;
+    timFor(regs)->active[index] = sConfig->Pulse;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_IC_Start_IT(TIM_HandleTypeDef *htim, uint32_t Channel)
+{
+    uint32_t index = Channel >> 2;
+
+    SET_BIT(htim->Instance->DIER, TIM_DIER_CC1IE << index);
+    SET_BIT(htim->Instance->CCER, TIM_CCER_CC1E << (4 * index));
+    SET_BIT(htim->Instance->CR1, TIM_CR1_CEN);
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef *htim, uint32_t Channel)
+{
+    SET_BIT(htim->Instance->CCER, TIM_CCER_CC1E << (4 * (Channel >> 2)));
+    if (htim->Instance == TIM1) {
+        SET_BIT(htim->Instance->BDTR, TIM_BDTR_MOE);
+    }
+    SET_BIT(htim->Instance->CR1, TIM_CR1_CEN);
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Stop(TIM_HandleTypeDef *htim, uint32_t Channel)
+{
+    CLEAR_BIT(htim->Instance->CCER, TIM_CCER_CC1E << (4 * (Channel >> 2)));
+
+    // The counter and main output only stop once every channel has
+    if ((htim->Instance->CCER & 0x1111U) == 0) {
+        if (htim->Instance == TIM1) {
+            CLEAR_BIT(htim->Instance->BDTR, TIM_BDTR_MOE);
+        }
+        CLEAR_BIT(htim->Instance->CR1, TIM_CR1_CEN);
+    }
+
+    return HAL_OK;
+}
+
+void HAL_TIM_IRQHandler(TIM_HandleTypeDef *htim)
+{
+    TIM_TypeDef *regs = htim->Instance;
+
+    for (uint32_t index = 0; index < TIM_CHANNELS; index++) {
+        uint32_t flag = TIM_SR_CC1IF << index;
+
+        if ((regs->SR & flag) && (regs->DIER & (TIM_DIER_CC1IE << index))) {
+            CLEAR_BIT(regs->SR, flag);
+            htim->Channel = (HAL_TIM_ActiveChannel)(1U << index);
+            if (timIsCapture(regs, index)) {
+                HAL_TIM_IC_CaptureCallback(htim);
+            }
+            htim->Channel = HAL_TIM_ACTIVE_CHANNEL_CLEARED;
+        }
+    }
+
+    if ((regs->SR & TIM_SR_UIF) && (regs->DIER & TIM_DIER_UIE)) {
+        CLEAR_BIT(regs->SR, TIM_SR_UIF);
+        HAL_TIM_PeriodElapsedCallback(htim);
+    }
+}
+
+/**
+ * @brief An edge on a capture channel's pin, now
+ *
+ * Captures CNT, and raises the interrupt if enabled. A capture while the
+ * last one's flag is still set overwrites it and sets the overcapture flag
+ */
+void fakeTimInputEdge(TIM_TypeDef *tim, uint32_t channel)
+{
+    FakeTim_t *fake = timFor(tim);
+    uint32_t index = channel >> 2;
+
+    if ((tim->CR1 & TIM_CR1_CEN) == 0
+        || (tim->CCER & (TIM_CCER_CC1E << (4 * index))) == 0
+        || !timIsCapture(tim, index))
+    {
+        return;
+    }
+
+    if (tim->SR & (TIM_SR_CC1IF << index)) {
+        SET_BIT(tim->SR, TIM_SR_CC1OF << index);
+        fake->stats.overcaptures++;
+    }
+
+    *timCcr(tim, index) = tim->CNT;
+    SET_BIT(tim->SR, TIM_SR_CC1IF << index);
+    fake->stats.captures++;
+
+    if (tim->DIER & (TIM_DIER_CC1IE << index)) {
+        fakeIrqRaise(fake->irq);
+    }
+}
+
+/**
+ * @return The compare value the output is using. With preload on, a value
+ * written to CCRx is only used from the next update event
+ */
+uint32_t fakeTimActiveCompare(TIM_TypeDef *tim, uint32_t channel)
+{
+    uint32_t index = channel >> 2;
+
+    if (timIsPreloaded(tim, index)) {
+        return timFor(tim)->active[index];
+    }
+    return *timCcr(tim, index);
+}
+
+bool fakeTimOutputEnabled(TIM_TypeDef *tim, uint32_t channel)
+{
+    return (tim->CR1 & TIM_CR1_CEN)
+           && (tim->CCER & (TIM_CCER_CC1E << (4 * (channel >> 2))))
+           && (tim != TIM1 || (tim->BDTR & TIM_BDTR_MOE));
+}
+
+const FakeTimStats_t *fakeTimStats(TIM_TypeDef *tim)
+{
+    return &timFor(tim)->stats;
+}
+
+/*
+ * I2C, 9 clocks a byte with the ack
+ */
+
+static uint64_t i2cBytesNs(const I2C_HandleTypeDef *hi2c, uint32_t bytes)
+{
+    return bytes * 9ULL * NS_PER_S / hi2c->Init.ClockSpeed;
+}
+
+static FakeI2cSlot_t *i2cSlot(FakeI2c_t *bus, uint16_t devAddress)
+{
+    for (int i = 0; i < bus->slotCount; i++) {
+        if (bus->slots[i].address == (devAddress >> 1)) {
+            return &bus->slots[i];
+        }
+    }
+    return NULL;
+}
+
+void fakeI2cAttach(I2C_TypeDef *i2c, uint8_t address, const FakeI2cDevice_t *device,
+                   void *ctx)
+{
+    FakeI2c_t *bus = i2cFor(i2c);
+
+    ASSERT(bus->slotCount < I2C_MAX_DEVICES);
+    bus->slots[bus->slotCount].address = address;
+    bus->slots[bus->slotCount].device = device;
+    bus->slots[bus->slotCount].ctx = ctx;
+    bus->slotCount++;
+}
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c)
+{
+    if (hi2c->State == HAL_I2C_STATE_RESET) {
+        HAL_I2C_MspInit(hi2c);
+    }
+
+    CLEAR_BIT(hi2c->Instance->CR1, I2C_CR1_PE);
+    hi2c->Instance->CR2 = HAL_RCC_GetPCLK1Freq() / 1000000U;
+    hi2c->Instance->CCR = HAL_RCC_GetPCLK1Freq() / (hi2c->Init.ClockSpeed * 25U);
+    hi2c->Instance->OAR1 = hi2c->Init.AddressingMode | hi2c->Init.OwnAddress1;
+    SET_BIT(hi2c->Instance->CR1, I2C_CR1_PE);
+
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+    hi2c->State = HAL_I2C_STATE_READY;
+
+    return HAL_OK;
+}
+
+/*
+ * The start of a memory access, polled as in the real HAL: the device
+ * address, the register address and for reads the address again. A missing
+ * device doesn't acknowledge its address
+ */
+static HAL_StatusTypeDef i2cRequestMemory(I2C_HandleTypeDef *hi2c, uint16_t devAddress,
+                                          uint16_t memAddSize, bool read,
+                                          FakeI2cSlot_t **slot)
+{
+    FakeI2c_t *bus = i2cFor(hi2c->Instance);
+
+    if (hi2c->State != HAL_I2C_STATE_READY) {
+        return HAL_BUSY;
+    }
+
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+    *slot = i2cSlot(bus, devAddress);
+    if (*slot == NULL) {
+        busyFor(i2cBytesNs(hi2c, 1));
+        hi2c->ErrorCode = HAL_I2C_ERROR_AF;
+        return HAL_ERROR;
+    }
+
+    busyFor(i2cBytesNs(hi2c, 1 + memAddSize + (read ? 1 : 0)));
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress,
+                                   uint16_t MemAddress, uint16_t MemAddSize,
+                                   uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+    FakeI2cSlot_t *slot;
+    HAL_StatusTypeDef rc;
+
+    (void)Timeout;
+
+    rc = i2cRequestMemory(hi2c, DevAddress, MemAddSize, true, &slot);
+    if (rc != HAL_OK) {
+        return rc;
+    }
+
+    busyFor(i2cBytesNs(hi2c, Size));
+    slot->device->read(slot->ctx, MemAddress, pData, Size);
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t DevAddress,
+                                    uint16_t MemAddress, uint16_t MemAddSize,
+                                    uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+    FakeI2cSlot_t *slot;
+    HAL_StatusTypeDef rc;
+
+    (void)Timeout;
+
+    rc = i2cRequestMemory(hi2c, DevAddress, MemAddSize, false, &slot);
+    if (rc != HAL_OK) {
+        return rc;
+    }
+
+    busyFor(i2cBytesNs(hi2c, Size));
+    slot->device->write(slot->ctx, MemAddress, pData, Size);
+
+    return HAL_OK;
+}
+
+static void i2cDmaDone(void *ctx, bool error)
+{
+    FakeI2c_t *bus = ctx;
+    I2C_HandleTypeDef *hi2c = bus->handle;
+
+    bus->handle = NULL;
+    hi2c->State = HAL_I2C_STATE_READY;
+
+    if (error) {
+        hi2c->ErrorCode |= HAL_I2C_ERROR_DMA;
+        HAL_I2C_ErrorCallback(hi2c);
+    } else if (bus->read) {
+        bus->slot->device->read(bus->slot->ctx, bus->memAddress, bus->data, bus->size);
+        HAL_I2C_MemRxCpltCallback(hi2c);
+    } else {
+        bus->slot->device->write(bus->slot->ctx, bus->memAddress, bus->data, bus->size);
+        HAL_I2C_MemTxCpltCallback(hi2c);
+    }
+}
+
+static HAL_StatusTypeDef i2cMemDma(I2C_HandleTypeDef *hi2c, uint16_t devAddress,
+                                   uint16_t memAddress, uint16_t memAddSize,
+                                   uint8_t *data, uint16_t size, bool read)
+{
+    FakeI2c_t *bus = i2cFor(hi2c->Instance);
+    FakeI2cSlot_t *slot;
+    HAL_StatusTypeDef rc;
+
+    rc = i2cRequestMemory(hi2c, devAddress, memAddSize, read, &slot);
+    if (rc != HAL_OK) {
+        return rc;
+    }
+
+    bus->handle = hi2c;
+    bus->slot = slot;
+    bus->memAddress = memAddress;
+    bus->data = data;
+    bus->size = size;
+    bus->read = read;
+    hi2c->State = read ? HAL_I2C_STATE_BUSY_RX : HAL_I2C_STATE_BUSY_TX;
+
+    dmaStart(read ? hi2c->hdmarx : hi2c->hdmatx, size, i2cBytesNs(hi2c, size),
+             i2cDmaDone, bus);
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress,
+                                       uint16_t MemAddress, uint16_t MemAddSize,
+                                       uint8_t *pData, uint16_t Size)
+{
+    return i2cMemDma(hi2c, DevAddress, MemAddress, MemAddSize, pData, Size, true);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress,
+                                        uint16_t MemAddress, uint16_t MemAddSize,
+                                        uint8_t *pData, uint16_t Size)
+{
+    return i2cMemDma(hi2c, DevAddress, MemAddress, MemAddSize, pData, Size, false);
+}
+
+/*
+ * SPI, mode 0 master. The clock is PCLK2 divided by 2 << BR
+ */
+
+uint32_t fakeSpiClockHz(SPI_TypeDef *spi)
+{
+    return HAL_RCC_GetPCLK2Freq() / (2U << ((spi->CR1 & SPI_CR1_BR) >> SPI_CR1_BR_Pos));
+}
+
+const FakeSpiStats_t *fakeSpiStats(SPI_TypeDef *spi)
+{
+    return &spiFor(spi)->stats;
+}
+
+static uint64_t spiBytesNs(SPI_TypeDef *spi, uint32_t bytes)
+{
+    return bytes * 8ULL * NS_PER_S / fakeSpiClockHz(spi);
+}
+
+static void spiUpdateSelect(FakeSpi_t *spi)
+{
+    GPIO_TypeDef *port = spi->csPort;
+    uint32_t pinNumber = __builtin_ctz(spi->csPin);
+    bool selected = gpioModeBits(port, pinNumber) == GPIO_MODE_OUTPUT_PP
+                    && (port->ODR & spi->csPin) == 0;
+
+    if (spi->device != NULL && selected != spi->selected) {
+        spi->selected = selected;
+        if (spi->device->select != NULL) {
+            spi->device->select(spi->ctx, selected);
+        }
+    }
+}
+
+/**
+ * @brief Connect a device, selected while the pin is an output driven low
+ */
+void fakeSpiAttach(SPI_TypeDef *spi, GPIO_TypeDef *csPort, uint16_t csPin,
+                   const FakeSpiDevice_t *device, void *ctx)
+{
+    FakeSpi_t *fake = spiFor(spi);
+
+    fake->csPort = csPort;
+    fake->csPin = csPin;
+    fake->device = device;
+    fake->ctx = ctx;
+    fake->selected = false;
+    spiUpdateSelect(fake);
+}
+
+// MISO is pulled up, so reads 0xFF with no device selected
+static uint8_t spiExchange(FakeSpi_t *spi, uint8_t mosi)
+{
+    spi->stats.bytes++;
+    if (spi->device == NULL || !spi->selected) {
+        return 0xFF;
+    }
+    return spi->device->exchange(spi->ctx, mosi);
+}
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi)
+{
+    if (hspi->State == HAL_SPI_STATE_RESET) {
+        HAL_SPI_MspInit(hspi);
+    }
+
+    hspi->Instance->CR1 = hspi->Init.Mode | hspi->Init.Direction | hspi->Init.DataSize
+                          | hspi->Init.CLKPolarity | hspi->Init.CLKPhase
+                          | (hspi->Init.NSS & SPI_CR1_SSM) | hspi->Init.BaudRatePrescaler
+                          | hspi->Init.FirstBit;
+
+    hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+    hspi->State = HAL_SPI_STATE_READY;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData,
+                                          uint8_t *pRxData, uint16_t Size,
+                                          uint32_t Timeout)
+{
+    FakeSpi_t *spi = spiFor(hspi->Instance);
+    uint64_t byteNs;
+
+    (void)Timeout;
+
+    if (hspi->State != HAL_SPI_STATE_READY) {
+        return HAL_BUSY;
+    }
+    if (pTxData == NULL || pRxData == NULL || Size == 0) {
+        return HAL_ERROR;
+    }
+
+    SET_BIT(hspi->Instance->CR1, SPI_CR1_SPE);
+    byteNs = spiBytesNs(hspi->Instance, 1);
+
+    for (uint16_t i = 0; i < Size; i++) {
+        pRxData[i] = spiExchange(spi, pTxData[i]);
+        busyFor(byteNs);
+    }
+
+    return HAL_OK;
+}
+
+static void spiDmaDone(void *ctx, bool error)
+{
+    FakeSpi_t *spi = ctx;
+    SPI_HandleTypeDef *hspi = spi->handle;
+
+    spi->handle = NULL;
+    hspi->State = HAL_SPI_STATE_READY;
+
+    if (error) {
+        hspi->ErrorCode |= HAL_SPI_ERROR_DMA;
+        HAL_SPI_ErrorCallback(hspi);
+        return;
+    }
+
+    for (uint16_t i = 0; i < spi->size; i++) {
+        spi->rx[i] = spiExchange(spi, spi->tx[i]);
+    }
+    HAL_SPI_TxRxCpltCallback(hspi);
+}
+
+/**
+ * @brief Starts the transfer, the bytes are exchanged with the device when it
+ * completes
+ */
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData,
+                                              uint8_t *pRxData, uint16_t Size)
+{
+    FakeSpi_t *spi = spiFor(hspi->Instance);
+
+    if (hspi->State != HAL_SPI_STATE_READY) {
+        return HAL_BUSY;
+    }
+    if (pTxData == NULL || pRxData == NULL || Size == 0) {
+        return HAL_ERROR;
+    }
+
+    SET_BIT(hspi->Instance->CR1, SPI_CR1_SPE);
+    hspi->State = HAL_SPI_STATE_BUSY_TX_RX;
+    hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+
+    spi->handle = hspi;
+    spi->tx = pTxData;
+    spi->rx = pRxData;
+    spi->size = Size;
+    spi->stats.dmaTransfers++;
+
+    // Completion is signalled by the rx stream, the last to finish
+    dmaStart(hspi->hdmarx, Size, spiBytesNs(hspi->Instance, Size), spiDmaDone, spi);
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi)
+{
+    FakeSpi_t *spi = spiFor(hspi->Instance);
+
+    if (spi->handle == hspi) {
+        dmaStop(hspi->hdmarx);
+        spi->handle = NULL;
+    }
+    spi->stats.aborts++;
+
+    hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+    hspi->State = HAL_SPI_STATE_READY;
+
+    return HAL_OK;
+}
+
+/*
+ * Errors
+ */
+
+void Error_Handler()
+{
+    errorHandlerCalls++;
+}
+
+void assertFailed(char *file, int line)
+{
+    (void)file;
+    (void)line;
+    assertFailures++;
+}
+
+uint32_t fakeHalErrorHandlerCalls(void)
+{
+    return errorHandlerCalls;
+}
+
+uint32_t fakeHalAssertFailures(void)
+{
+    return assertFailures;
+}
+
+/*
+ * Callbacks and MSP hooks the drivers don't define, weak as in the HAL
+ */
+
+__attribute__((weak)) void HAL_TIM_Base_MspInit(TIM_HandleTypeDef *htim)
+{
+    (void)htim;
+}
+
+__attribute__((weak)) void HAL_TIM_Base_MspDeInit(TIM_HandleTypeDef *htim)
+{
+    (void)htim;
+}
+
+__attribute__((weak)) void HAL_TIM_IC_MspInit(TIM_HandleTypeDef *htim)
+{
+    (void)htim;
+}
+
+__attribute__((weak)) void HAL_TIM_OC_MspInit(TIM_HandleTypeDef *htim)
+{
+    (void)htim;
+}
+
+__attribute__((weak)) void HAL_TIM_OC_MspDeInit(TIM_HandleTypeDef *htim)
+{
+    (void)htim;
+}
+
+__attribute__((weak)) void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef *htim)
+{
+    (void)htim;
+}
+
+__attribute__((weak)) void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
+{
+    (void)htim;
+}
+
+__attribute__((weak)) void HAL_I2C_MspInit(I2C_HandleTypeDef *hi2c)
+{
+    (void)hi2c;
+}
+
+__attribute__((weak)) void HAL_I2C_MspDeInit(I2C_HandleTypeDef *hi2c)
+{
+    (void)hi2c;
+}
+
+__attribute__((weak)) void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    (void)hi2c;
+}
+
+__attribute__((weak)) void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    (void)hi2c;
+}
+
+__attribute__((weak)) void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+    (void)hi2c;
+}
+
+__attribute__((weak)) void HAL_I2C_AbortCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    (void)hi2c;
+}
+
+__attribute__((weak)) void HAL_SPI_MspInit(SPI_HandleTypeDef *hspi)
+{
+    (void)hspi;
+}
+
+__attribute__((weak)) void HAL_SPI_MspDeInit(SPI_HandleTypeDef *hspi)
+{
+    (void)hspi;
+}
+
+__attribute__((weak)) void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    (void)hspi;
+}
+
+__attribute__((weak)) void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+    (void)hspi;
+}
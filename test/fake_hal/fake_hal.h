@@ -0,0 +1,132 @@
+#ifndef __FAKE_HAL_H
+#define __FAKE_HAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32f4xx.h"
+#include "FreeRTOS.h"
+
+/**
+ * @file test/fake_hal/fake_hal.h
+ *
+ * @brief What the driver tests control in the fake HAL (fake_hal.c) and
+ * fake FreeRTOS (fake_freertos.c)
+ *
+ * Nothing happens by itself. Time only moves when a test runs it, or when a
+ * driver waits: a polled transfer takes the time its bytes take on the bus,
+ * and a semaphore take runs time until the semaphore is given or the wait
+ * times out. Events that come due meanwhile (DMA completing, the timers'
+ * update events) run in time order, and interrupts call the driver's
+ * callbacks as the real HAL's handlers would.
+ */
+
+// Timer kernel clocks follow from these, see HAL_RCC_GetClockConfig
+#define FAKE_HAL_PCLK1_HZ       50000000U
+#define FAKE_HAL_PCLK2_HZ       100000000U
+
+// A polled register read, so wait loops on a pin or the tick end
+#define FAKE_HAL_POLL_NS        1000U
+
+// Events pending at once, DMA completions and test callbacks
+#define FAKE_HAL_MAX_EVENTS     16
+
+typedef void (*FakeHalEventFn)(void *arg);
+
+/*
+ * Time and events
+ */
+void fakeHalReset(void);
+uint64_t fakeHalNowNs(void);
+uint32_t fakeHalNowUs(void);
+void fakeHalRunUntilNs(uint64_t ns);
+void fakeHalRunForUs(uint32_t us);
+bool fakeHalRunNextEvent(uint64_t deadlineNs);
+
+int fakeHalSchedule(uint64_t atNs, FakeHalEventFn fn, void *arg);
+void fakeHalCancel(int event);
+
+/*
+ * Interrupts, called in the test's context as soon as they are raised,
+ * unless masked in the NVIC, then once enabled again
+ */
+void fakeIrqRaise(IRQn_Type irq);
+bool fakeIrqEnabled(IRQn_Type irq);
+bool fakeIrqPending(IRQn_Type irq);
+
+/*
+ * Timers
+ */
+typedef struct FakeTimStats_t {
+    uint32_t updates;       // Update events, with UDIS clear
+    uint32_t overcaptures;  // Captures with the last one not read
+    uint32_t captures;
+} FakeTimStats_t;
+
+void fakeTimInputEdge(TIM_TypeDef *tim, uint32_t channel);
+uint32_t fakeTimActiveCompare(TIM_TypeDef *tim, uint32_t channel);
+bool fakeTimOutputEnabled(TIM_TypeDef *tim, uint32_t channel);
+const FakeTimStats_t *fakeTimStats(TIM_TypeDef *tim);
+
+/*
+ * GPIO
+ */
+void fakeGpioHoldLow(GPIO_TypeDef *port, uint16_t pin, bool held);
+uint32_t fakeGpioMode(GPIO_TypeDef *port, uint16_t pin);
+
+/*
+ * DMA. A fault applies to the next transfer on the stream
+ */
+typedef enum {
+    FAKE_DMA_OK = 0,
+    FAKE_DMA_ERROR,         // Transfer error interrupt instead of complete
+    FAKE_DMA_STALL,         // Never completes
+} FakeDmaFault;
+
+void fakeDmaFailNext(DMA_Stream_TypeDef *stream, FakeDmaFault fault);
+uint32_t fakeDmaTransfers(DMA_Stream_TypeDef *stream);
+
+/*
+ * I2C devices, at their 7 bit address
+ */
+typedef struct FakeI2cDevice_t {
+    void (*read)(void *ctx, uint16_t memAddress, uint8_t *data, uint16_t size);
+    void (*write)(void *ctx, uint16_t memAddress, const uint8_t *data, uint16_t size);
+} FakeI2cDevice_t;
+
+void fakeI2cAttach(I2C_TypeDef *i2c, uint8_t address, const FakeI2cDevice_t *device,
+                   void *ctx);
+
+/*
+ * SPI devices, selected by their chip select pin going low
+ */
+typedef struct FakeSpiDevice_t {
+    uint8_t (*exchange)(void *ctx, uint8_t mosi);
+    void (*select)(void *ctx, bool selected);
+} FakeSpiDevice_t;
+
+typedef struct FakeSpiStats_t {
+    uint32_t bytes;
+    uint32_t dmaTransfers;
+    uint32_t aborts;
+} FakeSpiStats_t;
+
+void fakeSpiAttach(SPI_TypeDef *spi, GPIO_TypeDef *csPort, uint16_t csPin,
+                   const FakeSpiDevice_t *device, void *ctx);
+uint32_t fakeSpiClockHz(SPI_TypeDef *spi);
+const FakeSpiStats_t *fakeSpiStats(SPI_TypeDef *spi);
+
+/*
+ * Error_Handler and assertFailed return, the tests check they were called
+ */
+uint32_t fakeHalErrorHandlerCalls(void);
+uint32_t fakeHalAssertFailures(void);
+
+/*
+ * FreeRTOS
+ */
+void fakeRtosReset(void);
+void fakeRtosSetSchedulerState(BaseType_t state);
+uint32_t fakeRtosYieldsFromISR(void);
+
+#endif /* defined(__FAKE_HAL_H) */
@@ -0,0 +1,469 @@
+#include <string.h>
+
+#include "fake_sd_card.h"
+
+/**
+ * @file test/fake_hal/fake_sd_card.c
+ *
+ * @brief An SDHC card in spi mode, on the fake HAL's spi bus
+ *
+ * The card sees the bus a byte at a time, as the real one does, so it only
+ * works with a driver that gets the protocol right: commands, the Ncr and
+ * Nac gaps before responses and data tokens, a start token before every
+ * block of a multiple block read, the R2 byte after ACMD13, and the card
+ * holding DO low while busy after a write or erase. Bit positions in the
+ * registers are as numbered in the SD physical layer specification, the
+ * same as Src/sdCard.c.
+ */
+
+#define CSD_LENGTH          16
+#define CID_LENGTH          16
+#define STATUS_LENGTH       64
+
+#define TOKEN_START_BLOCK   0xFE
+#define TOKEN_START_MULTI   0xFC
+#define TOKEN_STOP_TRAN     0xFD
+
+#define R1_IDLE             0x01
+#define R1_ILLEGAL_COMMAND  0x04
+#define R1_PARAMETER        0x40
+
+#define DATA_ACCEPTED       0x05
+#define DATA_WRITE_ERROR    0x0D
+
+#define APP_CMD(cmd)        (0x80 | (cmd))
+
+// Queued response bytes, the longest is the SD status register
+#define QUEUE_LENGTH        (STATUS_LENGTH + FAKE_SD_CARD_SECTOR_SIZE)
+
+#define ERASE_BUSY_US       2000
+
+typedef enum {
+    WRITE_IDLE = 0,
+    WRITE_WAIT_TOKEN,       // For the start token of the next block
+    WRITE_DATA,             // Receiving the block and its crc
+} WriteState;
+
+static uint8_t sectors[FAKE_SD_CARD_SECTORS][FAKE_SD_CARD_SECTOR_SIZE];
+static uint8_t csd[CSD_LENGTH];
+static uint8_t cid[CID_LENGTH];
+static uint8_t sdStatus[STATUS_LENGTH];
+
+static bool idle;
+static bool appCmd;
+static uint32_t initPolls;
+static uint32_t initPollsLeft;
+
+// The command being received
+static uint8_t command[6];
+static uint32_t commandLength;
+
+// Bytes to send, before anything else
+static uint8_t queue[QUEUE_LENGTH];
+static uint32_t queueHead;
+static uint32_t queueLength;
+
+// A multiple block read, sending blocks until CMD12
+static bool streaming;
+static uint32_t streamSector;
+
+static WriteState writeState;
+static bool writeMultiple;
+static uint32_t writeSector;
+static uint32_t writeOffset;
+static uint8_t writeBlock[FAKE_SD_CARD_SECTOR_SIZE + 2];
+static bool rejectNextWrite;
+
+static uint32_t eraseStart;
+static uint32_t eraseEnd;
+
+static uint64_t busyUntilNs;
+static uint32_t writeBusyUs;
+
+static FakeSdCardStats_t stats;
+
+static void setBits(uint8_t *reg, int length, int msb, int lsb, uint32_t val)
+{
+    for (int bit = lsb; bit <= msb; bit++) {
+        int byte = length - 1 - bit / 8;
+        uint8_t mask = 1U << (bit % 8);
+
+        if (val & (1U << (bit - lsb))) {
+            reg[byte] |= mask;
+        } else {
+            reg[byte] &= ~mask;
+        }
+    }
+}
+
+/**
+ * @brief A blank card, powered up in SD mode
+ *
+ * 1 MB, 25 MHz, erasable by sector with an 8192 sector allocation unit
+ */
+void fakeSdCardReset(void)
+{
+    memset(sectors, 0, sizeof(sectors));
+
+    memset(csd, 0, sizeof(csd));
+    setBits(csd, CSD_LENGTH, 127, 126, 1);                           // CSD v2
+    setBits(csd, CSD_LENGTH, 103, 96, 0x32);                         // 25 MHz
+    setBits(csd, CSD_LENGTH, 83, 80, 9);                             // READ_BL_LEN
+    setBits(csd, CSD_LENGTH, 69, 48, FAKE_SD_CARD_SECTORS / 1024 - 1);
+    setBits(csd, CSD_LENGTH, 46, 46, 1);                             // ERASE_BLK_EN
+    setBits(csd, CSD_LENGTH, 45, 39, 0x7F);
+
+    memset(cid, 0, sizeof(cid));
+    cid[0] = 0x03;
+    memcpy(&cid[1], "SD", 2);
+    memcpy(&cid[3], "FAKE1", 5);
+    cid[8] = 0x10;
+
+    memset(sdStatus, 0, sizeof(sdStatus));
+    setBits(sdStatus, STATUS_LENGTH, 431, 428, 9);                   // 4 MB AU
+
+    idle = true;
+    appCmd = false;
+    initPolls = 2;
+    initPollsLeft = initPolls;
+    commandLength = 0;
+    queueHead = 0;
+    queueLength = 0;
+    streaming = false;
+    writeState = WRITE_IDLE;
+    rejectNextWrite = false;
+    eraseStart = 0;
+    eraseEnd = 0;
+    busyUntilNs = 0;
+    writeBusyUs = 250;
+    memset(&stats, 0, sizeof(stats));
+}
+
+uint8_t *fakeSdCardSector(uint32_t sector)
+{
+    return sectors[sector];
+}
+
+/**
+ * @brief ACMD41s the card stays idle for, initializing
+ */
+void fakeSdCardSetInitPolls(uint32_t polls)
+{
+    initPolls = polls;
+    initPollsLeft = polls;
+}
+
+void fakeSdCardSetWriteBusyUs(uint32_t us)
+{
+    writeBusyUs = us;
+}
+
+/**
+ * @brief Answer the next data block with a write error
+ */
+void fakeSdCardRejectNextWrite(void)
+{
+    rejectNextWrite = true;
+}
+
+const FakeSdCardStats_t *fakeSdCardStats(void)
+{
+    return &stats;
+}
+
+static void queueByte(uint8_t byte)
+{
+    if (queueHead + queueLength < QUEUE_LENGTH) {
+        queue[queueHead + queueLength++] = byte;
+    }
+}
+
+static void queueBytes(const uint8_t *bytes, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++) {
+        queueByte(bytes[i]);
+    }
+}
+
+// A data block: Nac, the start token, the data and a crc the host ignores
+static void queueDataBlock(const uint8_t *data, uint32_t length)
+{
+    queueByte(0xFF);
+    queueByte(TOKEN_START_BLOCK);
+    queueBytes(data, length);
+    queueByte(0x00);
+    queueByte(0x00);
+}
+
+static void setBusy(uint32_t us)
+{
+    busyUntilNs = fakeHalNowNs() + (uint64_t)us * 1000;
+}
+
+static uint8_t r1(uint8_t flags)
+{
+    return flags | (idle ? R1_IDLE : 0);
+}
+
+static void executeCommand(void)
+{
+    uint32_t cmd = command[0] & 0x3F;
+    uint32_t arg = ((uint32_t)command[1] << 24) | ((uint32_t)command[2] << 16)
+                   | ((uint32_t)command[3] << 8) | command[4];
+    bool app = appCmd;
+
+    stats.commands[cmd]++;
+    appCmd = false;
+    streaming = false;
+    writeState = WRITE_IDLE;
+    queueHead = 0;
+    queueLength = 0;
+
+    // Ncr, one byte before every response
+    queueByte(0xFF);
+
+    switch (app ? APP_CMD(cmd) : cmd) {
+        case 0:
+            idle = true;
+            initPollsLeft = initPolls;
+            queueByte(r1(0));
+            break;
+
+        case 8:
+            queueByte(r1(0));
+            queueByte(0x00);
+            queueByte(0x00);
+            queueByte((arg >> 8) & 0x0F);
+            queueByte(arg & 0xFF);
+            break;
+
+        case 9:
+            queueByte(r1(0));
+            queueDataBlock(csd, CSD_LENGTH);
+            break;
+
+        case 10:
+            queueByte(r1(0));
+            queueDataBlock(cid, CID_LENGTH);
+            break;
+
+        case 12:
+            // A stuff byte, then R1
+            queueByte(0xFF);
+            queueByte(r1(0));
+            break;
+
+        case 17:
+            if (arg >= FAKE_SD_CARD_SECTORS) {
+                queueByte(r1(R1_PARAMETER));
+                break;
+            }
+            queueByte(r1(0));
+            queueDataBlock(sectors[arg], FAKE_SD_CARD_SECTOR_SIZE);
+            stats.blocksRead++;
+            break;
+
+        case 18:
+            if (arg >= FAKE_SD_CARD_SECTORS) {
+                queueByte(r1(R1_PARAMETER));
+                break;
+            }
+            queueByte(r1(0));
+            streaming = true;
+            streamSector = arg;
+            break;
+
+        case 24:
+        case 25:
+            if (arg >= FAKE_SD_CARD_SECTORS) {
+                queueByte(r1(R1_PARAMETER));
+                break;
+            }
+            queueByte(r1(0));
+            writeState = WRITE_WAIT_TOKEN;
+            writeMultiple = (cmd == 25);
+            writeSector = arg;
+            break;
+
+        case 32:
+            eraseStart = arg;
+            queueByte(r1(0));
+            break;
+
+        case 33:
+            eraseEnd = arg;
+            queueByte(r1(0));
+            break;
+
+        case 38:
+            if (eraseStart > eraseEnd || eraseEnd >= FAKE_SD_CARD_SECTORS) {
+                queueByte(r1(R1_PARAMETER));
+                break;
+            }
+            for (uint32_t sector = eraseStart; sector <= eraseEnd; sector++) {
+                memset(sectors[sector], 0xFF, FAKE_SD_CARD_SECTOR_SIZE);
+                stats.erasedSectors++;
+            }
+            queueByte(r1(0));
+            setBusy(ERASE_BUSY_US);
+            break;
+
+        case 55:
+            appCmd = true;
+            queueByte(r1(0));
+            break;
+
+        case 58:
+            queueByte(r1(0));
+            queueByte(0xC0);        // Powered up, high capacity
+            queueByte(0xFF);
+            queueByte(0x80);
+            queueByte(0x00);
+            break;
+
+        case APP_CMD(13):
+            // R2, then the register
+            queueByte(r1(0));
+            queueByte(0x00);
+            queueDataBlock(sdStatus, STATUS_LENGTH);
+            break;
+
+        case APP_CMD(23):
+            stats.preErase = arg;
+            queueByte(r1(0));
+            break;
+
+        case APP_CMD(41):
+            if (initPollsLeft > 0) {
+                initPollsLeft--;
+            }
+            if (initPollsLeft == 0) {
+                idle = false;
+            }
+            queueByte(r1(0));
+            break;
+
+        default:
+            queueByte(r1(R1_ILLEGAL_COMMAND));
+            break;
+    }
+}
+
+static void receiveWrite(uint8_t mosi)
+{
+    if (writeState == WRITE_WAIT_TOKEN) {
+        if (mosi == TOKEN_START_BLOCK
+            || (writeMultiple && mosi == TOKEN_START_MULTI))
+        {
+            writeState = WRITE_DATA;
+            writeOffset = 0;
+        } else if (writeMultiple && mosi == TOKEN_STOP_TRAN) {
+            writeState = WRITE_IDLE;
+            setBusy(writeBusyUs);
+        }
+        return;
+    }
+
+    writeBlock[writeOffset++] = mosi;
+    if (writeOffset < sizeof(writeBlock)) {
+        return;
+    }
+
+    queueHead = 0;
+    queueLength = 0;
+    if (rejectNextWrite || writeSector >= FAKE_SD_CARD_SECTORS) {
+        rejectNextWrite = false;
+        queueByte(DATA_WRITE_ERROR);
+        writeState = WRITE_IDLE;
+    } else {
+        memcpy(sectors[writeSector++], writeBlock, FAKE_SD_CARD_SECTOR_SIZE);
+        stats.blocksWritten++;
+        queueByte(DATA_ACCEPTED);
+        writeState = writeMultiple ? WRITE_WAIT_TOKEN : WRITE_IDLE;
+    }
+    setBusy(writeBusyUs);
+}
+
+static void receiveCommandByte(uint8_t mosi)
+{
+    if (commandLength == 0 && (mosi & 0xC0) != 0x40) {
+        return;
+    }
+
+    command[commandLength++] = mosi;
+    if (commandLength == sizeof(command)) {
+        commandLength = 0;
+        executeCommand();
+    }
+}
+
+static uint8_t nextOutput(void)
+{
+    if (queueLength > 0) {
+        queueLength--;
+        return queue[queueHead++];
+    }
+
+    if (streaming) {
+        // The next block, read once the last one is sent
+        if (streamSector >= FAKE_SD_CARD_SECTORS) {
+            streaming = false;
+            return 0xFF;
+        }
+        queueHead = 0;
+        queueDataBlock(sectors[streamSector++], FAKE_SD_CARD_SECTOR_SIZE);
+        stats.blocksRead++;
+        queueLength--;
+        return queue[queueHead++];
+    }
+
+    // DO is held low while programming or erasing
+    if (fakeHalNowNs() < busyUntilNs) {
+        return 0x00;
+    }
+
+    return 0xFF;
+}
+
+static uint8_t sdCardExchange(void *ctx, uint8_t mosi)
+{
+    uint8_t miso;
+
+    (void)ctx;
+
+    // Full duplex, what is sent was decided before this byte came in
+    miso = nextOutput();
+
+    // Waiting for a data token, a command can still come instead
+    if (writeState == WRITE_DATA
+        || (writeState == WRITE_WAIT_TOKEN && commandLength == 0
+            && (mosi & 0xC0) != 0x40))
+    {
+        receiveWrite(mosi);
+    } else {
+        receiveCommandByte(mosi);
+    }
+
+    return miso;
+}
+
+static void sdCardSelect(void *ctx, bool selected)
+{
+    (void)ctx;
+
+    // The card drops whatever it was sending, but stays busy
+    if (!selected) {
+        commandLength = 0;
+        queueHead = 0;
+        queueLength = 0;
+        streaming = false;
+        if (writeState == WRITE_DATA) {
+            writeState = WRITE_IDLE;
+        }
+    }
+}
+
+const FakeSpiDevice_t fakeSdCardDevice = {
+    .exchange = sdCardExchange,
+    .select = sdCardSelect,
+};
@@ -0,0 +1,31 @@
+#ifndef __FAKE_SD_CARD_H
+#define __FAKE_SD_CARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fake_hal.h"
+
+#define FAKE_SD_CARD_SECTOR_SIZE    512
+
+// Sectors are (C_SIZE + 1) * 1024, see fakeSdCardReset
+#define FAKE_SD_CARD_SECTORS        2048
+
+typedef struct FakeSdCardStats_t {
+    uint32_t commands[64];      // By command index, ACMDs counted under theirs
+    uint32_t blocksRead;
+    uint32_t blocksWritten;
+    uint32_t erasedSectors;
+    uint32_t preErase;          // Argument of the last ACMD23
+} FakeSdCardStats_t;
+
+extern const FakeSpiDevice_t fakeSdCardDevice;
+
+void fakeSdCardReset(void);
+uint8_t *fakeSdCardSector(uint32_t sector);
+void fakeSdCardSetInitPolls(uint32_t polls);
+void fakeSdCardSetWriteBusyUs(uint32_t us);
+void fakeSdCardRejectNextWrite(void);
+const FakeSdCardStats_t *fakeSdCardStats(void);
+
+#endif /* defined(__FAKE_SD_CARD_H) */
@@ -0,0 +1,10 @@
+#ifndef __FAKE_FREERTOS_LOWER_H
+#define __FAKE_FREERTOS_LOWER_H
+
+// Some drivers include it in lower case, which only works on the case
+// insensitive file systems the firmware is built on. In its own directory,
+// after fake_hal/ in the include path, so a checkout on one of those doesn't
+// have two files with the same name
+#include "FreeRTOS.h"
+
+#endif /* defined(__FAKE_FREERTOS_LOWER_H) */
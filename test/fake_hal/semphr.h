@@ -0,0 +1,7 @@
+#ifndef __FAKE_SEMPHR_H
+#define __FAKE_SEMPHR_H
+
+// Everything is in FreeRTOS.h, see fake_freertos.c
+#include "FreeRTOS.h"
+
+#endif /* defined(__FAKE_SEMPHR_H) */
@@ -0,0 +1,605 @@
+#ifndef __FAKE_STM32F4XX_H
+#define __FAKE_STM32F4XX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @file test/fake_hal/stm32f4xx.h
+ *
+ * @brief Stands in for the ST device and HAL headers, so drivers build for
+ * the host as they are for the board
+ *
+ * Only what ppm.c, motors.c, i2c.c and sd.c use is here. Peripherals are
+ * register structs in RAM, with the same fields and bits as the hardware,
+ * and the HAL functions (fake_hal.c) drive them from a simulated clock. See
+ * fake_hal.h for what the tests control.
+ */
+
+#define __IO volatile
+
+typedef enum {
+    HAL_OK       = 0x00U,
+    HAL_ERROR    = 0x01U,
+    HAL_BUSY     = 0x02U,
+    HAL_TIMEOUT  = 0x03U,
+} HAL_StatusTypeDef;
+
+typedef enum {
+    HAL_UNLOCKED = 0x00U,
+    HAL_LOCKED   = 0x01U,
+} HAL_LockTypeDef;
+
+#define HAL_MAX_DELAY      0xFFFFFFFFU
+
+#define SET_BIT(REG, BIT)     ((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT)   ((REG) &= ~(BIT))
+#define READ_BIT(REG, BIT)    ((REG) & (BIT))
+#define WRITE_REG(REG, VAL)   ((REG) = (VAL))
+#define READ_REG(REG)         ((REG))
+#define MODIFY_REG(REG, CLEARMASK, SETMASK) \
+    WRITE_REG((REG), (((READ_REG(REG)) & (~(CLEARMASK))) | (SETMASK)))
+
+/*
+ * Interrupts, the ones the drivers use with their STM32F4 numbers
+ */
+typedef enum {
+    DMA1_Stream5_IRQn = 16,
+    DMA1_Stream6_IRQn = 17,
+    I2C1_EV_IRQn      = 31,
+    I2C1_ER_IRQn      = 32,
+    TIM1_CC_IRQn      = 27,
+    TIM5_IRQn         = 50,
+    DMA2_Stream0_IRQn = 56,
+    DMA2_Stream3_IRQn = 59,
+    FAKE_IRQ_COUNT    = 97,
+} IRQn_Type;
+
+/*
+ * Registers
+ */
+typedef struct {
+    __IO uint32_t MODER;
+    __IO uint32_t OTYPER;
+    __IO uint32_t OSPEEDR;
+    __IO uint32_t PUPDR;
+    __IO uint32_t IDR;
+    __IO uint32_t ODR;
+    __IO uint32_t BSRR;
+    __IO uint32_t LCKR;
+    __IO uint32_t AFR[2];
+} GPIO_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR1;
+    __IO uint32_t CR2;
+    __IO uint32_t SMCR;
+    __IO uint32_t DIER;
+    __IO uint32_t SR;
+    __IO uint32_t EGR;
+    __IO uint32_t CCMR1;
+    __IO uint32_t CCMR2;
+    __IO uint32_t CCER;
+    __IO uint32_t CNT;
+    __IO uint32_t PSC;
+    __IO uint32_t ARR;
+    __IO uint32_t RCR;
+    __IO uint32_t CCR1;
+    __IO uint32_t CCR2;
+    __IO uint32_t CCR3;
+    __IO uint32_t CCR4;
+    __IO uint32_t BDTR;
+    __IO uint32_t DCR;
+    __IO uint32_t DMAR;
+    __IO uint32_t OR;
+} TIM_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR1;
+    __IO uint32_t CR2;
+    __IO uint32_t OAR1;
+    __IO uint32_t OAR2;
+    __IO uint32_t DR;
+    __IO uint32_t SR1;
+    __IO uint32_t SR2;
+    __IO uint32_t CCR;
+    __IO uint32_t TRISE;
+    __IO uint32_t FLTR;
+} I2C_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR1;
+    __IO uint32_t CR2;
+    __IO uint32_t SR;
+    __IO uint32_t DR;
+    __IO uint32_t CRCPR;
+    __IO uint32_t RXCRCR;
+    __IO uint32_t TXCRCR;
+    __IO uint32_t I2SCFGR;
+    __IO uint32_t I2SPR;
+} SPI_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR;
+    __IO uint32_t NDTR;
+    __IO uint32_t PAR;
+    __IO uint32_t M0AR;
+    __IO uint32_t M1AR;
+    __IO uint32_t FCR;
+} DMA_Stream_TypeDef;
+
+/*
+ * The peripherals, defined in fake_hal.c
+ */
+extern GPIO_TypeDef fakeGpioA, fakeGpioB, fakeGpioC;
+extern TIM_TypeDef fakeTim1, fakeTim5;
+extern I2C_TypeDef fakeI2c1;
+extern SPI_TypeDef fakeSpi1;
+extern DMA_Stream_TypeDef fakeDma1Stream5, fakeDma1Stream6;
+extern DMA_Stream_TypeDef fakeDma2Stream0, fakeDma2Stream3;
+
+#define GPIOA           (&fakeGpioA)
+#define GPIOB           (&fakeGpioB)
+#define GPIOC           (&fakeGpioC)
+#define TIM1            (&fakeTim1)
+#define TIM5            (&fakeTim5)
+#define I2C1            (&fakeI2c1)
+#define SPI1            (&fakeSpi1)
+#define DMA1_Stream5    (&fakeDma1Stream5)
+#define DMA1_Stream6    (&fakeDma1Stream6)
+#define DMA2_Stream0    (&fakeDma2Stream0)
+#define DMA2_Stream3    (&fakeDma2Stream3)
+
+/*
+ * Register bits
+ */
+#define TIM_CR1_CEN         (1U << 0)
+#define TIM_CR1_UDIS        (1U << 1)
+#define TIM_CR1_ARPE        (1U << 7)
+#define TIM_DIER_UIE        (1U << 0)
+#define TIM_DIER_CC1IE      (1U << 1)
+#define TIM_SR_UIF          (1U << 0)
+#define TIM_SR_CC1IF        (1U << 1)
+#define TIM_SR_CC1OF        (1U << 9)
+#define TIM_CCMR1_CC1S      (3U << 0)
+#define TIM_CCMR1_OC1PE     (1U << 3)
+#define TIM_CCMR1_OC2PE     (1U << 11)
+#define TIM_CCMR2_OC3PE     (1U << 3)
+#define TIM_CCMR2_OC4PE     (1U << 11)
+#define TIM_CCER_CC1E       (1U << 0)
+#define TIM_BDTR_MOE        (1U << 15)
+
+#define I2C_CR1_PE          (1U << 0)
+#define I2C_CR1_SWRST       (1U << 15)
+
+#define SPI_CR1_CPHA        (1U << 0)
+#define SPI_CR1_CPOL        (1U << 1)
+#define SPI_CR1_MSTR        (1U << 2)
+#define SPI_CR1_BR_Pos      3U
+#define SPI_CR1_BR          (7U << SPI_CR1_BR_Pos)
+#define SPI_CR1_SPE         (1U << 6)
+#define SPI_CR1_LSBFIRST    (1U << 7)
+#define SPI_CR1_SSI         (1U << 8)
+#define SPI_CR1_SSM         (1U << 9)
+
+#define DMA_SxCR_EN         (1U << 0)
+
+/*
+ * RCC
+ */
+#define RCC_HCLK_DIV1       0x00000000U
+#define RCC_HCLK_DIV2       0x00001000U
+#define RCC_HCLK_DIV4       0x00001400U
+
+typedef struct {
+    uint32_t ClockType;
+    uint32_t SYSCLKSource;
+    uint32_t AHBCLKDivider;
+    uint32_t APB1CLKDivider;
+    uint32_t APB2CLKDivider;
+} RCC_ClkInitTypeDef;
+
+// Clocks only matter to the drivers through the frequencies they read
+#define __HAL_RCC_GPIOA_CLK_ENABLE()    do { } while (0)
+#define __HAL_RCC_GPIOB_CLK_ENABLE()    do { } while (0)
+#define __HAL_RCC_GPIOC_CLK_ENABLE()    do { } while (0)
+#define __HAL_RCC_TIM1_CLK_ENABLE()     do { } while (0)
+#define __HAL_RCC_TIM1_CLK_DISABLE()    do { } while (0)
+#define __HAL_RCC_TIM5_CLK_ENABLE()     do { } while (0)
+#define __HAL_RCC_TIM5_CLK_DISABLE()    do { } while (0)
+#define __HAL_RCC_I2C1_CLK_ENABLE()     do { } while (0)
+#define __HAL_RCC_SPI1_CLK_ENABLE()     do { } while (0)
+#define __HAL_RCC_DMA1_CLK_ENABLE()     do { } while (0)
+#define __HAL_RCC_DMA2_CLK_ENABLE()     do { } while (0)
+
+// A reset puts the peripheral's registers back to zero
+#define __HAL_RCC_I2C1_FORCE_RESET()    fakeHalResetRegisters(I2C1, sizeof(I2C_TypeDef))
+#define __HAL_RCC_I2C1_RELEASE_RESET()  do { } while (0)
+#define __HAL_RCC_SPI1_FORCE_RESET()    fakeHalResetRegisters(SPI1, sizeof(SPI_TypeDef))
+#define __HAL_RCC_SPI1_RELEASE_RESET()  do { } while (0)
+
+void fakeHalResetRegisters(void *peripheral, size_t size);
+
+void HAL_RCC_GetClockConfig(RCC_ClkInitTypeDef *clkInit, uint32_t *flashLatency);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+uint32_t HAL_RCC_GetPCLK2Freq(void);
+
+/*
+ * GPIO
+ */
+#define GPIO_PIN_0          ((uint16_t)0x0001)
+#define GPIO_PIN_4          ((uint16_t)0x0010)
+#define GPIO_PIN_5          ((uint16_t)0x0020)
+#define GPIO_PIN_6          ((uint16_t)0x0040)
+#define GPIO_PIN_7          ((uint16_t)0x0080)
+#define GPIO_PIN_8          ((uint16_t)0x0100)
+#define GPIO_PIN_9          ((uint16_t)0x0200)
+#define GPIO_PIN_10         ((uint16_t)0x0400)
+#define GPIO_PIN_11         ((uint16_t)0x0800)
+#define GPIO_PIN_12         ((uint16_t)0x1000)
+#define GPIO_PIN_13         ((uint16_t)0x2000)
+#define GPIO_PIN_14         ((uint16_t)0x4000)
+#define GPIO_PIN_15         ((uint16_t)0x8000)
+
+// Mode bits 0-1 are MODER, bit 4 is open drain, as in the HAL
+#define GPIO_MODE_INPUT         0x00000000U
+#define GPIO_MODE_OUTPUT_PP     0x00000001U
+#define GPIO_MODE_OUTPUT_OD     0x00000011U
+#define GPIO_MODE_AF_PP         0x00000002U
+#define GPIO_MODE_AF_OD         0x00000012U
+
+#define GPIO_NOPULL         0x00000000U
+#define GPIO_PULLUP         0x00000001U
+#define GPIO_PULLDOWN       0x00000002U
+
+#define GPIO_SPEED_FREQ_LOW         0x00000000U
+#define GPIO_SPEED_FREQ_MEDIUM      0x00000001U
+#define GPIO_SPEED_FREQ_HIGH        0x00000002U
+#define GPIO_SPEED_FREQ_VERY_HIGH   0x00000003U
+#define GPIO_SPEED_HIGH             GPIO_SPEED_FREQ_VERY_HIGH
+
+#define GPIO_AF1_TIM1       ((uint8_t)0x01)
+#define GPIO_AF2_TIM5       ((uint8_t)0x02)
+#define GPIO_AF4_I2C1       ((uint8_t)0x04)
+#define GPIO_AF5_SPI1       ((uint8_t)0x05)
+
+typedef enum {
+    GPIO_PIN_RESET = 0,
+    GPIO_PIN_SET,
+} GPIO_PinState;
+
+typedef struct {
+    uint32_t Pin;
+    uint32_t Mode;
+    uint32_t Pull;
+    uint32_t Speed;
+    uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init);
+void HAL_GPIO_DeInit(GPIO_TypeDef *GPIOx, uint32_t GPIO_Pin);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+
+/*
+ * NVIC and time base
+ */
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority);
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn);
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+
+/*
+ * DMA
+ */
+#define DMA_CHANNEL_1               0x02000000U
+#define DMA_CHANNEL_3               0x06000000U
+#define DMA_PERIPH_TO_MEMORY        0x00000000U
+#define DMA_MEMORY_TO_PERIPH        0x00000040U
+#define DMA_PINC_DISABLE            0x00000000U
+#define DMA_MINC_ENABLE             0x00000400U
+#define DMA_PDATAALIGN_BYTE         0x00000000U
+#define DMA_MDATAALIGN_BYTE         0x00000000U
+#define DMA_NORMAL                  0x00000000U
+#define DMA_PRIORITY_LOW            0x00000000U
+#define DMA_PRIORITY_HIGH           0x00020000U
+#define DMA_FIFOMODE_DISABLE        0x00000000U
+#define DMA_FIFO_THRESHOLD_FULL     0x00000003U
+#define DMA_MBURST_SINGLE           0x00000000U
+#define DMA_MBURST_INC4             0x00800000U
+#define DMA_PBURST_SINGLE           0x00000000U
+#define DMA_PBURST_INC4             0x00200000U
+
+typedef struct {
+    uint32_t Channel;
+    uint32_t Direction;
+    uint32_t PeriphInc;
+    uint32_t MemInc;
+    uint32_t PeriphDataAlignment;
+    uint32_t MemDataAlignment;
+    uint32_t Mode;
+    uint32_t Priority;
+    uint32_t FIFOMode;
+    uint32_t FIFOThreshold;
+    uint32_t MemBurst;
+    uint32_t PeriphBurst;
+} DMA_InitTypeDef;
+
+typedef struct __DMA_HandleTypeDef {
+    DMA_Stream_TypeDef *Instance;
+    DMA_InitTypeDef     Init;
+    void               *Parent;
+} DMA_HandleTypeDef;
+
+#define __HAL_LINKDMA(__HANDLE__, __PPP_DMA_FIELD__, __DMA_HANDLE__) \
+    do { \
+        (__HANDLE__)->__PPP_DMA_FIELD__ = &(__DMA_HANDLE__); \
+        (__DMA_HANDLE__).Parent = (__HANDLE__); \
+    } while (0)
+
+HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef *hdma);
+HAL_StatusTypeDef HAL_DMA_DeInit(DMA_HandleTypeDef *hdma);
+
+/*
+ * Timers
+ */
+#define TIM_CHANNEL_1               0x00000000U
+#define TIM_CHANNEL_2               0x00000004U
+#define TIM_CHANNEL_3               0x00000008U
+#define TIM_CHANNEL_4               0x0000000CU
+
+#define TIM_COUNTERMODE_UP          0x00000000U
+#define TIM_CLOCKDIVISION_DIV1      0x00000000U
+#define TIM_CLOCKSOURCE_INTERNAL    0x00001000U
+#define TIM_TRGO_RESET              0x00000000U
+#define TIM_MASTERSLAVEMODE_DISABLE 0x00000000U
+
+#define TIM_INPUTCHANNELPOLARITY_RISING 0x00000000U
+#define TIM_ICSELECTION_DIRECTTI    0x00000001U
+#define TIM_ICPSC_DIV1              0x00000000U
+
+#define TIM_OCMODE_PWM1             0x00000060U
+#define TIM_OCPOLARITY_HIGH         0x00000000U
+#define TIM_OCNPOLARITY_HIGH        0x00000000U
+#define TIM_OCFAST_DISABLE          0x00000000U
+#define TIM_OCIDLESTATE_RESET       0x00000000U
+#define TIM_OCNIDLESTATE_RESET      0x00000000U
+
+#define TIM_OSSR_DISABLE            0x00000000U
+#define TIM_OSSI_DISABLE            0x00000000U
+#define TIM_LOCKLEVEL_OFF           0x00000000U
+#define TIM_BREAK_DISABLE           0x00000000U
+#define TIM_BREAKPOLARITY_HIGH      0x00002000U
+#define TIM_AUTOMATICOUTPUT_DISABLE 0x00000000U
+
+typedef enum {
+    HAL_TIM_STATE_RESET = 0x00U,
+    HAL_TIM_STATE_READY = 0x01U,
+} HAL_TIM_StateTypeDef;
+
+typedef enum {
+    HAL_TIM_ACTIVE_CHANNEL_1       = 0x01U,
+    HAL_TIM_ACTIVE_CHANNEL_2       = 0x02U,
+    HAL_TIM_ACTIVE_CHANNEL_3       = 0x04U,
+    HAL_TIM_ACTIVE_CHANNEL_4       = 0x08U,
+    HAL_TIM_ACTIVE_CHANNEL_CLEARED = 0x00U,
+} HAL_TIM_ActiveChannel;
+
+typedef struct {
+    uint32_t Prescaler;
+    uint32_t CounterMode;
+    uint32_t Period;
+    uint32_t ClockDivision;
+    uint32_t RepetitionCounter;
+} TIM_Base_InitTypeDef;
+
+typedef struct {
+    TIM_TypeDef          *Instance;
+    TIM_Base_InitTypeDef  Init;
+    HAL_TIM_ActiveChannel Channel;
+    volatile HAL_TIM_StateTypeDef State;
+} TIM_HandleTypeDef;
+
+typedef struct {
+    uint32_t ClockSource;
+    uint32_t ClockPolarity;
+    uint32_t ClockPrescaler;
+    uint32_t ClockFilter;
+} TIM_ClockConfigTypeDef;
+
+typedef struct {
+    uint32_t MasterOutputTrigger;
+    uint32_t MasterSlaveMode;
+} TIM_MasterConfigTypeDef;
+
+typedef struct {
+    uint32_t ICPolarity;
+    uint32_t ICSelection;
+    uint32_t ICPrescaler;
+    uint32_t ICFilter;
+} TIM_IC_InitTypeDef;
+
+typedef struct {
+    uint32_t OCMode;
+    uint32_t Pulse;
+    uint32_t OCPolarity;
+    uint32_t OCNPolarity;
+    uint32_t OCFastMode;
+    uint32_t OCIdleState;
+    uint32_t OCNIdleState;
+} TIM_OC_InitTypeDef;
+
+typedef struct {
+    uint32_t OffStateRunMode;
+    uint32_t OffStateIDLEMode;
+    uint32_t LockLevel;
+    uint32_t DeadTime;
+    uint32_t BreakState;
+    uint32_t BreakPolarity;
+    uint32_t AutomaticOutput;
+} TIM_BreakDeadTimeConfigTypeDef;
+
+#define __HAL_TIM_SET_COMPARE(__HANDLE__, __CHANNEL__, __COMPARE__) \
+    (*(&((__HANDLE__)->Instance->CCR1) + ((__CHANNEL__) >> 2U)) = (__COMPARE__))
+#define __HAL_TIM_GET_COMPARE(__HANDLE__, __CHANNEL__) \
+    (*(&((__HANDLE__)->Instance->CCR1) + ((__CHANNEL__) >> 2U)))
+#define __HAL_TIM_GetCompare __HAL_TIM_GET_COMPARE
+
+HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_ConfigClockSource(TIM_HandleTypeDef *htim,
+                                            TIM_ClockConfigTypeDef *sClockSourceConfig);
+HAL_StatusTypeDef HAL_TIM_IC_Init(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_IC_ConfigChannel(TIM_HandleTypeDef *htim,
+                                           TIM_IC_InitTypeDef *sConfig, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_IC_Start_IT(TIM_HandleTypeDef *htim, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_OC_Init(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_OC_ConfigChannel(TIM_HandleTypeDef *htim,
+                                           TIM_OC_InitTypeDef *sConfig, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef *htim, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_PWM_Stop(TIM_HandleTypeDef *htim, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization(TIM_HandleTypeDef *htim,
+                                                        TIM_MasterConfigTypeDef *sMasterConfig);
+HAL_StatusTypeDef HAL_TIMEx_ConfigBreakDeadTime(TIM_HandleTypeDef *htim,
+                                                TIM_BreakDeadTimeConfigTypeDef *sBreakDeadTimeConfig);
+void HAL_TIM_IRQHandler(TIM_HandleTypeDef *htim);
+
+void HAL_TIM_Base_MspInit(TIM_HandleTypeDef *htim);
+void HAL_TIM_Base_MspDeInit(TIM_HandleTypeDef *htim);
+void HAL_TIM_IC_MspInit(TIM_HandleTypeDef *htim);
+void HAL_TIM_OC_MspInit(TIM_HandleTypeDef *htim);
+void HAL_TIM_OC_MspDeInit(TIM_HandleTypeDef *htim);
+void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef *htim);
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim);
+
+/*
+ * I2C
+ */
+#define I2C_ADDRESSINGMODE_7BIT     0x00004000U
+#define I2C_DUALADDRESS_DISABLE     0x00000000U
+#define I2C_DUTYCYCLE_16_9          0x00004000U
+#define I2C_GENERALCALL_DISABLE     0x00000000U
+#define I2C_NOSTRETCH_DISABLE       0x00000000U
+#define I2C_MEMADD_SIZE_8BIT        0x00000001U
+#define I2C_MEMADD_SIZE_16BIT       0x00000010U
+
+#define HAL_I2C_ERROR_NONE          0x00000000U
+#define HAL_I2C_ERROR_AF            0x00000004U
+#define HAL_I2C_ERROR_DMA           0x00000010U
+#define HAL_I2C_ERROR_TIMEOUT       0x00000020U
+
+typedef enum {
+    HAL_I2C_STATE_RESET   = 0x00U,
+    HAL_I2C_STATE_READY   = 0x20U,
+    HAL_I2C_STATE_BUSY_TX = 0x21U,
+    HAL_I2C_STATE_BUSY_RX = 0x22U,
+} HAL_I2C_StateTypeDef;
+
+typedef struct {
+    uint32_t ClockSpeed;
+    uint32_t DutyCycle;
+    uint32_t OwnAddress1;
+    uint32_t AddressingMode;
+    uint32_t DualAddressMode;
+    uint32_t OwnAddress2;
+    uint32_t GeneralCallMode;
+    uint32_t NoStretchMode;
+} I2C_InitTypeDef;
+
+typedef struct __I2C_HandleTypeDef {
+    I2C_TypeDef                   *Instance;
+    I2C_InitTypeDef                Init;
+    DMA_HandleTypeDef             *hdmatx;
+    DMA_HandleTypeDef             *hdmarx;
+    volatile HAL_I2C_StateTypeDef  State;
+    volatile uint32_t              ErrorCode;
+} I2C_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress,
+                                   uint16_t MemAddress, uint16_t MemAddSize,
+                                   uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t DevAddress,
+                                    uint16_t MemAddress, uint16_t MemAddSize,
+                                    uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress,
+                                       uint16_t MemAddress, uint16_t MemAddSize,
+                                       uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Mem_Write_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress,
+                                        uint16_t MemAddress, uint16_t MemAddSize,
+                                        uint8_t *pData, uint16_t Size);
+
+void HAL_I2C_MspInit(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MspDeInit(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_AbortCpltCallback(I2C_HandleTypeDef *hi2c);
+
+/*
+ * SPI
+ */
+#define SPI_MODE_MASTER                 (SPI_CR1_MSTR | SPI_CR1_SSI)
+#define SPI_DIRECTION_2LINES            0x00000000U
+#define SPI_DATASIZE_8BIT               0x00000000U
+#define SPI_POLARITY_LOW                0x00000000U
+#define SPI_PHASE_1EDGE                 0x00000000U
+#define SPI_NSS_SOFT                    SPI_CR1_SSM
+#define SPI_FIRSTBIT_MSB                0x00000000U
+#define SPI_TIMODE_DISABLE              0x00000000U
+#define SPI_CRCCALCULATION_DISABLE      0x00000000U
+#define SPI_BAUDRATEPRESCALER_2         0x00000000U
+#define SPI_BAUDRATEPRESCALER_256       0x00000038U
+
+#define HAL_SPI_ERROR_NONE              0x00000000U
+#define HAL_SPI_ERROR_OVR               0x00000004U
+#define HAL_SPI_ERROR_DMA               0x00000010U
+#define HAL_SPI_ERROR_ABORT             0x00000040U
+
+typedef enum {
+    HAL_SPI_STATE_RESET      = 0x00U,
+    HAL_SPI_STATE_READY      = 0x01U,
+    HAL_SPI_STATE_BUSY_TX_RX = 0x05U,
+} HAL_SPI_StateTypeDef;
+
+typedef struct {
+    uint32_t Mode;
+    uint32_t Direction;
+    uint32_t DataSize;
+    uint32_t CLKPolarity;
+    uint32_t CLKPhase;
+    uint32_t NSS;
+    uint32_t BaudRatePrescaler;
+    uint32_t FirstBit;
+    uint32_t TIMode;
+    uint32_t CRCCalculation;
+    uint32_t CRCPolynomial;
+} SPI_InitTypeDef;
+
+typedef struct __SPI_HandleTypeDef {
+    SPI_TypeDef                   *Instance;
+    SPI_InitTypeDef                Init;
+    DMA_HandleTypeDef             *hdmatx;
+    DMA_HandleTypeDef             *hdmarx;
+    volatile HAL_SPI_StateTypeDef  State;
+    volatile uint32_t              ErrorCode;
+} SPI_HandleTypeDef;
+
+#define __HAL_SPI_ENABLE(__HANDLE__)  SET_BIT((__HANDLE__)->Instance->CR1, SPI_CR1_SPE)
+#define __HAL_SPI_DISABLE(__HANDLE__) CLEAR_BIT((__HANDLE__)->Instance->CR1, SPI_CR1_SPE)
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData,
+                                          uint8_t *pRxData, uint16_t Size,
+                                          uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData,
+                                              uint8_t *pRxData, uint16_t Size);
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi);
+
+void HAL_SPI_MspInit(SPI_HandleTypeDef *hspi);
+void HAL_SPI_MspDeInit(SPI_HandleTypeDef *hspi);
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi);
+
+#endif /* defined(__FAKE_STM32F4XX_H) */
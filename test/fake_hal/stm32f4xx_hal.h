@@ -0,0 +1,7 @@
+#ifndef __FAKE_STM32F4XX_HAL_H
+#define __FAKE_STM32F4XX_HAL_H
+
+// The device header has the fake HAL in it too, see stm32f4xx.h
+#include "stm32f4xx.h"
+
+#endif /* defined(__FAKE_STM32F4XX_HAL_H) */
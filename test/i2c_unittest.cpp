@@ -0,0 +1,170 @@
+#include "gtest/gtest.h"
+
+#include <string.h>
+
+extern "C" {
+#include "fc.h"
+#include "fake_hal.h"
+#include "i2c.h"
+}
+
+// The IMU, as addressed in imu.c
+#define DEVICE_ADDRESS      0x6b
+#define DEVICE_ADDRESS_HAL  (DEVICE_ADDRESS << 1)
+
+// 9 clocks a byte at the bus speed in i2c.c
+#define BYTE_NS             (9 * 1000000000ULL / 200000)
+
+static uint8_t registers[256];
+
+static void deviceRead(void *ctx, uint16_t memAddress, uint8_t *data, uint16_t size)
+{
+    (void)ctx;
+    for (uint16_t i = 0; i < size; i++) {
+        data[i] = registers[(memAddress + i) & 0xFF];
+    }
+}
+
+static void deviceWrite(void *ctx, uint16_t memAddress, const uint8_t *data,
+                        uint16_t size)
+{
+    (void)ctx;
+    for (uint16_t i = 0; i < size; i++) {
+        registers[(memAddress + i) & 0xFF] = data[i];
+    }
+}
+
+static const FakeI2cDevice_t device = {deviceRead, deviceWrite};
+
+class I2cTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            fakeHalReset();
+            I2cHandle.State = HAL_I2C_STATE_RESET;
+
+            for (int i = 0; i < 256; i++) {
+                registers[i] = i ^ 0x5A;
+            }
+            fakeI2cAttach(I2C1, DEVICE_ADDRESS, &device, NULL);
+
+            setup_I2C();
+        }
+
+        // As AccelGyro_RegRead in imu.c
+        HAL_StatusTypeDef dmaRead(uint16_t address, uint8_t reg, uint8_t *data,
+                                  uint16_t size) {
+            HAL_StatusTypeDef rc;
+
+            if (xSemaphoreTake(I2CMutex, I2C_MUT_WAIT_TICKS) != pdTRUE) {
+                return HAL_BUSY;
+            }
+            rc = HAL_I2C_Mem_Read_DMA(&I2cHandle, address, reg,
+                                      I2C_MEMADD_SIZE_8BIT, data, size);
+            if (rc == HAL_OK
+                && xSemaphoreTake(I2C_DMA_CompleteSem,
+                                  I2C_DMA_SEM_WAIT_TICKS) != pdTRUE)
+            {
+                rc = HAL_TIMEOUT;
+            }
+            xSemaphoreGive(I2CMutex);
+
+            return rc;
+        }
+};
+
+TEST_F(I2cTest, Setup)
+{
+    EXPECT_EQ(0u, fakeHalErrorHandlerCalls());
+    EXPECT_EQ(HAL_I2C_STATE_READY, I2cHandle.State);
+    EXPECT_TRUE(I2C1->CR1 & I2C_CR1_PE);
+    EXPECT_FALSE(I2C1->CR1 & I2C_CR1_SWRST);
+
+    // Back to the peripheral after the busy flag erratum sequence
+    EXPECT_EQ((uint32_t)GPIO_MODE_AF_OD, fakeGpioMode(GPIOB, GPIO_PIN_6));
+    EXPECT_EQ((uint32_t)GPIO_MODE_AF_OD, fakeGpioMode(GPIOB, GPIO_PIN_7));
+
+    EXPECT_TRUE(fakeIrqEnabled(DMA1_Stream5_IRQn));
+    EXPECT_TRUE(fakeIrqEnabled(DMA1_Stream6_IRQn));
+    EXPECT_EQ(DMA1_Stream5, I2cHandle.hdmarx->Instance);
+    EXPECT_EQ(DMA1_Stream6, I2cHandle.hdmatx->Instance);
+
+    // The bus was free, so the sequence didn't wait
+    EXPECT_LT(fakeHalNowNs(), 1000000ULL);
+}
+
+TEST_F(I2cTest, DmaRead)
+{
+    uint8_t data[12];
+    uint64_t start = fakeHalNowNs();
+
+    ASSERT_EQ(HAL_OK, dmaRead(DEVICE_ADDRESS_HAL, 0x22, data, sizeof(data)));
+    for (unsigned i = 0; i < sizeof(data); i++) {
+        EXPECT_EQ(registers[0x22 + i], data[i]);
+    }
+
+    // Address, register, address again, then the data by DMA
+    EXPECT_EQ((3 + sizeof(data)) * BYTE_NS, fakeHalNowNs() - start);
+    EXPECT_EQ(1u, fakeDmaTransfers(DMA1_Stream5));
+    EXPECT_EQ(1u, fakeRtosYieldsFromISR());
+    EXPECT_EQ(HAL_I2C_STATE_READY, I2cHandle.State);
+}
+
+TEST_F(I2cTest, PolledWriteAndRead)
+{
+    uint8_t config[2] = {0x60, 0x04};
+    uint8_t readBack[2];
+
+    ASSERT_EQ(HAL_OK, HAL_I2C_Mem_Write(&I2cHandle, DEVICE_ADDRESS_HAL, 0x10,
+                                        I2C_MEMADD_SIZE_8BIT, config,
+                                        sizeof(config), 100));
+    ASSERT_EQ(HAL_OK, HAL_I2C_Mem_Read(&I2cHandle, DEVICE_ADDRESS_HAL, 0x10,
+                                       I2C_MEMADD_SIZE_8BIT, readBack,
+                                       sizeof(readBack), 100));
+    EXPECT_EQ(0, memcmp(config, readBack, sizeof(config)));
+    EXPECT_EQ(0u, fakeDmaTransfers(DMA1_Stream5));
+}
+
+TEST_F(I2cTest, Nack)
+{
+    uint8_t data[6];
+
+    EXPECT_EQ(HAL_ERROR, dmaRead(0x1e << 1, 0x00, data, sizeof(data)));
+    EXPECT_EQ((uint32_t)HAL_I2C_ERROR_AF, I2cHandle.ErrorCode);
+    EXPECT_EQ(0u, fakeDmaTransfers(DMA1_Stream5));
+
+    // The mutex was given back
+    EXPECT_EQ(HAL_OK, dmaRead(DEVICE_ADDRESS_HAL, 0x00, data, sizeof(data)));
+}
+
+TEST_F(I2cTest, DmaErrorWaitsForTimeout)
+{
+    uint8_t data[6];
+    uint64_t start = fakeHalNowNs();
+
+    fakeDmaFailNext(DMA1_Stream5, FAKE_DMA_ERROR);
+
+    // The error callback only turns on the led, it doesn't give the
+    // semaphore, so the reader waits out I2C_DMA_SEM_WAIT_TICKS
+    EXPECT_EQ(HAL_TIMEOUT, dmaRead(DEVICE_ADDRESS_HAL, 0x00, data, sizeof(data)));
+    EXPECT_TRUE(LED_PORT->ODR & LED3_PIN);
+    EXPECT_TRUE(I2cHandle.ErrorCode & HAL_I2C_ERROR_DMA);
+    EXPECT_GE(fakeHalNowNs() - start, I2C_DMA_SEM_WAIT_TICKS * 1000000ULL);
+
+    EXPECT_EQ(HAL_OK, dmaRead(DEVICE_ADDRESS_HAL, 0x00, data, sizeof(data)));
+}
+
+TEST_F(I2cTest, ErratumStuckSda)
+{
+    uint64_t start = fakeHalNowNs();
+
+    // A slave holding SDA low, the sequence gives up on each wait for it to
+    // go high
+    fakeGpioHoldLow(GPIOB, GPIO_PIN_7, true);
+    I2C_ClearBusyFlagErratum(10);
+
+    EXPECT_GE(fakeHalNowNs() - start, 2 * 10 * 1000000ULL);
+    EXPECT_LT(fakeHalNowNs() - start, 2 * 12 * 1000000ULL);
+    EXPECT_EQ((uint32_t)GPIO_MODE_AF_OD, fakeGpioMode(GPIOB, GPIO_PIN_6));
+    EXPECT_EQ((uint32_t)GPIO_MODE_AF_OD, fakeGpioMode(GPIOB, GPIO_PIN_7));
+    EXPECT_TRUE(I2C1->CR1 & I2C_CR1_PE);
+}
@@ -0,0 +1,263 @@
+#include "gtest/gtest.h"
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include "fc.h"
+#include "ff.h"
+#include "logFile.h"
+#include "diskio_image.h"
+}
+
+#define IMAGE_PATH     "Bin/log_file.img"
+#define IMAGE_SECTORS  (64 * 2048) // 64 MB
+#define LOG_NAME       "TEST.LOG"
+#define LOG_SIZE       (1024 * 1024)
+
+// Fill data with a pattern that depends on the position in the file, so
+// misplaced data is caught
+static void pattern(uint8_t *data, uint32_t length, uint32_t offset)
+{
+    for (uint32_t i = 0; i < length; i++) {
+        uint32_t pos = offset + i;
+        data[i] = (uint8_t)(pos * 7 + (pos >> 9));
+    }
+}
+
+class LogFileTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            static uint8_t work[_MAX_SS];
+
+            ASSERT_EQ(FC_OK, diskImageOpen(IMAGE_PATH, IMAGE_SECTORS));
+            ASSERT_EQ(FR_OK, f_mkfs("", FM_ANY, 0, work, sizeof(work)));
+            mount();
+        }
+
+        virtual void TearDown() {
+            f_mount(NULL, "", 0);
+            diskImageClose();
+        }
+
+        void mount(void) {
+            ASSERT_EQ(FR_OK, f_mount(&fs, "", 1));
+            diskImageSetMetadataBoundary(fs.database);
+            diskImageResetStats();
+        }
+
+        // Write length bytes of the pattern in pieces of varying size
+        void writePattern(uint32_t offset, uint32_t length) {
+            uint8_t piece[300];
+            uint32_t size = 1;
+
+            while (length != 0) {
+                size = (size * 13 + 5) % sizeof(piece) + 1;
+                if (size > length) {
+                    size = length;
+                }
+                pattern(piece, size, offset);
+                ASSERT_EQ(FR_OK, logFileWrite(&log, piece, size));
+                offset += size;
+                length -= size;
+            }
+        }
+
+        // Check the file contains the pattern up to length, then zeros
+        void checkFile(const char *name, uint32_t length, uint32_t size) {
+            FIL file;
+            uint8_t actual[512], expected[512];
+            UINT got;
+
+            ASSERT_EQ(FR_OK, f_open(&file, name, FA_READ));
+            EXPECT_EQ(size, f_size(&file));
+
+            for (uint32_t pos = 0; pos < size; pos += got) {
+                ASSERT_EQ(FR_OK, f_read(&file, actual, sizeof(actual), &got));
+                ASSERT_GT(got, 0u);
+
+                pattern(expected, got, pos);
+                for (uint32_t i = 0; i < got; i++) {
+                    if (pos + i >= length) {
+                        expected[i] = 0;
+                    }
+                }
+                ASSERT_EQ(0, memcmp(expected, actual, got)) << "at " << pos;
+            }
+
+            f_close(&file);
+        }
+
+        DWORD freeClusters(void) {
+            DWORD clusters;
+            FATFS *fatfs;
+
+            EXPECT_EQ(FR_OK, f_getfree("", &clusters, &fatfs));
+            return clusters;
+        }
+
+        FATFS fs;
+        LogFile_t log;
+};
+
+TEST_F(LogFileTest, roundTrip)
+{
+    const uint32_t length = 300000;
+
+    ASSERT_EQ(FR_OK, logFileOpen(&log, LOG_NAME, LOG_SIZE));
+    writePattern(0, length / 2);
+    ASSERT_EQ(FR_OK, logFileSync(&log));
+    writePattern(length / 2, length / 2);
+    EXPECT_EQ(length, logFileLength(&log));
+    ASSERT_EQ(FR_OK, logFileClose(&log));
+
+    checkFile(LOG_NAME, length, length);
+}
+
+TEST_F(LogFileTest, fileIsContiguous)
+{
+    uint8_t actual[512], expected[512];
+
+    ASSERT_EQ(FR_OK, logFileOpen(&log, LOG_NAME, LOG_SIZE));
+    writePattern(0, 8 * 512);
+    ASSERT_EQ(FR_OK, logFileClose(&log));
+
+    // Read straight from the disk, starting where the first cluster is
+    for (DWORD i = 0; i < 8; i++) {
+        ASSERT_EQ(RES_OK, disk_read(0, actual, log.startSector + i, 1));
+        pattern(expected, sizeof(expected), i * 512);
+        EXPECT_EQ(0, memcmp(expected, actual, sizeof(actual)));
+    }
+}
+
+TEST_F(LogFileTest, noMetadataWritesWhileStreaming)
+{
+    ASSERT_EQ(FR_OK, logFileOpen(&log, LOG_NAME, LOG_SIZE));
+    diskImageResetStats();
+
+    // Leave a partial sector for the sync to write
+    writePattern(0, LOG_SIZE / 2 + 100);
+    ASSERT_EQ(FR_OK, logFileSync(&log));
+
+    EXPECT_EQ(0u, diskImageStats()->metadataSectorsWritten);
+    EXPECT_EQ(0u, diskImageStats()->readCommands);
+    // Every write but the sync is a full multi block write
+    EXPECT_EQ(diskImageStats()->sectorsWritten,
+              (diskImageStats()->writeCommands - 1) * LOG_FILE_BUFFER_SECTORS
+              + 1);
+
+    ASSERT_EQ(FR_OK, logFileClose(&log));
+    EXPECT_GT(diskImageStats()->metadataSectorsWritten, 0u);
+}
+
+TEST_F(LogFileTest, fullFileIsDenied)
+{
+    uint8_t byte = 0;
+
+    ASSERT_EQ(FR_OK, logFileOpen(&log, LOG_NAME, 64 * 1024));
+    writePattern(0, 64 * 1024);
+
+    EXPECT_EQ(FR_DENIED, logFileWrite(&log, &byte, 1));
+    ASSERT_EQ(FR_OK, logFileClose(&log));
+
+    checkFile(LOG_NAME, 64 * 1024, 64 * 1024);
+}
+
+TEST_F(LogFileTest, existingFileIsNotReplaced)
+{
+    ASSERT_EQ(FR_OK, logFileOpen(&log, LOG_NAME, LOG_SIZE));
+    ASSERT_EQ(FR_OK, logFileClose(&log));
+
+    EXPECT_EQ(FR_EXIST, logFileOpen(&log, LOG_NAME, LOG_SIZE));
+}
+
+TEST_F(LogFileTest, tooLargeIsDeniedAndRemoved)
+{
+    FILINFO info;
+
+    EXPECT_EQ(FR_DENIED, logFileOpen(&log, LOG_NAME, 128UL * 1024 * 1024));
+    EXPECT_EQ(FR_NO_FILE, f_stat(LOG_NAME, &info));
+}
+
+TEST_F(LogFileTest, closeFreesUnusedSpace)
+{
+    DWORD before = freeClusters();
+    DWORD clusterBytes = fs.csize * 512;
+
+    ASSERT_EQ(FR_OK, logFileOpen(&log, LOG_NAME, LOG_SIZE));
+    EXPECT_EQ(before - LOG_SIZE / clusterBytes, freeClusters());
+
+    writePattern(0, 10000);
+    ASSERT_EQ(FR_OK, logFileClose(&log));
+
+    EXPECT_EQ(before - (10000 + clusterBytes - 1) / clusterBytes,
+              freeClusters());
+}
+
+TEST_F(LogFileTest, unclosedLogKeepsSyncedData)
+{
+    ASSERT_EQ(FR_OK, logFileOpen(&log, LOG_NAME, LOG_SIZE));
+    writePattern(0, 5000);
+    ASSERT_EQ(FR_OK, logFileSync(&log));
+    // Not synced, lost at power off
+    uint8_t lost[100];
+    memset(lost, 0xAA, sizeof(lost));
+    ASSERT_EQ(FR_OK, logFileWrite(&log, lost, sizeof(lost)));
+
+    // Power off, the file object is abandoned
+    f_mount(NULL, "", 0);
+    mount();
+
+    // The log keeps its pre-allocated size, with zeros after the last sync
+    checkFile(LOG_NAME, 5000, LOG_SIZE);
+}
+
+TEST_F(LogFileTest, fasterThanFatFsWrites)
+{
+    // Typical card, 25 MHz spi and a few ms to move to a new erase block
+    DiskImageLatency_t latency = {200, 170, 300, 2000};
+    const uint32_t pieceSize = 64;
+    const uint32_t length = 2 * 1024 * 1024;
+    uint8_t piece[pieceSize];
+    DiskImageStats_t fatFs, logged;
+    FIL file;
+    UINT written;
+
+    diskImageSetLatency(&latency);
+
+    // Log through FatFs, syncing every 32 KB, about a second of blackbox
+    ASSERT_EQ(FR_OK, f_open(&file, "FATFS.LOG", FA_WRITE | FA_CREATE_NEW));
+    diskImageResetStats();
+    for (uint32_t pos = 0; pos < length; pos += pieceSize) {
+        pattern(piece, pieceSize, pos);
+        ASSERT_EQ(FR_OK, f_write(&file, piece, pieceSize, &written));
+        if ((pos + pieceSize) % (32 * 1024) == 0) {
+            ASSERT_EQ(FR_OK, f_sync(&file));
+        }
+    }
+    ASSERT_EQ(FR_OK, f_close(&file));
+    fatFs = *diskImageStats();
+
+    ASSERT_EQ(FR_OK, logFileOpen(&log, LOG_NAME, 4 * 1024 * 1024));
+    diskImageResetStats();
+    for (uint32_t pos = 0; pos < length; pos += pieceSize) {
+        pattern(piece, pieceSize, pos);
+        ASSERT_EQ(FR_OK, logFileWrite(&log, piece, pieceSize));
+        if ((pos + pieceSize) % (32 * 1024) == 0) {
+            ASSERT_EQ(FR_OK, logFileSync(&log));
+        }
+    }
+    ASSERT_EQ(FR_OK, logFileClose(&log));
+    logged = *diskImageStats();
+
+    printf("f_write:  %.0f KB/s, %u metadata sectors, worst write %u us\n",
+           length / 1024.0 / (fatFs.totalUs / 1e6),
+           fatFs.metadataSectorsWritten, fatFs.worstWriteUs);
+    printf("logFile:  %.0f KB/s, %u metadata sectors, worst write %u us\n",
+           length / 1024.0 / (logged.totalUs / 1e6),
+           logged.metadataSectorsWritten, logged.worstWriteUs);
+
+    EXPECT_LT(logged.totalUs, fatFs.totalUs);
+    EXPECT_LT(logged.metadataSectorsWritten, fatFs.metadataSectorsWritten);
+
+    checkFile(LOG_NAME, length, length);
+}
@@ -0,0 +1,167 @@
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "fc.h"
+#include "loopScheduler.h"
+#include "loopTiming.h"
+}
+
+#include <stdio.h>
+
+// Stand ins for the task handles
+static int controlTask;
+static int imuTask;
+
+class LoopSchedulerTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            loopSchedulerReset();
+        }
+};
+
+TEST_F(LoopSchedulerTest, Period)
+{
+    EXPECT_EQ(5000u, loopSchedulerPeriodUs(200));
+    EXPECT_EQ(500u, loopSchedulerPeriodUs(2000));
+    EXPECT_EQ(250u, loopSchedulerPeriodUs(4000));
+    EXPECT_EQ(125u, loopSchedulerPeriodUs(8000));
+
+    // Not a whole number of us
+    EXPECT_EQ(0u, loopSchedulerPeriodUs(3000));
+    EXPECT_EQ(0u, loopSchedulerPeriodUs(0));
+    // Out of the timer's range
+    EXPECT_EQ(0u, loopSchedulerPeriodUs(20000));
+    EXPECT_EQ(0u, loopSchedulerPeriodUs(10));
+}
+
+TEST_F(LoopSchedulerTest, StartCount)
+{
+    // The timer wraps, releasing, when the us counter is a multiple of the
+    // period plus the phase
+    for (uint32_t phaseUs = 0; phaseUs < 600; phaseUs += 50) {
+        for (uint32_t nowUs = 1000; nowUs < 2000; nowUs += 7) {
+            uint32_t count = loopSchedulerStartCount(nowUs, 250, phaseUs);
+
+            ASSERT_LT(count, 250u);
+            uint32_t releaseUs = nowUs + (250 - count);
+            EXPECT_EQ(phaseUs % 250, releaseUs % 250) << nowUs;
+        }
+    }
+
+    // Across the us counter wrapping
+    EXPECT_EQ(UINT32_MAX % 125, loopSchedulerStartCount(UINT32_MAX, 125, 0));
+}
+
+TEST_F(LoopSchedulerTest, Dividers)
+{
+    ASSERT_EQ(FC_OK, loopSchedulerAddTask(&controlTask, 1));
+    ASSERT_EQ(FC_OK, loopSchedulerAddTask(&imuTask, 4));
+
+    uint32_t controlReleases = 0;
+    uint32_t imuReleases = 0;
+
+    for (int i = 0; i < 40; i++) {
+        uint32_t due = loopSchedulerRelease();
+
+        EXPECT_TRUE(due & 1);
+        EXPECT_EQ(i % 4 == 0, (due & 2) != 0) << i;
+        controlReleases += due & 1;
+        imuReleases += (due >> 1) & 1;
+    }
+
+    EXPECT_EQ(40u, controlReleases);
+    EXPECT_EQ(10u, imuReleases);
+}
+
+TEST_F(LoopSchedulerTest, AddTaskLimits)
+{
+    EXPECT_EQ(FC_ERROR, loopSchedulerAddTask(&controlTask, 0));
+
+    for (int i = 0; i < LOOP_SCHEDULER_MAX_TASKS; i++) {
+        EXPECT_EQ(FC_OK, loopSchedulerAddTask(&controlTask, 1));
+    }
+    EXPECT_EQ(FC_ERROR, loopSchedulerAddTask(&controlTask, 1));
+
+    EXPECT_EQ((1u << LOOP_SCHEDULER_MAX_TASKS) - 1, loopSchedulerRelease());
+}
+
+TEST_F(LoopSchedulerTest, Reset)
+{
+    ASSERT_EQ(FC_OK, loopSchedulerAddTask(&imuTask, 3));
+    loopSchedulerRelease();
+    loopSchedulerRelease();
+
+    loopSchedulerReset();
+    EXPECT_EQ(0u, loopSchedulerRelease());
+
+    // Counting starts again, so the task is due on the first release
+    loopSchedulerReset();
+    ASSERT_EQ(FC_OK, loopSchedulerAddTask(&imuTask, 3));
+    EXPECT_EQ(1u, loopSchedulerRelease());
+    EXPECT_EQ(0u, loopSchedulerRelease());
+}
+
+/*
+ * Model of the release jitter, through loopTiming as on the target. Each
+ * release starts the loop after the interrupt and context switch latency,
+ * plus, now and then, an interrupt already running (the PPM capture, DMA
+ * completions) or a critical section in a lower priority task. With the
+ * loop released in ticks, the same latencies apply but the period can only
+ * be a whole number of ms.
+ */
+#define JITTER_RELEASES        20000
+#define JITTER_LATENCY_US      3   // Interrupt entry, notify and switch
+#define JITTER_BLOCKED_US      20  // Longest time the release is held off
+#define JITTER_BLOCKED_ONE_IN  8
+#define JITTER_RUN_US          60  // controlRates, motors and the log
+
+static uint32_t lcgState;
+
+static uint32_t lcg(void)
+{
+    lcgState = lcgState * 1664525u + 1013904223u;
+    return lcgState >> 8;
+}
+
+static void modelJitter(uint32_t rateHz)
+{
+    uint32_t periodUs = loopSchedulerPeriodUs(rateHz);
+    ASSERT_NE(0u, periodUs);
+
+    lcgState = 12345;
+    loopTimingInit(periodUs);
+
+    uint32_t releaseUs = 1000;
+
+    for (int i = 0; i < JITTER_RELEASES; i++) {
+        uint32_t delayUs = JITTER_LATENCY_US;
+
+        if (lcg() % JITTER_BLOCKED_ONE_IN == 0) {
+            delayUs += lcg() % (JITTER_BLOCKED_US + 1);
+        }
+
+        uint32_t startUs = releaseUs + delayUs;
+        loopTimingUpdate(startUs, startUs + JITTER_RUN_US);
+        releaseUs += periodUs;
+    }
+
+    const TelemetryLoopTiming_t *stats = loopTimingStats();
+
+    printf("%5lu Hz: period %lu..%lu us, jitter %lu us, %lu misses\n",
+           (unsigned long)rateHz, (unsigned long)stats->minPeriodUs,
+           (unsigned long)stats->maxPeriodUs,
+           (unsigned long)(stats->maxPeriodUs - stats->minPeriodUs),
+           (unsigned long)stats->deadlineMisses);
+
+    // The jitter is bounded by the latencies, whatever the rate
+    EXPECT_GE(stats->minPeriodUs, periodUs - JITTER_BLOCKED_US);
+    EXPECT_LE(stats->maxPeriodUs, periodUs + JITTER_BLOCKED_US);
+    EXPECT_EQ(0u, stats->deadlineMisses);
+}
+
+TEST_F(LoopSchedulerTest, JitterModel)
+{
+    modelJitter(2000);
+    modelJitter(4000);
+    modelJitter(8000);
+}
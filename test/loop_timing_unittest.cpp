@@ -0,0 +1,154 @@
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "fc.h"
+#include "loopTiming.h"
+}
+
+#define PERIOD_US 5000
+#define RUN_US    1000
+
+class LoopTimingTest : public ::testing::Test {
+    protected:
+        uint32_t startUs;
+
+        virtual void SetUp() {
+            startUs = 1000;
+            loopTimingInit(PERIOD_US);
+        }
+
+        // Run an iteration periodUs after the last one
+        LoopTimingLevel run(uint32_t periodUs, uint32_t runUs = RUN_US) {
+            startUs += periodUs;
+            return loopTimingUpdate(startUs, startUs + runUs);
+        }
+};
+
+TEST_F(LoopTimingTest, SteadyPeriod)
+{
+    for (int i = 0; i < 100; i++) {
+        EXPECT_EQ(LOOP_TIMING_OK, run(PERIOD_US));
+    }
+
+    const TelemetryLoopTiming_t *stats = loopTimingStats();
+
+    EXPECT_EQ(100u, stats->iterations);
+    EXPECT_EQ(0u, stats->deadlineMisses);
+    EXPECT_EQ(0u, stats->maxLateUs);
+    EXPECT_EQ((uint32_t)PERIOD_US, stats->minPeriodUs);
+    EXPECT_EQ((uint32_t)PERIOD_US, stats->maxPeriodUs);
+    EXPECT_EQ((uint32_t)RUN_US, stats->maxExecutionUs);
+    // The first iteration has no period
+    EXPECT_EQ(99u, stats->histogram[LOOP_TIMING_BUCKETS / 2]);
+}
+
+TEST_F(LoopTimingTest, Buckets)
+{
+    EXPECT_EQ(LOOP_TIMING_BUCKETS / 2u, loopTimingBucket(PERIOD_US));
+    EXPECT_EQ(LOOP_TIMING_BUCKETS / 2u,
+              loopTimingBucket(PERIOD_US + LOOP_TIMING_BUCKET_US - 1));
+    EXPECT_EQ(LOOP_TIMING_BUCKETS / 2u + 1,
+              loopTimingBucket(PERIOD_US + LOOP_TIMING_BUCKET_US));
+    EXPECT_EQ(LOOP_TIMING_BUCKETS / 2u - 1, loopTimingBucket(PERIOD_US - 1));
+
+    // The end buckets count everything beyond them
+    EXPECT_EQ(0u, loopTimingBucket(0));
+    EXPECT_EQ(LOOP_TIMING_BUCKETS - 1u, loopTimingBucket(10 * PERIOD_US));
+}
+
+TEST_F(LoopTimingTest, Jitter)
+{
+    run(PERIOD_US);
+    run(PERIOD_US + 150);
+    run(PERIOD_US - 150);
+    run(PERIOD_US + 150);
+    run(PERIOD_US - 150);
+
+    const TelemetryLoopTiming_t *stats = loopTimingStats();
+
+    EXPECT_EQ(2u, stats->histogram[LOOP_TIMING_BUCKETS / 2 + 1]);
+    EXPECT_EQ(2u, stats->histogram[LOOP_TIMING_BUCKETS / 2 - 2]);
+    EXPECT_EQ(PERIOD_US - 150u, stats->minPeriodUs);
+    EXPECT_EQ(PERIOD_US + 150u, stats->maxPeriodUs);
+    // Starting late but finishing in time is not a miss
+    EXPECT_EQ(150u, stats->maxLateUs);
+    EXPECT_EQ(0u, stats->deadlineMisses);
+}
+
+TEST_F(LoopTimingTest, OneMissThenCatchUp)
+{
+    run(PERIOD_US);
+    EXPECT_EQ(LOOP_TIMING_MISSED, run(PERIOD_US, PERIOD_US + 500));
+
+    // The next iteration starts late, straight after, but is back in time
+    EXPECT_EQ(LOOP_TIMING_OK, run(PERIOD_US + 500));
+    EXPECT_EQ(LOOP_TIMING_OK, run(PERIOD_US - 500));
+
+    const TelemetryLoopTiming_t *stats = loopTimingStats();
+
+    EXPECT_EQ(1u, stats->deadlineMisses);
+    EXPECT_EQ(0u, stats->consecutiveMisses);
+    EXPECT_EQ(1u, stats->maxConsecutiveMisses);
+    EXPECT_EQ(500u, stats->maxLateUs);
+}
+
+TEST_F(LoopTimingTest, RunOfMisses)
+{
+    run(PERIOD_US);
+
+    for (int i = 1; i < LOOP_TIMING_WARN_MISSES; i++) {
+        EXPECT_EQ(LOOP_TIMING_MISSED, run(PERIOD_US, PERIOD_US + 1));
+    }
+    for (int i = LOOP_TIMING_WARN_MISSES; i < LOOP_TIMING_FAIL_MISSES; i++) {
+        EXPECT_EQ(LOOP_TIMING_WARN, run(PERIOD_US, PERIOD_US + 1));
+    }
+    EXPECT_EQ(LOOP_TIMING_FAIL, run(PERIOD_US, PERIOD_US + 1));
+    EXPECT_EQ((uint16_t)LOOP_TIMING_FAIL_MISSES,
+              loopTimingStats()->consecutiveMisses);
+
+    // Recovering clears the run but not the totals
+    EXPECT_EQ(LOOP_TIMING_OK, run(PERIOD_US));
+    EXPECT_EQ(0u, loopTimingStats()->consecutiveMisses);
+    EXPECT_EQ((uint16_t)LOOP_TIMING_FAIL_MISSES,
+              loopTimingStats()->maxConsecutiveMisses);
+    EXPECT_EQ((uint32_t)LOOP_TIMING_FAIL_MISSES,
+              loopTimingStats()->deadlineMisses);
+}
+
+TEST_F(LoopTimingTest, CounterWraps)
+{
+    startUs = UINT32_MAX - 2 * PERIOD_US;
+
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(LOOP_TIMING_OK, run(PERIOD_US));
+    }
+
+    EXPECT_EQ(0u, loopTimingStats()->deadlineMisses);
+    EXPECT_EQ((uint32_t)PERIOD_US, loopTimingStats()->maxPeriodUs);
+    EXPECT_EQ((uint32_t)RUN_US, loopTimingStats()->maxExecutionUs);
+}
+
+TEST_F(LoopTimingTest, StallRealigns)
+{
+    run(PERIOD_US);
+
+    // e.g. halted in the debugger, not counted as late or as misses after
+    run(100 * PERIOD_US);
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(LOOP_TIMING_OK, run(PERIOD_US));
+    }
+
+    EXPECT_EQ(0u, loopTimingStats()->maxLateUs);
+    EXPECT_EQ(0u, loopTimingStats()->deadlineMisses);
+    EXPECT_EQ(1u, loopTimingStats()->histogram[LOOP_TIMING_BUCKETS - 1]);
+}
+
+TEST_F(LoopTimingTest, EarlyStartMovesGrid)
+{
+    run(PERIOD_US);
+    run(PERIOD_US - 300);
+
+    // Now on the earlier phase, so a full period run after it is in time
+    EXPECT_EQ(LOOP_TIMING_OK, run(PERIOD_US, PERIOD_US));
+    EXPECT_EQ(0u, loopTimingStats()->maxLateUs);
+}
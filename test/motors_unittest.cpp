@@ -0,0 +1,132 @@
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "fc.h"
+#include "fake_hal.h"
+#include "motors.h"
+
+extern TIM_HandleTypeDef htim1;
+}
+
+// 1 MHz counter, MOTOR_OUTPUT_PERIOD in motors.c
+#define PERIOD_US (1000000 / 490)
+
+static const MotorNum motors[MOTOR_COUNT] = {
+    MOTOR_BACK_RIGHT, MOTOR_BACK_LEFT, MOTOR_FRONT_LEFT, MOTOR_FRONT_RIGHT
+};
+
+class MotorsTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            fakeHalReset();
+            htim1.State = HAL_TIM_STATE_RESET;
+            motorsInit();
+        }
+
+        void expectActive(const uint32_t compare[MOTOR_COUNT]) {
+            for (int i = 0; i < MOTOR_COUNT; i++) {
+                EXPECT_EQ(compare[MOTOR_INDEX(motors[i])],
+                          fakeTimActiveCompare(TIM1, motors[i]))
+                    << "motor " << i;
+            }
+        }
+};
+
+TEST_F(MotorsTest, Init)
+{
+    // 100 MHz APB2 timer clock divided to 1 MHz
+    EXPECT_EQ(99u, TIM1->PSC);
+    EXPECT_EQ((uint32_t)PERIOD_US, TIM1->ARR);
+    EXPECT_TRUE(TIM1->CR1 & TIM_CR1_ARPE);
+    EXPECT_TRUE(TIM1->CCMR1 & TIM_CCMR1_OC1PE);
+    EXPECT_TRUE(TIM1->CCMR1 & TIM_CCMR1_OC2PE);
+    EXPECT_TRUE(TIM1->CCMR2 & TIM_CCMR2_OC3PE);
+    EXPECT_TRUE(TIM1->CCMR2 & TIM_CCMR2_OC4PE);
+    EXPECT_EQ((uint32_t)GPIO_MODE_AF_PP, fakeGpioMode(GPIOA, GPIO_PIN_8));
+    EXPECT_EQ((uint32_t)GPIO_MODE_AF_PP, fakeGpioMode(GPIOA, GPIO_PIN_11));
+    EXPECT_EQ(0u, fakeHalErrorHandlerCalls());
+
+    // Nothing is driven until started
+    for (int i = 0; i < MOTOR_COUNT; i++) {
+        EXPECT_FALSE(fakeTimOutputEnabled(TIM1, motors[i]));
+    }
+}
+
+TEST_F(MotorsTest, StartAndDeinit)
+{
+    const uint32_t low[MOTOR_COUNT] = {
+        MOTOR_LOW_VAL_US, MOTOR_LOW_VAL_US, MOTOR_LOW_VAL_US, MOTOR_LOW_VAL_US
+    };
+
+    ASSERT_EQ(FC_OK, motorsStart());
+    for (int i = 0; i < MOTOR_COUNT; i++) {
+        EXPECT_TRUE(fakeTimOutputEnabled(TIM1, motors[i]));
+    }
+    expectActive(low);
+
+    ASSERT_EQ(FC_OK, motorsDeinit());
+    for (int i = 0; i < MOTOR_COUNT; i++) {
+        EXPECT_FALSE(fakeTimOutputEnabled(TIM1, motors[i]));
+    }
+    EXPECT_FALSE(TIM1->CR1 & TIM_CR1_CEN);
+}
+
+TEST_F(MotorsTest, WriteTakesEffectAtUpdate)
+{
+    const uint32_t low[MOTOR_COUNT] = {
+        MOTOR_LOW_VAL_US, MOTOR_LOW_VAL_US, MOTOR_LOW_VAL_US, MOTOR_LOW_VAL_US
+    };
+    const uint32_t compare[MOTOR_COUNT] = {1100, 1200, 1300, 1400};
+    uint32_t readBack[MOTOR_COUNT];
+
+    ASSERT_EQ(FC_OK, motorsStart());
+
+    // Part way through a period, the outputs finish it with the old values
+    fakeHalRunForUs(PERIOD_US / 2);
+    uint32_t updates = fakeTimStats(TIM1)->updates;
+    ASSERT_EQ(FC_OK, motorsWriteAll(compare));
+    expectActive(low);
+
+    motorsGetAll(readBack);
+    for (int i = 0; i < MOTOR_COUNT; i++) {
+        EXPECT_EQ(compare[i], readBack[i]);
+    }
+
+    fakeHalRunForUs(PERIOD_US / 2 + 2);
+    EXPECT_EQ(updates + 1, fakeTimStats(TIM1)->updates);
+    expectActive(compare);
+
+    ASSERT_EQ(FC_OK, motorsStop());
+    fakeHalRunForUs(PERIOD_US + 1);
+    expectActive(low);
+}
+
+TEST_F(MotorsTest, NoUpdateWhileDisabled)
+{
+    const uint32_t compare[MOTOR_COUNT] = {1100, 1200, 1300, 1400};
+
+    ASSERT_EQ(FC_OK, motorsStart());
+    uint32_t updates = fakeTimStats(TIM1)->updates;
+
+    // A period ending with UDIS set, as if motorsWriteAll were interrupted
+    // between its compare writes, latches nothing
+    TIM1->CR1 |= TIM_CR1_UDIS;
+    TIM1->CCR1 = compare[0];
+    fakeHalRunForUs(PERIOD_US + 1);
+    EXPECT_EQ(updates, fakeTimStats(TIM1)->updates);
+    EXPECT_EQ((uint32_t)MOTOR_LOW_VAL_US, fakeTimActiveCompare(TIM1, TIM_CHANNEL_1));
+
+    TIM1->CR1 &= ~TIM_CR1_UDIS;
+    fakeHalRunForUs(PERIOD_US + 1);
+    EXPECT_EQ(compare[0], fakeTimActiveCompare(TIM1, TIM_CHANNEL_1));
+}
+
+TEST_F(MotorsTest, SetMotorLimits)
+{
+    EXPECT_EQ(FC_OK, setMotor(MOTOR_FRONT_LEFT, 1500));
+    EXPECT_EQ(1500u, TIM1->CCR3);
+
+    // Out of range goes low, not to the nearest limit
+    EXPECT_EQ(FC_ERROR, setMotor(MOTOR_FRONT_LEFT, MOTOR_HIGH_VAL_US + 1));
+    EXPECT_EQ((uint32_t)MOTOR_LOW_VAL_US, TIM1->CCR3);
+}
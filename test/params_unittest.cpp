@@ -0,0 +1,423 @@
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "fff.h"
+
+extern "C" {
+#include "fc.h"
+#include "params.h"
+#include "paramStore.h"
+#include "rate_control.h"
+#include "telemetry.h"
+#include "uartTx.h"
+}
+
+FAKE_VALUE_FUNC(const uint32_t *, paramFlashBank, int);
+FAKE_VALUE_FUNC(FC_Status, paramFlashErase, int);
+FAKE_VALUE_FUNC(FC_Status, paramFlashProgram, int, uint32_t, uint32_t);
+
+#define BANK_WORDS (PARAM_STORE_BANK_SIZE / sizeof(uint32_t))
+
+// Flash behind the fakes. Programming can only clear bits, like the real
+// thing
+static uint32_t flash[PARAM_STORE_BANK_COUNT][BANK_WORDS];
+static int eraseCount[PARAM_STORE_BANK_COUNT];
+// Words that can be programmed before the power is cut, -1 for no limit.
+// Once cut, flash can't be changed until the test "resets"
+static int wordsBeforePowerCut;
+
+const uint32_t *paramFlashBank_custom_fake(int bank)
+{
+    return flash[bank];
+}
+
+FC_Status paramFlashErase_custom_fake(int bank)
+{
+    if (wordsBeforePowerCut == 0) {
+        return FC_ERROR;
+    }
+
+    memset(flash[bank], 0xFF, sizeof(flash[bank]));
+    eraseCount[bank]++;
+    return FC_OK;
+}
+
+FC_Status paramFlashProgram_custom_fake(int bank, uint32_t offset, uint32_t word)
+{
+    if (wordsBeforePowerCut == 0) {
+        return FC_ERROR;
+    }
+    if (wordsBeforePowerCut > 0) {
+        wordsBeforePowerCut--;
+    }
+
+    flash[bank][offset] &= word;
+    return FC_OK;
+}
+
+static ParamValue_t floatValue(float f)
+{
+    ParamValue_t value;
+    value.f = f;
+    return value;
+}
+
+class ParamStoreTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            RESET_FAKE(paramFlashBank);
+            RESET_FAKE(paramFlashErase);
+            RESET_FAKE(paramFlashProgram);
+            FFF_RESET_HISTORY();
+
+            paramFlashBank_fake.custom_fake = paramFlashBank_custom_fake;
+            paramFlashErase_fake.custom_fake = paramFlashErase_custom_fake;
+            paramFlashProgram_fake.custom_fake = paramFlashProgram_custom_fake;
+
+            memset(flash, 0xFF, sizeof(flash));
+            memset(eraseCount, 0, sizeof(eraseCount));
+            wordsBeforePowerCut = -1;
+
+            ASSERT_EQ(FC_OK, paramStoreInit());
+        }
+
+        // Restart, the way paramsLoad sees the store after a reset
+        void reset() {
+            wordsBeforePowerCut = -1;
+            ASSERT_EQ(FC_OK, paramStoreInit());
+        }
+
+        uint32_t load(uint32_t hash, uint32_t missing) {
+            uint32_t value = missing;
+            paramStoreLoad(&hash, &value, 1);
+            return value;
+        }
+};
+
+TEST_F(ParamStoreTest, BlankFlashStartsEmpty)
+{
+    EXPECT_EQ(1, eraseCount[0] + eraseCount[1]);
+    EXPECT_EQ(1u, paramStoreStats()->recordsUsed);
+
+    uint32_t hashes[2] = {1, 2};
+    uint32_t values[2] = {10, 20};
+    EXPECT_EQ(0u, paramStoreLoad(hashes, values, 2));
+    EXPECT_EQ(10u, values[0]);
+    EXPECT_EQ(20u, values[1]);
+}
+
+TEST_F(ParamStoreTest, ValuesSurviveReset)
+{
+    uint32_t hashes[3] = {0x1111, 0x2222, 0x3333};
+    uint32_t values[3] = {1, 2, 3};
+    ASSERT_EQ(FC_OK, paramStoreSave(hashes, values, 3));
+
+    reset();
+
+    // Loaded by hash, whatever the order
+    uint32_t reordered[2] = {0x3333, 0x1111};
+    uint32_t loaded[2] = {0, 0};
+    EXPECT_EQ(2u, paramStoreLoad(reordered, loaded, 2));
+    EXPECT_EQ(3u, loaded[0]);
+    EXPECT_EQ(1u, loaded[1]);
+}
+
+TEST_F(ParamStoreTest, OnlyChangesAreAppended)
+{
+    uint32_t hashes[3] = {0x1111, 0x2222, 0x3333};
+    uint32_t values[3] = {1, 2, 3};
+    ASSERT_EQ(FC_OK, paramStoreSave(hashes, values, 3));
+    uint32_t used = paramStoreStats()->recordsUsed;
+    int programs = paramFlashProgram_fake.call_count;
+
+    ASSERT_EQ(FC_OK, paramStoreSave(hashes, values, 3));
+    EXPECT_EQ(programs, (int)paramFlashProgram_fake.call_count);
+
+    values[1] = 22;
+    ASSERT_EQ(FC_OK, paramStoreSave(hashes, values, 3));
+    EXPECT_EQ(used + 1, paramStoreStats()->recordsUsed);
+
+    reset();
+    EXPECT_EQ(22u, load(0x2222, 0));
+    EXPECT_EQ(used + 1, paramStoreStats()->recordsUsed);
+}
+
+TEST_F(ParamStoreTest, FullBankCompactsAndWearIsShared)
+{
+    uint32_t hashes[2] = {0x1111, 0x2222};
+    uint32_t values[2] = {0, 7};
+
+    // Enough saves to fill each bank several times
+    for (uint32_t i = 1; i <= 5 * PARAM_STORE_BANK_RECORDS; i++) {
+        values[0] = i;
+        ASSERT_EQ(FC_OK, paramStoreSave(hashes, values, 2));
+        ASSERT_LE(paramStoreStats()->recordsUsed, PARAM_STORE_BANK_RECORDS);
+    }
+
+    EXPECT_GE(paramStoreStats()->compactions, 4u);
+    EXPECT_LE(abs(eraseCount[0] - eraseCount[1]), 1);
+
+    reset();
+    EXPECT_EQ(5 * PARAM_STORE_BANK_RECORDS, load(0x1111, 0));
+    EXPECT_EQ(7u, load(0x2222, 0));
+}
+
+TEST_F(ParamStoreTest, CutRecordIsIgnored)
+{
+    uint32_t hash = 0x1111;
+    uint32_t value = 1;
+    ASSERT_EQ(FC_OK, paramStoreSave(&hash, &value, 1));
+
+    // Power cut after the hash and value, before the check
+    wordsBeforePowerCut = 2;
+    value = 2;
+    EXPECT_EQ(FC_ERROR, paramStoreSave(&hash, &value, 1));
+
+    reset();
+    EXPECT_EQ(1u, load(0x1111, 0));
+
+    // The cut record's slot isn't reused
+    value = 3;
+    ASSERT_EQ(FC_OK, paramStoreSave(&hash, &value, 1));
+    reset();
+    EXPECT_EQ(3u, load(0x1111, 0));
+}
+
+TEST_F(ParamStoreTest, CutCompactionKeepsOldBank)
+{
+    uint32_t hashes[2] = {0x1111, 0x2222};
+    uint32_t values[2] = {0, 5};
+
+    // Fill the bank up to the last record
+    do {
+        values[0]++;
+        ASSERT_EQ(FC_OK, paramStoreSave(hashes, values, 2));
+    } while (paramStoreStats()->recordsUsed < PARAM_STORE_BANK_RECORDS);
+    uint32_t lastSaved = values[0];
+    uint32_t generation = paramStoreStats()->generation;
+
+    // The next save compacts, cut it after the records but before the header
+    wordsBeforePowerCut = 2 * 3;
+    values[0]++;
+    EXPECT_EQ(FC_ERROR, paramStoreSave(hashes, values, 2));
+
+    reset();
+    EXPECT_EQ(generation, paramStoreStats()->generation);
+    EXPECT_EQ(lastSaved, load(0x1111, 0));
+    EXPECT_EQ(5u, load(0x2222, 0));
+
+    // And compaction works next time
+    ASSERT_EQ(FC_OK, paramStoreSave(hashes, values, 2));
+    reset();
+    EXPECT_EQ(generation + 1, paramStoreStats()->generation);
+    EXPECT_EQ(lastSaved + 1, load(0x1111, 0));
+}
+
+class ParamsTest : public ParamStoreTest {
+    protected:
+        virtual void SetUp() {
+            ParamStoreTest::SetUp();
+            uartTxReset();
+            telemetryInit(100000);
+            ASSERT_EQ(FC_OK, paramsInit());
+        }
+
+        // Frames sent to the ground station since the last call
+        std::vector<TelemetryParamValue_t> replies() {
+            std::vector<TelemetryParamValue_t> out;
+            TelemetryParser_t parser;
+            const uint8_t *data;
+            uint32_t length;
+
+            telemetryParserReset(&parser);
+            while ((length = uartTxPeek(&data)) != 0) {
+                const uint8_t *next = data;
+                uint32_t remaining = length;
+                const TelemetryMessageInfo_t *info;
+
+                while ((info = telemetryParse(&parser, &next, &remaining)) != NULL) {
+                    if (info == telemetryMessageInfo(TELEMETRY_MSG_PARAM_VALUE)) {
+                        TelemetryParamValue_t value;
+                        memcpy(&value, &parser.frame[TELEMETRY_HEADER_LENGTH],
+                               sizeof(value));
+                        out.push_back(value);
+                    }
+                }
+                uartTxRelease(length);
+            }
+
+            return out;
+        }
+};
+
+TEST_F(ParamsTest, TableHashesAndLookup)
+{
+    EXPECT_EQ(paramHashName("RATE_P"), PARAM_HASH("RATE_P"));
+    EXPECT_NE(PARAM_HASH("RATE_P"), PARAM_HASH("RATE_I"));
+
+    for (int id = 0; id < PARAM_COUNT; id++) {
+        const ParamInfo_t *info = paramInfo((ParamId)id);
+        EXPECT_EQ(id, paramFind(info->name));
+        EXPECT_EQ(info->defaultValue.raw, paramGet((ParamId)id).raw);
+    }
+
+    EXPECT_EQ(-1, paramFind("RATE_X"));
+    EXPECT_EQ(-1, paramFind(""));
+
+    // A MAVLink param_id that fills the field has no terminator
+    char full[PARAM_NAME_LENGTH + 1];
+    memset(full, 'A', sizeof(full));
+    EXPECT_EQ(-1, paramFind(full));
+    EXPECT_EQ(paramHashName(full), paramHashName("AAAAAAAAAAAAAAAA"));
+}
+
+TEST_F(ParamsTest, SetChecksRange)
+{
+    const ParamInfo_t *info = paramInfo(PARAM_RATE_P);
+
+    EXPECT_EQ(FC_OK, paramSet(PARAM_RATE_P, info->max));
+    EXPECT_EQ(FC_ERROR, paramSet(PARAM_RATE_P, floatValue(info->max.f * 2)));
+    EXPECT_EQ(FC_ERROR, paramSet(PARAM_RATE_P, floatValue(-1)));
+    EXPECT_EQ(FC_ERROR, paramSet(PARAM_RATE_P, floatValue(NAN)));
+    EXPECT_EQ(FC_ERROR, paramSet(PARAM_COUNT, floatValue(0)));
+    EXPECT_EQ(info->max.f, paramGet(PARAM_RATE_P).f);
+}
+
+TEST_F(ParamsTest, NewValuesOnlyTakeEffectInParamsApply)
+{
+    float gainP = 0;
+    float gainD = 0;
+
+    paramRegister(PARAM_RATE_P, &gainP);
+    paramRegister(PARAM_RATE_D, &gainD);
+    EXPECT_EQ(RATE_P_DEFAULT, gainP);
+
+    ASSERT_EQ(FC_OK, paramSet(PARAM_RATE_P, floatValue(5)));
+    ASSERT_EQ(FC_OK, paramSet(PARAM_RATE_D, floatValue(3)));
+    EXPECT_EQ(RATE_P_DEFAULT, gainP);
+    EXPECT_EQ(RATE_D_DEFAULT, gainD);
+    EXPECT_EQ(5.0f, paramGet(PARAM_RATE_P).f);
+
+    paramsApply();
+    EXPECT_EQ(5.0f, gainP);
+    EXPECT_EQ(3.0f, gainD);
+
+    // Applying again changes nothing
+    gainP = 1;
+    paramsApply();
+    EXPECT_EQ(1.0f, gainP);
+}
+
+TEST_F(ParamsTest, SavedOnceSettledAndDisarmed)
+{
+    ASSERT_EQ(FC_OK, paramsLoad());
+    ASSERT_EQ(FC_OK, paramSet(PARAM_RATE_I, floatValue(0.5)));
+    EXPECT_NE(0u, paramsUnsaved());
+
+    paramsUpdate(0);
+    paramsUpdate(PARAM_SAVE_DELAY_MS - 1);
+    EXPECT_NE(0u, paramsUnsaved());
+
+    // Flash writes stall the cpu, never in flight
+    paramsSetArmed(true);
+    paramsUpdate(PARAM_SAVE_DELAY_MS);
+    EXPECT_NE(0u, paramsUnsaved());
+    EXPECT_EQ(0u, paramStoreStats()->recordsWritten);
+
+    paramsSetArmed(false);
+    paramsUpdate(PARAM_SAVE_DELAY_MS + 1);
+    EXPECT_EQ(0u, paramsUnsaved());
+
+    // After a reset
+    ASSERT_EQ(FC_OK, paramsInit());
+    EXPECT_EQ(RATE_I_DEFAULT, paramGet(PARAM_RATE_I).f);
+    ASSERT_EQ(FC_OK, paramsLoad());
+    EXPECT_EQ(0.5f, paramGet(PARAM_RATE_I).f);
+    EXPECT_EQ(0u, paramsUnsaved());
+}
+
+TEST_F(ParamsTest, OutOfRangeSavedValueIgnored)
+{
+    uint32_t hash = paramInfo(PARAM_RATE_D)->hash;
+    ParamValue_t tooBig = floatValue(paramInfo(PARAM_RATE_D)->max.f + 1);
+    ASSERT_EQ(FC_OK, paramStoreSave(&hash, &tooBig.raw, 1));
+
+    ASSERT_EQ(FC_OK, paramsLoad());
+    EXPECT_EQ(RATE_D_DEFAULT, paramGet(PARAM_RATE_D).f);
+}
+
+TEST_F(ParamsTest, MavlinkSetRepliesWithValue)
+{
+    TelemetryParamSet_t set;
+    uint8_t payload[sizeof(set)];
+
+    memset(&set, 0, sizeof(set));
+    set.paramValue = 7.5;
+    set.targetSystem = TELEMETRY_SYSTEM_ID;
+    strncpy(set.paramId, "RATE_P", sizeof(set.paramId));
+    set.paramType = TELEMETRY_MAV_PARAM_TYPE_REAL32;
+    memcpy(payload, &set, sizeof(set));
+
+    paramsHandleMessage(TELEMETRY_MSG_PARAM_SET, payload);
+    EXPECT_EQ(7.5f, paramGet(PARAM_RATE_P).f);
+
+    std::vector<TelemetryParamValue_t> r = replies();
+    ASSERT_EQ(1u, r.size());
+    EXPECT_EQ(7.5f, r[0].paramValue);
+    EXPECT_EQ(PARAM_COUNT, r[0].paramCount);
+    EXPECT_EQ(PARAM_RATE_P, r[0].paramIndex);
+    EXPECT_EQ(0, strncmp("RATE_P", r[0].paramId, sizeof(r[0].paramId)));
+
+    // Rejected, the reply has the value still in use
+    set.paramValue = -1;
+    memcpy(payload, &set, sizeof(set));
+    paramsHandleMessage(TELEMETRY_MSG_PARAM_SET, payload);
+    r = replies();
+    ASSERT_EQ(1u, r.size());
+    EXPECT_EQ(7.5f, r[0].paramValue);
+
+    // For another system
+    set.paramValue = 1;
+    set.targetSystem = TELEMETRY_SYSTEM_ID + 1;
+    memcpy(payload, &set, sizeof(set));
+    paramsHandleMessage(TELEMETRY_MSG_PARAM_SET, payload);
+    EXPECT_EQ(0u, replies().size());
+    EXPECT_EQ(7.5f, paramGet(PARAM_RATE_P).f);
+}
+
+TEST_F(ParamsTest, MavlinkReadAndList)
+{
+    TelemetryParamRequestRead_t read;
+    TelemetryParamRequestList_t list = {TELEMETRY_SYSTEM_ID, 0};
+    uint8_t payload[sizeof(read)];
+
+    memset(&read, 0, sizeof(read));
+    read.paramIndex = -1;
+    strncpy(read.paramId, "RATE_D", sizeof(read.paramId));
+    memcpy(payload, &read, sizeof(read));
+    paramsHandleMessage(TELEMETRY_MSG_PARAM_REQUEST_READ, payload);
+
+    std::vector<TelemetryParamValue_t> r = replies();
+    ASSERT_EQ(1u, r.size());
+    EXPECT_EQ(PARAM_RATE_D, r[0].paramIndex);
+    EXPECT_EQ(RATE_D_DEFAULT, r[0].paramValue);
+
+    // Sent a few at a time
+    memcpy(payload, &list, sizeof(list));
+    paramsHandleMessage(TELEMETRY_MSG_PARAM_REQUEST_LIST, payload);
+    std::vector<TelemetryParamValue_t> all;
+    for (int i = 0; i < PARAM_COUNT; i++) {
+        paramsUpdate(i * PARAM_PERIOD_MS);
+        r = replies();
+        ASSERT_LE(r.size(), (size_t)PARAM_LIST_BURST);
+        all.insert(all.end(), r.begin(), r.end());
+    }
+
+    ASSERT_EQ((size_t)PARAM_COUNT, all.size());
+    for (int id = 0; id < PARAM_COUNT; id++) {
+        EXPECT_EQ(id, all[id].paramIndex);
+        EXPECT_EQ(paramGet((ParamId)id).f, all[id].paramValue);
+    }
+}
@@ -0,0 +1,191 @@
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <string.h>
+
+extern "C" {
+#include "fc.h"
+#include "fake_hal.h"
+#include "ppm.h"
+#include "topics.h"
+
+void ppmReSync(void);
+extern volatile uint32_t lastCaptureUs;
+
+// As TOPIC_DEFINE, which C++ warns about. topics.c needs the loop scheduler
+static tPpmSignal rcInputTopicBuffers[2];
+Topic_t rcInputTopic;
+}
+
+#define FRAME_SPACE_US  6000
+
+static const uint16_t frame[RC_CHANNEL_IN_COUNT] = {
+    1500, 1500, 1000, 1500, 2000, 1000, 1200, 1800
+};
+
+static void edgeEvent(void *arg)
+{
+    (void)arg;
+    fakeTimInputEdge(TIM5, TIM_CHANNEL_1);
+}
+
+class PpmTest : public ::testing::Test {
+    protected:
+        TopicReader_t reader;
+
+        virtual void SetUp() {
+            fakeHalReset();
+            htim5.State = HAL_TIM_STATE_RESET;
+
+            memset(&rcInputTopic, 0, sizeof(rcInputTopic));
+            rcInputTopic.name = "rcInputTopic";
+            rcInputTopic.size = sizeof(tPpmSignal);
+            rcInputTopic.buffers = (uint8_t *)rcInputTopicBuffers;
+            topicBusInit(fakeHalNowUs);
+
+            lastCaptureUs = 0;
+            ppmReSync();
+            ppmInit();
+            topicSubscribe(&reader, &rcInputTopic);
+        }
+
+        // An edge starts each channel, the frame space ends with the first
+        void sendFrame(const uint16_t channels[RC_CHANNEL_IN_COUNT],
+                       uint32_t frameSpaceUs = FRAME_SPACE_US) {
+            fakeHalRunForUs(frameSpaceUs);
+            fakeTimInputEdge(TIM5, TIM_CHANNEL_1);
+            for (int i = 0; i < RC_CHANNEL_IN_COUNT; i++) {
+                fakeHalRunForUs(channels[i]);
+                fakeTimInputEdge(TIM5, TIM_CHANNEL_1);
+            }
+        }
+
+        void expectFrame(const uint16_t channels[RC_CHANNEL_IN_COUNT]) {
+            tPpmSignal signal;
+
+            ASSERT_TRUE(topicUpdate(&reader, &signal));
+            for (int i = 0; i < RC_CHANNEL_IN_COUNT; i++) {
+                EXPECT_EQ(channels[i], signal.signals[i]) << "channel " << i;
+            }
+        }
+};
+
+TEST_F(PpmTest, Init)
+{
+    // 100 MHz TIM5 kernel clock (APB1 / 2, doubled) divided to 1 MHz
+    EXPECT_EQ(99u, TIM5->PSC);
+    EXPECT_EQ(0xFFFFFFFFu, TIM5->ARR);
+    EXPECT_TRUE(TIM5->CR1 & TIM_CR1_CEN);
+    EXPECT_TRUE(TIM5->DIER & TIM_DIER_CC1IE);
+    EXPECT_TRUE(fakeIrqEnabled(TIM5_IRQn));
+    EXPECT_EQ((uint32_t)GPIO_MODE_AF_PP, fakeGpioMode(GPIOA, GPIO_PIN_0));
+    EXPECT_EQ(0u, fakeHalErrorHandlerCalls());
+
+    fakeHalRunForUs(1234);
+    EXPECT_EQ(1234u, TIM5->CNT);
+}
+
+TEST_F(PpmTest, DecodesFrame)
+{
+    sendFrame(frame);
+    expectFrame(frame);
+
+    sendFrame(frame);
+    expectFrame(frame);
+    EXPECT_EQ(0u, reader.missed);
+}
+
+TEST_F(PpmTest, TaskWakesOnFrame)
+{
+    uint64_t edgeNs = FRAME_SPACE_US * 1000ULL;
+
+    // The whole frame arrives while the reader is blocked in topicWait
+    fakeHalSchedule(edgeNs, edgeEvent, NULL);
+    for (int i = 0; i < RC_CHANNEL_IN_COUNT; i++) {
+        edgeNs += frame[i] * 1000ULL;
+        fakeHalSchedule(edgeNs, edgeEvent, NULL);
+    }
+
+    ASSERT_EQ(FC_OK, topicWait(&reader, 100));
+    EXPECT_EQ(edgeNs, fakeHalNowNs());
+    EXPECT_EQ(1u, fakeRtosYieldsFromISR());
+    expectFrame(frame);
+
+    // Nothing more comes, so the next wait times out
+    EXPECT_EQ(FC_TIMEOUT, topicWait(&reader, 20));
+    EXPECT_EQ(edgeNs + 20 * 1000000ULL, fakeHalNowNs());
+}
+
+TEST_F(PpmTest, ShortFrameSpaceResyncs)
+{
+    // Too short for a frame space, the decoder waits for the next one
+    sendFrame(frame, 3000);
+    EXPECT_FALSE(topicUpdated(&reader));
+
+    sendFrame(frame);
+    expectFrame(frame);
+}
+
+TEST_F(PpmTest, LongPulseResyncs)
+{
+    uint16_t broken[RC_CHANNEL_IN_COUNT];
+
+    memcpy(broken, frame, sizeof(broken));
+    broken[3] = 2500;
+
+    sendFrame(broken);
+    EXPECT_FALSE(topicUpdated(&reader));
+
+    sendFrame(frame);
+    expectFrame(frame);
+}
+
+TEST_F(PpmTest, MissedCaptureDropsFrame)
+{
+    fakeHalRunForUs(FRAME_SPACE_US);
+    fakeTimInputEdge(TIM5, TIM_CHANNEL_1);
+    fakeHalRunForUs(frame[0]);
+    fakeTimInputEdge(TIM5, TIM_CHANNEL_1);
+
+    // The interrupt is held off over two edges, the first capture is lost
+    HAL_NVIC_DisableIRQ(TIM5_IRQn);
+    fakeHalRunForUs(frame[1]);
+    fakeTimInputEdge(TIM5, TIM_CHANNEL_1);
+    fakeHalRunForUs(frame[2]);
+    fakeTimInputEdge(TIM5, TIM_CHANNEL_1);
+    EXPECT_TRUE(fakeIrqPending(TIM5_IRQn));
+    EXPECT_EQ(1u, fakeTimStats(TIM5)->overcaptures);
+    HAL_NVIC_EnableIRQ(TIM5_IRQn);
+
+    // The rest of the frame is out of step, so none of it is published
+    for (int i = 3; i < RC_CHANNEL_IN_COUNT; i++) {
+        fakeHalRunForUs(frame[i]);
+        fakeTimInputEdge(TIM5, TIM_CHANNEL_1);
+    }
+    EXPECT_FALSE(topicUpdated(&reader));
+
+    sendFrame(frame);
+    expectFrame(frame);
+}
+
+TEST_F(PpmTest, CaptureCost)
+{
+    const int frames = 2000;
+    tPpmSignal signal;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) {
+        sendFrame(frame);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    ASSERT_TRUE(topicUpdate(&reader, &signal));
+    EXPECT_EQ((uint32_t)frames * (RC_CHANNEL_IN_COUNT + 1),
+              fakeTimStats(TIM5)->captures);
+
+    // Host time, capture interrupt and the simulated time between edges
+    double nsPerEdge = std::chrono::duration<double, std::nano>(elapsed).count()
+                       / fakeTimStats(TIM5)->captures;
+    RecordProperty("HostNsPerEdge", (int)nsPerEdge);
+    printf("ppm: %.0f host ns per edge\n", nsPerEdge);
+}
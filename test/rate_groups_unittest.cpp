@@ -0,0 +1,208 @@
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "fc.h"
+#include "rateGroups.h"
+}
+
+// Simulated us clock, each group advances it by the time it takes
+static uint32_t nowUs;
+static uint32_t fastUs;
+static uint32_t slowUs;
+static uint32_t fastRuns;
+static uint32_t slowRuns;
+static uint32_t otherRuns;
+
+static uint32_t simClockUs(void)
+{
+    return nowUs;
+}
+
+static void fastGroup(void)
+{
+    nowUs += fastUs;
+    fastRuns++;
+}
+
+static void slowGroup(void)
+{
+    nowUs += slowUs;
+    slowRuns++;
+}
+
+static void otherGroup(void)
+{
+    nowUs += 30;
+    otherRuns++;
+}
+
+class RateGroupsTest : public ::testing::Test {
+    protected:
+        RateGroupSet_t set;
+        RateGroupStats_t stats[4];
+
+        virtual void SetUp() {
+            nowUs = UINT32_MAX - 1000; // Times across the clock wrapping
+            fastUs = 10;
+            slowUs = 40;
+            fastRuns = 0;
+            slowRuns = 0;
+            otherRuns = 0;
+        }
+
+        // Run iterations, periodUs apart on the simulated clock
+        void run(uint32_t iterations, uint32_t periodUs = 1000) {
+            for (uint32_t i = 0; i < iterations; i++) {
+                uint32_t startUs = nowUs;
+                rateGroupsRun(&set);
+                nowUs = startUs + periodUs;
+            }
+        }
+};
+
+TEST_F(RateGroupsTest, Dividers)
+{
+    static const RateGroup_t groups[] = {
+        RATE_GROUP(fastGroup,  "fast",  1,  0, 20),
+        RATE_GROUP(slowGroup,  "slow",  10, 3, 50),
+        RATE_GROUP(otherGroup, "other", 4,  2, 50),
+    };
+
+    ASSERT_EQ(FC_OK, rateGroupsInit(&set, groups, stats, 3, 1000, simClockUs));
+
+    run(100);
+
+    EXPECT_EQ(100u, fastRuns);
+    EXPECT_EQ(10u, slowRuns);
+    EXPECT_EQ(25u, otherRuns);
+
+    EXPECT_EQ(100u, stats[0].runs);
+    EXPECT_EQ(10u, stats[0].maxUs);
+    EXPECT_EQ(40u, stats[1].lastUs);
+    EXPECT_EQ(0u, stats[0].overruns + stats[1].overruns + stats[2].overruns);
+}
+
+TEST_F(RateGroupsTest, Phase)
+{
+    static const RateGroup_t groups[] = {
+        RATE_GROUP(slowGroup, "slow", 5, 3, 50),
+    };
+
+    ASSERT_EQ(FC_OK, rateGroupsInit(&set, groups, stats, 1, 1000, simClockUs));
+
+    for (uint32_t iteration = 0; iteration < 20; iteration++) {
+        uint32_t before = slowRuns;
+        rateGroupsRun(&set);
+        EXPECT_EQ(iteration % 5 == 3, slowRuns != before) << iteration;
+    }
+}
+
+TEST_F(RateGroupsTest, InvalidTable)
+{
+    static const RateGroup_t zeroDivider[] = {
+        RATE_GROUP(fastGroup, "fast", 0, 0, 20),
+    };
+    static const RateGroup_t latePhase[] = {
+        RATE_GROUP(fastGroup, "fast", 4, 4, 20),
+    };
+
+    EXPECT_EQ(FC_ERROR, rateGroupsInit(&set, zeroDivider, stats, 1, 1000,
+                                       simClockUs));
+    EXPECT_EQ(FC_ERROR, rateGroupsInit(&set, latePhase, stats, 1, 1000,
+                                       simClockUs));
+}
+
+TEST_F(RateGroupsTest, SpreadAcrossIterations)
+{
+    // Three slow groups in phase all land in one iteration
+    static const RateGroup_t together[] = {
+        RATE_GROUP(fastGroup,  "fast",  1, 0, 20),
+        RATE_GROUP(slowGroup,  "slow",  4, 0, 50),
+        RATE_GROUP(otherGroup, "other", 4, 0, 50),
+        RATE_GROUP(slowGroup,  "slow2", 8, 0, 50),
+    };
+    // Out of phase, no iteration has more than one
+    static const RateGroup_t spread[] = {
+        RATE_GROUP(fastGroup,  "fast",  1, 0, 20),
+        RATE_GROUP(slowGroup,  "slow",  4, 1, 50),
+        RATE_GROUP(otherGroup, "other", 4, 3, 50),
+        RATE_GROUP(slowGroup,  "slow2", 8, 2, 50),
+    };
+
+    EXPECT_EQ(170u, rateGroupsPeakBudgetUs(together, 4));
+    EXPECT_EQ(70u, rateGroupsPeakBudgetUs(spread, 4));
+
+    EXPECT_EQ(FC_ERROR, rateGroupsInit(&set, together, stats, 4, 100,
+                                       simClockUs));
+    ASSERT_EQ(FC_OK, rateGroupsInit(&set, spread, stats, 4, 100, simClockUs));
+
+    // Measured on the simulated clock, no iteration spikes
+    uint32_t maxIterationUs = 0;
+
+    for (int i = 0; i < 64; i++) {
+        uint32_t startUs = nowUs;
+        rateGroupsRun(&set);
+
+        if (nowUs - startUs > maxIterationUs) {
+            maxIterationUs = nowUs - startUs;
+        }
+        nowUs = startUs + 1000;
+    }
+
+    EXPECT_EQ(fastUs + slowUs, maxIterationUs);
+}
+
+TEST_F(RateGroupsTest, LongHyperperiod)
+{
+    static const RateGroup_t groups[] = {
+        RATE_GROUP(fastGroup, "fast", 997, 0, 20),
+        RATE_GROUP(slowGroup, "slow", 991, 0, 50),
+    };
+
+    EXPECT_EQ(UINT32_MAX, rateGroupsPeakBudgetUs(groups, 2));
+    EXPECT_EQ(FC_ERROR, rateGroupsInit(&set, groups, stats, 2, 1000,
+                                       simClockUs));
+}
+
+TEST_F(RateGroupsTest, Overrun)
+{
+    static const RateGroup_t groups[] = {
+        RATE_GROUP(fastGroup, "fast", 1, 0, 20),
+        RATE_GROUP(slowGroup, "slow", 2, 1, 50),
+    };
+
+    ASSERT_EQ(FC_OK, rateGroupsInit(&set, groups, stats, 2, 100, simClockUs));
+
+    EXPECT_EQ((const RateGroup_t *)NULL, rateGroupsRun(&set));
+    EXPECT_EQ((const RateGroup_t *)NULL, rateGroupsRun(&set));
+
+    slowUs = 80;
+    EXPECT_EQ((const RateGroup_t *)NULL, rateGroupsRun(&set));
+    EXPECT_EQ(&groups[1], rateGroupsRun(&set));
+
+    fastUs = 25;
+    EXPECT_EQ(&groups[0], rateGroupsRun(&set));
+    // The first to overrun is reported
+    EXPECT_EQ(&groups[0], rateGroupsRun(&set));
+
+    EXPECT_EQ(2u, stats[0].overruns);
+    EXPECT_EQ(2u, stats[1].overruns);
+    EXPECT_EQ(80u, stats[1].maxUs);
+}
+
+TEST_F(RateGroupsTest, PhaseHoldsAcrossWrap)
+{
+    static const RateGroup_t groups[] = {
+        RATE_GROUP(fastGroup, "fast", 3, 0, 20),
+        RATE_GROUP(slowGroup, "slow", 4, 1, 50),
+    };
+
+    ASSERT_EQ(FC_OK, rateGroupsInit(&set, groups, stats, 2, 100, simClockUs));
+    EXPECT_EQ(12u, set.hyperperiod);
+
+    run(1200);
+
+    EXPECT_EQ(400u, fastRuns);
+    EXPECT_EQ(300u, slowRuns);
+    EXPECT_LT(set.iteration, set.hyperperiod);
+}
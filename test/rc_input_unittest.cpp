@@ -0,0 +1,120 @@
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "rcInput.h"
+#include "mixer.h"
+}
+
+class RcInputTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            for (int i = 0; i < RC_CHANNEL_IN_COUNT; i++) {
+                ppm.signals[i] = 1500;
+            }
+            ppm.signals[THROTTLE_CHANNEL] = MOTOR_LOW_VAL_US;
+            ppm.signals[ARMED_SWITCH_CHANNEL] = 1000;
+            armed = false;
+        }
+
+        void process() {
+            EXPECT_EQ(FC_OK, processPpmSignal(&ppm, &desired, &throttle, &armed));
+        }
+
+        tPpmSignal ppm;
+        Rates_t desired;
+        uint32_t throttle;
+        bool armed;
+};
+
+TEST_F(RcInputTest, SticksToSetpoints)
+{
+    ppm.signals[ROLL_CHANNEL] = MAX_RC_VAL;
+    ppm.signals[PITCH_CHANNEL] = MIN_RC_VAL;
+    ppm.signals[YAW_CHANNEL] = 1500;
+    process();
+
+    EXPECT_EQ(ROTATION_AXIS_OUTPUT_MAX, desired.roll);
+    EXPECT_EQ(ROTATION_AXIS_OUTPUT_MIN, desired.pitch);
+    EXPECT_EQ(0, desired.yaw);
+
+    // Out of range pulses are limited
+    ppm.signals[ROLL_CHANNEL] = 2500;
+    ppm.signals[THROTTLE_CHANNEL] = 900;
+    process();
+    EXPECT_EQ(ROTATION_AXIS_OUTPUT_MAX, desired.roll);
+    EXPECT_EQ((uint32_t)MOTOR_LOW_VAL_US, throttle);
+}
+
+TEST_F(RcInputTest, OnlyDisarmsWithThrottleLow)
+{
+    ppm.signals[ARMED_SWITCH_CHANNEL] = 2000;
+    process();
+    EXPECT_TRUE(armed);
+
+    ppm.signals[THROTTLE_CHANNEL] = 1500;
+    ppm.signals[ARMED_SWITCH_CHANNEL] = 1000;
+    process();
+    EXPECT_TRUE(armed);
+    EXPECT_TRUE(rcRatesActive(armed, throttle));
+
+    ppm.signals[THROTTLE_CHANNEL] = MOTOR_LOW_VAL_US;
+    process();
+    EXPECT_FALSE(armed);
+    EXPECT_FALSE(rcRatesActive(armed, throttle));
+}
+
+TEST_F(RcInputTest, SwitchBetweenThresholdsKeepsState)
+{
+    ppm.signals[ARMED_SWITCH_CHANNEL] = 1500;
+    process();
+    EXPECT_FALSE(armed);
+
+    armed = true;
+    process();
+    EXPECT_TRUE(armed);
+
+    // Armed, but the motors stay low until the throttle is up
+    EXPECT_FALSE(rcRatesActive(armed, THROTTLE_LOW_THRESHOLD - 1));
+    EXPECT_TRUE(rcRatesActive(armed, THROTTLE_LOW_THRESHOLD));
+}
+
+TEST(MixerTest, QuadX)
+{
+    RotationAxisOutputs_t outputs = {0, 0, 0};
+    uint32_t compare[MOTOR_COUNT];
+
+    mixMotors(1500, &outputs, compare);
+    for (int i = 0; i < MOTOR_COUNT; i++) {
+        EXPECT_EQ(1500u, compare[i]);
+    }
+
+    // Roll speeds up the motors on one side and slows the other side
+    outputs.roll = 100;
+    mixMotors(1500, &outputs, compare);
+    EXPECT_EQ(1400u, compare[MOTOR_INDEX(MOTOR_FRONT_LEFT)]);
+    EXPECT_EQ(1400u, compare[MOTOR_INDEX(MOTOR_BACK_LEFT)]);
+    EXPECT_EQ(1600u, compare[MOTOR_INDEX(MOTOR_FRONT_RIGHT)]);
+    EXPECT_EQ(1600u, compare[MOTOR_INDEX(MOTOR_BACK_RIGHT)]);
+
+    outputs.roll = 0;
+    outputs.yaw = 100;
+    mixMotors(1500, &outputs, compare);
+    EXPECT_EQ(1400u, compare[MOTOR_INDEX(MOTOR_FRONT_LEFT)]);
+    EXPECT_EQ(1600u, compare[MOTOR_INDEX(MOTOR_BACK_LEFT)]);
+    EXPECT_EQ(1600u, compare[MOTOR_INDEX(MOTOR_FRONT_RIGHT)]);
+    EXPECT_EQ(1400u, compare[MOTOR_INDEX(MOTOR_BACK_RIGHT)]);
+}
+
+TEST(MixerTest, Saturates)
+{
+    RotationAxisOutputs_t outputs = {ROTATION_AXIS_OUTPUT_MAX, ROTATION_AXIS_OUTPUT_MAX,
+                                     ROTATION_AXIS_OUTPUT_MAX};
+    uint32_t compare[MOTOR_COUNT];
+
+    mixMotors(MOTOR_HIGH_VAL_US, &outputs, compare);
+    for (int i = 0; i < MOTOR_COUNT; i++) {
+        EXPECT_GE(compare[i], (uint32_t)MOTOR_LOW_VAL_US);
+        EXPECT_LE(compare[i], (uint32_t)MOTOR_HIGH_VAL_US);
+    }
+    EXPECT_EQ((uint32_t)MOTOR_HIGH_VAL_US, compare[MOTOR_INDEX(MOTOR_FRONT_RIGHT)]);
+}
@@ -0,0 +1,211 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+
+extern "C" {
+#include "fc.h"
+#include "sched.h"
+}
+
+// Ticks each task ran on, and the order tasks ran in
+static std::vector<uint32_t> runTicks[SCH_MAX_TASKS];
+static std::vector<int> runOrder;
+
+// Simulated cycle counter, advanced by the tasks
+static uint32_t cycles;
+static uint32_t taskCycles[SCH_MAX_TASKS];
+
+static uint32_t simCycles(void)
+{
+    return cycles;
+}
+
+template <int N>
+static void task(void)
+{
+    runTicks[N].push_back(sch_get_ticks());
+    runOrder.push_back(N);
+    cycles += taskCycles[N];
+}
+
+// A task still running when the next tick comes
+static void slowTask(void)
+{
+    runOrder.push_back(-1);
+    sch_update();
+}
+
+class SchedTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            sch_reset();
+            sch_set_cycle_counter(simCycles);
+            cycles = 0;
+            for (int i = 0; i < SCH_MAX_TASKS; i++) {
+                runTicks[i].clear();
+                taskCycles[i] = 0;
+            }
+            runOrder.clear();
+        }
+
+        void tick(uint32_t ticks) {
+            for (uint32_t i = 0; i < ticks; i++) {
+                sch_update();
+                sch_dispatch_tasks();
+            }
+        }
+
+        // The ticks up to ticks a task added at tick 0 runs on
+        std::vector<uint32_t> expected(uint32_t delay, uint32_t period,
+                                       uint32_t ticks) {
+            std::vector<uint32_t> runs;
+
+            for (uint32_t t = delay + 1; t <= ticks;
+                 t += period) {
+                runs.push_back(t);
+            }
+            return runs;
+        }
+};
+
+TEST_F(SchedTest, DelayAndPeriod)
+{
+    ASSERT_EQ(0u, sch_add_task(task<0>, 0, 1));
+    ASSERT_EQ(0u, sch_add_task(task<1>, 2, 5));
+
+    tick(20);
+
+    EXPECT_EQ(expected(0, 1, 20), runTicks[0]);
+    EXPECT_EQ(std::vector<uint32_t>({3, 8, 13, 18}), runTicks[1]);
+}
+
+TEST_F(SchedTest, BeyondTheWheel)
+{
+    // Past the first level, and past a whole turn of the second
+    ASSERT_EQ(0u, sch_add_task(task<0>, 63, 64));
+    ASSERT_EQ(0u, sch_add_task(task<1>, 100, 130));
+    ASSERT_EQ(0u, sch_add_task(task<2>, 5000, 4097));
+    ASSERT_EQ(0u, sch_add_task(task<3>, 0, 9000));
+
+    tick(20000);
+
+    EXPECT_EQ(expected(63, 64, 20000), runTicks[0]);
+    EXPECT_EQ(expected(100, 130, 20000), runTicks[1]);
+    EXPECT_EQ(expected(5000, 4097, 20000), runTicks[2]);
+    EXPECT_EQ(expected(0, 9000, 20000), runTicks[3]);
+}
+
+TEST_F(SchedTest, RandomTasksMatchModel)
+{
+    void (*tasks[8])(void) = {task<0>, task<1>, task<2>, task<3>,
+                              task<4>, task<5>, task<6>, task<7>};
+    uint32_t seed = 1;
+    uint32_t addedAt[8], delays[8], periods[8];
+
+    // Added at different ticks, so they land part way round the wheel
+    for (int i = 0; i < 8; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        delays[i] = (seed >> 8) % 6000;
+        seed = seed * 1664525u + 1013904223u;
+        periods[i] = 1 + (seed >> 8) % 3000;
+
+        tick(37);
+        addedAt[i] = sch_get_ticks();
+        ASSERT_EQ(0u, sch_add_task(tasks[i], delays[i], periods[i]));
+    }
+
+    tick(30000 - sch_get_ticks());
+
+    for (int i = 0; i < 8; i++) {
+        std::vector<uint32_t> model;
+
+        for (uint32_t t = addedAt[i] + delays[i] + 1; t <= 30000;
+             t += periods[i]) {
+            model.push_back(t);
+        }
+        EXPECT_EQ(model, runTicks[i]) << "task " << i;
+    }
+}
+
+TEST_F(SchedTest, Priority)
+{
+    ASSERT_EQ(0, sch_add_task_priority(task<0>, 0, 1, SCH_PRIORITY_LOW));
+    ASSERT_EQ(1, sch_add_task_priority(task<1>, 0, 1, SCH_PRIORITY_HIGH));
+    ASSERT_EQ(2, sch_add_task_priority(task<2>, 0, 1, SCH_PRIORITY_LOW));
+    ASSERT_EQ(3, sch_add_task_priority(task<3>, 0, 1, 1));
+
+    tick(1);
+
+    EXPECT_EQ(std::vector<int>({1, 3, 0, 2}), runOrder);
+}
+
+TEST_F(SchedTest, ExecutionTime)
+{
+    int id = sch_add_task_priority(task<0>, 0, 1, SCH_PRIORITY_LOW);
+    ASSERT_GE(id, 0);
+
+    for (uint32_t c = 100; c <= 500; c += 100) {
+        taskCycles[0] = c;
+        tick(1);
+    }
+
+    sch_task_stats stats;
+    ASSERT_EQ(0u, sch_get_task_stats(id, &stats));
+    EXPECT_EQ(5u, stats.runs);
+    EXPECT_EQ(100u, stats.min_cycles);
+    EXPECT_EQ(500u, stats.max_cycles);
+    EXPECT_EQ(300u, stats.avg_cycles);
+    EXPECT_EQ(0u, stats.budget_overruns);
+}
+
+TEST_F(SchedTest, BudgetOverrun)
+{
+    int fast = sch_add_task_priority(task<0>, 0, 1, SCH_PRIORITY_HIGH);
+    int slow = sch_add_task_priority(task<1>, 0, 1, SCH_PRIORITY_LOW);
+    ASSERT_EQ(0u, sch_set_task_budget(fast, 50));
+    ASSERT_EQ(0u, sch_set_task_budget(slow, 200));
+
+    taskCycles[0] = 40;
+    taskCycles[1] = 250;
+    tick(3);
+
+    sch_task_stats stats;
+    ASSERT_EQ(0u, sch_get_task_stats(fast, &stats));
+    EXPECT_EQ(0u, stats.budget_overruns);
+    ASSERT_EQ(0u, sch_get_task_stats(slow, &stats));
+    EXPECT_EQ(3u, stats.budget_overruns);
+}
+
+TEST_F(SchedTest, TickOverrunBlamesRunningTask)
+{
+    int ok = sch_add_task_priority(task<0>, 0, 1, SCH_PRIORITY_HIGH);
+    int slow = sch_add_task_priority(slowTask, 0, 2, SCH_PRIORITY_LOW);
+
+    // Each run of the slow task takes a tick, so these are ticks 1 to 4
+    tick(2);
+
+    sch_task_stats stats;
+    ASSERT_EQ(0u, sch_get_task_stats(ok, &stats));
+    EXPECT_EQ(0u, stats.tick_overruns);
+    ASSERT_EQ(0u, sch_get_task_stats(slow, &stats));
+    EXPECT_EQ(2u, stats.tick_overruns);
+
+    // The ticks that came during the slow task still released the others
+    EXPECT_EQ(std::vector<uint32_t>({1, 2, 3, 4}), runTicks[0]);
+}
+
+TEST_F(SchedTest, Limits)
+{
+    EXPECT_EQ(1u, sch_add_task(NULL, 0, 1));
+    EXPECT_EQ(1u, sch_add_task(task<0>, 0, 0));
+    EXPECT_EQ(-1, sch_add_task_priority(task<0>, 0, 1, SCH_PRIORITIES));
+
+    for (int i = 0; i < SCH_MAX_TASKS; i++) {
+        EXPECT_EQ(0u, sch_add_task(task<0>, 0, 1));
+    }
+    EXPECT_EQ(1u, sch_add_task(task<0>, 0, 1));
+
+    sch_task_stats stats;
+    EXPECT_EQ(1u, sch_get_task_stats(SCH_MAX_TASKS, &stats));
+    EXPECT_EQ(1u, sch_set_task_budget(-1, 10));
+}
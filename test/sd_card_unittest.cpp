@@ -0,0 +1,148 @@
+#include "gtest/gtest.h"
+#include <string.h>
+
+extern "C" {
+#include "fc.h"
+#include "sdCard.h"
+}
+
+// Set a field in a register, bits numbered as in the SD spec (bit 0 is the
+// lsb of the last byte)
+static void setBits(uint8_t *reg, int length, int msb, int lsb, uint32_t val)
+{
+    for (int bit = lsb; bit <= msb; bit++) {
+        int byte = length - 1 - bit / 8;
+        if (val & (1u << (bit - lsb))) {
+            reg[byte] |= 1 << (bit % 8);
+        } else {
+            reg[byte] &= ~(1 << (bit % 8));
+        }
+    }
+}
+
+class SdCardTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            memset(reg, 0, sizeof(reg));
+            memset(&info, 0, sizeof(info));
+        }
+
+        void csd(int msb, int lsb, uint32_t val) {
+            setBits(reg, SD_CSD_LENGTH_BYTES, msb, lsb, val);
+        }
+
+        uint8_t reg[SD_STATUS_LENGTH_BYTES];
+        SdCardInfo_t info;
+};
+
+TEST_F(SdCardTest, csdVersion2Capacity)
+{
+    // 8 GB SDHC card
+    csd(127, 126, 1);
+    csd(103, 96, 0x32);
+    csd(69, 48, 15159);
+    csd(46, 46, 1);
+    csd(45, 39, 0x7F);
+
+    ASSERT_EQ(FC_OK, SD_Parse_CSD(reg, &info));
+    EXPECT_EQ(2, info.csdVersion);
+    EXPECT_TRUE(info.highCapacity);
+    EXPECT_EQ((15159u + 1) * 1024, info.sectorCount);
+    EXPECT_TRUE(info.sectorErase);
+    EXPECT_EQ(128u, info.eraseBlockSectors);
+    EXPECT_EQ(25000000u, info.maxClockHz);
+}
+
+TEST_F(SdCardTest, csdVersion1Capacity)
+{
+    // 1 GB SDSC card with 1024 byte read blocks
+    csd(127, 126, 0);
+    csd(103, 96, 0x32);
+    csd(83, 80, 10);
+    csd(73, 62, 3840);
+    csd(49, 47, 6);
+    csd(46, 46, 0);
+    csd(45, 39, 31);
+
+    ASSERT_EQ(FC_OK, SD_Parse_CSD(reg, &info));
+    EXPECT_EQ(1, info.csdVersion);
+    EXPECT_FALSE(info.highCapacity);
+    // (C_SIZE + 1) * 2^(C_SIZE_MULT + 2) blocks of 1024 bytes
+    EXPECT_EQ((3840u + 1) * 256 * 2, info.sectorCount);
+    EXPECT_FALSE(info.sectorErase);
+    EXPECT_EQ(32u, info.eraseBlockSectors);
+}
+
+TEST_F(SdCardTest, csdTranSpeed)
+{
+    csd(127, 126, 1);
+
+    csd(103, 96, 0x5A);
+    ASSERT_EQ(FC_OK, SD_Parse_CSD(reg, &info));
+    EXPECT_EQ(50000000u, info.maxClockHz);
+
+    csd(103, 96, 0x0B);
+    ASSERT_EQ(FC_OK, SD_Parse_CSD(reg, &info));
+    EXPECT_EQ(100000000u, info.maxClockHz);
+
+    // Reserved time value
+    csd(103, 96, 0x02);
+    EXPECT_EQ(FC_ERROR, SD_Parse_CSD(reg, &info));
+}
+
+TEST_F(SdCardTest, csdUnknownStructure)
+{
+    csd(127, 126, 2);
+    csd(103, 96, 0x32);
+
+    EXPECT_EQ(FC_ERROR, SD_Parse_CSD(reg, &info));
+}
+
+TEST_F(SdCardTest, cidFields)
+{
+    const uint8_t cid[SD_CID_LENGTH_BYTES] = {
+        0x03, 'S', 'D', 'S', 'U', '0', '8', 'G', 0x80,
+        0x12, 0x34, 0x56, 0x78, 0x01, 0x0A, 0x01
+    };
+
+    SD_Parse_CID(cid, &info);
+
+    EXPECT_EQ(0x03, info.manufacturerId);
+    EXPECT_STREQ("SD", info.oemId);
+    EXPECT_STREQ("SU08G", info.productName);
+    EXPECT_EQ(0x80, info.productRevision);
+    EXPECT_EQ(0x12345678u, info.serialNumber);
+}
+
+TEST_F(SdCardTest, allocationUnit)
+{
+    setBits(reg, SD_STATUS_LENGTH_BYTES, 431, 428, 0);
+    EXPECT_EQ(0u, SD_Parse_AU_Sectors(reg));
+
+    setBits(reg, SD_STATUS_LENGTH_BYTES, 431, 428, 1);
+    EXPECT_EQ(32u, SD_Parse_AU_Sectors(reg));
+
+    // 4 MB
+    setBits(reg, SD_STATUS_LENGTH_BYTES, 431, 428, 9);
+    EXPECT_EQ(8192u, SD_Parse_AU_Sectors(reg));
+
+    // 12 MB
+    setBits(reg, SD_STATUS_LENGTH_BYTES, 431, 428, 0xB);
+    EXPECT_EQ(12u * 2048, SD_Parse_AU_Sectors(reg));
+
+    // 64 MB
+    setBits(reg, SD_STATUS_LENGTH_BYTES, 431, 428, 0xF);
+    EXPECT_EQ(64u * 2048, SD_Parse_AU_Sectors(reg));
+}
+
+TEST_F(SdCardTest, clockDivider)
+{
+    // Limited to 25 MHz in default speed mode
+    EXPECT_EQ(4u, SD_Select_Clock_Divider(100000000, 25000000));
+    EXPECT_EQ(4u, SD_Select_Clock_Divider(100000000, 50000000));
+    EXPECT_EQ(2u, SD_Select_Clock_Divider(50000000, 25000000));
+    // Round down to the next slower clock
+    EXPECT_EQ(8u, SD_Select_Clock_Divider(100000000, 20000000));
+    // Slowest clock if nothing else works
+    EXPECT_EQ(256u, SD_Select_Clock_Divider(100000000, 100000));
+}
@@ -0,0 +1,237 @@
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <string.h>
+
+extern "C" {
+#include "fc.h"
+#include "fake_hal.h"
+#include "fake_sd_card.h"
+#include "diskio.h"
+#include "sd.h"
+}
+
+#define SECTOR_SIZE FAKE_SD_CARD_SECTOR_SIZE
+
+// Spi clock once the card is identified, and a block's time at it
+#define SPI_CLOCK_HZ    25000000
+#define BLOCK_NS        (SECTOR_SIZE * 8 * 1000000000ULL / SPI_CLOCK_HZ)
+
+static void fill(uint8_t *buffer, uint32_t sectors, uint8_t seed)
+{
+    for (uint32_t i = 0; i < sectors * SECTOR_SIZE; i++) {
+        buffer[i] = (uint8_t)(i * 7 + seed);
+    }
+}
+
+class SdTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            fakeHalReset();
+            SpiHandle.State = HAL_SPI_STATE_RESET;
+
+            fakeSdCardReset();
+            fakeSpiAttach(SPI1, GPIOA, GPIO_PIN_4, &fakeSdCardDevice, NULL);
+
+            ASSERT_EQ(0, disk_initialize(0));
+        }
+
+        // Once the kernel is running, blocks go by DMA
+        void startScheduler() {
+            fakeRtosSetSchedulerState(taskSCHEDULER_RUNNING);
+        }
+};
+
+TEST_F(SdTest, Init)
+{
+    const SdCardInfo_t *info = SD_Get_Card_Info();
+    const FakeSdCardStats_t *stats = fakeSdCardStats();
+
+    EXPECT_TRUE(info->highCapacity);
+    EXPECT_EQ(2u, info->csdVersion);
+    EXPECT_EQ((uint32_t)FAKE_SD_CARD_SECTORS, info->sectorCount);
+    EXPECT_EQ(8192u, info->eraseBlockSectors);
+    EXPECT_TRUE(info->sectorErase);
+    EXPECT_STREQ("FAKE1", info->productName);
+    EXPECT_STREQ("SD", info->oemId);
+
+    EXPECT_EQ((uint32_t)SPI_CLOCK_HZ, info->spiClockHz);
+    EXPECT_EQ((uint32_t)SPI_CLOCK_HZ, fakeSpiClockHz(SPI1));
+
+    EXPECT_EQ(1u, stats->commands[0]);
+    EXPECT_EQ(1u, stats->commands[8]);
+    EXPECT_EQ(2u, stats->commands[41]);
+    EXPECT_EQ(1u, stats->commands[58]);
+    EXPECT_EQ(1u, stats->commands[13]);
+
+    DWORD sectors;
+    ASSERT_EQ(RES_OK, disk_ioctl(0, GET_SECTOR_COUNT, &sectors));
+    EXPECT_EQ((DWORD)FAKE_SD_CARD_SECTORS, sectors);
+}
+
+TEST_F(SdTest, NoCard)
+{
+    SpiHandle.State = HAL_SPI_STATE_RESET;
+    fakeHalReset();
+
+    // Nothing answers CMD0, it is retried 10 times 100 ms apart
+    EXPECT_EQ(STA_NOINIT, disk_initialize(0));
+    EXPECT_GE(fakeHalNowNs(), 10 * 100 * 1000000ULL);
+}
+
+TEST_F(SdTest, SlowInit)
+{
+    SpiHandle.State = HAL_SPI_STATE_RESET;
+    fakeHalReset();
+    fakeSdCardReset();
+    fakeSdCardSetInitPolls(5);
+    fakeSpiAttach(SPI1, GPIOA, GPIO_PIN_4, &fakeSdCardDevice, NULL);
+
+    EXPECT_EQ(0, disk_initialize(0));
+    EXPECT_EQ(5u, fakeSdCardStats()->commands[41]);
+}
+
+TEST_F(SdTest, PolledWriteBack)
+{
+    uint8_t data[SECTOR_SIZE];
+    uint8_t readBack[SECTOR_SIZE];
+
+    fill(data, 1, 3);
+
+    // Single sectors stay in the cache until a sync
+    ASSERT_EQ(RES_OK, disk_write(0, data, 5, 1));
+    EXPECT_EQ(0u, fakeSdCardStats()->blocksWritten);
+
+    ASSERT_EQ(RES_OK, disk_ioctl(0, CTRL_SYNC, NULL));
+    EXPECT_EQ(1u, fakeSdCardStats()->blocksWritten);
+    EXPECT_EQ(0, memcmp(data, fakeSdCardSector(5), SECTOR_SIZE));
+
+    fill(fakeSdCardSector(6), 1, 9);
+    ASSERT_EQ(RES_OK, disk_read(0, readBack, 6, 1));
+    EXPECT_EQ(0, memcmp(fakeSdCardSector(6), readBack, SECTOR_SIZE));
+
+    // Before the scheduler starts every transfer is polled
+    EXPECT_EQ(0u, fakeSpiStats(SPI1)->dmaTransfers);
+}
+
+TEST_F(SdTest, DmaMultipleSectors)
+{
+    uint8_t data[4 * SECTOR_SIZE];
+    uint8_t readBack[4 * SECTOR_SIZE];
+
+    startScheduler();
+    fill(data, 4, 1);
+
+    ASSERT_EQ(RES_OK, disk_write(0, data, 100, 4));
+    EXPECT_EQ(4u, fakeSdCardStats()->preErase);
+    EXPECT_EQ(4u, fakeSdCardStats()->blocksWritten);
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(0, memcmp(&data[i * SECTOR_SIZE], fakeSdCardSector(100 + i),
+                            SECTOR_SIZE)) << "sector " << i;
+    }
+
+    // Each block of a multiple block read has its own start token
+    memset(readBack, 0, sizeof(readBack));
+    ASSERT_EQ(RES_OK, disk_read(0, readBack, 100, 4));
+    EXPECT_EQ(0, memcmp(data, readBack, sizeof(data)));
+    EXPECT_EQ(1u, fakeSdCardStats()->commands[12]);
+
+    EXPECT_EQ(8u, fakeSpiStats(SPI1)->dmaTransfers);
+    EXPECT_EQ(8u, fakeRtosYieldsFromISR());
+}
+
+TEST_F(SdTest, ReadThroughput)
+{
+    const int sectors = 16;
+    static uint8_t readBack[sectors * SECTOR_SIZE];
+
+    startScheduler();
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t startNs = fakeHalNowNs();
+    ASSERT_EQ(RES_OK, disk_read(0, readBack, 200, sectors));
+    uint64_t elapsedNs = fakeHalNowNs() - startNs;
+    auto hostElapsed = std::chrono::steady_clock::now() - start;
+
+    // The blocks themselves, then a few bytes for the command, tokens and crc
+    EXPECT_GE(elapsedNs, sectors * BLOCK_NS);
+    EXPECT_LT(elapsedNs, sectors * BLOCK_NS * 11 / 10);
+
+    double hostNsPerSector =
+        std::chrono::duration<double, std::nano>(hostElapsed).count() / sectors;
+    RecordProperty("HostNsPerSector", (int)hostNsPerSector);
+    printf("sd: %.0f host ns per sector read, %.2f MB/s simulated\n",
+           hostNsPerSector, sectors * SECTOR_SIZE * 1000.0 / elapsedNs);
+}
+
+TEST_F(SdTest, DmaStallTimesOut)
+{
+    uint8_t readBack[SECTOR_SIZE];
+
+    startScheduler();
+    fill(fakeSdCardSector(7), 1, 4);
+
+    fakeDmaFailNext(DMA2_Stream0, FAKE_DMA_STALL);
+    uint64_t start = fakeHalNowNs();
+    EXPECT_EQ(RES_ERROR, disk_read(0, readBack, 7, 1));
+    EXPECT_GE(fakeHalNowNs() - start, 100 * 1000000ULL);
+    EXPECT_EQ(1u, fakeSpiStats(SPI1)->aborts);
+    EXPECT_EQ(HAL_SPI_STATE_READY, SpiHandle.State);
+
+    // The next transfer isn't confused by the one that was abandoned
+    ASSERT_EQ(RES_OK, disk_read(0, readBack, 7, 1));
+    EXPECT_EQ(0, memcmp(fakeSdCardSector(7), readBack, SECTOR_SIZE));
+}
+
+TEST_F(SdTest, DmaErrorFailsFast)
+{
+    uint8_t readBack[SECTOR_SIZE];
+
+    startScheduler();
+    fill(fakeSdCardSector(8), 1, 5);
+
+    fakeDmaFailNext(DMA2_Stream0, FAKE_DMA_ERROR);
+    uint64_t start = fakeHalNowNs();
+    EXPECT_EQ(RES_ERROR, disk_read(0, readBack, 8, 1));
+
+    // The error callback wakes the driver, it doesn't wait for the timeout
+    EXPECT_LT(fakeHalNowNs() - start, 1000000ULL);
+
+    ASSERT_EQ(RES_OK, disk_read(0, readBack, 8, 1));
+    EXPECT_EQ(0, memcmp(fakeSdCardSector(8), readBack, SECTOR_SIZE));
+}
+
+TEST_F(SdTest, RejectedWrite)
+{
+    uint8_t data[2 * SECTOR_SIZE];
+
+    startScheduler();
+    fill(data, 2, 6);
+
+    fakeSdCardRejectNextWrite();
+    EXPECT_EQ(RES_ERROR, disk_write(0, data, 20, 2));
+    EXPECT_EQ(0u, fakeSdCardStats()->blocksWritten);
+
+    ASSERT_EQ(RES_OK, disk_write(0, data, 20, 2));
+    EXPECT_EQ(0, memcmp(data, fakeSdCardSector(20), SECTOR_SIZE));
+}
+
+TEST_F(SdTest, Trim)
+{
+    DWORD range[2] = {10, 12};
+    uint8_t readBack[SECTOR_SIZE];
+
+    for (int sector = 9; sector <= 13; sector++) {
+        fill(fakeSdCardSector(sector), 1, sector);
+    }
+
+    ASSERT_EQ(RES_OK, disk_ioctl(0, CTRL_TRIM, range));
+    EXPECT_EQ(3u, fakeSdCardStats()->erasedSectors);
+
+    ASSERT_EQ(RES_OK, disk_read(0, readBack, 11, 1));
+    for (int i = 0; i < SECTOR_SIZE; i++) {
+        ASSERT_EQ(0xFF, readBack[i]);
+    }
+    EXPECT_NE(0xFF, fakeSdCardSector(9)[1]);
+    EXPECT_NE(0xFF, fakeSdCardSector(13)[1]);
+}
@@ -0,0 +1,117 @@
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "fc.h"
+#include "taskStats.h"
+}
+
+class TaskStatsTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            taskStatsReset(0);
+        }
+
+        void setTask(int i, uint32_t number, uint32_t runTimeUs,
+                     uint16_t stackFree, bool idle = false) {
+            samples[i].name = idle ? "IDLE" : "task";
+            samples[i].number = number;
+            samples[i].runTimeUs = runTimeUs;
+            samples[i].stackFree = stackFree;
+            samples[i].idle = idle;
+        }
+
+        TaskStatsSample_t samples[TASK_STATS_MAX_KERNEL_TASKS];
+        TelemetryTaskStats_t out;
+};
+
+TEST_F(TaskStatsTest, LoadIsShareOfInterval)
+{
+    // Listed out of order, the report is by task number with idle last
+    setTask(0, 3, 600000, 10, true);
+    setTask(1, 2, 100000, 40);
+    setTask(2, 1, 300000, 75);
+
+    taskStatsCompute(samples, 3, 1000000, &out);
+
+    EXPECT_EQ(1000000u, (uint32_t)out.intervalUs);
+    ASSERT_EQ(3, out.taskCount);
+    EXPECT_EQ(1, out.taskNumber[0]);
+    EXPECT_EQ(2, out.taskNumber[1]);
+    EXPECT_EQ(3, out.taskNumber[2]);
+    EXPECT_EQ(300, out.taskLoad[0]);
+    EXPECT_EQ(100, out.taskLoad[1]);
+    EXPECT_EQ(600, out.taskLoad[2]);
+    EXPECT_EQ(75, out.stackFree[0]);
+    EXPECT_EQ(10, out.stackFree[2]);
+    EXPECT_EQ(400, out.cpuLoad);
+}
+
+TEST_F(TaskStatsTest, LaterIntervalsUseDifferences)
+{
+    setTask(0, 1, 300000, 75);
+    setTask(1, 2, 700000, 10, true);
+    taskStatsCompute(samples, 2, 1000000, &out);
+
+    // Task 3 was created during the second interval
+    setTask(0, 1, 350000, 70);
+    setTask(1, 2, 1300000, 10, true);
+    setTask(2, 3, 100000, 20);
+    taskStatsCompute(samples, 3, 1750000, &out);
+
+    EXPECT_EQ(750000u, (uint32_t)out.intervalUs);
+    ASSERT_EQ(3, out.taskCount);
+    EXPECT_EQ(66, out.taskLoad[0]);
+    EXPECT_EQ(3, out.taskNumber[1]);
+    EXPECT_EQ(133, out.taskLoad[1]);
+    EXPECT_EQ(800, out.taskLoad[2]);
+    EXPECT_EQ(200, out.cpuLoad);
+    EXPECT_EQ(70, out.stackFree[0]);
+}
+
+TEST_F(TaskStatsTest, CountersWrap)
+{
+    taskStatsReset(UINT32_MAX - 499999);
+
+    setTask(0, 1, UINT32_MAX - 99999, 50);
+    setTask(1, 2, 0, 50, true);
+    taskStatsCompute(samples, 2, UINT32_MAX - 499999, &out);
+
+    // 1 s later, across the wrap
+    setTask(0, 1, 150000, 50);
+    setTask(1, 2, 750000, 50, true);
+    taskStatsCompute(samples, 2, 500000, &out);
+
+    EXPECT_EQ(1000000u, (uint32_t)out.intervalUs);
+    EXPECT_EQ(250, out.taskLoad[0]);
+    EXPECT_EQ(750, out.taskLoad[1]);
+    EXPECT_EQ(250, out.cpuLoad);
+}
+
+TEST_F(TaskStatsTest, TooManyTasksKeepsIdle)
+{
+    int count = TELEMETRY_MAX_TASKS + 2;
+
+    for (int i = 0; i < count - 1; i++) {
+        setTask(i, i + 1, 1000, 50);
+    }
+    setTask(count - 1, count, 900000, 50, true);
+
+    taskStatsCompute(samples, count, 1000000, &out);
+
+    ASSERT_EQ(TELEMETRY_MAX_TASKS, out.taskCount);
+    EXPECT_EQ(TELEMETRY_MAX_TASKS - 1, out.taskNumber[TELEMETRY_MAX_TASKS - 2]);
+    EXPECT_EQ(count, out.taskNumber[TELEMETRY_MAX_TASKS - 1]);
+    EXPECT_EQ(900, out.taskLoad[TELEMETRY_MAX_TASKS - 1]);
+    // Includes the tasks left out of the report
+    EXPECT_EQ(100, out.cpuLoad);
+}
+
+TEST_F(TaskStatsTest, WithoutIdleLoadIsSumOfTasks)
+{
+    setTask(0, 1, 200000, 50);
+    setTask(1, 2, 300000, 50);
+
+    taskStatsCompute(samples, 2, 1000000, &out);
+
+    EXPECT_EQ(500, out.cpuLoad);
+}
@@ -0,0 +1,272 @@
+#include <string.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "fc.h"
+#include "telemetry.h"
+#include "uartTx.h"
+#include "rate_control.h"
+}
+
+// Plenty of bandwidth for the default rates
+#define TEST_LINK_BYTES_PER_SECOND 100000
+
+class TelemetryTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            uartTxReset();
+            for (int i = 0; i < TELEMETRY_MSG_COUNT; i++) {
+                for (int source = 0; source < TELEMETRY_MAX_SOURCES; source++) {
+                    telemetrySetSource((TelemetryMessage)i, source, NULL, 0);
+                }
+            }
+            telemetryInit(TEST_LINK_BYTES_PER_SECOND);
+        }
+
+        // Take everything sent so far out of the uart ring
+        std::vector<uint8_t> sent() {
+            std::vector<uint8_t> out;
+            const uint8_t *data;
+            uint32_t length;
+
+            while ((length = uartTxPeek(&data)) != 0) {
+                out.insert(out.end(), data, data + length);
+                uartTxRelease(length);
+            }
+
+            return out;
+        }
+
+        // Split a stream into frames, checking each one
+        std::vector<std::vector<uint8_t> > frames(const std::vector<uint8_t> &stream) {
+            std::vector<std::vector<uint8_t> > out;
+            size_t pos = 0;
+
+            while (pos < stream.size()) {
+                EXPECT_EQ(TELEMETRY_STX, stream[pos]);
+                size_t length = stream[pos + 1] + TELEMETRY_FRAME_OVERHEAD;
+                std::vector<uint8_t> frame(stream.begin() + pos,
+                                           stream.begin() + pos + length);
+                const TelemetryMessageInfo_t *info = telemetryFindMessage(frame[5]);
+
+                EXPECT_TRUE(info != NULL);
+                if (info != NULL) {
+                    uint16_t crc = telemetryCrcAccumulate(0xFFFF, &frame[1],
+                                                          length - 3);
+                    crc = telemetryCrcAccumulate(crc, &info->crcExtra, 1);
+                    EXPECT_EQ(crc & 0xFF, frame[length - 2]);
+                    EXPECT_EQ(crc >> 8, frame[length - 1]);
+                }
+
+                out.push_back(frame);
+                pos += length;
+            }
+
+            return out;
+        }
+};
+
+TEST_F(TelemetryTest, CrcMatchesMavlink)
+{
+    // Check value of CRC-16/MCRF4XX
+    EXPECT_EQ(0x6F91, telemetryCrcAccumulate(0xFFFF, "123456789", 9));
+}
+
+TEST_F(TelemetryTest, HeartbeatIsStandardMavlink)
+{
+    telemetryUpdate(0);
+
+    std::vector<std::vector<uint8_t> > f = frames(sent());
+    ASSERT_EQ(1u, f.size());
+
+    const uint8_t expected[] = {
+        0xFE, 9, 0, TELEMETRY_SYSTEM_ID, TELEMETRY_COMPONENT_ID, 0,
+        0, 0, 0, 0, TELEMETRY_MAV_TYPE_QUADROTOR,
+        TELEMETRY_MAV_AUTOPILOT_GENERIC, 0, TELEMETRY_MAV_STATE_STANDBY,
+        TELEMETRY_MAVLINK_VERSION
+    };
+    ASSERT_EQ(sizeof(expected) + TELEMETRY_CRC_LENGTH, f[0].size());
+    EXPECT_EQ(0, memcmp(expected, &f[0][0], sizeof(expected)));
+
+    telemetrySetArmed(true);
+    telemetryUpdate(1000);
+    f = frames(sent());
+    ASSERT_EQ(1u, f.size());
+    EXPECT_EQ(1, f[0][2]); // sequence
+    EXPECT_EQ(TELEMETRY_MAV_MODE_FLAG_ARMED, f[0][12]);
+    EXPECT_EQ(TELEMETRY_MAV_STATE_ACTIVE, f[0][13]);
+}
+
+TEST_F(TelemetryTest, PayloadSentFromLiveSources)
+{
+    Rates_t actual = {10, -20, 30};
+    Rates_t desired = {-1, 2, -3};
+
+    telemetrySetSource(TELEMETRY_MSG_RATES, 0, &actual, sizeof(actual));
+    telemetrySetSource(TELEMETRY_MSG_RATES, 1, &desired, sizeof(desired));
+    telemetryUpdate(0);
+
+    // Changes show up in the next frame
+    actual.roll = 1234;
+    telemetryUpdate(20);
+
+    std::vector<std::vector<uint8_t> > f = frames(sent());
+    std::vector<std::vector<uint8_t> > rates;
+    for (size_t i = 0; i < f.size(); i++) {
+        if (f[i][5] == telemetryMessageInfo(TELEMETRY_MSG_RATES)->id) {
+            rates.push_back(f[i]);
+        }
+    }
+
+    ASSERT_EQ(2u, rates.size());
+    ASSERT_EQ(TELEMETRY_FRAME_OVERHEAD + 2 * sizeof(Rates_t), rates[1].size());
+
+    Rates_t sentActual, sentDesired;
+    memcpy(&sentActual, &rates[1][TELEMETRY_HEADER_LENGTH], sizeof(sentActual));
+    memcpy(&sentDesired, &rates[1][TELEMETRY_HEADER_LENGTH + sizeof(Rates_t)],
+           sizeof(sentDesired));
+    EXPECT_EQ(1234, sentActual.roll);
+    EXPECT_EQ(-20, sentActual.pitch);
+    EXPECT_EQ(30, sentActual.yaw);
+    EXPECT_EQ(-1, sentDesired.roll);
+    EXPECT_EQ(-3, sentDesired.yaw);
+}
+
+TEST_F(TelemetryTest, IncompleteSourcesNotSent)
+{
+    Rates_t actual = {0, 0, 0};
+
+    // Only half the payload
+    telemetrySetSource(TELEMETRY_MSG_RATES, 0, &actual, sizeof(actual));
+    telemetryUpdate(0);
+
+    std::vector<std::vector<uint8_t> > f = frames(sent());
+    ASSERT_EQ(1u, f.size());
+    EXPECT_EQ(0, f[0][5]); // Only the heartbeat
+}
+
+TEST_F(TelemetryTest, MessagesSentAtTheirRates)
+{
+    uint32_t motors[TELEMETRY_MOTOR_COUNT] = {1000, 1100, 1200, 1300};
+    TelemetryLoopStats_t loopStats = {0, 0, 0, 0, 0};
+    int heartbeats = 0, motorFrames = 0, statsFrames = 0;
+
+    telemetrySetSource(TELEMETRY_MSG_MOTORS, 0, motors, sizeof(motors));
+    telemetrySetSource(TELEMETRY_MSG_LOOP_STATS, 0, &loopStats, sizeof(loopStats));
+    ASSERT_EQ(FC_OK, telemetrySetRate(TELEMETRY_MSG_MOTORS, 100));
+
+    for (uint32_t ms = 0; ms < 2000; ms += TELEMETRY_PERIOD_MS) {
+        telemetryUpdate(ms);
+
+        std::vector<std::vector<uint8_t> > f = frames(sent());
+        for (size_t i = 0; i < f.size(); i++) {
+            if (f[i][5] == telemetryMessageInfo(TELEMETRY_MSG_HEARTBEAT)->id) {
+                heartbeats++;
+            } else if (f[i][5] == telemetryMessageInfo(TELEMETRY_MSG_MOTORS)->id) {
+                motorFrames++;
+            } else if (f[i][5] == telemetryMessageInfo(TELEMETRY_MSG_LOOP_STATS)->id) {
+                statsFrames++;
+            }
+        }
+    }
+
+    EXPECT_EQ(2, heartbeats);
+    EXPECT_EQ(200, motorFrames);
+    EXPECT_EQ(2 * (int)telemetryMessageInfo(TELEMETRY_MSG_LOOP_STATS)->defaultRateHz,
+              statsFrames);
+    EXPECT_EQ(0u, telemetryStats()->framesDropped);
+}
+
+TEST_F(TelemetryTest, RatesKeptWithinLinkBudget)
+{
+    // 115200 baud, half of it for telemetry
+    const uint32_t link = 11520;
+
+    telemetryInit(1000);
+
+    uint32_t load = 0;
+    for (int i = 0; i < TELEMETRY_MSG_COUNT; i++) {
+        const TelemetryMessageInfo_t *info = telemetryMessageInfo((TelemetryMessage)i);
+        load += telemetryGetRate((TelemetryMessage)i)
+                * (info->payloadLength + TELEMETRY_FRAME_OVERHEAD);
+    }
+    EXPECT_LE(load, 1000u * TELEMETRY_LINK_SHARE_PERCENT / 100);
+    EXPECT_LT(telemetryGetRate(TELEMETRY_MSG_RATES),
+              (uint32_t)telemetryMessageInfo(TELEMETRY_MSG_RATES)->defaultRateHz);
+
+    // The defaults fit on the default uart
+    telemetryInit(link);
+    for (int i = 0; i < TELEMETRY_MSG_COUNT; i++) {
+        EXPECT_EQ((uint32_t)telemetryMessageInfo((TelemetryMessage)i)->defaultRateHz,
+                  telemetryGetRate((TelemetryMessage)i));
+    }
+
+    EXPECT_EQ(FC_ERROR, telemetrySetRate(TELEMETRY_MSG_RATES, TELEMETRY_MAX_RATE_HZ + 1));
+    EXPECT_EQ(FC_OK, telemetrySetRate(TELEMETRY_MSG_RATES, 100));
+    EXPECT_EQ(FC_ERROR, telemetrySetRate(TELEMETRY_MSG_MOTORS, 100));
+    EXPECT_EQ(50u, telemetryGetRate(TELEMETRY_MSG_MOTORS));
+}
+
+TEST_F(TelemetryTest, FullUartDropsFrames)
+{
+    static uint8_t filler[UART_TX_RING_SIZE - 4];
+
+    ASSERT_EQ(FC_OK, uartTxWrite(filler, sizeof(filler)));
+    telemetryUpdate(0);
+
+    EXPECT_EQ(1u, telemetryStats()->framesDropped);
+    EXPECT_EQ(0u, telemetryStats()->framesSent);
+}
+
+TEST_F(TelemetryTest, ParserFindsFramesAmongOtherTraffic)
+{
+    TelemetryParser_t parser;
+    const TelemetryMessageInfo_t *info;
+    std::vector<const TelemetryMessageInfo_t *> received;
+
+    telemetryUpdate(0);
+    std::vector<uint8_t> heartbeat = sent();
+
+    // Debug text with a false start of a heartbeat whose length swallows the
+    // start of the real frame, then a frame with a bad crc, then a good one
+    std::vector<uint8_t> stream;
+    const char text[] = "debug \xFE" "\x09" "abc" "\x00" "\n";
+    stream.insert(stream.end(), text, text + sizeof(text) - 1);
+    stream.insert(stream.end(), heartbeat.begin(), heartbeat.end());
+    std::vector<uint8_t> corrupt = heartbeat;
+    corrupt[TELEMETRY_HEADER_LENGTH] ^= 1;
+    stream.insert(stream.end(), corrupt.begin(), corrupt.end());
+    stream.insert(stream.end(), heartbeat.begin(), heartbeat.end());
+
+    telemetryParserReset(&parser);
+
+    // A byte at a time, so frames span calls
+    for (size_t i = 0; i < stream.size(); i++) {
+        const uint8_t *data = &stream[i];
+        uint32_t length = 1;
+
+        while ((info = telemetryParse(&parser, &data, &length)) != NULL) {
+            received.push_back(info);
+            EXPECT_EQ(0, memcmp(&heartbeat[0], parser.frame, heartbeat.size()));
+        }
+        EXPECT_EQ(0u, length);
+    }
+
+    ASSERT_EQ(2u, received.size());
+    EXPECT_EQ(telemetryMessageInfo(TELEMETRY_MSG_HEARTBEAT), received[0]);
+    EXPECT_EQ(2u, parser.badCrc);
+
+    // All in one go gives the same frames
+    const uint8_t *data = &stream[0];
+    uint32_t length = stream.size();
+    int count = 0;
+
+    telemetryParserReset(&parser);
+    while ((info = telemetryParse(&parser, &data, &length)) != NULL) {
+        count++;
+    }
+    EXPECT_EQ(2, count);
+    EXPECT_EQ(0u, length);
+}
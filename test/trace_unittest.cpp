@@ -0,0 +1,123 @@
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "fc.h"
+#include "trace.h"
+}
+
+static uint32_t fakeTimeUs;
+
+extern "C" uint32_t traceTimeUs(void)
+{
+    return fakeTimeUs;
+}
+
+class TraceTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            fakeTimeUs = 0;
+            traceInit();
+        }
+
+        // Event n has time n and arg n, so the order can be checked
+        void record(uint32_t first, uint32_t count) {
+            for (uint32_t n = first; n < first + count; n++) {
+                fakeTimeUs = n;
+                traceRecord(TRACE_MARK_BEGIN, TRACE_MARK_LOG, n & 0xFFFF);
+            }
+        }
+
+        void expectHeld(uint32_t first, uint32_t count) {
+            static TraceEvent_t events[TRACE_RING_LENGTH];
+
+            ASSERT_EQ(count, traceEventCount());
+            ASSERT_EQ(count, traceRead(0, events, TRACE_RING_LENGTH));
+            for (uint32_t i = 0; i < count; i++) {
+                EXPECT_EQ(first + i, events[i].timeUs);
+            }
+        }
+};
+
+TEST_F(TraceTest, StartUpIsKept)
+{
+    record(0, TRACE_RING_LENGTH - 1);
+    EXPECT_EQ(TRACE_TRIGGERED, traceGetState());
+
+    record(TRACE_RING_LENGTH - 1, 10);
+    EXPECT_EQ(TRACE_STOPPED, traceGetState());
+
+    // The first ring full, later events are ignored
+    expectHeld(0, TRACE_RING_LENGTH);
+}
+
+TEST_F(TraceTest, TriggerKeepsEventsBeforeAndAfter)
+{
+    TraceEvent_t event;
+
+    record(0, TRACE_RING_LENGTH);
+    traceRestart();
+    EXPECT_EQ(TRACE_RECORDING, traceGetState());
+    EXPECT_EQ(0u, traceRead(0, &event, 1));
+
+    // Recording wraps until triggered
+    record(1000, 3 * TRACE_RING_LENGTH);
+    EXPECT_EQ(TRACE_RECORDING, traceGetState());
+
+    traceTrigger();
+    record(5000, TRACE_POST_TRIGGER_EVENTS - 1);
+    EXPECT_EQ(TRACE_TRIGGERED, traceGetState());
+    // A second trigger doesn't move the stop point
+    traceTrigger();
+    record(5000 + TRACE_POST_TRIGGER_EVENTS - 1, 5);
+    EXPECT_EQ(TRACE_STOPPED, traceGetState());
+
+    static TraceEvent_t events[TRACE_RING_LENGTH];
+    uint32_t before = TRACE_RING_LENGTH - TRACE_POST_TRIGGER_EVENTS;
+
+    ASSERT_EQ((uint32_t)TRACE_RING_LENGTH, traceRead(0, events, TRACE_RING_LENGTH));
+    EXPECT_EQ(1000 + 3 * TRACE_RING_LENGTH - before, events[0].timeUs);
+    EXPECT_EQ(1000 + 3 * TRACE_RING_LENGTH - 1, events[before - 1].timeUs);
+    EXPECT_EQ(5000u, events[before].timeUs);
+    EXPECT_EQ(5000u + TRACE_POST_TRIGGER_EVENTS - 1,
+              events[TRACE_RING_LENGTH - 1].timeUs);
+}
+
+TEST_F(TraceTest, ReadInFrames)
+{
+    TraceEvent_t events[TRACE_EVENTS_PER_FRAME];
+    uint32_t total = 0;
+
+    traceRestart();
+    record(0, 70);
+    traceTrigger();
+    record(70, TRACE_POST_TRIGGER_EVENTS);
+    ASSERT_EQ(TRACE_STOPPED, traceGetState());
+
+    uint32_t held = 70 + TRACE_POST_TRIGGER_EVENTS;
+    ASSERT_EQ(held, traceEventCount());
+
+    for (uint32_t first = 0; first < held; first += TRACE_EVENTS_PER_FRAME) {
+        uint32_t count = traceRead(first, events, TRACE_EVENTS_PER_FRAME);
+
+        ASSERT_GT(count, 0u);
+        for (uint32_t i = 0; i < count; i++) {
+            EXPECT_EQ(first + i, events[i].timeUs);
+            EXPECT_EQ(TRACE_MARK_BEGIN, events[i].type);
+            EXPECT_EQ(TRACE_MARK_LOG, events[i].id);
+            EXPECT_EQ((first + i) & 0xFFFF, events[i].arg);
+        }
+        total += count;
+    }
+
+    EXPECT_EQ(held, total);
+    EXPECT_EQ(0u, traceRead(held, events, TRACE_EVENTS_PER_FRAME));
+}
+
+TEST_F(TraceTest, MarkNames)
+{
+    for (int mark = 0; mark < TRACE_MARK_COUNT; mark++) {
+        ASSERT_NE((const char *)NULL, traceMarkName((TraceMark)mark));
+        EXPECT_LE(strlen(traceMarkName((TraceMark)mark)), (size_t)TRACE_NAME_LENGTH);
+    }
+    EXPECT_EQ((const char *)NULL, traceMarkName(TRACE_MARK_COUNT));
+}
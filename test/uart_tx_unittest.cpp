@@ -0,0 +1,101 @@
+#include <string.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "fc.h"
+#include "uartTx.h"
+}
+
+class UartTxTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            uartTxReset();
+        }
+
+        // Stand in for the DMA, take everything queued
+        uint32_t drain(uint8_t *out) {
+            const uint8_t *data;
+            uint32_t length;
+            uint32_t total = 0;
+
+            while ((length = uartTxPeek(&data)) != 0) {
+                memcpy(&out[total], data, length);
+                uartTxRelease(length);
+                total += length;
+            }
+
+            return total;
+        }
+};
+
+TEST_F(UartTxTest, QueuesDataInOrder)
+{
+    uint8_t out[32];
+
+    ASSERT_EQ(FC_OK, uartTxWrite("hello ", 6));
+    ASSERT_EQ(FC_OK, uartTxWrite("world", 5));
+
+    EXPECT_EQ(UART_TX_RING_SIZE - 11u, uartTxSpace());
+    ASSERT_EQ(11u, drain(out));
+    EXPECT_EQ(0, memcmp(out, "hello world", 11));
+    EXPECT_EQ((uint32_t)UART_TX_RING_SIZE, uartTxSpace());
+    EXPECT_EQ(11u, uartTxStats()->bytesQueued);
+}
+
+TEST_F(UartTxTest, PeekStopsAtEndOfRing)
+{
+    static uint8_t data[UART_TX_RING_SIZE];
+    static uint8_t out[UART_TX_RING_SIZE];
+    const uint8_t *block;
+
+    // Move the ring indexes near the end
+    ASSERT_EQ(FC_OK, uartTxWrite(data, UART_TX_RING_SIZE - 10));
+    drain(out);
+
+    for (uint32_t i = 0; i < 30; i++) {
+        data[i] = i;
+    }
+    ASSERT_EQ(FC_OK, uartTxWrite(data, 30));
+
+    // A DMA transfer can only send up to the end of the buffer
+    ASSERT_EQ(10u, uartTxPeek(&block));
+    EXPECT_EQ(0, memcmp(block, data, 10));
+    uartTxRelease(10);
+
+    ASSERT_EQ(20u, uartTxPeek(&block));
+    EXPECT_EQ(0, memcmp(block, &data[10], 20));
+}
+
+TEST_F(UartTxTest, WriteThatDoesntFitIsDroppedWhole)
+{
+    static uint8_t data[UART_TX_RING_SIZE];
+    uint8_t out[8];
+
+    ASSERT_EQ(FC_OK, uartTxWrite(data, UART_TX_RING_SIZE - 4));
+
+    EXPECT_EQ(FC_BUSY, uartTxWrite("too long", 8));
+    EXPECT_EQ(1u, uartTxStats()->writesDropped);
+    EXPECT_EQ(8u, uartTxStats()->bytesDropped);
+
+    // Smaller writes still fit
+    EXPECT_EQ(FC_OK, uartTxWrite("fits", 4));
+    EXPECT_EQ(0u, uartTxSpace());
+
+    uartTxRelease(UART_TX_RING_SIZE - 4);
+    ASSERT_EQ(4u, drain(out));
+    EXPECT_EQ(0, memcmp(out, "fits", 4));
+}
+
+TEST_F(UartTxTest, PartialReleaseKeepsRest)
+{
+    const uint8_t *block;
+
+    ASSERT_EQ(FC_OK, uartTxWrite("abcdef", 6));
+
+    ASSERT_EQ(6u, uartTxPeek(&block));
+    uartTxRelease(2);
+
+    ASSERT_EQ(4u, uartTxPeek(&block));
+    EXPECT_EQ(0, memcmp(block, "cdef", 4));
+}
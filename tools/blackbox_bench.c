@@ -0,0 +1,176 @@
+/**
+ * @file tools/blackbox_bench.c
+ *
+ * @brief Benchmark the blackbox encoder on simulated flight data
+ *
+ * Generates a deterministic flight at 1 kHz (stick inputs, a noisy gyro
+ * following the setpoint, pid terms and a quad mixer), encodes it, checks it
+ * decodes back exactly and reports the encoder cost and compression ratio.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "fc.h"
+#include "blackbox.h"
+#include "blackboxEncoder.h"
+
+#define SIM_FRAMES      200000
+#define SIM_LOOP_US     1000
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846264338327
+#endif
+
+static uint32_t rngState = 12345;
+
+// Small deterministic lcg so every run benchmarks the same data
+static int noise(int amplitude)
+{
+    rngState = rngState * 1664525u + 1013904223u;
+    return (int)((rngState >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+// fc.c depends on the HAL, so it isn't linked into the host tools
+int limit(int val, int min, int max)
+{
+    return val < min ? min : (val > max ? max : val);
+}
+
+static int16_t clamp16(float val)
+{
+    if (val > 32767) return 32767;
+    if (val < -32768) return -32768;
+    return (int16_t)val;
+}
+
+static void simulate(BlackboxRecord_t *records, int count)
+{
+    float integral[BLACKBOX_AXIS_COUNT] = {0};
+    float lastError[BLACKBOX_AXIS_COUNT] = {0};
+    float gyro[BLACKBOX_AXIS_COUNT] = {0};
+    uint32_t timeUs = 0;
+
+    for (int i = 0; i < count; i++) {
+        BlackboxRecord_t *r = &records[i];
+        float t = i * (SIM_LOOP_US / 1e6f);
+        int throttle = 1400 + (int)(150 * sinf(2 * M_PI * 0.1f * t));
+        int out[BLACKBOX_AXIS_COUNT];
+
+        r->sequence = i;
+        timeUs += SIM_LOOP_US + noise(3);
+        r->timeUs = timeUs;
+        r->loopTimeUs = 180 + noise(20);
+        r->throttle = throttle;
+
+        for (int axis = 0; axis < BLACKBOX_AXIS_COUNT; axis++) {
+            // Sticks move slowly, with some manoeuvres
+            float setpoint = 200 * sinf(2 * M_PI * (0.3f + 0.2f * axis) * t)
+                             * (sinf(2 * M_PI * 0.05f * t) > 0 ? 1 : 0.1f);
+            // Gyro lags the setpoint, with motor vibration on top
+            gyro[axis] += 0.2f * (setpoint - gyro[axis]);
+            int measured = (int)gyro[axis] + noise(4);
+
+            float error = setpoint - measured;
+            integral[axis] += 0.01f * error;
+            float p = 2 * error;
+            float d = error - lastError[axis];
+            lastError[axis] = error;
+
+            r->gyro[axis] = measured;
+            r->setpoint[axis] = (int16_t)setpoint;
+            r->pidP[axis] = clamp16(p);
+            r->pidI[axis] = clamp16(integral[axis]);
+            r->pidD[axis] = clamp16(d);
+            out[axis] = (int)(p + integral[axis] + d);
+        }
+
+        r->motor[0] = limit(throttle + out[0] - out[1] - out[2], 1000, 2000);
+        r->motor[1] = limit(throttle + out[0] + out[1] + out[2], 1000, 2000);
+        r->motor[2] = limit(throttle - out[0] - out[1] + out[2], 1000, 2000);
+        r->motor[3] = limit(throttle - out[0] + out[1] - out[2], 1000, 2000);
+    }
+}
+
+static double nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(void)
+{
+    BlackboxRecord_t *records = calloc(SIM_FRAMES, sizeof(BlackboxRecord_t));
+    uint8_t *encoded = malloc((size_t)SIM_FRAMES * BLACKBOX_ENCODED_MAX_BYTES);
+    BlackboxCodec_t codec;
+    size_t total = 0;
+    size_t largest = 0;
+
+    if (records == NULL || encoded == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    simulate(records, SIM_FRAMES);
+
+    blackboxCodecReset(&codec);
+#ifdef HAVE_TSC
+    uint64_t startCycles = __rdtsc();
+#endif
+    double startNs = nowNs();
+    for (int i = 0; i < SIM_FRAMES; i++) {
+        size_t length = blackboxEncode(&codec, &records[i], &encoded[total]);
+        total += length;
+        if (length > largest) {
+            largest = length;
+        }
+    }
+    double elapsedNs = nowNs() - startNs;
+#ifdef HAVE_TSC
+    uint64_t elapsedCycles = __rdtsc() - startCycles;
+#endif
+
+    // Check the whole stream decodes back to the input
+    BlackboxRecord_t decoded;
+    size_t pos = 0;
+    blackboxCodecReset(&codec);
+    for (int i = 0; i < SIM_FRAMES; i++) {
+        int used = blackboxDecode(&codec, &encoded[pos], total - pos, &decoded);
+        if (used <= 0 || memcmp(&decoded, &records[i], sizeof(decoded)) != 0) {
+            fprintf(stderr, "Round trip mismatch at frame %d\n", i);
+            return 1;
+        }
+        pos += used;
+    }
+
+    size_t raw = (size_t)SIM_FRAMES * sizeof(BlackboxRecord_t);
+    printf("frames:              %d at %d Hz\n", SIM_FRAMES,
+           1000000 / SIM_LOOP_US);
+    printf("raw size:            %zu bytes (%zu per frame)\n", raw,
+           sizeof(BlackboxRecord_t));
+    printf("encoded size:        %zu bytes (%.1f per frame, max %zu, "
+           "bound %d)\n", total, (double)total / SIM_FRAMES, largest,
+           BLACKBOX_ENCODED_MAX_BYTES);
+    printf("compression ratio:   %.2f\n", (double)raw / total);
+    printf("bandwidth at 1 kHz:  %.1f KB/s raw, %.1f KB/s encoded\n",
+           raw / (SIM_FRAMES * (SIM_LOOP_US / 1e6)) / 1024,
+           total / (SIM_FRAMES * (SIM_LOOP_US / 1e6)) / 1024);
+    printf("encode time:         %.1f ns per frame\n", elapsedNs / SIM_FRAMES);
+#ifdef HAVE_TSC
+    printf("encode cycles:       %.1f TSC cycles per frame\n",
+           (double)elapsedCycles / SIM_FRAMES);
+#endif
+
+    free(records);
+    free(encoded);
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+/**
+ * @file tools/blackbox_decode.c
+ *
+ * @brief Convert a blackbox log (BBnnn.BBL) recorded by the flight controller
+ * to CSV
+ *
+ * Usage: blackbox_decode <log file> > log.csv
+ *
+ * If the log is corrupt, decoding resumes at the next keyframe. A summary is
+ * printed to stderr.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "fc.h"
+#include "blackbox.h"
+#include "blackboxEncoder.h"
+
+#define READ_CHUNK_SIZE (64 * 1024)
+
+static const char *axisNames[BLACKBOX_AXIS_COUNT] = {"Roll", "Pitch", "Yaw"};
+
+static void printCsvHeader(void)
+{
+    printf("sequence,timeUs,loopTimeUs,throttle");
+    for (int axis = 0; axis < BLACKBOX_AXIS_COUNT; axis++) {
+        printf(",gyro%s,setpoint%s,pidP%s,pidI%s,pidD%s",
+               axisNames[axis], axisNames[axis], axisNames[axis],
+               axisNames[axis], axisNames[axis]);
+    }
+    for (int motor = 0; motor < BLACKBOX_MOTOR_COUNT; motor++) {
+        printf(",motor%d", motor);
+    }
+    printf("\n");
+}
+
+static void printCsvRecord(const BlackboxRecord_t *record)
+{
+    printf("%u,%u,%u,%u", record->sequence, record->timeUs,
+           record->loopTimeUs, record->throttle);
+    for (int axis = 0; axis < BLACKBOX_AXIS_COUNT; axis++) {
+        printf(",%d,%d,%d,%d,%d", record->gyro[axis], record->setpoint[axis],
+               record->pidP[axis], record->pidI[axis], record->pidD[axis]);
+    }
+    for (int motor = 0; motor < BLACKBOX_MOTOR_COUNT; motor++) {
+        printf(",%u", record->motor[motor]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t buffer[READ_CHUNK_SIZE];
+    BlackboxFileHeader_t header;
+    BlackboxCodec_t codec;
+    BlackboxRecord_t record;
+    size_t length = 0;
+    size_t pos = 0;
+    unsigned long frames = 0;
+    unsigned long skippedBytes = 0;
+    unsigned long dropped = 0;
+    bool haveSequence = false;
+    uint32_t lastSequence = 0;
+    bool eof = false;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <log file>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    if (fread(&header, sizeof(header), 1, in) != 1
+        || memcmp(header.magic, BLACKBOX_FILE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "%s is not a blackbox log\n", argv[1]);
+        fclose(in);
+        return 1;
+    }
+
+    if (header.version != BLACKBOX_FILE_VERSION) {
+        fprintf(stderr, "Unsupported log version %u, expected %u\n",
+                header.version, BLACKBOX_FILE_VERSION);
+        fclose(in);
+        return 1;
+    }
+
+    blackboxCodecReset(&codec);
+    printCsvHeader();
+
+    while (!eof || pos < length) {
+        // Keep at least one full frame in the buffer
+        if (!eof && length - pos < BLACKBOX_ENCODED_MAX_BYTES) {
+            memmove(buffer, &buffer[pos], length - pos);
+            length -= pos;
+            pos = 0;
+            size_t got = fread(&buffer[length], 1, sizeof(buffer) - length, in);
+            length += got;
+            eof = (got == 0);
+            continue;
+        }
+
+        int used = blackboxDecode(&codec, &buffer[pos], length - pos, &record);
+
+        if (used > 0) {
+            int32_t gap = record.sequence - lastSequence - 1;
+            if (haveSequence && gap > 0) {
+                dropped += gap;
+            }
+            haveSequence = true;
+            lastSequence = record.sequence;
+
+            printCsvRecord(&record);
+            frames++;
+            pos += used;
+        } else if (used == 0) {
+            // Truncated frame at the end of the log
+            break;
+        } else {
+            // Corrupt, skip forward until the next keyframe decodes
+            blackboxCodecReset(&codec);
+            haveSequence = false;
+            skippedBytes++;
+            pos++;
+        }
+    }
+
+    fclose(in);
+
+    fprintf(stderr, "%lu frames, %lu dropped records, %lu corrupt bytes "
+            "skipped\n", frames, dropped, skippedBytes);
+
+    return 0;
+}
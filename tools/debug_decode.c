@@ -0,0 +1,293 @@
+/**
+ * @file tools/debug_decode.c
+ *
+ * @brief Print debug messages sent by a flight controller built with
+ * DEBUG_LOG_BINARY
+ *
+ * Usage: debug_decode <firmware elf> [capture file]
+ *
+ * Messages hold the flash address of their format string and the raw
+ * argument words (see common/Inc/debug.h). Format strings, and any %s
+ * arguments, are looked up in the elf file, which must be the one running on
+ * the flight controller. Reads from stdin if no capture file is given, so a
+ * serial port can be piped in. A summary is printed to stderr.
+ */
+#include <elf.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+
+#define LINE_MAX_LENGTH 512
+
+typedef struct Image_t {
+    uint8_t *data;
+    size_t size;
+    const Elf32_Shdr *sections;
+    unsigned sectionCount;
+} Image_t;
+
+static bool loadElf(const char *path, Image_t *image)
+{
+    FILE *file = fopen(path, "rb");
+    const Elf32_Ehdr *header;
+
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    image->size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    image->data = malloc(image->size);
+    if (image->data == NULL
+        || fread(image->data, 1, image->size, file) != image->size)
+    {
+        fprintf(stderr, "Failed to read %s\n", path);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+
+    header = (const Elf32_Ehdr *)image->data;
+    if (image->size < sizeof(*header)
+        || memcmp(header->e_ident, ELFMAG, SELFMAG) != 0
+        || header->e_ident[EI_CLASS] != ELFCLASS32
+        || header->e_ident[EI_DATA] != ELFDATA2LSB
+        || header->e_shentsize != sizeof(Elf32_Shdr)
+        || header->e_shoff + (size_t)header->e_shnum * sizeof(Elf32_Shdr)
+           > image->size)
+    {
+        fprintf(stderr, "%s is not a 32 bit little endian elf file\n", path);
+        return false;
+    }
+
+    image->sections = (const Elf32_Shdr *)(image->data + header->e_shoff);
+    image->sectionCount = header->e_shnum;
+
+    return true;
+}
+
+/**
+ * @brief Find the string at an address in the firmware image
+ *
+ * @return The string, or NULL if the address isn't in a section loaded from
+ * flash or the string isn't terminated within its section
+ */
+static const char *lookupString(const Image_t *image, uint32_t address)
+{
+    for (unsigned i = 0; i < image->sectionCount; i++) {
+        const Elf32_Shdr *section = &image->sections[i];
+
+        if (section->sh_type != SHT_PROGBITS
+            || (section->sh_flags & SHF_ALLOC) == 0
+            || address < section->sh_addr
+            || address - section->sh_addr >= section->sh_size
+            || section->sh_offset + section->sh_size > image->size)
+        {
+            continue;
+        }
+
+        const char *start = (const char *)image->data + section->sh_offset
+                            + (address - section->sh_addr);
+        size_t space = section->sh_size - (address - section->sh_addr);
+
+        return (memchr(start, '\0', space) != NULL) ? start : NULL;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief printf for a message recorded on the flight controller, where every
+ * argument is a 32 bit word
+ *
+ * Length modifiers are dropped and each conversion is printed separately with
+ * the matching host type
+ */
+static void formatMessage(const Image_t *image, const char *format,
+                          const uint32_t *args, uint32_t argCount,
+                          char *out, size_t outSize)
+{
+    size_t length = 0;
+    uint32_t arg = 0;
+
+    while (*format != '\0' && length + 1 < outSize) {
+        char spec[32];
+        size_t specLength = 0;
+        const char *str;
+        uint32_t value;
+
+        if (*format != '%') {
+            out[length++] = *format++;
+            continue;
+        }
+
+        spec[specLength++] = *format++;
+        while (strchr("-+ #0123456789.", *format) != NULL && *format != '\0'
+               && specLength < sizeof(spec) - 2)
+        {
+            spec[specLength++] = *format++;
+        }
+        while (strchr("hlzjt", *format) != NULL && *format != '\0') {
+            format++;
+        }
+
+        if (*format == '%') {
+            out[length++] = '%';
+            format++;
+            continue;
+        } else if (*format == '\0') {
+            break;
+        }
+
+        spec[specLength++] = *format;
+        spec[specLength] = '\0';
+
+        if (arg >= argCount) {
+            length += snprintf(&out[length], outSize - length, "<missing>");
+            format++;
+            continue;
+        }
+        value = args[arg++];
+
+        switch (*format++) {
+            case 'd':
+            case 'i':
+            case 'c':
+                length += snprintf(&out[length], outSize - length, spec,
+                                   (int32_t)value);
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                length += snprintf(&out[length], outSize - length, spec,
+                                   value);
+                break;
+            case 's':
+                str = lookupString(image, value);
+                if (str != NULL) {
+                    length += snprintf(&out[length], outSize - length, spec,
+                                       str);
+                } else {
+                    length += snprintf(&out[length], outSize - length,
+                                       "<str 0x%08" PRIx32 ">", value);
+                }
+                break;
+            case 'p':
+                length += snprintf(&out[length], outSize - length,
+                                   "0x%08" PRIx32, value);
+                break;
+            default:
+                length += snprintf(&out[length], outSize - length,
+                                   "<%s>", spec);
+                break;
+        }
+
+        if (length >= outSize) {
+            length = outSize - 1;
+        }
+    }
+
+    out[length] = '\0';
+}
+
+int main(int argc, char **argv)
+{
+    Image_t image;
+    FILE *input = stdin;
+    uint8_t message[1 + 4 * (1 + DEBUG_LOG_MAX_ARGS)];
+    size_t messageLength = 0;
+    size_t expectedLength = 0;
+    int syncState = 0;
+    unsigned long messages = 0;
+    unsigned long badMessages = 0;
+    unsigned long skippedBytes = 0;
+    int c;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <firmware elf> [capture file]\n", argv[0]);
+        return 1;
+    }
+
+    if (!loadElf(argv[1], &image)) {
+        return 1;
+    }
+
+    if (argc == 3) {
+        input = fopen(argv[2], "rb");
+        if (input == NULL) {
+            perror(argv[2]);
+            return 1;
+        }
+    }
+
+    while ((c = fgetc(input)) != EOF) {
+        if (syncState == 0) {
+            if (c == DEBUG_BINARY_SYNC_0) {
+                syncState = 1;
+            } else {
+                skippedBytes++;
+            }
+            continue;
+        } else if (syncState == 1) {
+            if (c == DEBUG_BINARY_SYNC_1) {
+                syncState = 2;
+                messageLength = 0;
+            } else {
+                skippedBytes += 2;
+                syncState = (c == DEBUG_BINARY_SYNC_0) ? 1 : 0;
+            }
+            continue;
+        }
+
+        message[messageLength++] = c;
+
+        if (messageLength == 1) {
+            if (c > DEBUG_LOG_MAX_ARGS) {
+                badMessages++;
+                syncState = 0;
+                continue;
+            }
+            expectedLength = 1 + 4 * (1 + c);
+        }
+
+        if (messageLength < expectedLength) {
+            continue;
+        }
+
+        // Complete message, little endian words after the count
+        uint32_t words[1 + DEBUG_LOG_MAX_ARGS];
+        uint32_t argCount = message[0];
+        for (uint32_t i = 0; i < 1 + argCount; i++) {
+            words[i] = message[1 + 4 * i]
+                       | (uint32_t)message[2 + 4 * i] << 8
+                       | (uint32_t)message[3 + 4 * i] << 16
+                       | (uint32_t)message[4 + 4 * i] << 24;
+        }
+        syncState = 0;
+
+        const char *format = lookupString(&image, words[0]);
+        if (format == NULL) {
+            badMessages++;
+            continue;
+        }
+
+        char line[LINE_MAX_LENGTH];
+        formatMessage(&image, format, &words[1], argCount, line, sizeof(line));
+        fputs(line, stdout);
+        fflush(stdout);
+        messages++;
+    }
+
+    fprintf(stderr, "%lu messages, %lu bad, %lu bytes skipped\n",
+            messages, badMessages, skippedBytes);
+
+    return 0;
+}
@@ -0,0 +1,314 @@
+/**
+ * @file tools/ram_report.c
+ *
+ * @brief Summarise the RAM used by each subsystem from the firmware's linker
+ * map file
+ *
+ * Usage: ram_report <map file>
+ *
+ * Run by make ram-report at the top level. Every input section placed in
+ * RAM is counted against the object it came from. Firmware modules (Src/)
+ * are listed one per object, everything else by library: FreeRTOS, FatFs,
+ * HAL, common and the C library. The task stacks, queues and semaphores are
+ * all in kernelObjects (see Src/kernelObjects.c), and the main stack used
+ * by start up and interrupts is the reserved heap and stack.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SUBSYSTEMS 128
+#define NAME_LENGTH    32
+#define LINE_LENGTH    1024
+
+// Reserves the main stack (and newlib's heap) at the end of RAM, see the
+// linker script
+#define HEAP_STACK_SECTION "._user_heap_stack"
+#define HEAP_STACK_NAME    "main stack and heap"
+
+// Alignment padding between sections
+#define FILL_NAME          "padding"
+
+typedef struct Subsystem_t {
+    char          name[NAME_LENGTH];
+    unsigned long dataBytes;    // Initialised, also uses flash for the copy
+    unsigned long bssBytes;     // Zeroed, and anything else in RAM
+} Subsystem_t;
+
+static Subsystem_t subsystems[MAX_SUBSYSTEMS];
+static int subsystemCount = 0;
+
+static unsigned long ramStart = 0;
+static unsigned long ramLength = 0;
+
+static Subsystem_t *findSubsystem(const char *name)
+{
+    for (int i = 0; i < subsystemCount; i++) {
+        if (strcmp(subsystems[i].name, name) == 0) {
+            return &subsystems[i];
+        }
+    }
+
+    if (subsystemCount == MAX_SUBSYSTEMS) {
+        fprintf(stderr, "Too many subsystems, %s not counted\n", name);
+        return NULL;
+    }
+
+    Subsystem_t *subsystem = &subsystems[subsystemCount++];
+
+    snprintf(subsystem->name, sizeof(subsystem->name), "%s", name);
+    return subsystem;
+}
+
+/**
+ * @brief The subsystem an object file belongs to
+ *
+ * @param path As it appears in the map, e.g.
+ *             Bin/Flight_Controller/Src/ppm.o or
+ *             /usr/lib/arm-none-eabi/lib/libc.a(lib_a-impure.o)
+ * @param[out] name
+ */
+static void subsystemOf(const char *path, char *name, size_t size)
+{
+    static const struct {
+        const char *match;
+        const char *name;
+    } libraries[] = {
+        {"Src/FreeRTOS/",          "FreeRTOS"},
+        {"Src/FatFs/",             "FatFs"},
+        {"stm32f4xx_hal_driver/",  "HAL"},
+        {"common/",                "common"},
+    };
+
+    const char *member = strchr(path, '(');
+
+    if (member != NULL) {
+        // An archive member, named after the archive
+        const char *archive = path;
+
+        for (const char *c = path; c < member; c++) {
+            if (*c == '/') {
+                archive = c + 1;
+            }
+        }
+        snprintf(name, size, "%.*s", (int)(member - archive), archive);
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(libraries) / sizeof(libraries[0]); i++) {
+        if (strstr(path, libraries[i].match) != NULL) {
+            snprintf(name, size, "%s", libraries[i].name);
+            return;
+        }
+    }
+
+    // A firmware module, named after the object file
+    const char *base = strrchr(path, '/');
+    base = (base != NULL) ? base + 1 : path;
+
+    const char *extension = strrchr(base, '.');
+    int length = (extension != NULL) ? (int)(extension - base)
+                                     : (int)strlen(base);
+
+    snprintf(name, size, "%.*s", length, base);
+}
+
+static void count(const char *outputSection, unsigned long address,
+                  unsigned long bytes, const char *path)
+{
+    char name[NAME_LENGTH];
+
+    if (bytes == 0 || address < ramStart || address >= ramStart + ramLength) {
+        return;
+    }
+
+    subsystemOf(path, name, sizeof(name));
+
+    Subsystem_t *subsystem = findSubsystem(name);
+
+    if (subsystem == NULL) {
+        return;
+    }
+
+    if (strcmp(outputSection, ".data") == 0) {
+        subsystem->dataBytes += bytes;
+    } else {
+        subsystem->bssBytes += bytes;
+    }
+}
+
+static bool isNumber(const char *token)
+{
+    return strncmp(token, "0x", 2) == 0;
+}
+
+static int compareTotal(const void *a, const void *b)
+{
+    const Subsystem_t *first = a;
+    const Subsystem_t *second = b;
+    unsigned long firstTotal = first->dataBytes + first->bssBytes;
+    unsigned long secondTotal = second->dataBytes + second->bssBytes;
+
+    if (firstTotal != secondTotal) {
+        return (firstTotal < secondTotal) ? 1 : -1;
+    }
+    return strcmp(first->name, second->name);
+}
+
+/**
+ * @brief Read the map file
+ *
+ * Input sections are indented by one space, and their address, size and
+ * object follow on the same line, or on the next if the name is long:
+ *
+ *  .bss.ppmSignalQueue
+ *                 0x20000abc        0x4 Bin/Flight_Controller/Src/ppm.o
+ *
+ * Output sections are not indented. Only the reserved heap and stack output
+ * section is counted as a whole, it has no input sections. Its name is long
+ * enough to wrap too
+ */
+static int readMap(FILE *map)
+{
+    char line[LINE_LENGTH];
+    char outputSection[LINE_LENGTH] = "";
+    char pendingName[LINE_LENGTH] = "";
+    bool inMemoryConfiguration = false;
+    bool inMemoryMap = false;
+
+    while (fgets(line, sizeof(line), map) != NULL) {
+        char first[LINE_LENGTH], second[LINE_LENGTH], third[LINE_LENGTH];
+        char rest[LINE_LENGTH];
+        int tokens;
+
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (strncmp(line, "Memory Configuration", 20) == 0) {
+            inMemoryConfiguration = true;
+            continue;
+        }
+        if (strncmp(line, "Linker script and memory map", 28) == 0) {
+            inMemoryConfiguration = false;
+            inMemoryMap = true;
+            continue;
+        }
+
+        tokens = sscanf(line, "%s %s %s %[^\n]", first, second, third, rest);
+
+        if (inMemoryConfiguration) {
+            if (tokens >= 3 && strcmp(first, "RAM") == 0) {
+                ramStart = strtoul(second, NULL, 0);
+                ramLength = strtoul(third, NULL, 0);
+            }
+            continue;
+        }
+
+        if (!inMemoryMap || tokens <= 0) {
+            continue;
+        }
+
+        if (line[0] != ' ') {
+            snprintf(outputSection, sizeof(outputSection), "%s", first);
+            pendingName[0] = '\0';
+
+            if (strcmp(first, HEAP_STACK_SECTION) == 0) {
+                if (tokens == 1) {
+                    snprintf(pendingName, sizeof(pendingName), "%s", first);
+                } else if (tokens >= 3) {
+                    count(first, strtoul(second, NULL, 0),
+                          strtoul(third, NULL, 0), HEAP_STACK_NAME);
+                }
+            }
+            continue;
+        }
+
+        if (line[1] != ' ' && (first[0] == '.' || strcmp(first, "COMMON") == 0)) {
+            if (tokens == 1) {
+                // Address, size and object are on the next line
+                snprintf(pendingName, sizeof(pendingName), "%s", first);
+            } else if (tokens >= 4 && isNumber(second) && isNumber(third)) {
+                count(outputSection, strtoul(second, NULL, 0),
+                      strtoul(third, NULL, 0), rest);
+                pendingName[0] = '\0';
+            }
+            continue;
+        }
+
+        if (strcmp(first, "*fill*") == 0 && tokens >= 3) {
+            count(outputSection, strtoul(second, NULL, 0),
+                  strtoul(third, NULL, 0), FILL_NAME);
+            continue;
+        }
+
+        if (pendingName[0] != '\0' && tokens >= 2 && isNumber(first)
+            && isNumber(second)) {
+            char path[2 * LINE_LENGTH + 2];
+
+            if (strcmp(pendingName, HEAP_STACK_SECTION) == 0) {
+                snprintf(path, sizeof(path), "%s", HEAP_STACK_NAME);
+            } else {
+                // Put the object, which may contain spaces, back together
+                snprintf(path, sizeof(path), "%s%s%s",
+                         (tokens >= 3) ? third : "",
+                         (tokens == 4) ? " " : "", (tokens == 4) ? rest : "");
+            }
+            count(outputSection, strtoul(first, NULL, 0),
+                  strtoul(second, NULL, 0), path);
+        }
+        pendingName[0] = '\0';
+    }
+
+    if (ramLength == 0) {
+        fprintf(stderr, "No RAM region in the map file\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <map file>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *map = fopen(argv[1], "r");
+
+    if (map == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    int status = readMap(map);
+
+    fclose(map);
+    if (status != 0) {
+        return status;
+    }
+
+    qsort(subsystems, subsystemCount, sizeof(subsystems[0]), compareTotal);
+
+    unsigned long totalData = 0;
+    unsigned long totalBss = 0;
+
+    printf("%-24s %8s %8s %8s\n", "RAM (bytes)", "data", "bss", "total");
+    for (int i = 0; i < subsystemCount; i++) {
+        const Subsystem_t *subsystem = &subsystems[i];
+
+        printf("%-24s %8lu %8lu %8lu\n", subsystem->name, subsystem->dataBytes,
+               subsystem->bssBytes, subsystem->dataBytes + subsystem->bssBytes);
+        totalData += subsystem->dataBytes;
+        totalBss += subsystem->bssBytes;
+    }
+
+    unsigned long used = totalData + totalBss;
+
+    printf("%-24s %8lu %8lu %8lu\n", "Total", totalData, totalBss, used);
+    printf("\n%lu of %lu bytes used (%lu%%), %lu free\n", used, ramLength,
+           used * 100 / ramLength, (used < ramLength) ? ramLength - used : 0);
+
+    return 0;
+}
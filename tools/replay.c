@@ -0,0 +1,510 @@
+/**
+ * @file tools/replay.c
+ *
+ * @brief Run a recorded flight's gyro and rc input through the control code,
+ * and check the motor outputs against a golden run
+ *
+ * Usage: replay [-o output.csv] [-g golden.csv] [-t tolerance]
+ *               [-p NAME=value]... capture.csv
+ *
+ * The capture has a line per gyro sample or ppm frame, in time order:
+ *
+ *     <time us>,gyro,<roll>,<pitch>,<yaw>         rates in dps
+ *     <time us>,ppm,<channel 0>,...,<channel 7>   pulse widths in us
+ *
+ * Blank lines and lines starting with # are skipped. The control loop is
+ * run as on the board: an iteration every CONTROL_LOOP_PERIOD_US, once a ppm
+ * frame with the throttle low has been seen, each taking the newest sample
+ * and frame that arrived by then. The same processPpmSignal, controlRates
+ * and mixMotors as the firmware run, with the rate gains from the parameter
+ * defaults unless set with -p.
+ *
+ * Each iteration makes a line of output, all integers, so two runs of the
+ * same code give the same output byte for byte. With -g, the output is
+ * compared with a golden run field by field, the first differences are
+ * printed and the exit status is 1 if any field differs by more than the
+ * tolerance (0 unless set with -t). Without -o or -g it goes to stdout.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fc.h"
+#include "controlLoop.h"
+#include "mixer.h"
+#include "params.h"
+#include "paramStore.h"
+#include "rate_control.h"
+#include "rcInput.h"
+
+#define REPLAY_LINE_LENGTH      256
+#define REPLAY_MAX_FIELDS       (2 + RC_CHANNEL_IN_COUNT)
+#define REPLAY_OUTPUT_FIELDS    16
+#define REPLAY_DIFFS_SHOWN      10
+
+static const char *outputFields[REPLAY_OUTPUT_FIELDS] = {
+    "timeUs", "armed", "throttle",
+    "setpointRoll", "setpointPitch", "setpointYaw",
+    "gyroRoll", "gyroPitch", "gyroYaw",
+    "outputRoll", "outputPitch", "outputYaw",
+    "motor0", "motor1", "motor2", "motor3",
+};
+
+typedef enum SampleType {
+    SAMPLE_NONE,
+    SAMPLE_GYRO,
+    SAMPLE_PPM,
+} SampleType;
+
+typedef struct Sample_t {
+    SampleType type;
+    uint32_t timeUs;
+    Rates_t gyro;
+    tPpmSignal ppm;
+} Sample_t;
+
+typedef struct Capture_t {
+    FILE *file;
+    const char *name;
+    uint32_t line;
+    Sample_t next;      // Read but not yet due
+} Capture_t;
+
+// Parameters only come from the command line, they are never loaded or saved
+const uint32_t *paramFlashBank(int bank)
+{
+    (void)bank;
+    return NULL;
+}
+
+FC_Status paramFlashErase(int bank)
+{
+    (void)bank;
+    return FC_ERROR;
+}
+
+FC_Status paramFlashProgram(int bank, uint32_t offset, uint32_t word)
+{
+    (void)bank;
+    (void)offset;
+    (void)word;
+    return FC_ERROR;
+}
+
+/*
+ * The control loop's state, as in controlLoop.c
+ */
+static tPpmSignal ppmSignal;
+static bool newPpm = false;
+static Rates_t actualRates;
+static bool newGyro = false;
+static Rates_t desiredRates;
+static bool armed = false;
+static uint32_t rcThrottle = MOTOR_LOW_VAL_US;
+static RotationAxisOutputs_t rotationOutputs;
+static uint32_t motors[MOTOR_COUNT] = {
+    MOTOR_LOW_VAL_US, MOTOR_LOW_VAL_US, MOTOR_LOW_VAL_US, MOTOR_LOW_VAL_US
+};
+
+typedef struct Golden_t {
+    FILE *file;
+    const char *name;
+    int tolerance;
+    uint32_t line;
+    uint32_t differences;
+    uint32_t linesDifferent;
+    int maxDifference[REPLAY_OUTPUT_FIELDS];
+    bool ended;
+} Golden_t;
+
+static int splitFields(char *line, char *fields[], int maxFields)
+{
+    int count = 0;
+    char *save = NULL;
+
+    for (char *field = strtok_r(line, ",\r\n", &save);
+         field != NULL && count < maxFields;
+         field = strtok_r(NULL, ",\r\n", &save))
+    {
+        fields[count++] = field;
+    }
+
+    return count;
+}
+
+static bool parseInt(const char *text, long *value)
+{
+    char *end;
+
+    *value = strtol(text, &end, 10);
+    return end != text && *end == '\0';
+}
+
+/**
+ * @brief Read the next gyro sample or ppm frame
+ *
+ * @return false at the end of the file, exits on a line that can't be read
+ */
+static bool readSample(Capture_t *capture, Sample_t *sample)
+{
+    char line[REPLAY_LINE_LENGTH];
+    char *fields[REPLAY_MAX_FIELDS + 1];
+    long values[REPLAY_MAX_FIELDS];
+
+    while (fgets(line, sizeof(line), capture->file) != NULL) {
+        capture->line++;
+
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') {
+            continue;
+        }
+
+        int count = splitFields(line, fields, REPLAY_MAX_FIELDS + 1);
+        int expected = 0;
+
+        if (count >= 2 && strcmp(fields[1], "gyro") == 0) {
+            sample->type = SAMPLE_GYRO;
+            expected = 2 + 3;
+        } else if (count >= 2 && strcmp(fields[1], "ppm") == 0) {
+            sample->type = SAMPLE_PPM;
+            expected = 2 + RC_CHANNEL_IN_COUNT;
+        }
+
+        bool valid = expected != 0 && count == expected && parseInt(fields[0], &values[0]);
+        for (int i = 2; valid && i < count; i++) {
+            valid = parseInt(fields[i], &values[i]);
+        }
+
+        if (!valid || values[0] < 0 || values[0] > UINT32_MAX
+            || (uint32_t)values[0] < capture->next.timeUs)
+        {
+            fprintf(stderr, "%s:%u: not a gyro sample or ppm frame in time order\n",
+                    capture->name, capture->line);
+            exit(2);
+        }
+
+        sample->timeUs = values[0];
+        if (sample->type == SAMPLE_GYRO) {
+            sample->gyro.roll = values[2];
+            sample->gyro.pitch = values[3];
+            sample->gyro.yaw = values[4];
+        } else {
+            for (int i = 0; i < RC_CHANNEL_IN_COUNT; i++) {
+                sample->ppm.signals[i] = limit(values[2 + i], 0, UINT16_MAX);
+            }
+        }
+
+        return true;
+    }
+
+    sample->type = SAMPLE_NONE;
+    return false;
+}
+
+/**
+ * @brief Take every sample due by the time, as the topics would deliver them
+ *
+ * Only the newest of each is kept, as the loop only sees the newest
+ */
+static void receiveUntil(Capture_t *capture, uint32_t timeUs)
+{
+    while (capture->next.type != SAMPLE_NONE && capture->next.timeUs <= timeUs) {
+        if (capture->next.type == SAMPLE_GYRO) {
+            actualRates = capture->next.gyro;
+            newGyro = true;
+        } else {
+            ppmSignal = capture->next.ppm;
+            newPpm = true;
+        }
+        readSample(capture, &capture->next);
+    }
+}
+
+/**
+ * @brief One iteration of the control loop's rc and rates stages
+ */
+static void runIteration(uint32_t iteration)
+{
+    if (iteration % RC_DIVIDER == 0 && newPpm) {
+        newPpm = false;
+        processPpmSignal(&ppmSignal, &desiredRates, &rcThrottle, &armed);
+    }
+
+    if (rcRatesActive(armed, rcThrottle)) {
+        if (newGyro) {
+            newGyro = false;
+            rotationOutputs = *controlRates(&actualRates, &desiredRates);
+            mixMotors(rcThrottle, &rotationOutputs, motors);
+        }
+    } else {
+        resetRateInfo();
+        memset(&rotationOutputs, 0, sizeof(rotationOutputs));
+        for (int i = 0; i < MOTOR_COUNT; i++) {
+            motors[i] = MOTOR_LOW_VAL_US;
+        }
+    }
+}
+
+static int formatOutput(char *line, size_t size, uint32_t timeUs)
+{
+    return snprintf(line, size,
+                    "%u,%d,%u,%d,%d,%d,%d,%d,%d,%d,%d,%d,%u,%u,%u,%u\n",
+                    timeUs, armed, rcThrottle,
+                    desiredRates.roll, desiredRates.pitch, desiredRates.yaw,
+                    actualRates.roll, actualRates.pitch, actualRates.yaw,
+                    rotationOutputs.roll, rotationOutputs.pitch, rotationOutputs.yaw,
+                    motors[0], motors[1], motors[2], motors[3]);
+}
+
+static void compareLine(Golden_t *golden, const char *output)
+{
+    char expectedLine[REPLAY_LINE_LENGTH];
+    char actualLine[REPLAY_LINE_LENGTH];
+    char *expected[REPLAY_OUTPUT_FIELDS + 1];
+    char *actual[REPLAY_OUTPUT_FIELDS + 1];
+    bool different = false;
+
+    if (golden->ended) {
+        return;
+    }
+
+    do {
+        if (fgets(expectedLine, sizeof(expectedLine), golden->file) == NULL) {
+            golden->ended = true;
+            return;
+        }
+        golden->line++;
+    } while (expectedLine[0] == '#');
+
+    strcpy(actualLine, output);
+    int expectedCount = splitFields(expectedLine, expected, REPLAY_OUTPUT_FIELDS + 1);
+    splitFields(actualLine, actual, REPLAY_OUTPUT_FIELDS + 1);
+
+    if (expectedCount != REPLAY_OUTPUT_FIELDS) {
+        fprintf(stderr, "%s:%u: expected %d fields\n", golden->name,
+                golden->line, REPLAY_OUTPUT_FIELDS);
+        exit(2);
+    }
+
+    for (int i = 0; i < REPLAY_OUTPUT_FIELDS; i++) {
+        long want = strtol(expected[i], NULL, 10);
+        long got = strtol(actual[i], NULL, 10);
+        long difference = labs(got - want);
+
+        if (difference > golden->maxDifference[i]) {
+            golden->maxDifference[i] = difference;
+        }
+        if (difference <= golden->tolerance) {
+            continue;
+        }
+
+        if (golden->differences < REPLAY_DIFFS_SHOWN) {
+            fprintf(stderr, "%s:%u: %s at %s us is %ld, was %ld\n", golden->name,
+                    golden->line, outputFields[i], actual[0], got, want);
+        }
+        golden->differences++;
+        different = true;
+    }
+
+    if (different) {
+        golden->linesDifferent++;
+    }
+}
+
+/**
+ * @brief Set a parameter from NAME=value, as the ground station would
+ */
+static bool setParam(const char *arg)
+{
+    char name[PARAM_NAME_LENGTH + 1];
+    const char *equals = strchr(arg, '=');
+
+    if (equals == NULL || (size_t)(equals - arg) > PARAM_NAME_LENGTH) {
+        return false;
+    }
+
+    memcpy(name, arg, equals - arg);
+    name[equals - arg] = '\0';
+
+    int id = paramFind(name);
+    if (id < 0) {
+        return false;
+    }
+
+    ParamValue_t value;
+    char *end;
+    if (paramInfo(id)->type == PARAM_TYPE_FLOAT) {
+        value.f = strtof(equals + 1, &end);
+    } else {
+        value.i = strtol(equals + 1, &end, 10);
+    }
+
+    return *end == '\0' && paramSet(id, value) == FC_OK;
+}
+
+static double nowSeconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-o output.csv] [-g golden.csv] [-t tolerance] "
+            "[-p NAME=value]... capture.csv\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    Capture_t capture = {0};
+    Golden_t golden = {0};
+    FILE *output = NULL;
+    const char *outputName = NULL;
+    int opt;
+
+    if (paramsInit() != FC_OK) {
+        fprintf(stderr, "Invalid parameter table\n");
+        return 2;
+    }
+    rateControlInit();
+
+    while ((opt = getopt(argc, argv, "o:g:t:p:")) != -1) {
+        switch (opt) {
+            case 'o':
+                outputName = optarg;
+                break;
+            case 'g':
+                golden.name = optarg;
+                break;
+            case 't':
+                golden.tolerance = atoi(optarg);
+                break;
+            case 'p':
+                if (!setParam(optarg)) {
+                    fprintf(stderr, "Can't set %s\n", optarg);
+                    return 2;
+                }
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+    paramsApply();
+
+    capture.name = argv[optind];
+    capture.file = fopen(capture.name, "r");
+    if (capture.file == NULL) {
+        perror(capture.name);
+        return 2;
+    }
+
+    if (golden.name != NULL) {
+        golden.file = fopen(golden.name, "r");
+        if (golden.file == NULL) {
+            perror(golden.name);
+            return 2;
+        }
+    }
+
+    if (outputName != NULL) {
+        output = fopen(outputName, "w");
+        if (output == NULL) {
+            perror(outputName);
+            return 2;
+        }
+    } else if (golden.file == NULL) {
+        output = stdout;
+    }
+
+    if (output != NULL) {
+        fprintf(output, "#");
+        for (int i = 0; i < REPLAY_OUTPUT_FIELDS; i++) {
+            fprintf(output, "%s%s", outputFields[i],
+                    (i == REPLAY_OUTPUT_FIELDS - 1) ? "\n" : ",");
+        }
+    }
+
+    double startSeconds = nowSeconds();
+    uint32_t firstUs = 0;
+    uint32_t timeUs = 0;
+    uint32_t iteration = 0;
+    bool started = false;
+
+    readSample(&capture, &capture.next);
+    firstUs = capture.next.timeUs;
+    timeUs = firstUs;
+
+    while (capture.next.type != SAMPLE_NONE) {
+        receiveUntil(&capture, timeUs);
+
+        // The loop waits for a frame with the throttle low before it starts,
+        // and takes that frame's throttle
+        if (!started && newPpm) {
+            newPpm = false;
+            rcThrottle = ppmSignal.signals[THROTTLE_CHANNEL];
+            started = rcThrottle <= THROTTLE_LOW_THRESHOLD;
+        }
+
+        if (started) {
+            char line[REPLAY_LINE_LENGTH];
+
+            runIteration(iteration++);
+            formatOutput(line, sizeof(line), timeUs);
+            if (output != NULL) {
+                fputs(line, output);
+            }
+            if (golden.file != NULL) {
+                compareLine(&golden, line);
+            }
+        }
+
+        timeUs += CONTROL_LOOP_PERIOD_US;
+    }
+
+    double elapsedSeconds = nowSeconds() - startSeconds;
+    double flightSeconds = (timeUs - firstUs) * 1e-6;
+
+    fprintf(stderr, "%u iterations, %.1f s of flight in %.3f s (%.0fx real time)\n",
+            iteration, flightSeconds, elapsedSeconds,
+            elapsedSeconds > 0 ? flightSeconds / elapsedSeconds : 0);
+
+    if (output != NULL && output != stdout) {
+        fclose(output);
+    }
+    fclose(capture.file);
+
+    if (golden.file == NULL) {
+        return 0;
+    }
+
+    // Both runs must cover the same iterations
+    char extra[REPLAY_LINE_LENGTH];
+    bool goldenLonger = !golden.ended && fgets(extra, sizeof(extra), golden.file) != NULL;
+    bool goldenShorter = golden.ended;
+    fclose(golden.file);
+
+    if (goldenLonger || goldenShorter) {
+        fprintf(stderr, "%s: %s iterations than this run\n", golden.name,
+                goldenLonger ? "more" : "fewer");
+    }
+
+    fprintf(stderr, "%u fields on %u of %u lines differ by more than %d from %s\n",
+            golden.differences, golden.linesDifferent, iteration,
+            golden.tolerance, golden.name);
+    for (int i = 1; i < REPLAY_OUTPUT_FIELDS; i++) {
+        if (golden.maxDifference[i] > 0) {
+            fprintf(stderr, "Largest %s difference %d\n", outputFields[i],
+                    golden.maxDifference[i]);
+        }
+    }
+
+    return (golden.differences > 0 || goldenLonger || goldenShorter) ? 1 : 0;
+}
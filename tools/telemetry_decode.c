@@ -0,0 +1,234 @@
+/**
+ * @file tools/telemetry_decode.c
+ *
+ * @brief Convert a captured telemetry stream (see Src/telemetry.c) to lines
+ * of CSV, one per message, for plotting
+ *
+ * Usage: telemetry_decode [capture file] > telemetry.csv
+ *
+ * Reads from stdin if no capture file is given, so a serial port can be piped
+ * in and the output fed to a live plotter. Each line starts with the message
+ * name, followed by the frame sequence number and the payload fields. The
+ * first time a message is seen, a line starting with # names its fields.
+ *
+ * Debug text on the same uart is skipped. Frames with a bad crc are dropped.
+ * A summary is printed to stderr.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fc.h"
+#include "telemetry.h"
+
+typedef enum FieldType {
+    FIELD_U8,
+    FIELD_U16,
+    FIELD_U32,
+    FIELD_I16,
+    FIELD_I32,
+    FIELD_FLOAT,
+    FIELD_CHAR,   // A string of count chars, printed as one field
+} FieldType;
+
+typedef struct Field_t {
+    const char *name;
+    FieldType type;
+    int count;
+} Field_t;
+
+#define MAX_FIELDS 12
+
+// Payload layouts, must match the structs in telemetry.h
+static const Field_t fields[TELEMETRY_MSG_COUNT][MAX_FIELDS] = {
+    [TELEMETRY_MSG_HEARTBEAT] = {
+        {"customMode", FIELD_U32, 1}, {"type", FIELD_U8, 1},
+        {"autopilot", FIELD_U8, 1}, {"baseMode", FIELD_U8, 1},
+        {"systemStatus", FIELD_U8, 1}, {"mavlinkVersion", FIELD_U8, 1},
+    },
+    [TELEMETRY_MSG_ATTITUDE] = {
+        {"roll", FIELD_I32, 1}, {"pitch", FIELD_I32, 1},
+        {"yaw", FIELD_I32, 1},
+    },
+    [TELEMETRY_MSG_RATES] = {
+        {"gyroRoll", FIELD_I32, 1}, {"gyroPitch", FIELD_I32, 1},
+        {"gyroYaw", FIELD_I32, 1}, {"setpointRoll", FIELD_I32, 1},
+        {"setpointPitch", FIELD_I32, 1}, {"setpointYaw", FIELD_I32, 1},
+    },
+    [TELEMETRY_MSG_RC_INPUT] = {
+        {"channel", FIELD_U16, RC_CHANNEL_IN_COUNT},
+    },
+    [TELEMETRY_MSG_MOTORS] = {
+        {"motor", FIELD_U32, TELEMETRY_MOTOR_COUNT},
+    },
+    [TELEMETRY_MSG_LOOP_STATS] = {
+        {"timeUs", FIELD_U32, 1}, {"loopTimeUs", FIELD_U32, 1},
+        {"maxLoopTimeUs", FIELD_U32, 1}, {"iterations", FIELD_U32, 1},
+        {"telemetryDropped", FIELD_U32, 1},
+    },
+    [TELEMETRY_MSG_PARAM_REQUEST_READ] = {
+        {"paramIndex", FIELD_I16, 1}, {"targetSystem", FIELD_U8, 1},
+        {"targetComponent", FIELD_U8, 1},
+        {"paramId", FIELD_CHAR, TELEMETRY_PARAM_ID_LENGTH},
+    },
+    [TELEMETRY_MSG_PARAM_REQUEST_LIST] = {
+        {"targetSystem", FIELD_U8, 1}, {"targetComponent", FIELD_U8, 1},
+    },
+    [TELEMETRY_MSG_PARAM_VALUE] = {
+        {"paramValue", FIELD_FLOAT, 1}, {"paramCount", FIELD_U16, 1},
+        {"paramIndex", FIELD_U16, 1},
+        {"paramId", FIELD_CHAR, TELEMETRY_PARAM_ID_LENGTH},
+        {"paramType", FIELD_U8, 1},
+    },
+    [TELEMETRY_MSG_PARAM_SET] = {
+        {"paramValue", FIELD_FLOAT, 1}, {"targetSystem", FIELD_U8, 1},
+        {"targetComponent", FIELD_U8, 1},
+        {"paramId", FIELD_CHAR, TELEMETRY_PARAM_ID_LENGTH},
+        {"paramType", FIELD_U8, 1},
+    },
+    [TELEMETRY_MSG_TASK_STATS] = {
+        {"timeUs", FIELD_U32, 1}, {"intervalUs", FIELD_U32, 1},
+        {"cpuLoad", FIELD_U16, 1},
+        {"taskLoad", FIELD_U16, TELEMETRY_MAX_TASKS},
+        {"stackFree", FIELD_U16, TELEMETRY_MAX_TASKS},
+        {"taskNumber", FIELD_U8, TELEMETRY_MAX_TASKS},
+        {"taskCount", FIELD_U8, 1},
+    },
+    // The events themselves are converted by trace_to_chrome
+    [TELEMETRY_MSG_TRACE_EVENTS] = {
+        {"index", FIELD_U16, 1}, {"total", FIELD_U16, 1},
+    },
+    [TELEMETRY_MSG_TRACE_NAME] = {
+        {"kind", FIELD_U8, 1}, {"number", FIELD_U8, 1},
+        {"name", FIELD_CHAR, TRACE_NAME_LENGTH},
+    },
+    [TELEMETRY_MSG_LOOP_TIMING] = {
+        {"periodUs", FIELD_U32, 1}, {"minPeriodUs", FIELD_U32, 1},
+        {"maxPeriodUs", FIELD_U32, 1}, {"maxLateUs", FIELD_U32, 1},
+        {"executionUs", FIELD_U32, 1}, {"maxExecutionUs", FIELD_U32, 1},
+        {"iterations", FIELD_U32, 1}, {"deadlineMisses", FIELD_U32, 1},
+        {"consecutiveMisses", FIELD_U16, 1},
+        {"maxConsecutiveMisses", FIELD_U16, 1},
+        {"histogram", FIELD_U32, TELEMETRY_LOOP_TIMING_BUCKETS},
+    },
+};
+
+static const int fieldSizes[] = {
+    [FIELD_U8] = 1, [FIELD_U16] = 2, [FIELD_U32] = 4, [FIELD_I16] = 2,
+    [FIELD_I32] = 4, [FIELD_FLOAT] = 4, [FIELD_CHAR] = 1,
+};
+
+static void printHeader(int msg)
+{
+    printf("# %s,sequence", telemetryMessageInfo(msg)->name);
+    for (int i = 0; i < MAX_FIELDS && fields[msg][i].name != NULL; i++) {
+        if (fields[msg][i].count == 1 || fields[msg][i].type == FIELD_CHAR) {
+            printf(",%s", fields[msg][i].name);
+        } else {
+            for (int n = 0; n < fields[msg][i].count; n++) {
+                printf(",%s%d", fields[msg][i].name, n);
+            }
+        }
+    }
+    printf("\n");
+}
+
+static void printMessage(int msg, uint8_t sequence, const uint8_t *payload)
+{
+    printf("%s,%u", telemetryMessageInfo(msg)->name, sequence);
+
+    for (int i = 0; i < MAX_FIELDS && fields[msg][i].name != NULL; i++) {
+        if (fields[msg][i].type == FIELD_CHAR) {
+            printf(",%.*s", fields[msg][i].count, (const char *)payload);
+            payload += fields[msg][i].count;
+            continue;
+        }
+
+        for (int n = 0; n < fields[msg][i].count; n++) {
+            uint32_t value = 0;
+
+            // Little endian
+            for (int b = fieldSizes[fields[msg][i].type] - 1; b >= 0; b--) {
+                value = (value << 8) | payload[b];
+            }
+            payload += fieldSizes[fields[msg][i].type];
+
+            if (fields[msg][i].type == FIELD_I32) {
+                printf(",%d", (int32_t)value);
+            } else if (fields[msg][i].type == FIELD_I16) {
+                printf(",%d", (int16_t)value);
+            } else if (fields[msg][i].type == FIELD_FLOAT) {
+                float f;
+                memcpy(&f, &value, sizeof(f));
+                printf(",%g", f);
+            } else {
+                printf(",%u", value);
+            }
+        }
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    FILE *input = stdin;
+    TelemetryParser_t parser;
+    bool seen[TELEMETRY_MSG_COUNT] = {false};
+    // Per system id, a ground station on the same link counts separately
+    bool haveSequence[UINT8_MAX + 1] = {false};
+    uint8_t lastSequence[UINT8_MAX + 1];
+    unsigned long frames = 0;
+    unsigned long lost = 0;
+    uint8_t chunk[256];
+    ssize_t chunkLength;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [capture file]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc == 2) {
+        input = fopen(argv[1], "rb");
+        if (input == NULL) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    telemetryParserReset(&parser);
+
+    // Read whatever is available, so a live plot keeps up with a serial port
+    while ((chunkLength = read(fileno(input), chunk, sizeof(chunk))) > 0) {
+        const uint8_t *data = chunk;
+        uint32_t length = chunkLength;
+        const TelemetryMessageInfo_t *info;
+
+        while ((info = telemetryParse(&parser, &data, &length)) != NULL) {
+            uint8_t sequence = parser.frame[2];
+            uint8_t system = parser.frame[3];
+            int msg = info - telemetryMessageInfo(0);
+
+            if (haveSequence[system]) {
+                lost += (uint8_t)(sequence - lastSequence[system] - 1);
+            }
+            lastSequence[system] = sequence;
+            haveSequence[system] = true;
+
+            if (!seen[msg]) {
+                printHeader(msg);
+                seen[msg] = true;
+            }
+            printMessage(msg, sequence, &parser.frame[TELEMETRY_HEADER_LENGTH]);
+            frames++;
+        }
+
+        fflush(stdout);
+    }
+
+    fprintf(stderr, "%lu frames, %lu lost, %lu bad crc, %lu unknown, "
+            "%lu bytes skipped\n", frames, lost, (unsigned long)parser.badCrc,
+            (unsigned long)parser.unknown, (unsigned long)parser.skippedBytes);
+
+    return 0;
+}
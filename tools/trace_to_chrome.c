@@ -0,0 +1,323 @@
+/**
+ * @file tools/trace_to_chrome.c
+ *
+ * @brief Convert the trace dumps in a telemetry capture (see Src/trace.c) to
+ * a Chrome trace, for chrome://tracing or ui.perfetto.dev
+ *
+ * Usage: trace_to_chrome [capture file] > trace.json
+ *
+ * Reads from stdin if no capture file is given. Every dump in the capture is
+ * converted, on the same time line (us since start up):
+ * +     The CPU track shows which task or interrupt was running
+ * +     Each task has a track with its marked stages (TRACE_BEGIN/END), and
+ *       instants for queue, semaphore and mutex operations, becoming ready,
+ *       and priority inheritance
+ *
+ * A summary is printed to stderr.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fc.h"
+#include "telemetry.h"
+#include "trace.h"
+
+#define MAX_NUMBER    (UINT8_MAX + 1)
+#define MAX_ISR_DEPTH 8
+#define CPU_TID       0
+
+// Names from TRACE_NAME frames, by kind and number
+static char names[TRACE_NAME_MARK + 1][MAX_NUMBER][TRACE_NAME_LENGTH + 1];
+
+static bool taskSeen[MAX_NUMBER];
+
+// State of the dump being converted
+static uint64_t timeBase = 0;
+static uint32_t lastTimeUs = 0;
+static bool haveTime = false;
+static int runningTask = -1;
+static uint64_t runningSinceUs;
+static int isrDepth = 0;
+static uint8_t isrStack[MAX_ISR_DEPTH];
+static uint64_t isrSinceUs[MAX_ISR_DEPTH];
+static int markDepth[MAX_NUMBER];
+static uint32_t expectedIndex = 0;
+
+static unsigned long eventCount = 0;
+static unsigned long dumpCount = 0;
+static unsigned long lostFrames = 0;
+static bool firstOutput = true;
+
+static const char *nameOf(TraceNameKind kind, int number, char *fallback,
+                          size_t size)
+{
+    static const char *kindNames[] = {
+        [TRACE_NAME_TASK] = "task", [TRACE_NAME_QUEUE] = "queue",
+        [TRACE_NAME_ISR] = "irq", [TRACE_NAME_MARK] = "mark",
+    };
+
+    if (names[kind][number][0] != '\0') {
+        return names[kind][number];
+    }
+
+    snprintf(fallback, size, "%s %d", kindNames[kind], number);
+    return fallback;
+}
+
+/**
+ * @brief Start a JSON event object, the caller adds any more fields and the
+ * closing brace
+ */
+static void beginEvent(const char *phase, const char *name, int tid,
+                       uint64_t timeUs)
+{
+    printf("%s\n{\"ph\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"name\":\"",
+           firstOutput ? "" : ",", phase, tid, (unsigned long long)timeUs);
+    firstOutput = false;
+
+    // Names come from the firmware, but escape them to be safe
+    for (const char *c = name; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            putchar('\\');
+        }
+        putchar((*c >= ' ') ? *c : '?');
+    }
+    putchar('"');
+}
+
+static void slice(const char *name, const char *category, int tid,
+                  uint64_t startUs, uint64_t endUs)
+{
+    beginEvent("X", name, tid, startUs);
+    printf(",\"cat\":\"%s\",\"dur\":%llu}", category,
+           (unsigned long long)(endUs - startUs));
+}
+
+static void instant(const char *name, int tid, uint64_t timeUs)
+{
+    beginEvent("i", name, tid, timeUs);
+    printf(",\"s\":\"t\"}");
+}
+
+static void threadName(int tid, const char *name)
+{
+    beginEvent("M", "thread_name", tid, 0);
+    printf(",\"args\":{\"name\":\"%s\"}}", name);
+    beginEvent("M", "thread_sort_index", tid, 0);
+    printf(",\"args\":{\"sort_index\":%d}}", tid);
+}
+
+static void startDump(void)
+{
+    runningTask = -1;
+    isrDepth = 0;
+    memset(markDepth, 0, sizeof(markDepth));
+    dumpCount++;
+}
+
+/**
+ * @return The track for events from whatever is running now
+ */
+static int currentTid(void)
+{
+    if (isrDepth > 0 || runningTask < 0) {
+        return CPU_TID;
+    }
+    return runningTask;
+}
+
+static void convertEvent(const TraceEvent_t *event)
+{
+    char fallback[32];
+    char text[64];
+    const char *name;
+
+    // Unwrap the 32 bit us counter
+    if (haveTime && event->timeUs < lastTimeUs) {
+        timeBase += (uint64_t)UINT32_MAX + 1;
+    }
+    lastTimeUs = event->timeUs;
+    haveTime = true;
+    uint64_t timeUs = timeBase + event->timeUs;
+
+    eventCount++;
+
+    switch (event->type) {
+    case TRACE_TASK_SWITCHED_IN:
+        runningTask = event->id;
+        runningSinceUs = timeUs;
+        taskSeen[event->id] = true;
+        break;
+
+    case TRACE_TASK_SWITCHED_OUT:
+        if (runningTask == event->id) {
+            name = nameOf(TRACE_NAME_TASK, event->id, fallback, sizeof(fallback));
+            slice(name, "task", CPU_TID, runningSinceUs, timeUs);
+        }
+        runningTask = -1;
+        break;
+
+    case TRACE_TASK_READY:
+        taskSeen[event->id] = true;
+        instant("ready", event->id, timeUs);
+        break;
+
+    case TRACE_TASK_PRIORITY_INHERIT:
+    case TRACE_TASK_PRIORITY_DISINHERIT:
+        taskSeen[event->id] = true;
+        snprintf(text, sizeof(text), "%s priority %u",
+                 event->type == TRACE_TASK_PRIORITY_INHERIT ? "inherit"
+                                                             : "restore",
+                 event->arg);
+        instant(text, event->id, timeUs);
+        break;
+
+    case TRACE_ISR_ENTER:
+        if (isrDepth < MAX_ISR_DEPTH) {
+            isrStack[isrDepth] = event->id;
+            isrSinceUs[isrDepth] = timeUs;
+        }
+        isrDepth++;
+        break;
+
+    case TRACE_ISR_EXIT:
+        if (isrDepth == 0) {
+            // Entered before the dump started
+            break;
+        }
+        isrDepth--;
+        if (isrDepth < MAX_ISR_DEPTH && isrStack[isrDepth] == event->id) {
+            name = nameOf(TRACE_NAME_ISR, event->id, fallback, sizeof(fallback));
+            slice(name, "isr", CPU_TID, isrSinceUs[isrDepth], timeUs);
+        }
+        break;
+
+    case TRACE_QUEUE_SEND:
+    case TRACE_QUEUE_SEND_FAILED:
+    case TRACE_QUEUE_RECEIVE:
+    case TRACE_QUEUE_RECEIVE_FAILED:
+    case TRACE_QUEUE_BLOCK_SEND:
+    case TRACE_QUEUE_BLOCK_RECEIVE: {
+        static const char *formats[] = {
+            [TRACE_QUEUE_SEND]           = "send %s",
+            [TRACE_QUEUE_SEND_FAILED]    = "send %s failed",
+            [TRACE_QUEUE_RECEIVE]        = "receive %s",
+            [TRACE_QUEUE_RECEIVE_FAILED] = "receive %s failed",
+            [TRACE_QUEUE_BLOCK_SEND]     = "wait to send %s",
+            [TRACE_QUEUE_BLOCK_RECEIVE]  = "wait to receive %s",
+        };
+
+        name = nameOf(TRACE_NAME_QUEUE, event->id, fallback, sizeof(fallback));
+        snprintf(text, sizeof(text), formats[event->type], name);
+        instant(text, currentTid(), timeUs);
+        break;
+    }
+
+    case TRACE_MARK_BEGIN:
+        name = nameOf(TRACE_NAME_MARK, event->id, fallback, sizeof(fallback));
+        beginEvent("B", name, currentTid(), timeUs);
+        printf("}");
+        markDepth[currentTid()]++;
+        break;
+
+    case TRACE_MARK_END:
+        // Ends of marks begun before the dump started are dropped
+        if (markDepth[currentTid()] > 0) {
+            name = nameOf(TRACE_NAME_MARK, event->id, fallback, sizeof(fallback));
+            beginEvent("E", name, currentTid(), timeUs);
+            printf("}");
+            markDepth[currentTid()]--;
+        }
+        break;
+
+    default:
+        fprintf(stderr, "Unknown event type %u\n", event->type);
+        break;
+    }
+}
+
+static void convertFrame(const TelemetryTraceEvents_t *frame)
+{
+    if (frame->index == 0) {
+        startDump();
+    } else if (frame->index != expectedIndex) {
+        lostFrames++;
+    }
+    expectedIndex = frame->index + TRACE_EVENTS_PER_FRAME;
+
+    for (int i = 0; i < TRACE_EVENTS_PER_FRAME
+                    && frame->index + i < frame->total; i++) {
+        convertEvent(&frame->events[i]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    FILE *input = stdin;
+    TelemetryParser_t parser;
+    uint8_t chunk[256];
+    ssize_t chunkLength;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [capture file]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc == 2) {
+        input = fopen(argv[1], "rb");
+        if (input == NULL) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    telemetryParserReset(&parser);
+
+    printf("{\"traceEvents\":[");
+
+    while ((chunkLength = read(fileno(input), chunk, sizeof(chunk))) > 0) {
+        const uint8_t *data = chunk;
+        uint32_t length = chunkLength;
+        const TelemetryMessageInfo_t *info;
+
+        while ((info = telemetryParse(&parser, &data, &length)) != NULL) {
+            const uint8_t *payload = &parser.frame[TELEMETRY_HEADER_LENGTH];
+
+            if (info == telemetryMessageInfo(TELEMETRY_MSG_TRACE_NAME)) {
+                TelemetryTraceName_t msg;
+
+                memcpy(&msg, payload, sizeof(msg));
+                if (msg.kind <= TRACE_NAME_MARK) {
+                    memcpy(names[msg.kind][msg.number], msg.name,
+                           TRACE_NAME_LENGTH);
+                }
+            } else if (info == telemetryMessageInfo(TELEMETRY_MSG_TRACE_EVENTS)) {
+                TelemetryTraceEvents_t msg;
+
+                memcpy(&msg, payload, sizeof(msg));
+                convertFrame(&msg);
+            }
+        }
+    }
+
+    threadName(CPU_TID, "CPU");
+    for (int i = 0; i < MAX_NUMBER; i++) {
+        if (taskSeen[i] && i != CPU_TID) {
+            char fallback[32];
+            threadName(i, nameOf(TRACE_NAME_TASK, i, fallback, sizeof(fallback)));
+        }
+    }
+
+    printf("\n]}\n");
+
+    fprintf(stderr, "%lu dumps, %lu events, %lu frames lost\n", dumpCount,
+            eventCount, lostFrames);
+
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    return 0;
+}